@@ -0,0 +1,183 @@
+#!/usr/bin/python
+# Copyright (c) 2015, The Tor Project, Inc.
+# See LICENSE for licensing information
+#
+# Compare two sets of benchmark results, as written by
+# "src/test/bench --reps N --json FILE", and say which metrics got
+# significantly worse (or better) between them.
+#
+# For each metric, we run a two-sided Mann-Whitney U test on the samples
+# from the two runs.  A metric has regressed if the test says the two runs
+# differ (p < --alpha) *and* the median moved by more than --threshold
+# percent in the wrong direction.  Both conditions matter: with enough
+# repetitions, even a meaningless 0.1% shift is "significant", and with
+# noisy samples, a big shift in the medians may be nothing but noise.
+#
+# Usage: bench-compare.py [options] baseline.json candidate.json
+#
+# Exits with status 1 if anything regressed, and 0 otherwise.
+
+from __future__ import print_function
+
+import json
+import math
+import optparse
+import sys
+
+def exact_u_pvalue(u, n1, n2):
+    """Return the exact two-sided p-value for a Mann-Whitney U statistic
+       of u, with samples of size n1 and n2 and no ties."""
+    # cur[j][k] is the number of ways to interleave samples of size i and j
+    # so that U == k; we build it up one value at a time.
+    prev = [[1] for _ in range(n2 + 1)]
+    for i in range(1, n1 + 1):
+        cur = [[1]]
+        for j in range(1, n2 + 1):
+            # Either the largest value comes from the first sample, in which
+            # case it beats all j values of the second sample; or it comes
+            # from the second sample, and beats nothing.
+            a = prev[j]
+            b = cur[j - 1]
+            dist = [0] * (i * j + 1)
+            for k, c in enumerate(a):
+                dist[k + j] += c
+            for k, c in enumerate(b):
+                dist[k] += c
+            cur.append(dist)
+        prev = cur
+    dist = prev[n2]
+    total = float(sum(dist))
+    lo = min(u, n1 * n2 - u)
+    tail = sum(dist[:int(math.floor(lo)) + 1]) / total
+    return min(1.0, 2 * tail)
+
+def mann_whitney(xs, ys):
+    """Return the two-sided p-value for the hypothesis that the samples
+       xs and ys come from the same distribution."""
+    n1, n2 = len(xs), len(ys)
+    combined = sorted([(v, 0) for v in xs] + [(v, 1) for v in ys])
+    ranks = [0.0] * len(combined)
+    tie_term = 0.0
+    i = 0
+    while i < len(combined):
+        j = i
+        while j + 1 < len(combined) and combined[j + 1][0] == combined[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2.0 + 1
+        t = j - i + 1
+        tie_term += t ** 3 - t
+        i = j + 1
+    r1 = sum(r for r, (_, which) in zip(ranks, combined) if which == 0)
+    u = r1 - n1 * (n1 + 1) / 2.0
+
+    if tie_term == 0 and n1 * n2 <= 400:
+        return exact_u_pvalue(u, n1, n2)
+
+    # Normal approximation, with a correction for ties and for continuity.
+    n = n1 + n2
+    mean = n1 * n2 / 2.0
+    var = n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1)))
+    if var <= 0:
+        return 1.0
+    z = (abs(u - mean) - 0.5) / math.sqrt(var)
+    if z < 0:
+        return 1.0
+    return math.erfc(z / math.sqrt(2))
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if n % 2:
+        return values[n // 2]
+    return (values[n // 2 - 1] + values[n // 2]) / 2.0
+
+def load(fname):
+    with open(fname) as f:
+        results = json.load(f)
+    metrics = {}
+    order = []
+    for m in results["metrics"]:
+        key = (m["benchmark"], m["metric"], m["unit"])
+        metrics[key] = m
+        order.append(key)
+    return results.get("environment", {}), metrics, order
+
+def main(argv):
+    parser = optparse.OptionParser(
+        usage="%prog [options] baseline.json candidate.json")
+    parser.add_option("--alpha", type="float", default=0.05,
+                      help="significance level for the U test [%default]")
+    parser.add_option("--threshold", type="float", default=2.0,
+                      help="ignore changes in the median smaller than this "
+                      "many percent [%default]")
+    parser.add_option("--all", action="store_true", default=False,
+                      help="show every metric, not just the ones that "
+                      "changed")
+    options, args = parser.parse_args(argv[1:])
+    if len(args) != 2:
+        parser.error("I need a baseline and a candidate.")
+
+    env_a, base, order = load(args[0])
+    env_b, cand, cand_order = load(args[1])
+
+    for key in ("cpu_model", "num_cpus", "cpu_governor", "params"):
+        if env_a.get(key) != env_b.get(key):
+            print("Warning: %s differs between runs: %r vs %r"
+                  % (key, env_a.get(key), env_b.get(key)))
+
+    min_reps = min([len(m["samples"]) for m in list(base.values()) +
+                    list(cand.values())] or [0])
+    if 0 < min_reps < 4:
+        print("Warning: with only %d samples per metric, no difference "
+              "can be significant; try more repetitions." % min_reps)
+
+    n_regressed = n_improved = 0
+    rows = []
+    for key in order + [k for k in cand_order if k not in base]:
+        benchmark, metric, unit = key
+        name = "%s: %s" % (benchmark, metric)
+        if key not in cand:
+            rows.append((name, unit, "", "", "", "", "missing"))
+            continue
+        if key not in base:
+            rows.append((name, unit, "", "", "", "", "new"))
+            continue
+        a, b = base[key], cand[key]
+        med_a, med_b = median(a["samples"]), median(b["samples"])
+        p = mann_whitney(a["samples"], b["samples"])
+        if med_a:
+            change = (med_b - med_a) / abs(med_a) * 100
+        elif med_b:
+            change = float("inf") if med_b > 0 else float("-inf")
+        else:
+            change = 0.0
+        worse = -change if a.get("higher_is_better") else change
+        verdict = ""
+        if p < options.alpha and abs(change) > options.threshold:
+            if worse > 0:
+                verdict = "REGRESSED"
+                n_regressed += 1
+            else:
+                verdict = "improved"
+                n_improved += 1
+        if verdict or options.all:
+            rows.append((name, unit, "%.4g" % med_a, "%.4g" % med_b,
+                         "%+.1f%%" % change, "%.3g" % p, verdict))
+
+    if rows:
+        headers = ("metric", "unit", "baseline", "candidate", "change", "p",
+                   "")
+        widths = [max(len(r[i]) for r in rows + [headers])
+                  for i in range(len(headers))]
+        for r in [headers] + rows:
+            print("  ".join(r[i].ljust(widths[i])
+                            for i in range(len(r))).rstrip())
+    print("%d metrics compared: %d regressed, %d improved "
+          "(alpha %g, threshold %g%%)."
+          % (len([k for k in order if k in cand]), n_regressed, n_improved,
+             options.alpha, options.threshold))
+    return 1 if n_regressed else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -58,13 +58,16 @@
  * gives us, and the best possible counter-mode implementation, and combine
  * them.
  */
-#if OPENSSL_VERSION_NUMBER >= OPENSSL_V_NOPATCH(1,0,1) &&               \
-  (defined(__i386) || defined(__i386__) || defined(_M_IX86) ||          \
-   defined(__x86_64) || defined(__x86_64__) ||                          \
-   defined(_M_AMD64) || defined(_M_X64) || defined(__INTEL__))          \
-
+#if OPENSSL_VERSION_NUMBER >= OPENSSL_V_NOPATCH(1,0,1)
+/* OpenSSL 1.0.1 added EVP_aes_128_ctr(). */
+#define CAN_USE_EVP_CTR
+#if (defined(__i386) || defined(__i386__) || defined(_M_IX86) ||        \
+     defined(__x86_64) || defined(__x86_64__) ||                        \
+     defined(_M_AMD64) || defined(_M_X64) || defined(__INTEL__))
+/* ...and on x86 it's usually the fastest choice, so we use it unless
+ * somebody tells us otherwise. */
 #define USE_EVP_AES_CTR
-
+#endif
 #endif
 
 /* We have 2 strategies for getting the AES block cipher: Via OpenSSL's
@@ -84,74 +87,19 @@
  * one to used based on the Openssl version above.  (OpenSSL 1.0.0a fixed a
  * critical bug in that counter mode implementation, so we need to test to
  * make sure that we have a fixed version.)
+ *
+ * All of these guesses can be wrong for a particular CPU or OpenSSL build,
+ * so aes_set_ctr_impl() lets crypto_calibrate() override them.
  */
 
-#ifdef USE_EVP_AES_CTR
-
-struct aes_cnt_cipher {
-  EVP_CIPHER_CTX evp;
-};
-
-aes_cnt_cipher_t *
-aes_new_cipher(const char *key, const char *iv)
-{
-  aes_cnt_cipher_t *cipher;
-  cipher = tor_malloc_zero(sizeof(aes_cnt_cipher_t));
-  EVP_EncryptInit(&cipher->evp, EVP_aes_128_ctr(),
-                  (const unsigned char*)key, (const unsigned char *)iv);
-  return cipher;
-}
-void
-aes_cipher_free(aes_cnt_cipher_t *cipher)
-{
-  if (!cipher)
-    return;
-  EVP_CIPHER_CTX_cleanup(&cipher->evp);
-  memwipe(cipher, 0, sizeof(aes_cnt_cipher_t));
-  tor_free(cipher);
-}
-void
-aes_crypt(aes_cnt_cipher_t *cipher, const char *input, size_t len,
-          char *output)
-{
-  int outl;
-
-  tor_assert(len < INT_MAX);
-
-  EVP_EncryptUpdate(&cipher->evp, (unsigned char*)output,
-                    &outl, (const unsigned char *)input, (int)len);
-}
-void
-aes_crypt_inplace(aes_cnt_cipher_t *cipher, char *data, size_t len)
-{
-  int outl;
-
-  tor_assert(len < INT_MAX);
-
-  EVP_EncryptUpdate(&cipher->evp, (unsigned char*)data,
-                    &outl, (unsigned char*)data, (int)len);
-}
-int
-evaluate_evp_for_aes(int force_val)
-{
-  (void) force_val;
-  log_info(LD_CRYPTO, "This version of OpenSSL has a known-good EVP "
-           "counter-mode implementation. Using it.");
-  return 0;
-}
-int
-evaluate_ctr_for_aes(void)
-{
-  return 0;
-}
-#else
-
 /*======================================================================*/
 /* Interface to AES code, and counter implementation */
 
 /** Implements an AES counter-mode cipher. */
 struct aes_cnt_cipher {
-/** This next element (however it's defined) is the AES key. */
+/** This next element (however it's defined) is the AES key.  When we're
+ * using AES_CTR_IMPL_EVP, it holds the whole counter-mode state, and the
+ * rest of this structure is unused. */
   union {
     EVP_CIPHER_CTX evp;
     AES_KEY aes;
@@ -183,6 +131,9 @@ struct aes_cnt_cipher {
 
   /** True iff we're using the evp implementation of this cipher. */
   uint8_t using_evp;
+  /** Which aes_ctr_impl_t this cipher uses.  We remember it per cipher, so
+   * that changing the global choice doesn't break ciphers already in use. */
+  uint8_t ctr_impl;
 };
 
 /** True iff we should prefer the EVP implementation for AES, either because
@@ -192,9 +143,12 @@ static int should_use_EVP = 0;
 #ifdef CAN_USE_OPENSSL_CTR
 /** True iff we have tested the counter-mode implementation and found that it
  * doesn't have the counter-mode bug from OpenSSL 1.0.0. */
-static int should_use_openssl_CTR = 0;
+static int openssl_CTR_is_good = 0;
 #endif
 
+/** Which counter-mode implementation new ciphers should use. */
+static aes_ctr_impl_t aes_ctr_impl = AES_CTR_IMPL_BUILTIN;
+
 /** Check whether we should use the EVP interface for AES. If <b>force_val</b>
  * is nonnegative, we use use EVP iff it is true.  Otherwise, we use EVP
  * if there is an engine enabled for aes-ecb. */
@@ -226,8 +180,8 @@ evaluate_evp_for_aes(int force_val)
 }
 
 /** Test the OpenSSL counter mode implementation to see whether it has the
- * counter-mode bug from OpenSSL 1.0.0. If the implementation works, then
- * we will use it for future encryption/decryption operations.
+ * counter-mode bug from OpenSSL 1.0.0, and pick the counter-mode
+ * implementation that we expect to be fastest among those that work.
  *
  * We can't just look at the OpenSSL version, since some distributions update
  * their OpenSSL packages without changing the version number.
@@ -262,19 +216,83 @@ evaluate_ctr_for_aes(void)
     /* Counter mode is buggy */
     log_notice(LD_CRYPTO, "This OpenSSL has a buggy version of counter mode; "
                "not using it.");
+    openssl_CTR_is_good = 0;
   } else {
     /* Counter mode is okay */
     log_info(LD_CRYPTO, "This OpenSSL has a good implementation of counter "
-               "mode; using it.");
-    should_use_openssl_CTR = 1;
+               "mode.");
+    openssl_CTR_is_good = 1;
   }
+#endif
+
+#if defined(USE_EVP_AES_CTR)
+  log_info(LD_CRYPTO, "This version of OpenSSL has a known-good EVP "
+           "counter-mode implementation. Using it.");
+  aes_ctr_impl = AES_CTR_IMPL_EVP;
+#elif defined(CAN_USE_OPENSSL_CTR)
+  aes_ctr_impl = openssl_CTR_is_good ?
+    AES_CTR_IMPL_OPENSSL : AES_CTR_IMPL_BUILTIN;
 #else
   log_info(LD_CRYPTO, "This version of OpenSSL has a slow implementation of "
              "counter mode; not using it.");
+  aes_ctr_impl = AES_CTR_IMPL_BUILTIN;
 #endif
   return 0;
 }
 
+/** Return true iff we can use <b>impl</b> for AES counter mode with this
+ * OpenSSL.  Only meaningful after evaluate_ctr_for_aes(). */
+int
+aes_ctr_impl_is_available(aes_ctr_impl_t impl)
+{
+  switch (impl) {
+    case AES_CTR_IMPL_EVP:
+#ifdef CAN_USE_EVP_CTR
+      return 1;
+#else
+      return 0;
+#endif
+    case AES_CTR_IMPL_OPENSSL:
+#ifdef CAN_USE_OPENSSL_CTR
+      return openssl_CTR_is_good;
+#else
+      return 0;
+#endif
+    case AES_CTR_IMPL_BUILTIN:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/** Make every AES cipher created from now on use the counter-mode
+ * implementation <b>impl</b>, which must be available. */
+void
+aes_set_ctr_impl(aes_ctr_impl_t impl)
+{
+  tor_assert(aes_ctr_impl_is_available(impl));
+  aes_ctr_impl = impl;
+}
+
+/** Return the counter-mode implementation that new AES ciphers use. */
+aes_ctr_impl_t
+aes_get_ctr_impl(void)
+{
+  return aes_ctr_impl;
+}
+
+/** Return a short name for the counter-mode implementation <b>impl</b>. */
+const char *
+aes_ctr_impl_get_name(aes_ctr_impl_t impl)
+{
+  switch (impl) {
+    case AES_CTR_IMPL_EVP: return "evp";
+    case AES_CTR_IMPL_OPENSSL: return "openssl";
+    case AES_CTR_IMPL_BUILTIN: return "builtin";
+    default: return "unknown";
+  }
+}
+
 #if !defined(USING_COUNTER_VARS)
 #define COUNTER(c, n) ((c)->ctr_buf.buf32[3-(n)])
 #else
@@ -317,6 +335,16 @@ aes_new_cipher(const char *key, const char *iv)
 {
   aes_cnt_cipher_t* result = tor_malloc_zero(sizeof(aes_cnt_cipher_t));
 
+  result->ctr_impl = aes_ctr_impl;
+#ifdef CAN_USE_EVP_CTR
+  if (result->ctr_impl == AES_CTR_IMPL_EVP) {
+    EVP_EncryptInit(&result->key.evp, EVP_aes_128_ctr(),
+                    (const unsigned char*)key, (const unsigned char *)iv);
+    result->using_evp = 1;
+    return result;
+  }
+#endif
+
   aes_set_key(result, key, 128);
   aes_set_iv(result, iv);
 
@@ -356,11 +384,9 @@ aes_set_key(aes_cnt_cipher_t *cipher, const char *key, int key_bits)
 
   cipher->pos = 0;
 
-#ifdef CAN_USE_OPENSSL_CTR
-  if (should_use_openssl_CTR)
+  if (cipher->ctr_impl == AES_CTR_IMPL_OPENSSL)
     memset(cipher->buf, 0, sizeof(cipher->buf));
   else
-#endif
     aes_fill_buf_(cipher);
 }
 
@@ -407,8 +433,17 @@ void
 aes_crypt(aes_cnt_cipher_t *cipher, const char *input, size_t len,
           char *output)
 {
+#ifdef CAN_USE_EVP_CTR
+  if (cipher->ctr_impl == AES_CTR_IMPL_EVP) {
+    int outl;
+    tor_assert(len < INT_MAX);
+    EVP_EncryptUpdate(&cipher->key.evp, (unsigned char*)output,
+                      &outl, (const unsigned char *)input, (int)len);
+    return;
+  }
+#endif
 #ifdef CAN_USE_OPENSSL_CTR
-  if (should_use_openssl_CTR) {
+  if (cipher->ctr_impl == AES_CTR_IMPL_OPENSSL) {
     if (cipher->using_evp) {
       /* In openssl 1.0.0, there's an if'd out EVP_aes_128_ctr in evp.h.  If
        * it weren't disabled, it might be better just to use that.
@@ -466,13 +501,10 @@ aes_crypt(aes_cnt_cipher_t *cipher, const char *input, size_t len,
 void
 aes_crypt_inplace(aes_cnt_cipher_t *cipher, char *data, size_t len)
 {
-#ifdef CAN_USE_OPENSSL_CTR
-  if (should_use_openssl_CTR) {
+  if (cipher->ctr_impl != AES_CTR_IMPL_BUILTIN) {
     aes_crypt(cipher, data, len, data);
     return;
-  } else
-#endif
-  {
+  } else {
     int c = cipher->pos;
     if (PREDICT_UNLIKELY(!len)) return;
 
@@ -512,11 +544,7 @@ aes_set_iv(aes_cnt_cipher_t *cipher, const char *iv)
   cipher->pos = 0;
   memcpy(cipher->ctr_buf.buf, iv, 16);
 
-#ifdef CAN_USE_OPENSSL_CTR
-  if (!should_use_openssl_CTR)
-#endif
+  if (cipher->ctr_impl != AES_CTR_IMPL_OPENSSL)
     aes_fill_buf_(cipher);
 }
 
-#endif
-
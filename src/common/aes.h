@@ -25,5 +25,24 @@ void aes_crypt_inplace(aes_cnt_cipher_t *cipher, char *data, size_t len);
 int evaluate_evp_for_aes(int force_value);
 int evaluate_ctr_for_aes(void);
 
+/** The ways we know how to run AES in counter mode. */
+typedef enum {
+  /** OpenSSL's EVP_aes_128_ctr(), which can use AES-NI and vectorized
+   * counter mode.  Needs OpenSSL 1.0.1 or later. */
+  AES_CTR_IMPL_EVP = 0,
+  /** OpenSSL's counter mode around the AES block cipher.  Needs OpenSSL
+   * 1.0.0 or later, without the 1.0.0 counter-mode bug. */
+  AES_CTR_IMPL_OPENSSL = 1,
+  /** Our own counter mode around the AES block cipher. */
+  AES_CTR_IMPL_BUILTIN = 2,
+} aes_ctr_impl_t;
+/** How many values of aes_ctr_impl_t are there? */
+#define N_AES_CTR_IMPLS 3
+
+int aes_ctr_impl_is_available(aes_ctr_impl_t impl);
+void aes_set_ctr_impl(aes_ctr_impl_t impl);
+aes_ctr_impl_t aes_get_ctr_impl(void);
+const char *aes_ctr_impl_get_name(aes_ctr_impl_t impl);
+
 #endif
 
@@ -166,6 +166,57 @@ tor_get_thread_id(void)
   return r.id;
 }
 
+/** Restrict the calling thread to run only on the CPUs in <b>set</b>.
+ * Return 0 on success and -1 on failure, or if this platform can't pin
+ * threads. */
+MOCK_IMPL(int,
+tor_thread_set_cpus,(const tor_cpuset_t *set))
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t cs;
+  int cpu, err;
+  CPU_ZERO(&cs);
+  for (cpu = 0; cpu < TOR_CPUSET_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+    if (tor_cpuset_contains(set, cpu))
+      CPU_SET(cpu, &cs);
+  }
+  err = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+  if (err) {
+    log_info(LD_GENERAL, "Couldn't set thread CPU affinity: %s",
+             strerror(err));
+    return -1;
+  }
+  return 0;
+#else
+  (void)set;
+  return -1;
+#endif
+}
+
+/** Set <b>set_out</b> to the CPUs that the calling thread may run on.
+ * Return 0 on success and -1 on failure. */
+MOCK_IMPL(int,
+tor_thread_get_cpus,(tor_cpuset_t *set_out))
+{
+  tor_cpuset_clear(set_out);
+#ifdef HAVE_PTHREAD_GETAFFINITY_NP
+  {
+    cpu_set_t cs;
+    int cpu;
+    CPU_ZERO(&cs);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cs), &cs))
+      return -1;
+    for (cpu = 0; cpu < TOR_CPUSET_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cs))
+        tor_cpuset_add(set_out, cpu);
+    }
+    return 0;
+  }
+#else
+  return -1;
+#endif
+}
+
 /* Conditions. */
 
 /** Initialize an already-allocated condition variable. */
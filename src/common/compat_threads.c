@@ -11,6 +11,7 @@
 #include "compat_threads.h"
 
 #include "util.h"
+#include "container.h"
 #include "torlog.h"
 
 #ifdef HAVE_SYS_EVENTFD_H
@@ -22,6 +23,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 /** Return a newly allocated, ready-for-use mutex. */
 tor_mutex_t *
@@ -304,3 +308,235 @@ alert_sockets_close(alert_sockets_t *socks)
   socks->read_fd = socks->write_fd = -1;
 }
 
+/** Remove every CPU from <b>set</b>. */
+void
+tor_cpuset_clear(tor_cpuset_t *set)
+{
+  memset(set, 0, sizeof(*set));
+}
+
+/** Add <b>cpu</b> to <b>set</b>.  Out-of-range indices are ignored. */
+void
+tor_cpuset_add(tor_cpuset_t *set, int cpu)
+{
+  if (cpu < 0 || cpu >= TOR_CPUSET_MAX_CPUS)
+    return;
+  set->bits[cpu >> 5] |= (1u << (cpu & 31));
+}
+
+/** Remove <b>cpu</b> from <b>set</b>. */
+void
+tor_cpuset_remove(tor_cpuset_t *set, int cpu)
+{
+  if (cpu < 0 || cpu >= TOR_CPUSET_MAX_CPUS)
+    return;
+  set->bits[cpu >> 5] &= ~(1u << (cpu & 31));
+}
+
+/** Return true iff <b>cpu</b> is in <b>set</b>. */
+int
+tor_cpuset_contains(const tor_cpuset_t *set, int cpu)
+{
+  if (cpu < 0 || cpu >= TOR_CPUSET_MAX_CPUS)
+    return 0;
+  return (set->bits[cpu >> 5] >> (cpu & 31)) & 1;
+}
+
+/** Return the number of CPUs in <b>set</b>. */
+int
+tor_cpuset_count(const tor_cpuset_t *set)
+{
+  int cpu, n = 0;
+  for (cpu = 0; cpu < TOR_CPUSET_MAX_CPUS; ++cpu)
+    n += tor_cpuset_contains(set, cpu);
+  return n;
+}
+
+/** Return the index of the <b>n</b>th lowest CPU in <b>set</b>, counting
+ * from 0, or -1 if <b>set</b> holds no more than <b>n</b> CPUs. */
+int
+tor_cpuset_nth(const tor_cpuset_t *set, int n)
+{
+  int cpu;
+  for (cpu = 0; cpu < TOR_CPUSET_MAX_CPUS; ++cpu) {
+    if (tor_cpuset_contains(set, cpu) && n-- == 0)
+      return cpu;
+  }
+  return -1;
+}
+
+/** Parse a CPU list such as "0-3,8" into <b>set_out</b>, in the format
+ * that Linux uses for cpusets.  Return 0 on success and -1 if <b>s</b> is
+ * malformed or names a CPU we can't represent.  The empty string is the
+ * empty set. */
+int
+tor_cpuset_parse(tor_cpuset_t *set_out, const char *s)
+{
+  smartlist_t *items = smartlist_new();
+  int r = 0;
+
+  tor_cpuset_clear(set_out);
+  smartlist_split_string(items, s, ",",
+                         SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+  SMARTLIST_FOREACH_BEGIN(items, const char *, item) {
+    int ok;
+    char *next = NULL;
+    long lo, hi, cpu;
+    lo = tor_parse_long(item, 10, 0, TOR_CPUSET_MAX_CPUS-1, &ok, &next);
+    if (ok && *next == '-')
+      hi = tor_parse_long(next+1, 10, lo, TOR_CPUSET_MAX_CPUS-1, &ok, NULL);
+    else if (ok && *next == '\0')
+      hi = lo;
+    else
+      ok = 0;
+    if (!ok) {
+      r = -1;
+      break;
+    }
+    for (cpu = lo; cpu <= hi; ++cpu)
+      tor_cpuset_add(set_out, (int)cpu);
+  } SMARTLIST_FOREACH_END(item);
+
+  SMARTLIST_FOREACH(items, char *, cp, tor_free(cp));
+  smartlist_free(items);
+  if (r < 0)
+    tor_cpuset_clear(set_out);
+  return r;
+}
+
+/** Return a newly allocated string describing <b>set</b> in the format
+ * that tor_cpuset_parse() accepts, with runs of CPUs collapsed: for
+ * example, "0-3,8". */
+char *
+tor_cpuset_format(const tor_cpuset_t *set)
+{
+  smartlist_t *items = smartlist_new();
+  char *result;
+  int cpu = 0;
+
+  while (cpu < TOR_CPUSET_MAX_CPUS) {
+    int first;
+    if (!tor_cpuset_contains(set, cpu)) {
+      ++cpu;
+      continue;
+    }
+    first = cpu;
+    while (cpu + 1 < TOR_CPUSET_MAX_CPUS && tor_cpuset_contains(set, cpu+1))
+      ++cpu;
+    if (first == cpu)
+      smartlist_add_asprintf(items, "%d", first);
+    else
+      smartlist_add_asprintf(items, "%d-%d", first, cpu);
+    ++cpu;
+  }
+
+  result = smartlist_join_strings(items, ",", 0, NULL);
+  SMARTLIST_FOREACH(items, char *, cp, tor_free(cp));
+  smartlist_free(items);
+  return result;
+}
+
+/** If <b>enable</b> is true, ask the kernel to allocate memory for the
+ * calling thread from the NUMA node that it is running on, overriding any
+ * process-wide policy such as interleaving.  Otherwise, return the thread
+ * to the system's default policy.  Return 0 on success and -1 if we
+ * can't. */
+int
+tor_thread_set_local_memory(int enable)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  /* These are MPOL_DEFAULT and MPOL_PREFERRED from <numaif.h>; with an
+   * empty node mask, MPOL_PREFERRED means "the local node".  We make the
+   * system call directly so that we don't need libnuma. */
+  const int mode = enable ? 1 : 0;
+  if (syscall(SYS_set_mempolicy, mode, NULL, 0) < 0)
+    return -1;
+  return 0;
+#else
+  (void)enable;
+  return -1;
+#endif
+}
+
+#ifdef __linux__
+/** Read the small sysfs file at <b>fname</b> and return its contents as a
+ * newly allocated string, or NULL on failure.  (We can't use
+ * read_file_to_str(): sysfs lies about file sizes.) */
+static char *
+read_sysfs_file(const char *fname)
+{
+  size_t sz = 0;
+  char *s;
+  int fd = tor_open_cloexec(fname, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+  s = read_file_to_str_until_eof(fd, 65536, &sz);
+  close(fd);
+  return s;
+}
+#endif
+
+/** Set <b>siblings_out</b> to the CPUs that share a physical core with
+ * <b>cpu</b>, including <b>cpu</b> itself.  Return 0 on success and -1 if
+ * the topology is unknown. */
+int
+tor_get_cpu_siblings(int cpu, tor_cpuset_t *siblings_out)
+{
+  tor_cpuset_clear(siblings_out);
+#ifdef __linux__
+  {
+    char fname[128];
+    char *s;
+    int r;
+    tor_snprintf(fname, sizeof(fname),
+            "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+            cpu);
+    s = read_sysfs_file(fname);
+    if (!s)
+      return -1;
+    tor_strstrip(s, "\n");
+    r = tor_cpuset_parse(siblings_out, s);
+    tor_free(s);
+    if (r == 0)
+      tor_cpuset_add(siblings_out, cpu);
+    return r;
+  }
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+/** Return the NUMA node that holds <b>cpu</b>, or -1 if we don't know. */
+int
+tor_get_cpu_numa_node(int cpu)
+{
+#ifdef __linux__
+  char dirname[64];
+  smartlist_t *entries;
+  int node = -1;
+  tor_snprintf(dirname, sizeof(dirname), "/sys/devices/system/cpu/cpu%d",
+               cpu);
+  entries = tor_listdir(dirname);
+  if (!entries)
+    return -1;
+  SMARTLIST_FOREACH_BEGIN(entries, const char *, name) {
+    int ok;
+    long n;
+    if (strcmpstart(name, "node"))
+      continue;
+    n = tor_parse_long(name+4, 10, 0, INT_MAX, &ok, NULL);
+    if (ok) {
+      node = (int)n;
+      break;
+    }
+  } SMARTLIST_FOREACH_END(name);
+  SMARTLIST_FOREACH(entries, char *, cp, tor_free(cp));
+  smartlist_free(entries);
+  return node;
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
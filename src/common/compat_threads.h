@@ -111,5 +111,29 @@ typedef struct alert_sockets_s {
 int alert_sockets_create(alert_sockets_t *socks_out, uint32_t flags);
 void alert_sockets_close(alert_sockets_t *socks);
 
+/** One more than the highest CPU index that a tor_cpuset_t can hold. */
+#define TOR_CPUSET_MAX_CPUS 1024
+
+/** A set of CPUs, identified by the operating system's CPU indices. Used
+ * to say which CPUs a thread may run on. */
+typedef struct tor_cpuset_t {
+  uint32_t bits[TOR_CPUSET_MAX_CPUS / 32];
+} tor_cpuset_t;
+
+void tor_cpuset_clear(tor_cpuset_t *set);
+void tor_cpuset_add(tor_cpuset_t *set, int cpu);
+void tor_cpuset_remove(tor_cpuset_t *set, int cpu);
+int tor_cpuset_contains(const tor_cpuset_t *set, int cpu);
+int tor_cpuset_count(const tor_cpuset_t *set);
+int tor_cpuset_nth(const tor_cpuset_t *set, int n);
+int tor_cpuset_parse(tor_cpuset_t *set_out, const char *s);
+char *tor_cpuset_format(const tor_cpuset_t *set);
+
+MOCK_DECL(int, tor_thread_set_cpus, (const tor_cpuset_t *set));
+MOCK_DECL(int, tor_thread_get_cpus, (tor_cpuset_t *set_out));
+int tor_thread_set_local_memory(int enable);
+int tor_get_cpu_siblings(int cpu, tor_cpuset_t *siblings_out);
+int tor_get_cpu_numa_node(int cpu);
+
 #endif
 
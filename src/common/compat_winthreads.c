@@ -78,6 +78,32 @@ tor_get_thread_id(void)
   return (unsigned long)GetCurrentThreadId();
 }
 
+/** Restrict the calling thread to run only on the CPUs in <b>set</b>.
+ * Windows affinity masks only cover one processor group, so we only look
+ * at the first 64 CPUs.  Return 0 on success and -1 on failure. */
+MOCK_IMPL(int,
+tor_thread_set_cpus,(const tor_cpuset_t *set))
+{
+  DWORD_PTR mask = 0;
+  int cpu;
+  for (cpu = 0; cpu < (int)(sizeof(mask)*8); ++cpu) {
+    if (tor_cpuset_contains(set, cpu))
+      mask |= ((DWORD_PTR)1) << cpu;
+  }
+  if (!mask || SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+    return -1;
+  return 0;
+}
+
+/** Windows has no call to read a thread's affinity mask, so this always
+ * returns -1. */
+MOCK_IMPL(int,
+tor_thread_get_cpus,(tor_cpuset_t *set_out))
+{
+  tor_cpuset_clear(set_out);
+  return -1;
+}
+
 int
 tor_cond_init(tor_cond_t *cond)
 {
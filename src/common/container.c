@@ -969,18 +969,121 @@ smartlist_pqueue_assert_ok(smartlist_t *sl,
   }
 }
 
-/** Helper: compare two DIGEST_LEN digests. */
+/** Helper: compare two DIGEST256_LEN digests. */
 static int
-compare_digests_(const void **_a, const void **_b)
+compare_digests256_(const void **_a, const void **_b)
 {
-  return tor_memcmp((const char*)*_a, (const char*)*_b, DIGEST_LEN);
+  return tor_memcmp((const char*)*_a, (const char*)*_b, DIGEST256_LEN);
+}
+
+/** Lists of digests with fewer than this many members get sorted by
+ * insertion sort instead of by another radix pass. */
+#define DIGEST_RADIX_SORT_CUTOFF 32
+
+/** Helper: sort the <b>n</b> fixed-length keys pointed to by <b>items</b>
+ * into ascending order, assuming that they all agree on their first
+ * <b>byte</b> bytes.  Keys are <b>keylen</b> bytes long.  <b>tmp</b> must
+ * have room for <b>n</b> pointers.
+ *
+ * This is a most-significant-byte-first radix sort: it distributes the keys
+ * into 256 buckets by their <b>byte</b>th byte, and then sorts each bucket
+ * on the next byte.  Since digests are close to uniformly distributed, one
+ * or two passes are usually enough before the buckets get small enough for
+ * insertion sort.
+ *
+ * Note that unlike tor_memcmp(), this takes time that depends on the
+ * contents of the keys: don't use it on secret values. */
+static void
+radix_sort_fixed_keys(void **items, void **tmp, int n, size_t byte,
+                      size_t keylen)
+{
+  int count[256];
+  int i, start;
+
+  if (n < DIGEST_RADIX_SORT_CUTOFF) {
+    const size_t rest = keylen - byte;
+    for (i = 1; i < n; ++i) {
+      void *item = items[i];
+      int j = i;
+      while (j > 0 && memcmp((const uint8_t*)items[j-1] + byte,
+                             (const uint8_t*)item + byte, rest) > 0) {
+        items[j] = items[j-1];
+        --j;
+      }
+      items[j] = item;
+    }
+    return;
+  }
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; ++i)
+    ++count[((const uint8_t*)items[i])[byte]];
+
+  /* Turn the counts into starting offsets, and distribute the items. */
+  for (i = 0, start = 0; i < 256; ++i) {
+    int c = count[i];
+    count[i] = start;
+    start += c;
+  }
+  for (i = 0; i < n; ++i)
+    tmp[count[((const uint8_t*)items[i])[byte]]++] = items[i];
+  memcpy(items, tmp, n * sizeof(void*));
+
+  if (byte + 1 == keylen)
+    return;
+
+  /* count[i] is now the end of bucket i. */
+  for (i = 0, start = 0; i < 256; ++i) {
+    if (count[i] - start > 1)
+      radix_sort_fixed_keys(items + start, tmp + start, count[i] - start,
+                            byte + 1, keylen);
+    start = count[i];
+  }
+}
+
+/** Sort the list <b>sl</b> of <b>keylen</b>-byte keys into ascending
+ * order, as compared by memcmp(). */
+static void
+smartlist_sort_fixed_keys(smartlist_t *sl, size_t keylen)
+{
+  void **tmp;
+  if (sl->num_used < 2)
+    return;
+  if (sl->num_used < DIGEST_RADIX_SORT_CUTOFF) {
+    radix_sort_fixed_keys(sl->list, NULL, sl->num_used, 0, keylen);
+    return;
+  }
+  tmp = tor_malloc(sl->num_used * sizeof(void*));
+  radix_sort_fixed_keys(sl->list, tmp, sl->num_used, 0, keylen);
+  tor_free(tmp);
+}
+
+/** Remove duplicate <b>keylen</b>-byte keys from the sorted list <b>sl</b>,
+ * freeing them with tor_free().  Preserves order.  Unlike smartlist_uniq(),
+ * this compacts the list in a single pass, so it stays linear no matter how
+ * many duplicates there are. */
+static void
+smartlist_uniq_fixed_keys(smartlist_t *sl, size_t keylen)
+{
+  int i, n_kept;
+  if (sl->num_used < 2)
+    return;
+  for (i = 1, n_kept = 1; i < sl->num_used; ++i) {
+    if (fast_memeq(sl->list[n_kept-1], sl->list[i], keylen)) {
+      tor_free(sl->list[i]);
+    } else {
+      sl->list[n_kept++] = sl->list[i];
+    }
+  }
+  memset(sl->list + n_kept, 0, sizeof(void*) * (sl->num_used - n_kept));
+  sl->num_used = n_kept;
 }
 
 /** Sort the list of DIGEST_LEN-byte digests into ascending order. */
 void
 smartlist_sort_digests(smartlist_t *sl)
 {
-  smartlist_sort(sl, compare_digests_);
+  smartlist_sort_fixed_keys(sl, DIGEST_LEN);
 }
 
 /** Remove duplicate digests from a sorted list, and free them with tor_free().
@@ -988,21 +1091,14 @@ smartlist_sort_digests(smartlist_t *sl)
 void
 smartlist_uniq_digests(smartlist_t *sl)
 {
-  smartlist_uniq(sl, compare_digests_, tor_free_);
-}
-
-/** Helper: compare two DIGEST256_LEN digests. */
-static int
-compare_digests256_(const void **_a, const void **_b)
-{
-  return tor_memcmp((const char*)*_a, (const char*)*_b, DIGEST256_LEN);
+  smartlist_uniq_fixed_keys(sl, DIGEST_LEN);
 }
 
 /** Sort the list of DIGEST256_LEN-byte digests into ascending order. */
 void
 smartlist_sort_digests256(smartlist_t *sl)
 {
-  smartlist_sort(sl, compare_digests256_);
+  smartlist_sort_fixed_keys(sl, DIGEST256_LEN);
 }
 
 /** Return the most frequent member of the sorted list of DIGEST256_LEN
@@ -1019,7 +1115,7 @@ smartlist_get_most_frequent_digest256(smartlist_t *sl)
 void
 smartlist_uniq_digests256(smartlist_t *sl)
 {
-  smartlist_uniq(sl, compare_digests256_, tor_free_);
+  smartlist_uniq_fixed_keys(sl, DIGEST256_LEN);
 }
 
 /** Helper: Declare an entry type and a map type to implement a mapping using
@@ -1470,3 +1566,109 @@ digestset_free(digestset_t *set)
   tor_free(set);
 }
 
+/** An entry in the table of interned strings.  The string itself is
+ * allocated in the same chunk, right after the entry. */
+typedef struct interned_str_t {
+  HT_ENTRY(interned_str_t) node;
+  /** Number of outstanding references returned by tor_intern_str(). */
+  unsigned int refcnt;
+  /** The interned string. */
+  const char *str;
+} interned_str_t;
+
+/** Helper: compare interned_str_t objects by their strings. */
+static INLINE int
+interned_str_eq(const interned_str_t *a, const interned_str_t *b)
+{
+  return !strcmp(a->str, b->str);
+}
+
+/** Helper: return a hash value for an interned_str_t. */
+static INLINE unsigned int
+interned_str_hash(const interned_str_t *a)
+{
+  return (unsigned) siphash24g(a->str, strlen(a->str));
+}
+
+/** Table of all interned strings. */
+static HT_HEAD(interned_str_map, interned_str_t) interned_strs =
+  HT_INITIALIZER();
+
+HT_PROTOTYPE(interned_str_map, interned_str_t, node, interned_str_hash,
+             interned_str_eq)
+HT_GENERATE2(interned_str_map, interned_str_t, node, interned_str_hash,
+             interned_str_eq, 0.6, tor_reallocarray_, tor_free_)
+
+/** Return a shared, read-only copy of <b>s</b>.  Descriptors repeat the
+ * same platform strings, family members, and so on many thousands of times;
+ * interning them lets us keep a single copy of each.  Every string returned
+ * by this function must eventually be released with tor_intern_str_release().
+ *
+ * Not threadsafe: call only from the main thread. */
+const char *
+tor_intern_str(const char *s)
+{
+  interned_str_t search, *found;
+  tor_assert(s);
+
+  search.str = s;
+  found = HT_FIND(interned_str_map, &interned_strs, &search);
+  if (!found) {
+    size_t len = strlen(s);
+    char *copy;
+    found = tor_malloc(sizeof(interned_str_t) + len + 1);
+    copy = ((char *)found) + sizeof(interned_str_t);
+    memcpy(copy, s, len + 1);
+    found->str = copy;
+    found->refcnt = 0;
+    HT_INSERT(interned_str_map, &interned_strs, found);
+  }
+  ++found->refcnt;
+  return found->str;
+}
+
+/** Drop a reference to <b>s</b>, which should have come from
+ * tor_intern_str().  For convenience when freeing structures that might
+ * have been filled in either way, if <b>s</b> was not interned, free it
+ * with tor_free() instead. */
+void
+tor_intern_str_release(const char *s)
+{
+  interned_str_t search, *found;
+  if (!s)
+    return;
+
+  search.str = s;
+  found = HT_FIND(interned_str_map, &interned_strs, &search);
+  if (!found || found->str != s) {
+    /* Not an interned string. */
+    tor_free_((void *)s);
+    return;
+  }
+  if (--found->refcnt == 0) {
+    HT_REMOVE(interned_str_map, &interned_strs, found);
+    tor_free(found);
+  }
+}
+
+/** Return the number of distinct strings currently interned. */
+int
+tor_intern_str_count(void)
+{
+  return (int) HT_SIZE(&interned_strs);
+}
+
+/** Release all interned strings, whether or not they are still referenced.
+ * Call only at exit. */
+void
+tor_intern_str_free_all(void)
+{
+  interned_str_t **ent, **next, *this;
+  for (ent = HT_START(interned_str_map, &interned_strs); ent; ent = next) {
+    this = *ent;
+    next = HT_NEXT_RMV(interned_str_map, &interned_strs, ent);
+    tor_free(this);
+  }
+  HT_CLEAR(interned_str_map, &interned_strs);
+}
+
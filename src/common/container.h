@@ -664,6 +664,11 @@ digestset_contains(const digestset_t *set, const char *digest)
 }
 #undef BIT
 
+const char *tor_intern_str(const char *s);
+void tor_intern_str_release(const char *s);
+int tor_intern_str_count(void);
+void tor_intern_str_free_all(void);
+
 digestset_t *digestset_new(int max_elements);
 void digestset_free(digestset_t* set);
 
@@ -1514,6 +1514,43 @@ crypto_cipher_decrypt_with_iv(const char *key,
 
 /* SHA-1 */
 
+/** How crypto_digest() and crypto_digest256() compute each digest
+ * algorithm. */
+static digest_impl_t digest_impls[N_DIGEST_ALGORITHMS] = {
+  DIGEST_IMPL_DIRECT, DIGEST_IMPL_DIRECT
+};
+
+/** Make crypto_digest() or crypto_digest256() use <b>impl</b> to compute
+ * <b>alg</b> from now on.  (Digest objects always call OpenSSL's SHA
+ * functions directly.) */
+void
+crypto_digest_set_impl(digest_algorithm_t alg, digest_impl_t impl)
+{
+  tor_assert(alg < N_DIGEST_ALGORITHMS);
+  tor_assert(impl == DIGEST_IMPL_DIRECT || impl == DIGEST_IMPL_EVP);
+  digest_impls[alg] = impl;
+}
+
+/** Return the way we compute <b>alg</b> in crypto_digest() or
+ * crypto_digest256(). */
+digest_impl_t
+crypto_digest_get_impl(digest_algorithm_t alg)
+{
+  tor_assert(alg < N_DIGEST_ALGORITHMS);
+  return digest_impls[alg];
+}
+
+/** Return a short name for the digest implementation <b>impl</b>. */
+const char *
+crypto_digest_impl_get_name(digest_impl_t impl)
+{
+  switch (impl) {
+    case DIGEST_IMPL_DIRECT: return "direct";
+    case DIGEST_IMPL_EVP: return "evp";
+    default: return "unknown";
+  }
+}
+
 /** Compute the SHA1 digest of the <b>len</b> bytes on data stored in
  * <b>m</b>.  Write the DIGEST_LEN byte result into <b>digest</b>.
  * Return 0 on success, -1 on failure.
@@ -1523,6 +1560,9 @@ crypto_digest(char *digest, const char *m, size_t len)
 {
   tor_assert(m);
   tor_assert(digest);
+  if (digest_impls[DIGEST_SHA1] == DIGEST_IMPL_EVP)
+    return !EVP_Digest(m, len, (unsigned char*)digest, NULL, EVP_sha1(),
+                       NULL) ? -1 : 0;
   return (SHA1((const unsigned char*)m,len,(unsigned char*)digest) == NULL);
 }
 
@@ -1536,6 +1576,9 @@ crypto_digest256(char *digest, const char *m, size_t len,
   tor_assert(m);
   tor_assert(digest);
   tor_assert(algorithm == DIGEST_SHA256);
+  if (digest_impls[DIGEST_SHA256] == DIGEST_IMPL_EVP)
+    return !EVP_Digest(m, len, (unsigned char*)digest, NULL, EVP_sha256(),
+                       NULL) ? -1 : 0;
   return (SHA256((const unsigned char*)m,len,(unsigned char*)digest) == NULL);
 }
 
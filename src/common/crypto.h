@@ -91,6 +91,16 @@ typedef enum {
 #define  N_DIGEST_ALGORITHMS (DIGEST_SHA256+1)
 #define digest_algorithm_bitfield_t ENUM_BF(digest_algorithm_t)
 
+/** The ways we know how to digest a whole string at once. */
+typedef enum {
+  /** Call OpenSSL's SHA1() or SHA256() directly. */
+  DIGEST_IMPL_DIRECT = 0,
+  /** Go through OpenSSL's EVP layer, which can use an engine. */
+  DIGEST_IMPL_EVP = 1,
+} digest_impl_t;
+/** How many values of digest_impl_t are there? */
+#define N_DIGEST_IMPLS 2
+
 /** A set of all the digests we know how to compute, taken on a single
  * string.  Any digests that are shorter than 256 bits are right-padded
  * with 0 bits.
@@ -212,6 +222,9 @@ void crypto_digest_smartlist(char *digest_out, size_t len_out,
                              digest_algorithm_t alg);
 const char *crypto_digest_algorithm_get_name(digest_algorithm_t alg);
 int crypto_digest_algorithm_parse_name(const char *name);
+void crypto_digest_set_impl(digest_algorithm_t alg, digest_impl_t impl);
+digest_impl_t crypto_digest_get_impl(digest_algorithm_t alg);
+const char *crypto_digest_impl_get_name(digest_impl_t impl);
 crypto_digest_t *crypto_digest_new(void);
 crypto_digest_t *crypto_digest256_new(digest_algorithm_t algorithm);
 void crypto_digest_free(crypto_digest_t *digest);
@@ -0,0 +1,515 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file crypto_calibrate.c
+ * \brief Time each implementation we have of a crypto primitive, and pick
+ * the fastest one that gives the right answers.
+ *
+ * Which implementation is fastest depends on the CPU, on which OpenSSL we
+ * have and how it was built, and on whether an engine is loaded, so the
+ * compile-time guesses in aes.c and elsewhere are sometimes wrong.  Timing
+ * them all takes a few milliseconds.  Callers can remember what we picked
+ * with crypto_get_implementations(), and go back to it next time with
+ * crypto_set_implementations(), as long as crypto_calibration_platform()
+ * hasn't changed.
+ */
+
+#include "orconfig.h"
+#include <stdio.h>
+#include <string.h>
+#include "crypto.h"
+#include "crypto_calibrate.h"
+#include "crypto_curve25519.h"
+#include "aes.h"
+#include "compat.h"
+#include "container.h"
+#include "util.h"
+#include "torlog.h"
+
+/** How many bytes do we feed each cipher or digest when we time it? */
+#define CALIBRATE_BUF_LEN 16384
+/** How many times do we time each implementation?  We keep the fastest
+ * time, since anything slower than that was probably interrupted. */
+#define CALIBRATE_TRIALS 5
+/** We only switch away from the implementation we'd use anyway if another
+ * one is at least this many percent faster: smaller differences are as
+ * likely to be noise as anything else. */
+#define CALIBRATE_MIN_GAIN_PCT 10
+
+/** A crypto primitive that we have more than one implementation of.
+ * Implementations are numbered from 0 to n_impls-1. */
+typedef struct calibrated_primitive_t {
+  /** Name of the primitive, as used by crypto_get_implementations(). */
+  const char *name;
+  /** How many implementations are there? */
+  int n_impls;
+  /** Return a short name for implementation <b>impl</b>. */
+  const char *(*get_impl_name)(int impl);
+  /** Return true iff we can use implementation <b>impl</b> here. */
+  int (*impl_is_available)(int impl);
+  /** Return the implementation we're using now. */
+  int (*get_impl)(void);
+  /** Start using implementation <b>impl</b>. */
+  void (*set_impl)(int impl);
+  /** Run a workload with the current implementation, of a size worth
+   * timing.  Return 0 if it gave the right answer, and -1 if it didn't. */
+  int (*run_test)(void);
+} calibrated_primitive_t;
+
+/** Return a CALIBRATE_BUF_LEN-byte buffer in which every byte is the low
+ * byte of its offset. */
+static const char *
+get_test_input(void)
+{
+  static char *buf = NULL;
+  if (!buf) {
+    int i;
+    buf = tor_malloc(CALIBRATE_BUF_LEN);
+    for (i = 0; i < CALIBRATE_BUF_LEN; ++i)
+      buf[i] = (char)(i & 0xff);
+  }
+  return buf;
+}
+
+/** Return 0 if the <b>len</b>-byte digest in <b>digest</b> is the one whose
+ * hexadecimal encoding is <b>expected_hex</b>, and -1 otherwise. */
+static int
+check_digest(const char *digest, size_t len, const char *expected_hex)
+{
+  char hex[HEX_DIGEST256_LEN+1];
+  tor_assert(len <= DIGEST256_LEN);
+  base16_encode(hex, sizeof(hex), digest, len);
+  return strcasecmp(hex, expected_hex) ? -1 : 0;
+}
+
+/* AES in counter mode */
+
+static const char *
+aes_get_impl_name(int impl)
+{
+  return aes_ctr_impl_get_name(impl);
+}
+static int
+aes_impl_is_available(int impl)
+{
+  return aes_ctr_impl_is_available(impl);
+}
+static int
+aes_get_impl(void)
+{
+  return aes_get_ctr_impl();
+}
+static void
+aes_set_impl(int impl)
+{
+  aes_set_ctr_impl(impl);
+}
+
+/** Encrypt CALIBRATE_BUF_LEN zero bytes with an all-zero key and IV, once
+ * in a single call and once in pieces of awkward sizes, and check both
+ * results against the right answer. */
+static int
+aes_run_test(void)
+{
+  /* SHA256 of the result. */
+  static const char expected[] =
+    "4013f49ab9a79591bdedaffe7d8ceefc6e8837f1ed80b753540b0fcf14577357";
+  char key[16], iv[16], d[DIGEST256_LEN];
+  char *buf1 = tor_malloc_zero(CALIBRATE_BUF_LEN);
+  char *buf2 = tor_malloc_zero(CALIBRATE_BUF_LEN);
+  aes_cnt_cipher_t *c;
+  crypto_digest_t *digest;
+  size_t off, chunk;
+  int r;
+
+  memset(key, 0, sizeof(key));
+  memset(iv, 0, sizeof(iv));
+  c = aes_new_cipher(key, iv);
+  aes_crypt_inplace(c, buf1, CALIBRATE_BUF_LEN);
+  aes_cipher_free(c);
+
+  /* Counter-mode bugs tend to show up when we stop partway through a
+   * block. */
+  c = aes_new_cipher(key, iv);
+  for (off = 0, chunk = 1; off < CALIBRATE_BUF_LEN; chunk = chunk*2 + 1) {
+    chunk = MIN(chunk, CALIBRATE_BUF_LEN - off);
+    aes_crypt_inplace(c, buf2 + off, chunk);
+    off += chunk;
+  }
+  aes_cipher_free(c);
+
+  /* Digest objects don't depend on anything we calibrate. */
+  digest = crypto_digest256_new(DIGEST_SHA256);
+  crypto_digest_add_bytes(digest, buf1, CALIBRATE_BUF_LEN);
+  crypto_digest_get_digest(digest, d, sizeof(d));
+  crypto_digest_free(digest);
+
+  r = check_digest(d, sizeof(d), expected);
+  if (tor_memneq(buf1, buf2, CALIBRATE_BUF_LEN))
+    r = -1;
+  tor_free(buf1);
+  tor_free(buf2);
+  return r;
+}
+
+/* SHA1 and SHA256 */
+
+static int
+digest_impl_is_available(int impl)
+{
+  return impl == DIGEST_IMPL_DIRECT || impl == DIGEST_IMPL_EVP;
+}
+static const char *
+digest_get_impl_name(int impl)
+{
+  return crypto_digest_impl_get_name(impl);
+}
+static int
+sha1_get_impl(void)
+{
+  return crypto_digest_get_impl(DIGEST_SHA1);
+}
+static void
+sha1_set_impl(int impl)
+{
+  crypto_digest_set_impl(DIGEST_SHA1, impl);
+}
+static int
+sha256_get_impl(void)
+{
+  return crypto_digest_get_impl(DIGEST_SHA256);
+}
+static void
+sha256_set_impl(int impl)
+{
+  crypto_digest_set_impl(DIGEST_SHA256, impl);
+}
+
+/** Digest the test input a few times with crypto_digest(), and check the
+ * result. */
+static int
+sha1_run_test(void)
+{
+  static const char expected[] = "80cb9c430d80c3084649f65e0ca25dabbffb1b62";
+  char d[DIGEST_LEN];
+  int i;
+  for (i = 0; i < 4; ++i) {
+    if (crypto_digest(d, get_test_input(), CALIBRATE_BUF_LEN) < 0 ||
+        check_digest(d, sizeof(d), expected) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/** Digest the test input a few times with crypto_digest256(), and check
+ * the result. */
+static int
+sha256_run_test(void)
+{
+  static const char expected[] =
+    "a1f259d4365ed4320c377ce26f5c8c56dcdc9a89e7b641bfd8eabfbbeac86654";
+  char d[DIGEST256_LEN];
+  int i;
+  for (i = 0; i < 4; ++i) {
+    if (crypto_digest256(d, get_test_input(), CALIBRATE_BUF_LEN,
+                         DIGEST_SHA256) < 0 ||
+        check_digest(d, sizeof(d), expected) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* curve25519 public key generation */
+
+static const char *
+curve25519_get_impl_name(int impl)
+{
+  return curve25519_basepoint_impl_get_name(impl);
+}
+static int
+curve25519_impl_is_available(int impl)
+{
+  return impl == CURVE25519_BASEPOINT_IMPL_LADDER ||
+    impl == CURVE25519_BASEPOINT_IMPL_ED25519;
+}
+static int
+curve25519_get_impl(void)
+{
+  return curve25519_get_basepoint_impl();
+}
+static void
+curve25519_set_impl(int impl)
+{
+  curve25519_set_basepoint_impl(impl);
+}
+
+/** Compute the public key for the test vector from RFC 7748 a few times,
+ * and check the result. */
+static int
+curve25519_run_test(void)
+{
+  static const char secret_hex[] =
+    "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a";
+  static const char expected[] =
+    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a";
+  curve25519_secret_key_t seckey;
+  curve25519_public_key_t pubkey;
+  int i;
+
+  base16_decode((char*)seckey.secret_key, sizeof(seckey.secret_key),
+                secret_hex, strlen(secret_hex));
+  for (i = 0; i < 4; ++i) {
+    curve25519_public_key_generate(&pubkey, &seckey);
+    if (check_digest((const char*)pubkey.public_key,
+                     sizeof(pubkey.public_key), expected) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/** Every primitive we know how to calibrate. */
+static const calibrated_primitive_t primitives[] = {
+  { "aes-ctr", N_AES_CTR_IMPLS, aes_get_impl_name, aes_impl_is_available,
+    aes_get_impl, aes_set_impl, aes_run_test },
+  { "sha1", N_DIGEST_IMPLS, digest_get_impl_name, digest_impl_is_available,
+    sha1_get_impl, sha1_set_impl, sha1_run_test },
+  { "sha256", N_DIGEST_IMPLS, digest_get_impl_name, digest_impl_is_available,
+    sha256_get_impl, sha256_set_impl, sha256_run_test },
+  { "curve25519-base", N_CURVE25519_BASEPOINT_IMPLS, curve25519_get_impl_name,
+    curve25519_impl_is_available, curve25519_get_impl, curve25519_set_impl,
+    curve25519_run_test },
+  { NULL, 0, NULL, NULL, NULL, NULL, NULL }
+};
+
+/** How many entries of primitives are real? */
+#define N_PRIMITIVES (ARRAY_LENGTH(primitives) - 1)
+
+/** Return a monotonic time in nanoseconds, for timing implementations. */
+static uint64_t
+calibrate_now_nsec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ((uint64_t)ts.tv_sec)*1000000000 + ts.tv_nsec;
+#endif
+  {
+    struct timeval tv;
+    tor_gettimeofday(&tv);
+    return ((uint64_t)tv.tv_sec)*1000000000 + ((uint64_t)tv.tv_usec)*1000;
+  }
+}
+
+/** Time the current implementation of <b>p</b>, and set *<b>nsec_out</b>
+ * to how long its fastest run took.  Return 0 on success, or -1 if it
+ * ever gave the wrong answer. */
+static int
+time_primitive(const calibrated_primitive_t *p, uint64_t *nsec_out)
+{
+  uint64_t best = UINT64_MAX;
+  int i;
+
+  /* The first run warms the caches, and doesn't count. */
+  if (p->run_test() < 0)
+    return -1;
+  for (i = 0; i < CALIBRATE_TRIALS; ++i) {
+    uint64_t start = calibrate_now_nsec(), elapsed;
+    if (p->run_test() < 0)
+      return -1;
+    elapsed = calibrate_now_nsec() - start;
+    best = MIN(best, elapsed);
+  }
+  *nsec_out = best;
+  return 0;
+}
+
+/** Time every available implementation of <b>p</b>, and start using the
+ * best one. */
+static void
+calibrate_primitive(const calibrated_primitive_t *p)
+{
+  const int default_impl = p->get_impl();
+  uint64_t default_time = UINT64_MAX, best_time = UINT64_MAX;
+  int impl, best = -1;
+
+  for (impl = 0; impl < p->n_impls; ++impl) {
+    uint64_t t;
+    if (!p->impl_is_available(impl))
+      continue;
+    p->set_impl(impl);
+    if (time_primitive(p, &t) < 0) {
+      log_warn(LD_CRYPTO, "The \"%s\" implementation of %s gave the wrong "
+               "answer. Not using it.", p->get_impl_name(impl), p->name);
+      continue;
+    }
+    log_debug(LD_CRYPTO, "%s: \"%s\" took "U64_FORMAT" nsec.", p->name,
+              p->get_impl_name(impl), U64_PRINTF_ARG(t));
+    if (impl == default_impl)
+      default_time = t;
+    if (t < best_time) {
+      best = impl;
+      best_time = t;
+    }
+  }
+
+  if (best < 0) {
+    log_warn(LD_CRYPTO, "No implementation of %s gave the right answer!",
+             p->name);
+    best = default_impl;
+  } else if (default_time != UINT64_MAX &&
+             best_time * 100 > default_time * (100 - CALIBRATE_MIN_GAIN_PCT)) {
+    best = default_impl;
+  }
+  p->set_impl(best);
+}
+
+/** Time every implementation we have of every primitive in primitives,
+ * and start using the fastest ones that work.  This takes a few
+ * milliseconds; it must run after crypto_global_init(), and before we
+ * start any threads that use crypto. */
+void
+crypto_calibrate(void)
+{
+  const uint64_t start = calibrate_now_nsec();
+  const calibrated_primitive_t *p;
+  char *impls;
+
+  for (p = primitives; p->name; ++p)
+    calibrate_primitive(p);
+
+  impls = crypto_get_implementations();
+  log_info(LD_CRYPTO, "Calibrated crypto implementations in %.1f msec: %s",
+           (calibrate_now_nsec() - start) / 1e6, impls);
+  tor_free(impls);
+}
+
+/** Return a newly allocated string listing which implementation we use
+ * for each primitive, as a space-separated list of
+ * <b>primitive</b>=<b>impl</b> pairs. */
+char *
+crypto_get_implementations(void)
+{
+  smartlist_t *items = smartlist_new();
+  const calibrated_primitive_t *p;
+  char *result;
+
+  for (p = primitives; p->name; ++p)
+    smartlist_add_asprintf(items, "%s=%s", p->name,
+                           p->get_impl_name(p->get_impl()));
+  result = smartlist_join_strings(items, " ", 0, NULL);
+  SMARTLIST_FOREACH(items, char *, cp, tor_free(cp));
+  smartlist_free(items);
+  return result;
+}
+
+/** Return the primitive whose name is the first <b>namelen</b> bytes of
+ * <b>name</b>, or NULL if there is none. */
+static const calibrated_primitive_t *
+find_primitive(const char *name, size_t namelen)
+{
+  const calibrated_primitive_t *p;
+  for (p = primitives; p->name; ++p) {
+    if (strlen(p->name) == namelen && !strncmp(p->name, name, namelen))
+      return p;
+  }
+  return NULL;
+}
+
+/** Start using the implementations listed in <b>impls</b>, a string of
+ * the kind crypto_get_implementations() returns.  We check each one before
+ * we use it.  Return 0 on success.  If anything in <b>impls</b> is
+ * unrecognized, unavailable or broken, change nothing, and return -1. */
+int
+crypto_set_implementations(const char *impls)
+{
+  smartlist_t *items = smartlist_new();
+  int saved[N_PRIMITIVES];
+  int i, r = 0;
+
+  for (i = 0; primitives[i].name; ++i)
+    saved[i] = primitives[i].get_impl();
+
+  smartlist_split_string(items, impls, NULL,
+                         SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+  SMARTLIST_FOREACH_BEGIN(items, const char *, item) {
+    const char *eq = strchr(item, '=');
+    const calibrated_primitive_t *p = NULL;
+    int impl = -1, j;
+    if (eq)
+      p = find_primitive(item, eq - item);
+    if (p) {
+      for (j = 0; j < p->n_impls; ++j) {
+        if (!strcmp(eq + 1, p->get_impl_name(j)))
+          impl = j;
+      }
+    }
+    if (impl < 0 || !p->impl_is_available(impl)) {
+      log_info(LD_CRYPTO, "Can't use crypto implementation \"%s\".", item);
+      r = -1;
+      break;
+    }
+    p->set_impl(impl);
+    if (p->run_test() < 0) {
+      log_warn(LD_CRYPTO, "The \"%s\" implementation of %s gave the wrong "
+               "answer. Not using it.", eq + 1, p->name);
+      r = -1;
+      break;
+    }
+  } SMARTLIST_FOREACH_END(item);
+
+  if (r < 0) {
+    for (i = 0; primitives[i].name; ++i)
+      primitives[i].set_impl(saved[i]);
+  }
+  SMARTLIST_FOREACH(items, char *, cp, tor_free(cp));
+  smartlist_free(items);
+  return r;
+}
+
+/** Return a newly allocated string that identifies this CPU, this OpenSSL,
+ * and this version of Tor.  If any of them change, we should calibrate
+ * again instead of reusing an old crypto_get_implementations() result. */
+char *
+crypto_calibration_platform(void)
+{
+  crypto_digest_t *digest = crypto_digest256_new(DIGEST_SHA256);
+  char d[DIGEST256_LEN];
+  char *result;
+#ifdef __linux__
+  /* The first of each of these lines describes the CPU model and its
+   * features on the architectures we know about. */
+  static const char *cpuinfo_fields[] = {
+    "model name", "flags", "Features", "CPU part", "cpu model", "cpu\t",
+    NULL
+  };
+  int found[ARRAY_LENGTH(cpuinfo_fields)];
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  memset(found, 0, sizeof(found));
+  if (f) {
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+      int i;
+      for (i = 0; cpuinfo_fields[i]; ++i) {
+        if (!found[i] && !strcmpstart(line, cpuinfo_fields[i])) {
+          crypto_digest_add_bytes(digest, line, strlen(line));
+          found[i] = 1;
+        }
+      }
+    }
+    fclose(f);
+  }
+#endif
+  crypto_digest_add_bytes(digest, get_uname(), strlen(get_uname()));
+  crypto_digest_add_bytes(digest, "\n", 1);
+  crypto_digest_add_bytes(digest, crypto_openssl_get_version_str(),
+                          strlen(crypto_openssl_get_version_str()));
+  crypto_digest_add_bytes(digest, "\n" VERSION, strlen("\n" VERSION));
+  crypto_digest_get_digest(digest, d, sizeof(d));
+  crypto_digest_free(digest);
+
+  result = tor_malloc(HEX_DIGEST_LEN+1);
+  base16_encode(result, HEX_DIGEST_LEN+1, d, DIGEST_LEN);
+  return result;
+}
+
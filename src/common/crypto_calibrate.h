@@ -0,0 +1,13 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#ifndef TOR_CRYPTO_CALIBRATE_H
+#define TOR_CRYPTO_CALIBRATE_H
+
+void crypto_calibrate(void);
+char *crypto_get_implementations(void);
+int crypto_set_implementations(const char *impls);
+char *crypto_calibration_platform(void);
+
+#endif
+
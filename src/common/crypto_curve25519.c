@@ -13,6 +13,7 @@
 #include "crypto_curve25519.h"
 #include "util.h"
 #include "torlog.h"
+#include "ed25519/ref10/ed25519_ref10.h"
 
 /* ==============================
    Part 1: wrap a suitable curve25519 implementation as curve25519_impl
@@ -50,6 +51,49 @@ curve25519_impl(uint8_t *output, const uint8_t *secret,
   return r;
 }
 
+/** How do we multiply secret keys by the basepoint? */
+static curve25519_basepoint_impl_t basepoint_impl =
+  CURVE25519_BASEPOINT_IMPL_LADDER;
+
+/** Make curve25519_basepoint_impl() use <b>impl</b> from now on. */
+void
+curve25519_set_basepoint_impl(curve25519_basepoint_impl_t impl)
+{
+  tor_assert(impl == CURVE25519_BASEPOINT_IMPL_LADDER ||
+             impl == CURVE25519_BASEPOINT_IMPL_ED25519);
+  basepoint_impl = impl;
+}
+
+/** Return the way curve25519_basepoint_impl() works now. */
+curve25519_basepoint_impl_t
+curve25519_get_basepoint_impl(void)
+{
+  return basepoint_impl;
+}
+
+/** Return a short name for the basepoint implementation <b>impl</b>. */
+const char *
+curve25519_basepoint_impl_get_name(curve25519_basepoint_impl_t impl)
+{
+  switch (impl) {
+    case CURVE25519_BASEPOINT_IMPL_LADDER: return "ladder";
+    case CURVE25519_BASEPOINT_IMPL_ED25519: return "ed25519";
+    default: return "unknown";
+  }
+}
+
+/** Set <b>output</b> to the public key that goes with <b>secret</b>. */
+STATIC int
+curve25519_basepoint_impl(uint8_t *output, const uint8_t *secret)
+{
+  static const uint8_t basepoint[32] = {9};
+
+  if (basepoint_impl == CURVE25519_BASEPOINT_IMPL_ED25519)
+    return ed25519_ref10_curve25519_basepoint(output, secret);
+  else
+    return curve25519_impl(output, secret, basepoint);
+}
+
 /* ==============================
    Part 2: Wrap curve25519_impl with some convenience types and functions.
    ============================== */
@@ -113,9 +157,7 @@ void
 curve25519_public_key_generate(curve25519_public_key_t *key_out,
                                const curve25519_secret_key_t *seckey)
 {
-  static const uint8_t basepoint[32] = {9};
-
-  curve25519_impl(key_out->public_key, seckey->secret_key, basepoint);
+  curve25519_basepoint_impl(key_out->public_key, seckey->secret_key);
 }
 
 int
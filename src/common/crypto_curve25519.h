@@ -58,9 +58,27 @@ int curve25519_keypair_read_from_file(curve25519_keypair_t *keypair_out,
 
 int curve25519_rand_seckey_bytes(uint8_t *out, int extra_strong);
 
+/** The ways we know how to compute a public key from a secret key. */
+typedef enum {
+  /** Multiply by the basepoint like any other point, with a Montgomery
+   * ladder. */
+  CURVE25519_BASEPOINT_IMPL_LADDER = 0,
+  /** Use ed25519's table-driven fixed-base multiplication, and convert the
+   * result to its curve25519 form. */
+  CURVE25519_BASEPOINT_IMPL_ED25519 = 1,
+} curve25519_basepoint_impl_t;
+/** How many values of curve25519_basepoint_impl_t are there? */
+#define N_CURVE25519_BASEPOINT_IMPLS 2
+
+void curve25519_set_basepoint_impl(curve25519_basepoint_impl_t impl);
+curve25519_basepoint_impl_t curve25519_get_basepoint_impl(void);
+const char *curve25519_basepoint_impl_get_name(
+                                        curve25519_basepoint_impl_t impl);
+
 #ifdef CRYPTO_CURVE25519_PRIVATE
 STATIC int curve25519_impl(uint8_t *output, const uint8_t *secret,
                            const uint8_t *basepoint);
+STATIC int curve25519_basepoint_impl(uint8_t *output, const uint8_t *secret);
 #endif
 
 #define CURVE25519_BASE64_PADDED_LEN 44
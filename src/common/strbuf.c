@@ -0,0 +1,179 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/** \file strbuf.c
+ * \brief Implementation for strbuf_t, a growable string that documents can
+ * be formatted into piece by piece.
+ *
+ * Building a large document as a smartlist of small strings and then
+ * joining them costs one allocation per piece, plus a full copy at the end.
+ * A strbuf_t keeps everything in a single buffer that can be digested in
+ * place and handed to the caller without copying it again.
+ */
+
+#include "orconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strbuf.h"
+#include "util.h"
+#include "torlog.h"
+
+/** Smallest buffer we allocate for a strbuf_t. */
+#define STRBUF_MIN_ALLOC 256
+
+/** A growable NUL-terminated string. */
+struct strbuf_t {
+  char *mem; /**< The contents, always NUL-terminated. */
+  size_t len; /**< Number of bytes in mem, not counting the NUL. */
+  size_t alloc; /**< Number of bytes allocated for mem. */
+};
+
+/** Allocate and return a new empty strbuf_t.  If we have an idea how long
+ * the result will be, <b>size_hint</b> should say so: that way we can avoid
+ * reallocating as it grows. */
+strbuf_t *
+strbuf_new(size_t size_hint)
+{
+  strbuf_t *sb = tor_malloc_zero(sizeof(strbuf_t));
+  sb->alloc = size_hint + 1 < STRBUF_MIN_ALLOC ?
+    STRBUF_MIN_ALLOC : size_hint + 1;
+  sb->mem = tor_malloc(sb->alloc);
+  sb->mem[0] = '\0';
+  return sb;
+}
+
+/** Release all storage held by <b>sb</b>. */
+void
+strbuf_free(strbuf_t *sb)
+{
+  if (!sb)
+    return;
+  tor_free(sb->mem);
+  tor_free(sb);
+}
+
+/** Make sure that <b>sb</b> has room for at least <b>n</b> more bytes, plus
+ * the terminating NUL. */
+static void
+strbuf_ensure_space(strbuf_t *sb, size_t n)
+{
+  size_t needed;
+  tor_assert(n < SIZE_T_CEILING - sb->len - 1);
+  needed = sb->len + n + 1;
+  if (needed <= sb->alloc)
+    return;
+  while (sb->alloc < needed) {
+    if (sb->alloc >= SIZE_T_CEILING / 2) {
+      sb->alloc = needed;
+      break;
+    }
+    sb->alloc *= 2;
+  }
+  sb->mem = tor_realloc(sb->mem, sb->alloc);
+}
+
+/** Append the first <b>len</b> bytes of <b>s</b> to <b>sb</b>. */
+void
+strbuf_add_len(strbuf_t *sb, const char *s, size_t len)
+{
+  strbuf_ensure_space(sb, len);
+  memcpy(sb->mem + sb->len, s, len);
+  sb->len += len;
+  sb->mem[sb->len] = '\0';
+}
+
+/** Append the NUL-terminated string <b>s</b> to <b>sb</b>. */
+void
+strbuf_add(strbuf_t *sb, const char *s)
+{
+  strbuf_add_len(sb, s, strlen(s));
+}
+
+/** Append the result of formatting <b>fmt</b> with <b>args</b> to
+ * <b>sb</b>, as by vsnprintf. */
+void
+strbuf_add_vprintf(strbuf_t *sb, const char *fmt, va_list args)
+{
+#ifdef _WIN32
+  /* _vsnprintf won't tell us how much space we need, so let
+   * tor_vasprintf() figure it out. */
+  char *s = NULL;
+  int len = tor_vasprintf(&s, fmt, args);
+  tor_assert(len >= 0);
+  strbuf_add_len(sb, s, len);
+  tor_free(s);
+#else
+  size_t avail = sb->alloc - sb->len;
+  va_list tmp_args;
+  int len;
+
+  va_copy(tmp_args, args);
+  len = vsnprintf(sb->mem + sb->len, avail, fmt, tmp_args);
+  va_end(tmp_args);
+  tor_assert(len >= 0);
+
+  if ((size_t)len >= avail) {
+    /* It didn't fit: now we know how much room we need. */
+    strbuf_ensure_space(sb, len);
+    len = vsnprintf(sb->mem + sb->len, sb->alloc - sb->len, fmt, args);
+    tor_assert(len >= 0 && (size_t)len < sb->alloc - sb->len);
+  }
+  sb->len += len;
+#endif
+}
+
+/** Append the result of formatting <b>fmt</b> and the following arguments
+ * to <b>sb</b>, as by snprintf. */
+void
+strbuf_add_printf(strbuf_t *sb, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  strbuf_add_vprintf(sb, fmt, ap);
+  va_end(ap);
+}
+
+/** Append every string in <b>sl</b> to <b>sb</b>, separated by
+ * <b>join</b>, as smartlist_join_strings() would. */
+void
+strbuf_add_joined(strbuf_t *sb, const smartlist_t *sl, const char *join)
+{
+  const size_t join_len = strlen(join);
+  SMARTLIST_FOREACH_BEGIN(sl, const char *, s) {
+    if (s_sl_idx)
+      strbuf_add_len(sb, join, join_len);
+    strbuf_add(sb, s);
+  } SMARTLIST_FOREACH_END(s);
+}
+
+/** Return the number of bytes in <b>sb</b>. */
+size_t
+strbuf_len(const strbuf_t *sb)
+{
+  return sb->len;
+}
+
+/** Return a pointer to the NUL-terminated contents of <b>sb</b>.  The
+ * pointer is only valid until the next time <b>sb</b> is modified. */
+const char *
+strbuf_get(const strbuf_t *sb)
+{
+  return sb->mem;
+}
+
+/** Free <b>sb</b>, and return its contents as a newly allocated
+ * NUL-terminated string.  If <b>len_out</b> is provided, set *<b>len_out</b>
+ * to the length of that string. */
+char *
+strbuf_steal(strbuf_t *sb, size_t *len_out)
+{
+  char *result = sb->mem;
+  if (len_out)
+    *len_out = sb->len;
+  if (sb->alloc > sb->len + 1)
+    result = tor_realloc(result, sb->len + 1);
+  tor_free(sb);
+  return result;
+}
+
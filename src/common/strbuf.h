@@ -0,0 +1,28 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#ifndef TOR_STRBUF_H
+#define TOR_STRBUF_H
+
+#include <stdarg.h>
+#include "compat.h"
+#include "container.h"
+
+typedef struct strbuf_t strbuf_t;
+
+strbuf_t *strbuf_new(size_t size_hint);
+void strbuf_free(strbuf_t *sb);
+void strbuf_add(strbuf_t *sb, const char *s);
+void strbuf_add_len(strbuf_t *sb, const char *s, size_t len);
+void strbuf_add_printf(strbuf_t *sb, const char *fmt, ...)
+  CHECK_PRINTF(2, 3);
+void strbuf_add_vprintf(strbuf_t *sb, const char *fmt, va_list args)
+  CHECK_PRINTF(2, 0);
+void strbuf_add_joined(strbuf_t *sb, const smartlist_t *sl,
+                       const char *join);
+size_t strbuf_len(const strbuf_t *sb);
+const char *strbuf_get(const strbuf_t *sb);
+char *strbuf_steal(strbuf_t *sb, size_t *len_out);
+
+#endif
+
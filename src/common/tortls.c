@@ -263,6 +263,8 @@ static tor_tls_context_t *tor_tls_context_new(crypto_pk_t *identity,
                                               unsigned int key_lifetime,
                                               unsigned int flags,
                                               int is_client);
+static tor_cert_t *tor_cert_decode_uncached(const uint8_t *certificate,
+                                           size_t certificate_len);
 static int check_cert_lifetime_internal(int severity, const X509 *cert,
                                    int past_tolerance, int future_tolerance);
 
@@ -588,6 +590,8 @@ tor_tls_free_all(void)
     client_tls_context = NULL;
     tor_tls_context_decref(ctx);
   }
+  tor_cert_cache_clear();
+
 #ifdef V2_HANDSHAKE_CLIENT
   if (CLIENT_CIPHER_DUMMIES)
     tor_free(CLIENT_CIPHER_DUMMIES);
@@ -879,11 +883,162 @@ tor_cert_new(X509 *x509_cert)
   return cert;
 }
 
+/** Return a new tor_cert_t holding the same certificate as <b>cert</b>.
+ * The two share one reference-counted X509 object, so this is much cheaper
+ * than decoding the certificate again. */
+static tor_cert_t *
+tor_cert_share(const tor_cert_t *cert)
+{
+  tor_cert_t *newcert = tor_memdup(cert, sizeof(tor_cert_t));
+  newcert->encoded = tor_memdup(cert->encoded, cert->encoded_len);
+  CRYPTO_add(&newcert->cert->references, 1, CRYPTO_LOCK_X509);
+  return newcert;
+}
+
+/** How many certificates do we remember in the certificate cache? */
+#define CERT_CACHE_MAX_ENTRIES 1024
+
+/** An entry in the certificate cache.
+ *
+ * The same relays connect to us over and over with the same identity
+ * certificates, so we keep the certificates we have decoded recently,
+ * along with the certificate that we last found had signed each of them.
+ * Seeing a certificate again lets us skip decoding it, and seeing it with
+ * the same signer lets us skip checking the signature.  Lifetime and key
+ * checks still happen every time: they're cheap, and they depend on the
+ * current time and on the caller. */
+typedef struct cert_cache_entry_t {
+  /** The decoded certificate. */
+  tor_cert_t *cert;
+  /** SHA256 digest of the encoded certificate whose key signed
+   * <b>cert</b>, if <b>signature_checked</b> is set. */
+  uint8_t signer_digest[DIGEST256_LEN];
+  /** True iff we've checked that the key in the certificate with digest
+   * <b>signer_digest</b> signed <b>cert</b>. */
+  unsigned signature_checked : 1;
+  /** When did we last look this entry up? */
+  time_t last_used;
+} cert_cache_entry_t;
+
+/** Map from SHA256 digest of an encoded certificate to its
+ * cert_cache_entry_t. */
+static digest256map_t *cert_cache = NULL;
+/** How many times have we checked a certificate's signature? */
+static uint64_t cert_cache_n_sig_checks = 0;
+/** How many of those checks did the certificate cache let us skip? */
+static uint64_t cert_cache_n_sig_checks_skipped = 0;
+
+/** Release all storage held in <b>ent</b>. */
+static void
+cert_cache_entry_free(cert_cache_entry_t *ent)
+{
+  if (!ent)
+    return;
+  tor_cert_free(ent->cert);
+  tor_free(ent);
+}
+
+/** Return the certificate cache entry for the certificate whose encoding
+ * has the SHA256 digest <b>digest</b>, or NULL if there is none. */
+static cert_cache_entry_t *
+cert_cache_lookup(const uint8_t *digest)
+{
+  cert_cache_entry_t *ent;
+  if (!cert_cache)
+    return NULL;
+  ent = digest256map_get(cert_cache, digest);
+  if (ent)
+    ent->last_used = approx_time();
+  return ent;
+}
+
+/** Remove the least recently used entry from the certificate cache. */
+static void
+cert_cache_evict_one(void)
+{
+  const uint8_t *oldest_digest = NULL;
+  time_t oldest = 0;
+  DIGEST256MAP_FOREACH(cert_cache, digest, cert_cache_entry_t *, ent) {
+    if (!oldest_digest || ent->last_used < oldest) {
+      oldest_digest = digest;
+      oldest = ent->last_used;
+    }
+  } DIGEST256MAP_FOREACH_END;
+  if (oldest_digest)
+    cert_cache_entry_free(digest256map_remove(cert_cache, oldest_digest));
+}
+
+/** Add <b>cert</b> to the certificate cache if it isn't there already, and
+ * return its entry. */
+static cert_cache_entry_t *
+cert_cache_add(const tor_cert_t *cert)
+{
+  const uint8_t *digest = (const uint8_t *)cert->cert_digests.d[DIGEST_SHA256];
+  cert_cache_entry_t *ent = cert_cache_lookup(digest);
+  if (ent)
+    return ent;
+  if (!cert_cache)
+    cert_cache = digest256map_new();
+  if (digest256map_size(cert_cache) >= CERT_CACHE_MAX_ENTRIES)
+    cert_cache_evict_one();
+
+  ent = tor_malloc_zero(sizeof(cert_cache_entry_t));
+  ent->cert = tor_cert_share(cert);
+  ent->last_used = approx_time();
+  digest256map_set(cert_cache, digest, ent);
+  return ent;
+}
+
+/** Forget every certificate in the certificate cache. */
+void
+tor_cert_cache_clear(void)
+{
+  if (!cert_cache)
+    return;
+  digest256map_free(cert_cache, (void (*)(void *))cert_cache_entry_free);
+  cert_cache = NULL;
+}
+
+/** Set *<b>n_entries_out</b> to the number of certificates in the
+ * certificate cache, *<b>n_checks_out</b> to the number of times we've
+ * been asked to check a certificate's signature, and
+ * *<b>n_skipped_out</b> to the number of those checks that the cache
+ * answered for us. */
+void
+tor_cert_cache_get_stats(int *n_entries_out, uint64_t *n_checks_out,
+                         uint64_t *n_skipped_out)
+{
+  *n_entries_out = cert_cache ? digest256map_size(cert_cache) : 0;
+  *n_checks_out = cert_cache_n_sig_checks;
+  *n_skipped_out = cert_cache_n_sig_checks_skipped;
+}
+
 /** Read a DER-encoded X509 cert, of length exactly <b>certificate_len</b>,
  * from a <b>certificate</b>.  Return a newly allocated tor_cert_t on success
- * and NULL on failure. */
+ * and NULL on failure.  If we've decoded the same certificate recently, we
+ * answer from the certificate cache. */
 tor_cert_t *
 tor_cert_decode(const uint8_t *certificate, size_t certificate_len)
+{
+  uint8_t digest[DIGEST256_LEN];
+  cert_cache_entry_t *ent;
+  tor_cert_t *newcert;
+  tor_assert(certificate);
+
+  crypto_digest256((char *)digest, (const char *)certificate,
+                   certificate_len, DIGEST_SHA256);
+  if ((ent = cert_cache_lookup(digest)))
+    return tor_cert_share(ent->cert);
+
+  newcert = tor_cert_decode_uncached(certificate, certificate_len);
+  if (newcert)
+    cert_cache_add(newcert);
+  return newcert;
+}
+
+/** As tor_cert_decode(), but don't use the certificate cache. */
+static tor_cert_t *
+tor_cert_decode_uncached(const uint8_t *certificate, size_t certificate_len)
 {
   X509 *x509;
   const unsigned char *cp = (const unsigned char *)certificate;
@@ -1050,7 +1205,8 @@ tor_tls_cert_matches_key(const tor_tls_t *tls, const tor_cert_t *cert)
  * signed by the public key in <b>signing_cert</b>.  If <b>check_rsa_1024</b>,
  * make sure that it has an RSA key with 1024 bits; otherwise, just check that
  * the key is long enough. Return 1 if the cert is good, and 0 if it's bad or
- * we couldn't check it. */
+ * we couldn't check it.  If we've already seen <b>signing_cert</b> sign
+ * <b>cert</b>, we don't check the signature again. */
 int
 tor_tls_cert_is_valid(int severity,
                       const tor_cert_t *cert,
@@ -1060,15 +1216,31 @@ tor_tls_cert_is_valid(int severity,
   check_no_tls_errors();
 
   EVP_PKEY *cert_key;
-  EVP_PKEY *signing_key = X509_get_pubkey(signing_cert->cert);
+  const uint8_t *signer_digest =
+    (const uint8_t *)signing_cert->cert_digests.d[DIGEST_SHA256];
+  cert_cache_entry_t *ent =
+    cert_cache_lookup((const uint8_t *)cert->cert_digests.d[DIGEST_SHA256]);
   int r, key_ok = 0;
 
-  if (!signing_key)
-    goto bad;
-  r = X509_verify(cert->cert, signing_key);
-  EVP_PKEY_free(signing_key);
-  if (r <= 0)
-    goto bad;
+  ++cert_cache_n_sig_checks;
+  if (ent && ent->signature_checked &&
+      tor_memeq(ent->signer_digest, signer_digest, DIGEST256_LEN)) {
+    ++cert_cache_n_sig_checks_skipped;
+  } else {
+    EVP_PKEY *signing_key = X509_get_pubkey(signing_cert->cert);
+    if (!signing_key)
+      goto bad;
+    r = X509_verify(cert->cert, signing_key);
+    EVP_PKEY_free(signing_key);
+    if (r <= 0)
+      goto bad;
+
+    /* Remember that the signature checked out. */
+    if (!ent)
+      ent = cert_cache_add(cert);
+    memcpy(ent->signer_digest, signer_digest, DIGEST256_LEN);
+    ent->signature_checked = 1;
+  }
 
   /* okay, the signature checked out right.  Now let's check the check the
    * lifetime. */
@@ -31,6 +31,19 @@ struct threadpool_s {
   /** Array of n_threads update arguments. */
   void **update_args;
 
+  /** The current 'placement generation' of the threadpool.  Any thread
+   * that is at an earlier generation needs to move itself onto the CPUs
+   * that <b>placement</b> assigns it. */
+  unsigned placement_generation;
+  /** Array of n_placement CPU sets: thread i runs on the CPUs in
+   * placement[i % n_placement].  NULL if we aren't placing threads. */
+  tor_cpuset_t *placement;
+  /** Number of elements in placement. */
+  int n_placement;
+  /** True iff placed threads should also prefer memory from the NUMA node
+   * that they run on. */
+  int placement_local_memory;
+
   /** Number of elements in threads. */
   int n_threads;
   /** Mutex to protect all the above fields. */
@@ -88,6 +101,15 @@ typedef struct workerthread_s {
   replyqueue_t *reply_queue;
   /** The current update generation of this thread */
   unsigned generation;
+  /** The placement generation that this thread last applied. */
+  unsigned placement_generation;
+  /** The CPUs that this thread last tried to restrict itself to. */
+  tor_cpuset_t cpus;
+  /** 1 if this thread is running on <b>cpus</b>; -1 if it tried and
+   * failed; 0 if it hasn't been placed. */
+  int placed;
+  /** True iff this thread has asked for memory from its own NUMA node. */
+  int local_memory;
 } workerthread_t;
 
 static void queue_reply(replyqueue_t *queue, workqueue_entry_t *work);
@@ -160,7 +182,45 @@ static int
 worker_thread_has_work(workerthread_t *thread)
 {
   return !TOR_TAILQ_EMPTY(&thread->in_pool->work) ||
-    thread->generation != thread->in_pool->generation;
+    thread->generation != thread->in_pool->generation ||
+    thread->placement_generation != thread->in_pool->placement_generation;
+}
+
+/** Move <b>thread</b> onto the CPUs that its pool currently assigns it.
+ * Called from the worker thread itself, with the pool lock held; the lock
+ * is released while we talk to the kernel. */
+static void
+worker_thread_apply_placement(workerthread_t *thread)
+{
+  threadpool_t *pool = thread->in_pool;
+  tor_cpuset_t cpus;
+  const unsigned generation = pool->placement_generation;
+  const int have_cpus = pool->n_placement > 0;
+  const int local_memory = pool->placement_local_memory;
+  int r = 0;
+
+  if (have_cpus)
+    memcpy(&cpus, &pool->placement[thread->index % pool->n_placement],
+           sizeof(cpus));
+  else
+    tor_cpuset_clear(&cpus);
+  tor_mutex_release(&pool->lock);
+
+  if (have_cpus)
+    r = tor_thread_set_cpus(&cpus);
+  /* Only touch the memory policy if it changes, so that we don't discard
+   * a policy that we inherited from whoever launched us. */
+  if (local_memory != thread->local_memory)
+    tor_thread_set_local_memory(local_memory);
+
+  tor_mutex_acquire(&pool->lock);
+  thread->placement_generation = generation;
+  thread->local_memory = local_memory;
+  memcpy(&thread->cpus, &cpus, sizeof(cpus));
+  if (!have_cpus)
+    thread->placed = 0;
+  else
+    thread->placed = (r < 0) ? -1 : 1;
 }
 
 /**
@@ -179,6 +239,11 @@ worker_thread_main(void *thread_)
     /* lock must be held at this point. */
     while (worker_thread_has_work(thread)) {
       /* lock must be held at this point. */
+      if (thread->in_pool->placement_generation !=
+          thread->placement_generation) {
+        worker_thread_apply_placement(thread);
+        continue;
+      }
       if (thread->in_pool->generation != thread->generation) {
         void *arg = thread->in_pool->update_args[thread->index];
         thread->in_pool->update_args[thread->index] = NULL;
@@ -359,6 +424,81 @@ threadpool_queue_update(threadpool_t *pool,
   return 0;
 }
 
+/**
+ * Ask every thread in <b>pool</b> to restrict itself to a set of CPUs: the
+ * thread with index i uses <b>sets</b>[i % <b>n_sets</b>].  If
+ * <b>local_memory</b> is true, each thread also asks to get its memory from
+ * its own NUMA node.  If <b>n_sets</b> is 0, the threads forget their
+ * placement, but stay on whatever CPUs they were last given.
+ *
+ * The threads move themselves the next time they look for work, so this
+ * function doesn't wait for them.  Return 0 on success, -1 on failure.
+ */
+int
+threadpool_set_thread_cpus(threadpool_t *pool,
+                           const tor_cpuset_t *sets, int n_sets,
+                           int local_memory)
+{
+  tor_cpuset_t *new_sets = NULL;
+  tor_cpuset_t *old_sets;
+
+  if (n_sets < 0)
+    return -1;
+  if (n_sets)
+    new_sets = tor_memdup(sets, sizeof(tor_cpuset_t) * n_sets);
+
+  tor_mutex_acquire(&pool->lock);
+  old_sets = pool->placement;
+  pool->placement = new_sets;
+  pool->n_placement = n_sets;
+  pool->placement_local_memory = local_memory ? 1 : 0;
+  ++pool->placement_generation;
+  tor_mutex_release(&pool->lock);
+
+  tor_cond_signal_all(&pool->condition);
+
+  tor_free(old_sets);
+  return 0;
+}
+
+/**
+ * Set <b>out</b> to the CPUs that thread number <b>idx</b> in <b>pool</b>
+ * was last placed on.  Return 1 if the thread is running there, 0 if it
+ * hasn't been placed (or hasn't got around to it yet), and -1 if placing it
+ * failed or there is no such thread.
+ */
+int
+threadpool_get_thread_cpus(threadpool_t *pool, int idx, tor_cpuset_t *out)
+{
+  int r;
+  tor_cpuset_clear(out);
+  tor_mutex_acquire(&pool->lock);
+  if (idx < 0 || idx >= pool->n_threads) {
+    r = -1;
+  } else {
+    workerthread_t *thr = pool->threads[idx];
+    if (thr->placement_generation != pool->placement_generation) {
+      r = 0;
+    } else {
+      memcpy(out, &thr->cpus, sizeof(*out));
+      r = thr->placed;
+    }
+  }
+  tor_mutex_release(&pool->lock);
+  return r;
+}
+
+/** Return the number of worker threads in <b>pool</b>. */
+int
+threadpool_get_n_threads(threadpool_t *pool)
+{
+  int n;
+  tor_mutex_acquire(&pool->lock);
+  n = pool->n_threads;
+  tor_mutex_release(&pool->lock);
+  return n;
+}
+
 /** Launch threads until we have <b>n</b>. */
 static int
 threadpool_start_threads(threadpool_t *pool, int n)
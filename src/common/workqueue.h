@@ -39,6 +39,12 @@ threadpool_t *threadpool_new(int n_threads,
                              void (*free_thread_state_fn)(void*),
                              void *arg);
 replyqueue_t *threadpool_get_replyqueue(threadpool_t *tp);
+int threadpool_set_thread_cpus(threadpool_t *pool,
+                               const tor_cpuset_t *sets, int n_sets,
+                               int local_memory);
+int threadpool_get_thread_cpus(threadpool_t *pool, int idx,
+                               tor_cpuset_t *out);
+int threadpool_get_n_threads(threadpool_t *pool);
 
 replyqueue_t *replyqueue_new(uint32_t alertsocks_flags);
 tor_socket_t replyqueue_get_socket(replyqueue_t *rq);
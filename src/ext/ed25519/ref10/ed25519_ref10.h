@@ -26,5 +26,7 @@ int ed25519_ref10_blind_secret_key(unsigned char *out,
 int ed25519_ref10_blind_public_key(unsigned char *out,
                               const unsigned char *inp,
                               const unsigned char *param);
+int ed25519_ref10_curve25519_basepoint(unsigned char *out,
+                                       const unsigned char *secret);
 
 #endif
@@ -1,8 +1,12 @@
 /* Added to ref10 for Tor. We place this in the public domain.  Alternatively,
  * you may have it under the Creative Commons 0 "CC0" license. */
 #include "fe.h"
+#include "ge.h"
 #include "ed25519_ref10.h"
 
+#include <string.h>
+#include "crypto.h"
+
 int ed25519_ref10_pubkey_from_curve25519_pubkey(unsigned char *out,
                                                 const unsigned char *inp,
                                                 int signbit)
@@ -35,3 +39,37 @@ int ed25519_ref10_pubkey_from_curve25519_pubkey(unsigned char *out,
 
   return 0;
 }
+
+int ed25519_ref10_curve25519_basepoint(unsigned char *out,
+                                       const unsigned char *secret)
+{
+  unsigned char e[32];
+  ge_p3 A;
+  fe zplusy;
+  fe zminusy;
+  fe inv_zminusy;
+  fe u;
+
+  memcpy(e, secret, 32);
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+
+  /* Multiplying by the ed25519 basepoint uses a precomputed table, so it's
+   * much faster than a Montgomery ladder.  The curve25519 basepoint is the
+   * same point on the birationally equivalent Montgomery curve, so we only
+   * need to convert the result, using
+
+         u = (1+y)/(1-y) = (Z+Y)/(Z-Y)
+  */
+  ge_scalarmult_base(&A, e);
+  fe_add(zplusy, A.Z, A.Y);
+  fe_sub(zminusy, A.Z, A.Y);
+  fe_invert(inv_zminusy, zminusy);
+  fe_mul(u, zplusy, inv_zminusy);
+  fe_tobytes(out, u);
+
+  memwipe(e, 0, sizeof(e));
+  memwipe(&A, 0, sizeof(A));
+  return 0;
+}
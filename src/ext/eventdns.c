@@ -36,6 +36,9 @@
  * Version: 0.1b
  */
 
+/* We need _GNU_SOURCE before any system header for recvmmsg/sendmmsg. */
+#define _GNU_SOURCE
+
 #include "eventdns_tor.h"
 #include "../common/util.h"
 #include <sys/types.h>
@@ -51,7 +54,6 @@
 #endif
 
 /* #define _POSIX_C_SOURCE 200507 */
-#define _GNU_SOURCE
 
 #ifdef DNS_USE_CPU_CLOCK_FOR_ID
 #ifdef DNS_USE_OPENSSL_FOR_ID
@@ -95,6 +97,7 @@
 #include <stdarg.h>
 
 #include "eventdns.h"
+#include "ht.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -179,6 +182,8 @@ struct evdns_request {
 
 	/* these objects are kept in a circular list */
 	struct evdns_request *next, *prev;
+	/* inflight requests are also indexed by trans_id */
+	HT_ENTRY(evdns_request) trans_id_node;
 
 	struct event timeout_event;
 
@@ -225,11 +230,42 @@ struct nameserver {
 	char state;	 /* zero if we think that this server is down */
 	char choked;  /* true if we have an EAGAIN from this server's socket */
 	char write_waiting;	 /* true if we are waiting for EV_WRITE events */
+
+	/* statistics, reported by evdns_get_nameserver_stats() */
+	u64 n_queries_sent;	 /* packets we have written to this server */
+	u64 n_replies_received;	 /* packets we have read from this server */
+	u64 n_send_calls;  /* send()/sendmmsg() calls that wrote something */
+	u64 n_recv_calls;  /* recvfrom()/recvmmsg() calls that read something */
+	u64 n_timeouts;	 /* requests to this server which timed out */
 };
 
 static struct evdns_request *req_head = NULL, *req_waiting_head = NULL;
 static struct nameserver *server_head = NULL;
 
+/* Hash table of inflight requests (the ones in req_head), keyed by */
+/* transaction id, so that we don't need to walk the whole inflight */
+/* list for every reply we get. */
+static inline unsigned
+request_trans_id_hash(const struct evdns_request *req) {
+	return req->trans_id;
+}
+static inline int
+request_trans_id_eq(const struct evdns_request *a,
+					const struct evdns_request *b) {
+	return a->trans_id == b->trans_id;
+}
+static HT_HEAD(request_trans_id_map, evdns_request) inflight_by_trans_id =
+	HT_INITIALIZER();
+HT_PROTOTYPE(request_trans_id_map, evdns_request, trans_id_node,
+			 request_trans_id_hash, request_trans_id_eq)
+HT_GENERATE2(request_trans_id_map, evdns_request, trans_id_node,
+			 request_trans_id_hash, request_trans_id_eq, 0.6,
+			 tor_reallocarray_, tor_free_)
+
+/* The largest number of packets we try to read or write with a single */
+/* recvmmsg() or sendmmsg() call. */
+#define EVDNS_MAX_BATCH 32
+
 /* Represents a local port where we're listening for DNS requests. Right now, */
 /* only UDP is supported. */
 struct evdns_server_port {
@@ -484,21 +520,13 @@ sockaddr_eq(const struct sockaddr *sa1, const struct sockaddr *sa2,
 #define del_timeout_event(s)					\
 	(event_del(&(s)->timeout_event))
 
-/* This walks the list of inflight requests to find the */
-/* one with a matching transaction id. Returns NULL on */
-/* failure */
+/* This looks up the inflight request with a matching */
+/* transaction id. Returns NULL on failure */
 static struct evdns_request *
 request_find_from_trans_id(u16 trans_id) {
-	struct evdns_request *req = req_head, *const started_at = req_head;
-
-	if (req) {
-		do {
-			if (req->trans_id == trans_id) return req;
-			req = req->next;
-		} while (req != started_at);
-	}
-
-	return NULL;
+	struct evdns_request search;
+	search.trans_id = trans_id;
+	return HT_FIND(request_trans_id_map, &inflight_by_trans_id, &search);
 }
 
 /* a libevent callback function which is called when a nameserver */
@@ -611,6 +639,8 @@ request_trans_id_set(struct evdns_request *const req, const u16 trans_id) {
 /* removed from or NULL if the request isn't in a list. */
 static void
 request_finished(struct evdns_request *const req, struct evdns_request **head) {
+	if (head == &req_head)
+		HT_REMOVE(request_trans_id_map, &inflight_by_trans_id, req);
 	if (head) {
 		if (req->next == req) {
 			/* only item in the list */
@@ -674,6 +704,7 @@ request_reissue(struct evdns_request *req) {
 /* requests from the waiting queue if it can. */
 static void
 evdns_requests_pump_waiting_queue(void) {
+	int pumped = 0;
 	while (global_requests_inflight < global_max_requests_inflight &&
 		global_requests_waiting) {
 		struct evdns_request *req;
@@ -697,9 +728,12 @@ evdns_requests_pump_waiting_queue(void) {
 		request_trans_id_set(req, transaction_id_pick());
 
 		evdns_request_insert(req, &req_head);
-		evdns_request_transmit(req);
-		evdns_transmit();
+		req->transmit_me = 1;
+		pumped = 1;
 	}
+	/* send everything we promoted in one go */
+	if (pumped)
+		evdns_transmit();
 }
 
 static void
@@ -1192,20 +1226,11 @@ evdns_set_random_bytes_fn(void (*fn)(char *, size_t))
 static u16
 transaction_id_pick(void) {
 	for (;;) {
-		const struct evdns_request *req = req_head, *started_at;
 		u16 trans_id = trans_id_function();
 
 		if (trans_id == 0xffff) continue;
 		/* now check to see if that id is already inflight */
-		req = started_at = req_head;
-		if (req) {
-			do {
-				if (req->trans_id == trans_id) break;
-				req = req->next;
-			} while (req != started_at);
-		}
-		/* we didn't find it, so this is a good id */
-		if (req == started_at) return trans_id;
+		if (!request_find_from_trans_id(trans_id)) return trans_id;
 	}
 }
 
@@ -1246,6 +1271,63 @@ nameserver_pick(void) {
 	}
 }
 
+#ifdef HAVE_RECVMMSG
+/* set to true once we learn that the kernel doesn't implement recvmmsg */
+static int recvmmsg_unsupported = 0;
+
+/* Read as many packets as we can from the nameserver ns in batches of up */
+/* to EVDNS_MAX_BATCH using recvmmsg(). Returns 0 when the socket has been */
+/* drained or has failed, or -1 if recvmmsg() isn't usable and the caller */
+/* should fall back to recvfrom(). */
+static int
+nameserver_read_batch(struct nameserver *ns) {
+	static u8 packets[EVDNS_MAX_BATCH][1500];
+	static struct sockaddr_storage addrs[EVDNS_MAX_BATCH];
+	struct mmsghdr msgs[EVDNS_MAX_BATCH];
+	struct iovec iovs[EVDNS_MAX_BATCH];
+	int i, n;
+
+	for (;;) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < EVDNS_MAX_BATCH; ++i) {
+			iovs[i].iov_base = packets[i];
+			iovs[i].iov_len = sizeof(packets[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		}
+		n = recvmmsg(ns->socket, msgs, EVDNS_MAX_BATCH, 0, NULL);
+		if (n < 0) {
+			int err = last_error(ns->socket);
+			if (error_is_eagain(err)) return 0;
+			if (err == ENOSYS) {
+				recvmmsg_unsupported = 1;
+				return -1;
+			}
+			nameserver_failed(ns, tor_socket_strerror(err));
+			return 0;
+		}
+		ns->n_recv_calls++;
+		for (i = 0; i < n; ++i) {
+			struct sockaddr *sa = (struct sockaddr *) &addrs[i];
+			/* XXX Match port too? */
+			if (!sockaddr_eq(sa, (struct sockaddr*)&ns->address, 0)) {
+				evdns_log(EVDNS_LOG_WARN,
+					"Address mismatch on received DNS packet.  Address was %s",
+					debug_ntop(sa));
+				continue;
+			}
+			ns->n_replies_received++;
+			ns->timedout = 0;
+			reply_parse(packets[i], msgs[i].msg_len);
+		}
+		if (n < EVDNS_MAX_BATCH)
+			return 0;
+	}
+}
+#endif
+
 /* this is called when a namesever socket is ready for reading */
 static void
 nameserver_read(struct nameserver *ns) {
@@ -1254,6 +1336,11 @@ nameserver_read(struct nameserver *ns) {
 	socklen_t addrlen = sizeof(ss);
 	u8 packet[1500];
 
+#ifdef HAVE_RECVMMSG
+	if (!recvmmsg_unsupported && nameserver_read_batch(ns) == 0)
+		return;
+#endif
+
 	for (;;) {
 		const int r =
             (int)recvfrom(ns->socket, (void*)packet,
@@ -1272,6 +1359,8 @@ nameserver_read(struct nameserver *ns) {
 				debug_ntop(sa));
 			return;
 		}
+		ns->n_recv_calls++;
+		ns->n_replies_received++;
 		ns->timedout = 0;
 		reply_parse(packet, r);
 	}
@@ -1996,6 +2085,7 @@ evdns_request_timeout_callback(int fd, short events, void *arg) {
 
 	evdns_log(EVDNS_LOG_DEBUG, "Request %lx timed out", (unsigned long) arg);
 
+	req->ns->n_timeouts++;
 	req->ns->timedout++;
 	if (req->ns->timedout > global_max_nameserver_timeout) {
 		req->ns->timedout = 0;
@@ -2034,10 +2124,29 @@ evdns_request_transmit_to(struct evdns_request *req, struct nameserver *server)
 	} else if (r != (ssize_t)req->request_len) {
 		return 1;  /* short write */
 	} else {
+		server->n_send_calls++;
+		server->n_queries_sent++;
 		return 0;
 	}
 }
 
+/* called once a request has been handed to the kernel (or has failed in */
+/* a way that only a timeout and retransmit can fix): start its timer. */
+static void
+evdns_request_transmitted(struct evdns_request *req) {
+	evdns_log(EVDNS_LOG_DEBUG,
+		"Setting timeout for request %lx", (unsigned long) req);
+
+	if (add_timeout_event(req, &global_timeout) < 0) {
+		evdns_log(EVDNS_LOG_WARN,
+			"Error from libevent when adding timer for request %lx",
+			(unsigned long) req);
+		/* ???? Do more? */
+	}
+	req->tx_count++;
+	req->transmit_me = 0;
+}
+
 /* try to send a request, updating the fields of the request */
 /* as needed */
 /* */
@@ -2073,21 +2182,111 @@ evdns_request_transmit(struct evdns_request *req) {
 		 * and make us retransmit the request anyway. */
 	default:
 		/* transmitted; we need to check for timeout. */
-		evdns_log(EVDNS_LOG_DEBUG,
-			"Setting timeout for request %lx", (unsigned long) req);
+		evdns_request_transmitted(req);
+		return retcode;
+	}
+}
 
-		if (add_timeout_event(req, &global_timeout) < 0) {
-			evdns_log(EVDNS_LOG_WARN,
-				"Error from libevent when adding timer for request %lx",
-				(unsigned long) req);
-			/* ???? Do more? */
+#ifdef HAVE_SENDMMSG
+/* set to true once we learn that the kernel doesn't implement sendmmsg */
+static int sendmmsg_unsupported = 0;
+
+/* Write the n requests in batch, all bound for ns, with one sendmmsg() */
+/* call, and update them as evdns_request_transmit would. */
+/* */
+/* return: */
+/* 0 ok, everything was written */
+/* 1 the socket is choked or failed; stop writing to it for now */
+/* -1 sendmmsg isn't supported here */
+static int
+nameserver_flush_batch(struct nameserver *ns,
+					   struct evdns_request **batch, int n) {
+	struct mmsghdr msgs[EVDNS_MAX_BATCH];
+	struct iovec iovs[EVDNS_MAX_BATCH];
+	int i, r, done = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < n; ++i) {
+		iovs[i].iov_base = batch[i]->request;
+		iovs[i].iov_len = batch[i]->request_len;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (done < n) {
+		r = sendmmsg(ns->socket, msgs + done, n - done, 0);
+		if (r < 0) {
+			int err = last_error(ns->socket);
+			if (err == ENOSYS) {
+				sendmmsg_unsupported = 1;
+				return -1;
+			}
+			if (error_is_eagain(err)) {
+				ns->choked = 1;
+				nameserver_write_waiting(ns, 1);
+				return 1;
+			}
+			/* as in evdns_request_transmit: the request that failed gets a */
+			/* timeout, and will be retransmitted when that expires. */
+			nameserver_failed(ns, tor_socket_strerror(err));
+			evdns_request_transmitted(batch[done]);
+			return 1;
 		}
-		req->tx_count++;
-		req->transmit_me = 0;
-		return retcode;
+		ns->n_send_calls++;
+		for (i = done; i < done + r; ++i) {
+			if (msgs[i].msg_len != batch[i]->request_len) {
+				/* short write: treat it like EAGAIN, as */
+				/* evdns_request_transmit_to does */
+				ns->n_queries_sent += i - done;
+				ns->choked = 1;
+				nameserver_write_waiting(ns, 1);
+				return 1;
+			}
+			evdns_request_transmitted(batch[i]);
+		}
+		ns->n_queries_sent += r;
+		done += r;
 	}
+	return 0;
 }
 
+/* Transmit every inflight request which is waiting to go out to ns, */
+/* EVDNS_MAX_BATCH requests per sendmmsg() call. */
+/* */
+/* return: */
+/* 0 there was nothing to transmit to ns */
+/* 1 tried to transmit something */
+/* -1 sendmmsg isn't supported here; nothing was done */
+static int
+nameserver_transmit_batched(struct nameserver *ns) {
+	struct evdns_request *batch[EVDNS_MAX_BATCH];
+	struct evdns_request *const started_at = req_head, *req = req_head;
+	int n = 0, did_try_to_transmit = 0, r;
+
+	if (!req_head || ns->choked)
+		return 0;
+
+	do {
+		if (req->transmit_me && req->ns == ns) {
+			if (req->trans_id == 0xffff) abort();
+			did_try_to_transmit = 1;
+			batch[n++] = req;
+			if (n == EVDNS_MAX_BATCH) {
+				r = nameserver_flush_batch(ns, batch, n);
+				if (r)
+					return r < 0 ? -1 : 1;
+				n = 0;
+			}
+		}
+		req = req->next;
+	} while (req != started_at);
+
+	if (n && nameserver_flush_batch(ns, batch, n) < 0)
+		return -1;
+	return did_try_to_transmit;
+}
+#endif
+
 static void
 nameserver_probe_callback(int result, char type, int count, int ttl, void *addresses, void *arg) {
 	struct sockaddr *addr = arg;
@@ -2147,7 +2346,24 @@ evdns_transmit(void) {
 
 	if (req_head) {
 		struct evdns_request *const started_at = req_head, *req = req_head;
-		/* first transmit all the requests which are currently waiting */
+#ifdef HAVE_SENDMMSG
+		/* first write out as much as we can in batches, one nameserver at */
+		/* a time.  (Remember the first server: nameserver_failed moves */
+		/* server_head around.) */
+		if (!sendmmsg_unsupported && server_head) {
+			struct nameserver *const ns_started_at = server_head;
+			struct nameserver *ns = ns_started_at;
+			do {
+				const int r = nameserver_transmit_batched(ns);
+				if (r < 0)
+					break;
+				if (r)
+					did_try_to_transmit = 1;
+				ns = ns->next;
+			} while (ns != ns_started_at);
+		}
+#endif
+		/* now transmit all the requests which are still waiting */
 		do {
 			if (req->transmit_me) {
 				did_try_to_transmit = 1;
@@ -2176,6 +2392,28 @@ evdns_count_nameservers(void)
 	return n;
 }
 
+/* exported function */
+void
+evdns_get_nameserver_stats(evdns_nameserver_stats_fn_type fn, void *arg)
+{
+	const struct nameserver *server = server_head;
+	struct evdns_nameserver_stats stats;
+	if (!server)
+		return;
+	do {
+		memset(&stats, 0, sizeof(stats));
+		stats.address = (const struct sockaddr *) &server->address;
+		stats.is_up = server->state;
+		stats.n_queries_sent = server->n_queries_sent;
+		stats.n_replies_received = server->n_replies_received;
+		stats.n_send_calls = server->n_send_calls;
+		stats.n_recv_calls = server->n_recv_calls;
+		stats.n_timeouts = server->n_timeouts;
+		fn(&stats, arg);
+		server = server->next;
+	} while (server != server_head);
+}
+
 /* exported function */
 int
 evdns_clear_nameservers_and_suspend(void)
@@ -2223,6 +2461,7 @@ evdns_clear_nameservers_and_suspend(void)
 		req = next;
 	}
 	req_head = NULL;
+	HT_CLEAR(request_trans_id_map, &inflight_by_trans_id);
 	global_requests_inflight = 0;
 
 	return 0;
@@ -2497,6 +2736,8 @@ evdns_nameserver_sockaddr_add(const struct sockaddr *sa, socklen_t len)
 /* insert into the tail of the queue */
 static void
 evdns_request_insert(struct evdns_request *req, struct evdns_request **head) {
+	if (head == &req_head)
+		HT_INSERT(request_trans_id_map, &inflight_by_trans_id, req);
 	if (!*head) {
 		*head = req;
 		req->next = req->prev = req;
@@ -3369,6 +3610,7 @@ evdns_shutdown(int fail_requests)
 		request_finished(req_waiting_head, &req_waiting_head);
 	}
 	global_requests_inflight = global_requests_waiting = 0;
+	HT_CLEAR(request_trans_id_map, &inflight_by_trans_id);
 
 	for (server = server_head; server; server = server_next) {
 		server_next = server->next;
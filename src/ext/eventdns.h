@@ -153,6 +153,11 @@
  *	 whether our calls to the various nameserver configuration functions
  *	 have been successful.
  *
+ * void evdns_get_nameserver_stats(evdns_nameserver_stats_fn_type fn,
+ *	     void *arg)
+ *	 Call fn once for each configured nameserver with its address and the
+ *	 number of queries, replies and timeouts we have seen for it so far.
+ *
  * int evdns_clear_nameservers_and_suspend(void)
  *	 Remove all currently configured nameservers, and suspend all pending
  *	 resolves.	Resolves will not necessarily be re-attempted until
@@ -286,6 +291,21 @@ void evdns_set_log_fn(evdns_debug_log_fn_type fn);
 void evdns_set_transaction_id_fn(uint16_t (*fn)(void));
 void evdns_set_random_bytes_fn(void (*fn)(char *, size_t));
 
+struct sockaddr;
+/* Per-nameserver counters, as reported by evdns_get_nameserver_stats. */
+struct evdns_nameserver_stats {
+	const struct sockaddr *address;
+	int is_up;
+	uint64_t n_queries_sent;
+	uint64_t n_replies_received;
+	uint64_t n_send_calls;
+	uint64_t n_recv_calls;
+	uint64_t n_timeouts;
+};
+typedef void (*evdns_nameserver_stats_fn_type)(
+	const struct evdns_nameserver_stats *stats, void *arg);
+void evdns_get_nameserver_stats(evdns_nameserver_stats_fn_type fn, void *arg);
+
 #define DNS_NO_SEARCH 1
 
 /* Structures and functions used to implement a DNS server. */
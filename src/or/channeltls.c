@@ -26,6 +26,7 @@
 #include "router.h"
 #include "routerlist.h"
 #include "scheduler.h"
+#include "link_handshake.h"
 
 /** How many CELL_PADDING cells have we received, ever? */
 uint64_t stats_n_padding_cells_processed = 0;
@@ -1546,6 +1547,25 @@ channel_tls_process_versions_cell(var_cell_t *cell, channel_tls_t *chan)
   }
 }
 
+/** Helper: set <b>addr_out</b> to the address in the parsed NETINFO address
+ * <b>na</b>, or make it AF_UNSPEC if it is of a type we don't know. */
+static void
+netinfo_addr_to_tor_addr(tor_addr_t *addr_out, netinfo_addr_t *na)
+{
+  switch (netinfo_addr_get_addr_type(na)) {
+  case NETINFO_ADDR_TYPE_IPV4:
+    tor_addr_from_ipv4h(addr_out, netinfo_addr_get_addr_ipv4(na));
+    break;
+  case NETINFO_ADDR_TYPE_IPV6:
+    tor_addr_from_ipv6_bytes(addr_out,
+                    (const char*) netinfo_addr_getarray_addr_ipv6(na));
+    break;
+  default:
+    tor_addr_make_unspec(addr_out);
+    break;
+  }
+}
+
 /**
  * Process a 'netinfo' cell
  *
@@ -1557,11 +1577,8 @@ static void
 channel_tls_process_netinfo_cell(cell_t *cell, channel_tls_t *chan)
 {
   time_t timestamp;
-  uint8_t my_addr_type;
-  uint8_t my_addr_len;
-  const uint8_t *my_addr_ptr;
-  const uint8_t *cp, *end;
-  uint8_t n_other_addrs;
+  netinfo_cell_t *netinfo = NULL;
+  size_t n_other_addrs, i;
   time_t now = time(NULL);
 
   long apparent_skew = 0;
@@ -1617,49 +1634,33 @@ channel_tls_process_netinfo_cell(cell_t *cell, channel_tls_t *chan)
   }
 
   /* Decode the cell. */
-  timestamp = ntohl(get_uint32(cell->payload));
+  if (netinfo_cell_parse(&netinfo, cell->payload, CELL_PAYLOAD_SIZE) < 0) {
+    log_fn(LOG_PROTOCOL_WARN,  LD_OR,
+           "Bad address in netinfo cell; closing connection.");
+    connection_or_close_for_error(chan->conn, 0);
+    return;
+  }
+
+  timestamp = netinfo_cell_get_timestamp(netinfo);
   if (labs(now - chan->conn->handshake_state->sent_versions_at) < 180) {
     apparent_skew = now - timestamp;
   }
 
-  my_addr_type = (uint8_t) cell->payload[4];
-  my_addr_len = (uint8_t) cell->payload[5];
-  my_addr_ptr = (uint8_t*) cell->payload + 6;
-  end = cell->payload + CELL_PAYLOAD_SIZE;
-  cp = cell->payload + 6 + my_addr_len;
-
-  /* We used to check:
-   *    if (my_addr_len >= CELL_PAYLOAD_SIZE - 6) {
-   *
-   * This is actually never going to happen, since my_addr_len is at most 255,
-   * and CELL_PAYLOAD_LEN - 6 is 503.  So we know that cp is < end. */
-
-  if (my_addr_type == RESOLVED_TYPE_IPV4 && my_addr_len == 4) {
-    tor_addr_from_ipv4n(&my_apparent_addr, get_uint32(my_addr_ptr));
-  } else if (my_addr_type == RESOLVED_TYPE_IPV6 && my_addr_len == 16) {
-    tor_addr_from_ipv6_bytes(&my_apparent_addr, (const char *) my_addr_ptr);
-  }
+  netinfo_addr_to_tor_addr(&my_apparent_addr,
+                           netinfo_cell_get_other_addr(netinfo));
 
-  n_other_addrs = (uint8_t) *cp++;
-  while (n_other_addrs && cp < end-2) {
+  n_other_addrs = netinfo_cell_getlen_my_addrs(netinfo);
+  for (i = 0; i < n_other_addrs; ++i) {
     /* Consider all the other addresses; if any matches, this connection is
      * "canonical." */
     tor_addr_t addr;
-    const uint8_t *next =
-      decode_address_from_payload(&addr, cp, (int)(end-cp));
-    if (next == NULL) {
-      log_fn(LOG_PROTOCOL_WARN,  LD_OR,
-             "Bad address in netinfo cell; closing connection.");
-      connection_or_close_for_error(chan->conn, 0);
-      return;
-    }
+    netinfo_addr_to_tor_addr(&addr, netinfo_cell_get_my_addrs(netinfo, i));
     if (tor_addr_eq(&addr, &(chan->conn->real_addr))) {
       connection_or_set_canonical(chan->conn, 1);
       break;
     }
-    cp = next;
-    --n_other_addrs;
   }
+  netinfo_cell_free(netinfo);
 
   /* Act on apparent skew. */
   /** Warn when we get a netinfo skew with at least this value. */
@@ -1750,7 +1751,7 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
   tor_cert_t *link_cert = NULL;
   tor_cert_t *id_cert = NULL;
   tor_cert_t *auth_cert = NULL;
-  uint8_t *ptr;
+  certs_cell_t *cc = NULL;
   int n_certs, i;
   int send_netinfo = 0;
 
@@ -1783,27 +1784,18 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
   if (cell->circ_id)
     ERR("It had a nonzero circuit ID");
 
-  n_certs = cell->payload[0];
-  ptr = cell->payload + 1;
+  if (certs_cell_parse(&cc, cell->payload, cell->payload_len) < 0)
+    ERR("It ends in the middle of a certificate");
+
+  n_certs = (int) certs_cell_getlen_certs(cc);
   for (i = 0; i < n_certs; ++i) {
-    uint8_t cert_type;
-    uint16_t cert_len;
-    if (cell->payload_len < 3)
-      goto truncated;
-    if (ptr > cell->payload + cell->payload_len - 3) {
-      goto truncated;
-    }
-    cert_type = *ptr;
-    cert_len = ntohs(get_uint16(ptr+1));
-    if (cell->payload_len < 3 + cert_len)
-      goto truncated;
-    if (ptr > cell->payload + cell->payload_len - cert_len - 3) {
-      goto truncated;
-    }
+    certs_cell_cert_t *c = certs_cell_get_certs(cc, i);
+    uint8_t cert_type = certs_cell_cert_get_cert_type(c);
     if (cert_type == OR_CERT_TYPE_TLS_LINK ||
         cert_type == OR_CERT_TYPE_ID_1024 ||
         cert_type == OR_CERT_TYPE_AUTH_1024) {
-      tor_cert_t *cert = tor_cert_decode(ptr + 3, cert_len);
+      tor_cert_t *cert = tor_cert_decode(certs_cell_cert_getarray_body(c),
+                                         certs_cell_cert_getlen_body(c));
       if (!cert) {
         log_fn(LOG_PROTOCOL_WARN, LD_PROTOCOL,
                "Received undecodable certificate in CERTS cell from %s:%d",
@@ -1833,11 +1825,6 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
         }
       }
     }
-    ptr += 3 + cert_len;
-    continue;
-
-  truncated:
-    ERR("It ends in the middle of a certificate");
   }
 
   if (chan->conn->handshake_state->started_here) {
@@ -1932,6 +1919,7 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
   tor_cert_free(id_cert);
   tor_cert_free(link_cert);
   tor_cert_free(auth_cert);
+  certs_cell_free(cc);
 #undef ERR
 }
 
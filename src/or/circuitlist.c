@@ -36,6 +36,13 @@
 
 #include "ht.h"
 
+#include "compat_libevent.h"
+#ifdef HAVE_EVENT2_EVENT_H
+#include <event2/event.h>
+#else
+#include <event.h>
+#endif
+
 /********* START VARIABLES **********/
 
 /** A global list of all circuits at this hop. */
@@ -44,6 +51,18 @@ static smartlist_t *global_circuitlist = NULL;
 /** A list of all the circuits in CIRCUIT_STATE_CHAN_WAIT. */
 static smartlist_t *circuits_pending_chans = NULL;
 
+/** A list of all the circuits that have been marked for close, but not yet
+ * freed by circuit_close_all_marked(). */
+static smartlist_t *circuits_pending_close = NULL;
+
+/** True while circuit_close_all_marked() is freeing a batch of circuits that
+ * it has already taken off circuits_pending_close. */
+static int freeing_marked_circuits = 0;
+
+/** Event used to free the rest of circuits_pending_close soon, when
+ * circuit_close_all_marked() had more than one batch to free. */
+static struct event *close_marked_ev = NULL;
+
 static void circuit_free_cpath_node(crypt_path_t *victim);
 static void cpath_ref_decref(crypt_path_reference_t *cpath_ref);
 //static void circuit_set_rend_token(or_circuit_t *circ, int is_rend_circ,
@@ -445,22 +464,70 @@ circuit_count_pending_on_channel(channel_t *chan)
   return cnt;
 }
 
-/** Detach from the global circuit list, and deallocate, all
- * circuits that have been marked for close.
+/** How many marked circuits will we free in one call to
+ * circuit_close_all_marked()? */
+#define MAX_CIRCUITS_FREED_PER_BATCH 1024
+
+/** Callback: free another batch of marked circuits. */
+static void
+close_marked_ev_cb(evutil_socket_t fd, short what, void *arg)
+{
+  (void)fd;
+  (void)what;
+  (void)arg;
+  circuit_close_all_marked();
+}
+
+/** Arrange for circuit_close_all_marked() to be called again as soon as we
+ * have handled any pending events. */
+static void
+circuit_schedule_close_marked(void)
+{
+  struct timeval no_delay = { 0, 0 };
+  if (!tor_libevent_get_base())
+    return;
+  if (!close_marked_ev)
+    close_marked_ev = tor_evtimer_new(tor_libevent_get_base(),
+                                      close_marked_ev_cb, NULL);
+  if (evtimer_add(close_marked_ev, &no_delay) < 0)
+    log_warn(LD_BUG, "Couldn't add timer for freeing marked circuits");
+}
+
+/** Detach from the global circuit list, and deallocate, circuits that have
+ * been marked for close.  We free at most MAX_CIRCUITS_FREED_PER_BATCH of
+ * them at a time, so that losing a busy channel doesn't stall the main loop;
+ * if there are more, we come back for them once pending events are handled.
  */
 void
 circuit_close_all_marked(void)
 {
-  smartlist_t *lst = circuit_get_global_list();
-  SMARTLIST_FOREACH_BEGIN(lst, circuit_t *, circ) {
-    /* Fix up index if SMARTLIST_DEL_CURRENT just moved this one. */
-    circ->global_circuitlist_idx = circ_sl_idx;
-    if (circ->marked_for_close) {
-      circ->global_circuitlist_idx = -1;
-      circuit_free(circ);
-      SMARTLIST_DEL_CURRENT(lst, circ);
-    }
-  } SMARTLIST_FOREACH_END(circ);
+  smartlist_t *batch;
+
+  if (!circuits_pending_close || !smartlist_len(circuits_pending_close))
+    return;
+
+  batch = circuits_pending_close;
+  circuits_pending_close = smartlist_new();
+  if (smartlist_len(batch) > MAX_CIRCUITS_FREED_PER_BATCH) {
+    while (smartlist_len(batch) > MAX_CIRCUITS_FREED_PER_BATCH)
+      smartlist_add(circuits_pending_close, smartlist_pop_last(batch));
+    log_info(LD_CIRC, "Freeing %d marked circuits; %d more left for later.",
+             smartlist_len(batch), smartlist_len(circuits_pending_close));
+    circuit_schedule_close_marked();
+  }
+
+  freeing_marked_circuits = 1;
+  SMARTLIST_FOREACH(batch, circuit_t *, circ, circuit_free(circ));
+  freeing_marked_circuits = 0;
+  smartlist_free(batch);
+}
+
+/** Return the number of circuits that have been marked for close but not
+ * yet freed. */
+int
+circuit_count_pending_close(void)
+{
+  return circuits_pending_close ? smartlist_len(circuits_pending_close) : 0;
 }
 
 /** Return the head of the global linked list of circuits. */
@@ -749,6 +816,10 @@ circuit_free(circuit_t *circ)
   if (!circ)
     return;
 
+  if (circ->marked_for_close && circuits_pending_close &&
+      !freeing_marked_circuits)
+    smartlist_remove(circuits_pending_close, circ);
+
   if (CIRCUIT_IS_ORIGIN(circ)) {
     origin_circuit_t *ocirc = TO_ORIGIN_CIRCUIT(circ);
     mem = ocirc;
@@ -874,6 +945,12 @@ circuit_free_all(void)
 {
   smartlist_t *lst = circuit_get_global_list();
 
+  /* Every marked circuit is on the global list too; free them from there. */
+  smartlist_free(circuits_pending_close);
+  circuits_pending_close = NULL;
+  tor_event_free(close_marked_ev);
+  close_marked_ev = NULL;
+
   SMARTLIST_FOREACH_BEGIN(lst, circuit_t *, tmp) {
     if (! CIRCUIT_IS_ORIGIN(tmp)) {
       or_circuit_t *or_circ = TO_OR_CIRCUIT(tmp);
@@ -1180,6 +1257,7 @@ void
 circuit_unlink_all_from_channel(channel_t *chan, int reason)
 {
   smartlist_t *detached = smartlist_new();
+  int n_marked = 0;
 
 /* #define DEBUG_CIRCUIT_UNLINK_ALL */
 
@@ -1252,10 +1330,18 @@ circuit_unlink_all_from_channel(channel_t *chan, int reason)
           "to mark");
       continue;
     }
-    if (!circ->marked_for_close)
+    if (!circ->marked_for_close) {
       circuit_mark_for_close(circ, reason);
+      ++n_marked;
+    }
   } SMARTLIST_FOREACH_END(circ);
 
+  if (n_marked)
+    log_info(LD_CIRC, "Marked %d circuits for close after losing channel "
+             U64_FORMAT"; %d circuits are waiting to be freed.", n_marked,
+             U64_PRINTF_ARG(chan->global_identifier),
+             circuit_count_pending_close());
+
   smartlist_free(detached);
 }
 
@@ -1813,6 +1899,9 @@ circuit_mark_for_close_, (circuit_t *circ, int reason, int line,
 
   circ->marked_for_close = line;
   circ->marked_for_close_file = file;
+  if (!circuits_pending_close)
+    circuits_pending_close = smartlist_new();
+  smartlist_add(circuits_pending_close, circ);
 
   if (!CIRCUIT_IS_ORIGIN(circ)) {
     or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
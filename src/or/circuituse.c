@@ -9,6 +9,7 @@
  * \brief Launch the right sort of circuits and attach streams to them.
  **/
 
+#define CIRCUITUSE_PRIVATE
 #include "or.h"
 #include "addressmap.h"
 #include "channel.h"
@@ -32,6 +33,8 @@
 #include "router.h"
 #include "routerlist.h"
 
+#include <math.h>
+
 static void circuit_expire_old_circuits_clientside(void);
 static void circuit_increment_failure_count(void);
 
@@ -903,20 +906,57 @@ circuit_log_ancient_one_hop_circuits(int age)
   smartlist_free(log_these);
 }
 
-/** Remove any elements in <b>needed_ports</b> that are handled by an
- * open or in-progress circuit.
+/** Don't keep more than this many unused open circuits around. */
+#define MAX_UNUSED_OPEN_CIRCUITS 14
+
+/** Return how many circuits we should keep ready for a predicted port, if
+ * we expect <b>rate</b> streams per second to need a fresh circuit and it
+ * takes up to <b>window</b> seconds to build one.  We want enough
+ * circuits to cover the expected arrivals during one build time, plus one
+ * standard deviation (treating arrivals as Poisson), so that bursts don't
+ * have to wait; but we always keep at least one. */
+STATIC int
+circuit_predicted_pool_size(double rate, double window)
+{
+  double expected, target;
+  if (rate <= 0 || window <= 0)
+    return 1;
+  expected = rate * window;
+  target = ceil(expected + sqrt(expected));
+  if (target < 1)
+    return 1;
+  if (target > MAX_UNUSED_OPEN_CIRCUITS - 2)
+    return MAX_UNUSED_OPEN_CIRCUITS - 2;
+  return (int)target;
+}
+
+/** Return how many open or in-progress circuits we want to be able to
+ * handle <b>port</b>, based on recent demand for fresh circuits. */
+static int
+circuit_get_needed_circs_for_port(time_t now, uint16_t port)
+{
+  const int need_uptime =
+    smartlist_contains_int_as_string(get_options()->LongLivedPorts, port);
+  return circuit_predicted_pool_size(
+                          rep_hist_get_clean_circ_demand(now, need_uptime),
+                          get_circuit_build_timeout_ms() / 1000.0);
+}
+
+/** Remove any elements in <b>needed_ports</b> that are handled by enough
+ * open or in-progress circuits to meet the demand we expect for them.
  */
 void
 circuit_remove_handled_ports(smartlist_t *needed_ports)
 {
   int i;
   uint16_t *port;
+  time_t now = time(NULL);
 
   for (i = 0; i < smartlist_len(needed_ports); ++i) {
     port = smartlist_get(needed_ports, i);
     tor_assert(*port);
     if (circuit_stream_is_being_handled(NULL, *port,
-                                        MIN_CIRCUITS_HANDLING_STREAM)) {
+                            circuit_get_needed_circs_for_port(now, *port))) {
 //      log_debug(LD_CIRC,"Port %d is already being handled; removing.", port);
       smartlist_del(needed_ports, i--);
       tor_free(port);
@@ -976,9 +1016,6 @@ circuit_stream_is_being_handled(entry_connection_t *conn,
   return 0;
 }
 
-/** Don't keep more than this many unused open circuits around. */
-#define MAX_UNUSED_OPEN_CIRCUITS 14
-
 /** Figure out how many circuits we have open that are clean. Make
  * sure it's enough for all the upcoming behaviors we predict we'll have.
  * But put an upper bound on the total number of circuits.
@@ -2338,8 +2375,22 @@ connection_ap_handshake_attach_circuit(entry_connection_t *conn)
     /* find the circuit that we should use, if there is one. */
     retval = circuit_get_open_circ_or_launch(
         conn, CIRCUIT_PURPOSE_C_GENERAL, &circ);
-    if (retval < 1) // XXX023 if we totally fail, this still returns 0 -RD
+    if (retval < 1) { // XXX023 if we totally fail, this still returns 0 -RD
+      if (retval == 0)
+        conn->waited_for_circuit = 1;
       return retval;
+    }
+
+    if (!want_onehop) {
+      /* Remember how this stream was served, to size our pool of clean
+       * circuits and to see how well we're doing. */
+      if (!circ->base_.timestamp_dirty || conn->waited_for_circuit) {
+        rep_hist_note_clean_circ_demand(time(NULL),
+              smartlist_contains_int_as_string(get_options()->LongLivedPorts,
+                                               conn->socks_request->port));
+      }
+      rep_hist_note_stream_attached(conn->waited_for_circuit);
+    }
 
     log_debug(LD_APP|LD_CIRC,
               "Attaching apconn to circ %u (stream %d sec old).",
@@ -12,6 +12,8 @@
 #ifndef TOR_CIRCUITUSE_H
 #define TOR_CIRCUITUSE_H
 
+#include "testsupport.h"
+
 void circuit_expire_building(void);
 void circuit_remove_handled_ports(smartlist_t *needed_ports);
 int circuit_stream_is_being_handled(entry_connection_t *conn, uint16_t port,
@@ -59,5 +61,9 @@ int hostname_in_track_host_exits(const or_options_t *options,
                                  const char *address);
 void mark_circuit_unusable_for_new_conns(origin_circuit_t *circ);
 
+#ifdef CIRCUITUSE_PRIVATE
+STATIC int circuit_predicted_pool_size(double rate, double window);
+#endif
+
 #endif
 
@@ -28,6 +28,7 @@
 #include "dirserv.h"
 #include "dirvote.h"
 #include "dns.h"
+#include "dnsserv.h"
 #include "entrynodes.h"
 #include "geoip.h"
 #include "hibernate.h"
@@ -141,6 +142,7 @@ static config_abbrev_t option_abbrevs_[] = {
  */
 static config_var_t option_vars_[] = {
   V(AccountingMax,               MEMUNIT,  "0 bytes"),
+  V(AccountingPacing,            BOOL,     "0"),
   VAR("AccountingRule",          STRING,   AccountingRule_option,  "max"),
   V(AccountingStart,             STRING,   NULL),
   V(Address,                     STRING,   NULL),
@@ -175,6 +177,7 @@ static config_var_t option_vars_[] = {
   V(AvoidDiskWrites,             BOOL,     "0"),
   V(BandwidthBurst,              MEMUNIT,  "1 GB"),
   V(BandwidthRate,               MEMUNIT,  "1 GB"),
+  V(BootstrapConsensusFetches,   UINT,     "1"),
   V(BridgeAuthoritativeDir,      BOOL,     "0"),
   VAR("Bridge",                  LINELIST, Bridges,    NULL),
   V(BridgePassword,              STRING,   NULL),
@@ -227,6 +230,7 @@ static config_var_t option_vars_[] = {
   V(DynamicDHGroups,             BOOL,     "0"),
   VPORT(DNSPort,                     LINELIST, NULL),
   V(DNSListenAddress,            LINELIST, NULL),
+  V(DNSPortCacheSize,            UINT,     "0"),
   V(DownloadExtraInfo,           BOOL,     "0"),
   V(TestingEnableConnBwEvent,    BOOL,     "0"),
   V(TestingEnableCellStatsEvent, BOOL,     "0"),
@@ -308,6 +312,7 @@ static config_var_t option_vars_[] = {
   V(TruncateLogFile,             BOOL,     "0"),
   V(LongLivedPorts,              CSV,
         "21,22,706,1863,5050,5190,5222,5223,6523,6667,6697,8300"),
+  V(MainThreadCPUs,              STRING,   NULL),
   VAR("MapAddress",              LINELIST, AddressMap,           NULL),
   V(MaxAdvertisedBandwidth,      MEMUNIT,  "1 GB"),
   V(MaxCircuitDirtiness,         INTERVAL, "10 minutes"),
@@ -397,11 +402,13 @@ static config_var_t option_vars_[] = {
   VPORT(SocksPort,                   LINELIST, NULL),
   V(SocksTimeout,                INTERVAL, "2 minutes"),
   V(SSLKeyLifetime,              INTERVAL, "0"),
+  V(StreamCoalesceDelay,         UINT,     "0"),
   OBSOLETE("StrictEntryNodes"),
   OBSOLETE("StrictExitNodes"),
   V(StrictNodes,                 BOOL,     "0"),
   OBSOLETE("Support022HiddenServices"),
   V(TestSocks,                   BOOL,     "0"),
+  V(ThreadLocalMemory,           BOOL,     "0"),
   V(TokenBucketRefillInterval,   MSEC_INTERVAL, "100 msec"),
   V(Tor2webMode,                 BOOL,     "0"),
   V(TLSECGroup,                  STRING,   NULL),
@@ -436,6 +443,8 @@ static config_var_t option_vars_[] = {
   V(VirtualAddrNetworkIPv4,      STRING,   "127.192.0.0/10"),
   V(VirtualAddrNetworkIPv6,      STRING,   "[FE80::]/10"),
   V(WarnPlaintextPorts,          CSV,      "23,109,110,143"),
+  V(WorkerThreadCPUs,            STRING,   NULL),
+  V(WorkerThreadsAvoidMainSiblings, BOOL,  "0"),
   V(UseFilteringSSLBufferevents, BOOL,    "0"),
   VAR("__ReloadTorrcOnSIGHUP",   BOOL,  ReloadTorrcOnSIGHUP,      "1"),
   VAR("__AllDirActionsPrivate",  BOOL,  AllDirActionsPrivate,     "0"),
@@ -1731,8 +1740,13 @@ options_act(const or_options_t *old_options)
     if (options->PerConnBWRate != old_options->PerConnBWRate ||
         options->PerConnBWBurst != old_options->PerConnBWBurst)
       connection_or_update_token_buckets(get_connection_array(), options);
+
+    if (options->DNSPortCacheSize < old_options->DNSPortCacheSize)
+      dnsserv_cache_trim(options->DNSPortCacheSize);
   }
 
+  cpu_placement_configure(options);
+
   /* Only collect directory-request statistics on relays and bridges. */
   options->DirReqStatistics = options->DirReqStatistics_option &&
     server_mode(options);
@@ -3141,11 +3155,43 @@ options_validate(or_options_t *old_options, or_options_t *options,
   if (options->KeepalivePeriod < 1)
     REJECT("KeepalivePeriod option must be positive.");
 
+  if (options->StreamCoalesceDelay > MAX_STREAM_COALESCE_DELAY) {
+    tor_asprintf(msg, "StreamCoalesceDelay is too high; it may be at most "
+                 "%d microseconds.", MAX_STREAM_COALESCE_DELAY);
+    return -1;
+  }
+
+  if (options->BootstrapConsensusFetches < 1 ||
+      options->BootstrapConsensusFetches > MAX_BOOTSTRAP_CONSENSUS_FETCHES) {
+    tor_asprintf(msg, "BootstrapConsensusFetches must be between 1 and %d.",
+                 MAX_BOOTSTRAP_CONSENSUS_FETCHES);
+    return -1;
+  }
+
   if (options->PortForwarding && options->Sandbox) {
     REJECT("PortForwarding is not compatible with Sandbox; at most one can "
            "be set");
   }
 
+  {
+    tor_cpuset_t cpus;
+    if (options->MainThreadCPUs &&
+        (tor_cpuset_parse(&cpus, options->MainThreadCPUs) < 0 ||
+         tor_cpuset_count(&cpus) == 0))
+      REJECT("MainThreadCPUs must be a nonempty list of CPUs, like 0-3,8.");
+    if (options->WorkerThreadCPUs &&
+        (tor_cpuset_parse(&cpus, options->WorkerThreadCPUs) < 0 ||
+         tor_cpuset_count(&cpus) == 0))
+      REJECT("WorkerThreadCPUs must be a nonempty list of CPUs, like 0-3,8.");
+  }
+  if (options->Sandbox &&
+      (options->MainThreadCPUs || options->WorkerThreadCPUs ||
+       options->WorkerThreadsAvoidMainSiblings ||
+       options->ThreadLocalMemory)) {
+    REJECT("MainThreadCPUs, WorkerThreadCPUs, WorkerThreadsAvoidMainSiblings "
+           "and ThreadLocalMemory are not compatible with Sandbox.");
+  }
+
   if (ensure_bandwidth_cap(&options->BandwidthRate,
                            "BandwidthRate", msg) < 0)
     return -1;
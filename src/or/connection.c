@@ -36,6 +36,7 @@
 #include "entrynodes.h"
 #include "ext_orport.h"
 #include "geoip.h"
+#include "hibernate.h"
 #include "main.h"
 #include "policies.h"
 #include "reasons.h"
@@ -570,6 +571,7 @@ connection_free_(connection_t *conn)
     entry_connection_t *entry_conn = TO_ENTRY_CONN(conn);
     tor_free(entry_conn->chosen_exit_name);
     tor_free(entry_conn->original_dest_address);
+    tor_free(entry_conn->dns_server_key);
     if (entry_conn->socks_request)
       socks_request_free(entry_conn->socks_request);
     if (entry_conn->pending_optimistic_data) {
@@ -581,6 +583,7 @@ connection_free_(connection_t *conn)
   }
   if (CONN_IS_EDGE(conn)) {
     rend_data_free(TO_EDGE_CONN(conn)->rend_data);
+    edge_stream_coalesce_cancel(TO_EDGE_CONN(conn));
   }
   if (conn->type == CONN_TYPE_CONTROL) {
     control_connection_t *control_conn = TO_CONTROL_CONN(conn);
@@ -3008,6 +3011,7 @@ connection_bucket_refill(int milliseconds_elapsed, time_t now)
   const or_options_t *options = get_options();
   smartlist_t *conns = get_connection_array();
   int bandwidthrate, bandwidthburst, relayrate, relayburst;
+  int pacingrate, pacingburst;
 
   int prev_global_read = global_read_bucket;
   int prev_global_write = global_write_bucket;
@@ -3026,6 +3030,15 @@ connection_bucket_refill(int milliseconds_elapsed, time_t now)
     relayburst = bandwidthburst;
   }
 
+  /* If we're spreading our accounting quota over the interval, don't let
+   * any bucket fill faster than that. */
+  if (accounting_get_pacing_limits(&pacingrate, &pacingburst)) {
+    bandwidthrate = MIN(bandwidthrate, pacingrate);
+    bandwidthburst = MIN(bandwidthburst, pacingburst);
+    relayrate = MIN(relayrate, pacingrate);
+    relayburst = MIN(relayburst, pacingburst);
+  }
+
   tor_assert(milliseconds_elapsed >= 0);
 
   write_buckets_empty_last_second =
@@ -4348,6 +4361,33 @@ connection_dir_get_by_purpose_and_resource(int purpose,
   return NULL;
 }
 
+/** Return the number of directory connections that are fetching the item
+ * described by <b>purpose</b>/<b>resource</b>. */
+int
+connection_dir_count_by_purpose_and_resource(int purpose,
+                                             const char *resource)
+{
+  smartlist_t *conns = get_connection_array();
+  int n = 0;
+
+  SMARTLIST_FOREACH_BEGIN(conns, connection_t *, conn) {
+    dir_connection_t *dirconn;
+    if (conn->type != CONN_TYPE_DIR || conn->marked_for_close ||
+        conn->purpose != purpose)
+      continue;
+    dirconn = TO_DIR_CONN(conn);
+    if (dirconn->requested_resource == NULL) {
+      if (resource == NULL)
+        ++n;
+    } else if (resource) {
+      if (0 == strcmp(resource, dirconn->requested_resource))
+        ++n;
+    }
+  } SMARTLIST_FOREACH_END(conn);
+
+  return n;
+}
+
 /** Return 1 if there are any active OR connections apart from
  * <b>this_conn</b>.
  *
@@ -194,6 +194,8 @@ connection_t *connection_get_by_type_state_rendquery(int type, int state,
                                                      const char *rendquery);
 dir_connection_t *connection_dir_get_by_purpose_and_resource(
                                            int state, const char *resource);
+int connection_dir_count_by_purpose_and_resource(int purpose,
+                                                 const char *resource);
 
 int any_other_active_or_conns(const or_connection_t *this_conn);
 
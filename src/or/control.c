@@ -26,6 +26,7 @@
 #include "connection_edge.h"
 #include "connection_or.h"
 #include "control.h"
+#include "crypto_calibrate.h"
 #include "directory.h"
 #include "dirserv.h"
 #include "dnsserv.h"
@@ -1452,6 +1453,8 @@ getinfo_helper_misc(control_connection_t *conn, const char *question,
     *answer = options_dump(get_options(), OPTIONS_DUMP_MINIMAL);
   } else if (!strcmp(question, "info/names")) {
     *answer = list_getinfo_options();
+  } else if (!strcmp(question, "crypto/backends")) {
+    *answer = crypto_get_implementations();
   } else if (!strcmp(question, "dormant")) {
     int dormant = rep_hist_circbuilding_dormant(time(NULL));
     *answer = tor_strdup(dormant ? "1" : "0");
@@ -2136,6 +2139,8 @@ static const getinfo_item_t getinfo_items[] = {
   ITEM("bw-event-cache", misc, "Cached BW events for a short interval."),
   ITEM("config-file", misc, "Current location of the \"torrc\" file."),
   ITEM("config-defaults-file", misc, "Current location of the defaults file."),
+  ITEM("crypto/backends", misc,
+       "Which implementation we use for each crypto primitive."),
   ITEM("config-text", misc,
        "Return the string that would be written by a saveconf command."),
   ITEM("accounting/bytes", accounting,
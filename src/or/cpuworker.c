@@ -10,6 +10,7 @@
  *
  * Right now, we only use this for processing onionskins.
  **/
+#define CPUWORKER_PRIVATE
 #include "or.h"
 #include "channel.h"
 #include "circuitbuild.h"
@@ -97,6 +98,232 @@ cpu_init(void)
   /* Total voodoo. Can we make this more sensible? */
   max_pending_tasks = get_num_cpus(get_options()) * 64;
   crypto_seed_weak_rng(&request_sample_rng);
+  cpu_placement_configure(get_options());
+}
+
+/** True iff initial_cpus holds the CPUs we were allowed to run on before we
+ * placed any threads. */
+static int initial_cpus_known = 0;
+/** The CPUs we were allowed to run on before we placed any threads. */
+static tor_cpuset_t initial_cpus;
+/** True iff we have restricted the main thread with MainThreadCPUs. */
+static int main_thread_placed = 0;
+/** The CPUs to which we have restricted the main thread. */
+static tor_cpuset_t main_thread_cpus;
+/** True iff the main thread has asked for memory from its own NUMA node. */
+static int main_thread_local_memory = 0;
+/** True iff we have asked the worker threads to move onto particular
+ * CPUs. */
+static int workers_placed = 0;
+
+/** Remove from <b>set</b> every CPU in <b>avoid</b>, along with every CPU
+ * that shares a physical core with one of them. */
+static void
+cpuset_remove_with_siblings(tor_cpuset_t *set, const tor_cpuset_t *avoid)
+{
+  int i, j, n = tor_cpuset_count(avoid);
+  for (i = 0; i < n; ++i) {
+    tor_cpuset_t siblings;
+    int cpu = tor_cpuset_nth(avoid, i);
+    tor_cpuset_remove(set, cpu);
+    if (tor_get_cpu_siblings(cpu, &siblings) < 0)
+      continue;
+    for (j = 0; j < TOR_CPUSET_MAX_CPUS; ++j) {
+      if (tor_cpuset_contains(&siblings, j))
+        tor_cpuset_remove(set, j);
+    }
+  }
+}
+
+/** Tell the worker threads in <b>pool</b> where <b>options</b> wants
+ * them.  With WorkerThreadCPUs, each thread gets one of those CPUs in
+ * turn.  Otherwise, every thread may use any of the CPUs we started with,
+ * less the main thread's CPUs and their siblings if
+ * WorkerThreadsAvoidMainSiblings is set. */
+static void
+place_worker_threads(const or_options_t *options, threadpool_t *pool)
+{
+  tor_cpuset_t base;
+  tor_cpuset_t *sets;
+  int i, n;
+
+  if (options->WorkerThreadCPUs) {
+    tor_cpuset_parse(&base, options->WorkerThreadCPUs);
+  } else if (initial_cpus_known) {
+    memcpy(&base, &initial_cpus, sizeof(base));
+  } else {
+    log_warn(LD_CONFIG, "I couldn't find out which CPUs I may use, so I "
+             "can't keep worker threads off the main thread's CPUs. Set "
+             "WorkerThreadCPUs to say which ones the workers should use.");
+    return;
+  }
+
+  if (options->WorkerThreadsAvoidMainSiblings && main_thread_placed) {
+    tor_cpuset_t reduced;
+    memcpy(&reduced, &base, sizeof(reduced));
+    cpuset_remove_with_siblings(&reduced, &main_thread_cpus);
+    if (tor_cpuset_count(&reduced))
+      memcpy(&base, &reduced, sizeof(base));
+    else
+      log_warn(LD_CONFIG, "WorkerThreadsAvoidMainSiblings would leave no "
+               "CPUs for the worker threads; ignoring it.");
+  }
+
+  if (!options->WorkerThreadCPUs) {
+    threadpool_set_thread_cpus(pool, &base, 1, options->ThreadLocalMemory);
+    workers_placed = 1;
+    return;
+  }
+
+  n = tor_cpuset_count(&base);
+  sets = tor_calloc(n, sizeof(tor_cpuset_t));
+  for (i = 0; i < n; ++i)
+    tor_cpuset_add(&sets[i], tor_cpuset_nth(&base, i));
+  threadpool_set_thread_cpus(pool, sets, n, options->ThreadLocalMemory);
+  tor_free(sets);
+  workers_placed = 1;
+}
+
+/** Apply the thread placement options in <b>options</b>
+ * (MainThreadCPUs, WorkerThreadCPUs, WorkerThreadsAvoidMainSiblings and
+ * ThreadLocalMemory) to the main thread and to the worker threads, if we
+ * have any.  If an option has been turned off since the last call, put the
+ * threads back where they started.  Must be called from the main thread.
+ */
+void
+cpu_placement_configure(const or_options_t *options)
+{
+  cpu_placement_apply(options, threadpool);
+}
+
+/** Helper for cpu_placement_configure(): apply the placement options in
+ * <b>options</b> to the main thread and to the threads in <b>pool</b>, if
+ * <b>pool</b> is set. */
+STATIC void
+cpu_placement_apply(const or_options_t *options, threadpool_t *pool)
+{
+  /* Threads inherit the CPUs of the thread that creates them, so once the
+   * main thread is pinned, we have to say where the workers go even if no
+   * worker option is set.  Otherwise they'd all share the main thread's
+   * CPUs. */
+  const int want_workers = options->WorkerThreadCPUs != NULL ||
+    options->WorkerThreadsAvoidMainSiblings || options->MainThreadCPUs;
+
+  if (!options->MainThreadCPUs && !want_workers &&
+      !options->ThreadLocalMemory && !main_thread_placed &&
+      !main_thread_local_memory && !workers_placed)
+    return; /* Nothing to do, and nothing to undo. */
+
+  if (!initial_cpus_known && !main_thread_placed) {
+    if (tor_thread_get_cpus(&initial_cpus) == 0 &&
+        tor_cpuset_count(&initial_cpus))
+      initial_cpus_known = 1;
+  }
+
+  if (options->MainThreadCPUs) {
+    tor_cpuset_parse(&main_thread_cpus, options->MainThreadCPUs);
+    if (tor_thread_set_cpus(&main_thread_cpus) < 0) {
+      log_warn(LD_CONFIG, "Couldn't restrict the main thread to CPUs %s.",
+               options->MainThreadCPUs);
+      main_thread_placed = 0;
+    } else {
+      main_thread_placed = 1;
+    }
+  } else if (main_thread_placed) {
+    if (initial_cpus_known)
+      tor_thread_set_cpus(&initial_cpus);
+    main_thread_placed = 0;
+  }
+
+  if (!options->ThreadLocalMemory != !main_thread_local_memory) {
+    if (tor_thread_set_local_memory(options->ThreadLocalMemory) < 0 &&
+        options->ThreadLocalMemory)
+      log_warn(LD_CONFIG, "ThreadLocalMemory isn't supported here.");
+    main_thread_local_memory = options->ThreadLocalMemory;
+  }
+
+  if (!pool)
+    return;
+  if (want_workers) {
+    place_worker_threads(options, pool);
+  } else if (workers_placed) {
+    if (initial_cpus_known)
+      threadpool_set_thread_cpus(pool, &initial_cpus, 1, 0);
+    else
+      threadpool_set_thread_cpus(pool, NULL, 0, 0);
+    workers_placed = 0;
+  }
+}
+
+/** Return a newly allocated string describing where our threads are
+ * running, for the heartbeat message, or NULL if we haven't placed any
+ * threads. */
+char *
+cpu_placement_describe(void)
+{
+  smartlist_t *parts;
+  tor_cpuset_t cpus, numa_nodes;
+  char *s, *result;
+  int i, n, cpu, n_failed = 0;
+
+  if (!main_thread_placed && !workers_placed)
+    return NULL;
+
+  parts = smartlist_new();
+  tor_cpuset_clear(&cpus);
+
+  if (main_thread_placed)
+    memcpy(&cpus, &main_thread_cpus, sizeof(cpus));
+  else
+    tor_thread_get_cpus(&cpus);
+  s = tor_cpuset_format(&cpus);
+  smartlist_add_asprintf(parts, "main thread on CPUs %s", s);
+  tor_free(s);
+
+  if (workers_placed && threadpool) {
+    tor_cpuset_clear(&cpus);
+    n = threadpool_get_n_threads(threadpool);
+    for (i = 0; i < n; ++i) {
+      tor_cpuset_t one;
+      int r = threadpool_get_thread_cpus(threadpool, i, &one);
+      if (r < 0) {
+        ++n_failed;
+        continue;
+      }
+      for (cpu = 0; cpu < TOR_CPUSET_MAX_CPUS; ++cpu) {
+        if (tor_cpuset_contains(&one, cpu))
+          tor_cpuset_add(&cpus, cpu);
+      }
+    }
+    s = tor_cpuset_format(&cpus);
+    smartlist_add_asprintf(parts, "%d worker threads on CPUs %s%s", n,
+                           s, n_failed ? " (some couldn't be placed)" : "");
+    tor_free(s);
+  }
+
+  /* Which NUMA nodes are local to the main thread? */
+  tor_cpuset_clear(&numa_nodes);
+  if (main_thread_placed) {
+    n = tor_cpuset_count(&main_thread_cpus);
+    for (i = 0; i < n; ++i) {
+      int node = tor_get_cpu_numa_node(tor_cpuset_nth(&main_thread_cpus, i));
+      if (node >= 0)
+        tor_cpuset_add(&numa_nodes, node);
+    }
+  }
+  if (tor_cpuset_count(&numa_nodes)) {
+    s = tor_cpuset_format(&numa_nodes);
+    smartlist_add_asprintf(parts, "main thread memory on NUMA node%s %s",
+                           tor_cpuset_count(&numa_nodes) > 1 ? "s" : "", s);
+    tor_free(s);
+  }
+
+  s = smartlist_join_strings(parts, "; ", 0, NULL);
+  tor_asprintf(&result, "Thread placement: %s.", s);
+  tor_free(s);
+  SMARTLIST_FOREACH(parts, char *, cp, tor_free(cp));
+  smartlist_free(parts);
+  return result;
 }
 
 /** Magic numbers to make sure our cpuworker_requests don't grow any
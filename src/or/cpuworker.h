@@ -13,6 +13,8 @@
 #define TOR_CPUWORKER_H
 
 void cpu_init(void);
+void cpu_placement_configure(const or_options_t *options);
+char *cpu_placement_describe(void);
 void cpuworkers_rotate_keyinfo(void);
 
 struct create_cell_t;
@@ -25,5 +27,11 @@ void cpuworker_log_onionskin_overhead(int severity, int onionskin_type,
                                       const char *onionskin_type_name);
 void cpuworker_cancel_circ_handshake(or_circuit_t *circ);
 
+#ifdef CPUWORKER_PRIVATE
+struct threadpool_s;
+STATIC void cpu_placement_apply(const or_options_t *options,
+                                struct threadpool_s *pool);
+#endif
+
 #endif
 
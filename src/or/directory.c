@@ -113,6 +113,21 @@ static void directory_initiate_command_rend(const tor_addr_t *addr,
 #define ROBOTS_CACHE_LIFETIME (24*60*60)
 #define MICRODESC_CACHE_LIFETIME (48*60*60)
 
+/** How many consensus fetches have we cancelled because another fetch of the
+ * same flavor finished first? */
+uint64_t stats_n_consensus_race_losers = 0;
+/** How many bytes had those cancelled fetches already read? */
+uint64_t stats_n_consensus_race_bytes_discarded = 0;
+/** How many microdescriptor fetches have we cancelled while bootstrapping
+ * because they were taking too long? */
+uint64_t stats_n_microdesc_stragglers = 0;
+/** How many bytes had those cancelled fetches already read? */
+uint64_t stats_n_microdesc_straggler_bytes_discarded = 0;
+
+/** While bootstrapping, how many seconds may a microdescriptor fetch run
+ * before we give up on it and ask another directory server instead? */
+#define MICRODESC_STRAGGLER_TIMEOUT 15
+
 /********* END VARIABLES ************/
 
 /** Return true iff the directory purpose <b>dir_purpose</b> (and if it's
@@ -401,7 +416,11 @@ directory_pick_generic_dirserver(dirinfo_type_t type, int pds_flags,
   if (options->UseBridges)
     log_warn(LD_BUG, "Called when we have UseBridges set.");
 
-  if (should_use_directory_guards(options)) {
+  if (pds_flags & PDS_NO_EXISTING_CONSENSUS_FETCH) {
+    /* We're racing a consensus fetch that is already in progress, most
+     * likely with one of our directory guards: ask a fallback instead. */
+    return router_pick_fallback_dirserver(type, pds_flags);
+  } else if (should_use_directory_guards(options)) {
     const node_t *node = choose_random_dirguard(type);
     if (node)
       rs = node->rs;
@@ -528,6 +547,11 @@ MOCK_IMPL(void, directory_get_from_dirserver, (uint8_t dir_purpose,
             return;
           }
         }
+        if (rs == NULL && (pds_flags & PDS_NO_EXISTING_CONSENSUS_FETCH)) {
+          log_info(LD_DIR, "No other authority is free to race our "
+                   "consensus fetch; not launching another one.");
+          return;
+        }
         if (rs == NULL && require_authority) {
           log_info(LD_DIR, "No authorities were available for %s: will try "
                    "later.", dir_conn_purpose_to_string(dir_purpose));
@@ -538,6 +562,11 @@ MOCK_IMPL(void, directory_get_from_dirserver, (uint8_t dir_purpose,
         /* */
         rs = directory_pick_generic_dirserver(type, pds_flags,
                                               dir_purpose);
+        if (!rs && (pds_flags & PDS_NO_EXISTING_CONSENSUS_FETCH)) {
+          log_info(LD_DIR, "No other directory server is free to race our "
+                   "consensus fetch; not launching another one.");
+          return;
+        }
         if (!rs)
           get_via_tor = 1; /* last resort: try routing it via Tor */
       }
@@ -741,6 +770,98 @@ connection_dir_request_failed(dir_connection_t *conn)
   }
 }
 
+/** Return the number of bytes that we have thrown away by cancelling
+ * directory fetches while bootstrapping: consensus fetches that lost a race,
+ * and microdescriptor fetches that took too long. */
+uint64_t
+bootstrap_fetch_bytes_discarded(void)
+{
+  return stats_n_consensus_race_bytes_discarded +
+    stats_n_microdesc_straggler_bytes_discarded;
+}
+
+/** We just loaded the consensus fetched on <b>winner</b>: cancel any other
+ * fetches for the same flavor that we launched to race it, and count the
+ * bytes they had already read as wasted. */
+STATIC void
+connection_dir_close_consensus_race_losers(dir_connection_t *winner)
+{
+  const char *resource = winner->requested_resource;
+  smartlist_t *conns = get_connection_array();
+
+  SMARTLIST_FOREACH_BEGIN(conns, connection_t *, conn) {
+    dir_connection_t *dirconn;
+    size_t n_read;
+    if (conn->type != CONN_TYPE_DIR || conn->marked_for_close ||
+        conn->purpose != DIR_PURPOSE_FETCH_CONSENSUS ||
+        conn == TO_CONN(winner))
+      continue;
+    dirconn = TO_DIR_CONN(conn);
+    if (!resource || !dirconn->requested_resource ||
+        strcmp(resource, dirconn->requested_resource))
+      continue;
+
+    n_read = conn->inbuf ? buf_datalen(conn->inbuf) : 0;
+    log_info(LD_DIR, "Cancelling %s consensus fetch from '%s:%d' after "
+             "%d bytes: another server answered first.",
+             resource, conn->address, conn->port, (int)n_read);
+    ++stats_n_consensus_race_losers;
+    stats_n_consensus_race_bytes_discarded += n_read;
+    /* This isn't the server's fault: don't count it as a failed download. */
+    conn->state = DIR_CONN_STATE_CLIENT_FINISHED;
+    connection_mark_for_close(conn);
+  } SMARTLIST_FOREACH_END(conn);
+}
+
+/** While we are bootstrapping with BootstrapConsensusFetches above 1,
+ * cancel every microdescriptor fetch that has been running for more than
+ * MICRODESC_STRAGGLER_TIMEOUT seconds as of <b>now</b>, so that
+ * update_microdesc_downloads() asks another server for the same
+ * microdescriptors.  Count the bytes they had already read as wasted, and
+ * stop once the wasted bytes reach MAX_BOOTSTRAP_FETCH_OVERHEAD.  Return
+ * the number of fetches cancelled. */
+int
+connection_dir_cancel_microdesc_stragglers(time_t now)
+{
+  const or_options_t *options = get_options();
+  smartlist_t *conns;
+  int n_cancelled = 0;
+
+  if (options->BootstrapConsensusFetches <= 1 ||
+      directory_fetches_from_authorities(options) ||
+      router_have_minimum_dir_info() ||
+      bootstrap_fetch_bytes_discarded() >= MAX_BOOTSTRAP_FETCH_OVERHEAD)
+    return 0;
+
+  conns = get_connection_array();
+  SMARTLIST_FOREACH_BEGIN(conns, connection_t *, conn) {
+    size_t n_read;
+    if (conn->type != CONN_TYPE_DIR || conn->marked_for_close ||
+        conn->purpose != DIR_PURPOSE_FETCH_MICRODESC ||
+        conn->state == DIR_CONN_STATE_CLIENT_FINISHED ||
+        conn->timestamp_created + MICRODESC_STRAGGLER_TIMEOUT > now)
+      continue;
+
+    n_read = conn->inbuf ? buf_datalen(conn->inbuf) : 0;
+    log_info(LD_DIR, "Microdescriptor fetch from '%s:%d' has taken %d "
+             "seconds; cancelling it after %d bytes and asking another "
+             "server.", conn->address, conn->port,
+             (int)(now - conn->timestamp_created), (int)n_read);
+    ++stats_n_microdesc_stragglers;
+    stats_n_microdesc_straggler_bytes_discarded += n_read;
+    ++n_cancelled;
+    /* Leave this server alone for now, as if the fetch had failed... */
+    if (!entry_list_is_constrained(options))
+      router_set_status(TO_DIR_CONN(conn)->identity_digest, 0);
+    /* ...but don't count it against the microdescriptors: we want to ask
+     * for them again right away. */
+    conn->state = DIR_CONN_STATE_CLIENT_FINISHED;
+    connection_mark_for_close(conn);
+  } SMARTLIST_FOREACH_END(conn);
+
+  return n_cancelled;
+}
+
 /** Helper: Attempt to fetch directly the descriptors of each bridge
  * listed in <b>failed</b>.
  */
@@ -1789,6 +1910,7 @@ connection_dir_client_reached_eof(dir_connection_t *conn)
     update_microdesc_downloads(now);
     directory_info_has_arrived(now, 0);
     log_info(LD_DIR, "Successfully loaded consensus.");
+    connection_dir_close_consensus_race_losers(conn);
   }
 
   if (conn->base_.purpose == DIR_PURPOSE_FETCH_CERTIFICATE) {
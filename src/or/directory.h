@@ -119,6 +119,17 @@ download_status_mark_impossible(download_status_t *dl)
 
 int download_status_get_n_failures(const download_status_t *dls);
 
+/** Once the directory fetches that we cancel while bootstrapping have
+ * thrown away this many bytes in total, stop launching extra ones. */
+#define MAX_BOOTSTRAP_FETCH_OVERHEAD (4*1024*1024)
+
+extern uint64_t stats_n_consensus_race_losers;
+extern uint64_t stats_n_consensus_race_bytes_discarded;
+extern uint64_t stats_n_microdesc_stragglers;
+extern uint64_t stats_n_microdesc_straggler_bytes_discarded;
+uint64_t bootstrap_fetch_bytes_discarded(void);
+int connection_dir_cancel_microdesc_stragglers(time_t now);
+
 #ifdef TOR_UNIT_TESTS
 /* Used only by directory.c and test_dir.c */
 
@@ -127,6 +138,8 @@ STATIC int purpose_needs_anonymity(uint8_t dir_purpose,
                                    uint8_t router_purpose);
 STATIC dirinfo_type_t dir_fetch_type(int dir_purpose, int router_purpose,
                                      const char *resource);
+STATIC void connection_dir_close_consensus_race_losers(
+                                               dir_connection_t *winner);
 #endif
 
 #endif
@@ -2452,6 +2452,7 @@ dirserv_generate_networkstatus_vote_obj(crypto_pk_t *private_key,
     smartlist_free(added);
     smartlist_free(microdescriptors);
   }
+  dirvote_expire_generated_microdescs();
 
   smartlist_free(routers);
   digestmap_free(omit_as_sybil, NULL);
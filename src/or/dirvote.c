@@ -16,6 +16,7 @@
 #include "router.h"
 #include "routerlist.h"
 #include "routerparse.h"
+#include "strbuf.h"
 
 /**
  * \file dirvote.c
@@ -49,9 +50,19 @@ static void dirvote_fetch_missing_votes(void);
 static void dirvote_fetch_missing_signatures(void);
 static int dirvote_perform_vote(void);
 static void dirvote_clear_votes(int all_votes);
+static void dirvote_free_generated_microdescs(void);
 static int dirvote_compute_consensuses(void);
 static int dirvote_publish_consensus(void);
 static char *make_consensus_method_list(int low, int high, const char *sep);
+static ssize_t format_microdesc_vote_line_by_digest(char *out_buf,
+                                                    size_t out_buf_len,
+                                                    const char *digest256,
+                                                    int consensus_method_low,
+                                                    int consensus_method_high);
+
+/** About how many bytes does each router take up in a vote or a consensus?
+ * We use this to size our buffers up front. */
+#define VOTE_ENTRY_SIZE_HINT 256
 
 /* =====
  * Voting
@@ -60,11 +71,11 @@ static char *make_consensus_method_list(int low, int high, const char *sep);
 /** Return a new string containing the string representation of the vote in
  * <b>v3_ns</b>, signed with our v3 signing key <b>private_signing_key</b>.
  * For v3 authorities. */
-STATIC char *
+char *
 format_networkstatus_vote(crypto_pk_t *private_signing_key,
                           networkstatus_t *v3_ns)
 {
-  smartlist_t *chunks = smartlist_new();
+  strbuf_t *sb = NULL;
   const char *client_versions = NULL, *server_versions = NULL;
   char *packages = NULL;
   char fingerprint[FINGERPRINT_LEN+1];
@@ -80,6 +91,8 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
   voter = smartlist_get(v3_ns->voters, 0);
 
   addr = voter->addr;
+  sb = strbuf_new(smartlist_len(v3_ns->routerstatus_list) *
+                  VOTE_ENTRY_SIZE_HINT);
 
   base16_encode(fingerprint, sizeof(fingerprint),
                 v3_ns->cert->cache_info.identity_digest, DIGEST_LEN);
@@ -135,7 +148,7 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
       params = tor_strdup("");
 
     tor_assert(cert);
-    smartlist_add_asprintf(chunks,
+    strbuf_add_printf(sb,
                  "network-status-version 3\n"
                  "vote-status %s\n"
                  "consensus-methods %s\n"
@@ -173,11 +186,11 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
     if (!tor_digest_is_zero(voter->legacy_id_digest)) {
       char fpbuf[HEX_DIGEST_LEN+1];
       base16_encode(fpbuf, sizeof(fpbuf), voter->legacy_id_digest, DIGEST_LEN);
-      smartlist_add_asprintf(chunks, "legacy-dir-key %s\n", fpbuf);
+      strbuf_add_printf(sb, "legacy-dir-key %s\n", fpbuf);
     }
 
-    smartlist_add(chunks, tor_strndup(cert->cache_info.signed_descriptor_body,
-                                      cert->cache_info.signed_descriptor_len));
+    strbuf_add_len(sb, cert->cache_info.signed_descriptor_body,
+                   cert->cache_info.signed_descriptor_len);
   }
 
   SMARTLIST_FOREACH_BEGIN(v3_ns->routerstatus_list, vote_routerstatus_t *,
@@ -186,20 +199,22 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
     vote_microdesc_hash_t *h;
     rsf = routerstatus_format_entry(&vrs->status,
                                     vrs->version, NS_V3_VOTE, vrs);
-    if (rsf)
-      smartlist_add(chunks, rsf);
+    if (rsf) {
+      strbuf_add(sb, rsf);
+      tor_free(rsf);
+    }
 
     for (h = vrs->microdesc; h; h = h->next) {
-      smartlist_add(chunks, tor_strdup(h->microdesc_hash_line));
+      strbuf_add(sb, h->microdesc_hash_line);
     }
   } SMARTLIST_FOREACH_END(vrs);
 
-  smartlist_add(chunks, tor_strdup("directory-footer\n"));
+  strbuf_add(sb, "directory-footer\n");
 
   /* The digest includes everything up through the space after
    * directory-signature.  (Yuck.) */
-  crypto_digest_smartlist(digest, DIGEST_LEN, chunks,
-                          "directory-signature ", DIGEST_SHA1);
+  strbuf_add(sb, "directory-signature ");
+  crypto_digest(digest, strbuf_get(sb), strbuf_len(sb));
 
   {
     char signing_key_fingerprint[FINGERPRINT_LEN+1];
@@ -209,8 +224,7 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
       goto err;
     }
 
-    smartlist_add_asprintf(chunks, "directory-signature %s %s\n", fingerprint,
-                           signing_key_fingerprint);
+    strbuf_add_printf(sb, "%s %s\n", fingerprint, signing_key_fingerprint);
   }
 
   note_crypto_pk_op(SIGN_DIR);
@@ -221,10 +235,12 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
       log_warn(LD_BUG, "Unable to sign networkstatus vote.");
       goto err;
     }
-    smartlist_add(chunks, sig);
+    strbuf_add(sb, sig);
+    tor_free(sig);
   }
 
-  status = smartlist_join_strings(chunks, "", 0, NULL);
+  status = strbuf_steal(sb, NULL);
+  sb = NULL;
 
   {
     networkstatus_t *v;
@@ -247,8 +263,7 @@ format_networkstatus_vote(crypto_pk_t *private_signing_key,
   tor_free(server_versions_line);
   tor_free(packages);
 
-  SMARTLIST_FOREACH(chunks, char *, cp, tor_free(cp));
-  smartlist_free(chunks);
+  strbuf_free(sb);
   return status;
 }
 
@@ -786,7 +801,7 @@ networkstatus_check_weights(int64_t Wgg, int64_t Wgd, int64_t Wmg,
  * It returns true if weights could be computed, false otherwise.
  */
 static int
-networkstatus_compute_bw_weights_v10(smartlist_t *chunks, int64_t G,
+networkstatus_compute_bw_weights_v10(strbuf_t *sb, int64_t G,
                                      int64_t M, int64_t E, int64_t D,
                                      int64_t T, int64_t weight_scale)
 {
@@ -1002,7 +1017,7 @@ networkstatus_compute_bw_weights_v10(smartlist_t *chunks, int64_t G,
    *
    * NOTE: This list is sorted.
    */
-  smartlist_add_asprintf(chunks,
+  strbuf_add_printf(sb,
      "bandwidth-weights Wbd=%d Wbe=%d Wbg=%d Wbm=%d "
      "Wdb=%d "
      "Web=%d Wed=%d Wee=%d Weg=%d Wem=%d "
@@ -1040,7 +1055,7 @@ networkstatus_compute_consensus(smartlist_t *votes,
                                 crypto_pk_t *legacy_signing_key,
                                 consensus_flavor_t flavor)
 {
-  smartlist_t *chunks;
+  strbuf_t *sb = NULL;
   char *result = NULL;
   int consensus_method;
   time_t valid_after, fresh_until, valid_until;
@@ -1158,7 +1173,13 @@ networkstatus_compute_consensus(smartlist_t *votes,
     tor_free(distsec_list);
   }
 
-  chunks = smartlist_new();
+  {
+    int max_entries = 0;
+    SMARTLIST_FOREACH(votes, networkstatus_t *, v,
+      if (smartlist_len(v->routerstatus_list) > max_entries)
+        max_entries = smartlist_len(v->routerstatus_list));
+    sb = strbuf_new(max_entries * VOTE_ENTRY_SIZE_HINT);
+  }
 
   {
     char va_buf[ISO_TIME_LEN+1], fu_buf[ISO_TIME_LEN+1],
@@ -1169,15 +1190,14 @@ networkstatus_compute_consensus(smartlist_t *votes,
     format_iso_time(vu_buf, valid_until);
     flaglist = smartlist_join_strings(flags, " ", 0, NULL);
 
-    smartlist_add_asprintf(chunks, "network-status-version 3%s%s\n"
+    strbuf_add_printf(sb, "network-status-version 3%s%s\n"
                  "vote-status consensus\n",
                  flavor == FLAV_NS ? "" : " ",
                  flavor == FLAV_NS ? "" : flavor_name);
 
-    smartlist_add_asprintf(chunks, "consensus-method %d\n",
-                           consensus_method);
+    strbuf_add_printf(sb, "consensus-method %d\n", consensus_method);
 
-    smartlist_add_asprintf(chunks,
+    strbuf_add_printf(sb,
                  "valid-after %s\n"
                  "fresh-until %s\n"
                  "valid-until %s\n"
@@ -1198,9 +1218,7 @@ networkstatus_compute_consensus(smartlist_t *votes,
   params = dirvote_compute_params(votes, consensus_method,
                                   total_authorities);
   if (params) {
-    smartlist_add(chunks, tor_strdup("params "));
-    smartlist_add(chunks, params);
-    smartlist_add(chunks, tor_strdup("\n"));
+    strbuf_add_printf(sb, "params %s\n", params);
   }
 
   /* Sort the votes. */
@@ -1234,14 +1252,14 @@ networkstatus_compute_consensus(smartlist_t *votes,
       base16_encode(votedigest, sizeof(votedigest), voter->vote_digest,
                     DIGEST_LEN);
 
-      smartlist_add_asprintf(chunks,
+      strbuf_add_printf(sb,
                    "dir-source %s%s %s %s %s %d %d\n",
                    voter->nickname, e->is_legacy ? "-legacy" : "",
                    fingerprint, voter->address, fmt_addr32(voter->addr),
                    voter->dir_port,
                    voter->or_port);
       if (! e->is_legacy) {
-        smartlist_add_asprintf(chunks,
+        strbuf_add_printf(sb,
                      "contact %s\n"
                      "vote-digest %s\n",
                      voter->contact,
@@ -1698,37 +1716,38 @@ networkstatus_compute_consensus(smartlist_t *votes,
         /* Okay!! Now we can write the descriptor... */
         /*     First line goes into "buf". */
         buf = routerstatus_format_entry(&rs_out, NULL, rs_format, NULL);
-        if (buf)
-          smartlist_add(chunks, buf);
+        if (buf) {
+          strbuf_add(sb, buf);
+          tor_free(buf);
+        }
       }
       /*     Now an m line, if applicable. */
       if (flavor == FLAV_MICRODESC &&
           !tor_digest256_is_zero(microdesc_digest)) {
         char m[BASE64_DIGEST256_LEN+1];
         digest256_to_base64(m, microdesc_digest);
-        smartlist_add_asprintf(chunks, "m %s\n", m);
+        strbuf_add_printf(sb, "m %s\n", m);
       }
       /*     Next line is all flags.  The "\n" is missing. */
-      smartlist_add(chunks,
-                    smartlist_join_strings(chosen_flags, " ", 0, NULL));
+      strbuf_add_joined(sb, chosen_flags, " ");
       /*     Now the version line. */
       if (chosen_version) {
-        smartlist_add(chunks, tor_strdup("\nv "));
-        smartlist_add(chunks, tor_strdup(chosen_version));
+        strbuf_add(sb, "\nv ");
+        strbuf_add(sb, chosen_version);
       }
-      smartlist_add(chunks, tor_strdup("\n"));
+      strbuf_add(sb, "\n");
       /*     Now the weight line. */
       if (rs_out.has_bandwidth) {
         int unmeasured = rs_out.bw_is_unmeasured &&
           consensus_method >= MIN_METHOD_TO_CLIP_UNMEASURED_BW;
-        smartlist_add_asprintf(chunks, "w Bandwidth=%d%s\n",
+        strbuf_add_printf(sb, "w Bandwidth=%d%s\n",
                                rs_out.bandwidth_kb,
                                unmeasured?" Unmeasured=1":"");
       }
 
       /*     Now the exitpolicy summary line. */
       if (rs_out.has_exitsummary && flavor == FLAV_NS) {
-        smartlist_add_asprintf(chunks, "p %s\n", rs_out.exitsummary);
+        strbuf_add_printf(sb, "p %s\n", rs_out.exitsummary);
       }
 
       /* And the loop is over and we move on to the next router */
@@ -1754,7 +1773,7 @@ networkstatus_compute_consensus(smartlist_t *votes,
   }
 
   /* Mark the directory footer region */
-  smartlist_add(chunks, tor_strdup("directory-footer\n"));
+  strbuf_add(sb, "directory-footer\n");
 
   {
     int64_t weight_scale = BW_WEIGHT_SCALE;
@@ -1789,7 +1808,7 @@ networkstatus_compute_consensus(smartlist_t *votes,
       }
     }
 
-    added_weights = networkstatus_compute_bw_weights_v10(chunks, G, M, E, D,
+    added_weights = networkstatus_compute_bw_weights_v10(sb, G, M, E, D,
                                                          T, weight_scale);
   }
 
@@ -1805,10 +1824,13 @@ networkstatus_compute_consensus(smartlist_t *votes,
     const char *algname = crypto_digest_algorithm_get_name(digest_alg);
     char *signature;
 
-    smartlist_add(chunks, tor_strdup("directory-signature "));
+    strbuf_add(sb, "directory-signature ");
 
-    /* Compute the hash of the chunks. */
-    crypto_digest_smartlist(digest, digest_len, chunks, "", digest_alg);
+    /* Compute the hash of everything so far. */
+    if (digest_alg == DIGEST_SHA1)
+      crypto_digest(digest, strbuf_get(sb), strbuf_len(sb));
+    else
+      crypto_digest256(digest, strbuf_get(sb), strbuf_len(sb), digest_alg);
 
     /* Get the fingerprints */
     crypto_pk_get_fingerprint(identity_key, fingerprint, 0);
@@ -1816,10 +1838,10 @@ networkstatus_compute_consensus(smartlist_t *votes,
 
     /* add the junk that will go at the end of the line. */
     if (flavor == FLAV_NS) {
-      smartlist_add_asprintf(chunks, "%s %s\n", fingerprint,
+      strbuf_add_printf(sb, "%s %s\n", fingerprint,
                    signing_key_fingerprint);
     } else {
-      smartlist_add_asprintf(chunks, "%s %s %s\n",
+      strbuf_add_printf(sb, "%s %s %s\n",
                    algname, fingerprint,
                    signing_key_fingerprint);
     }
@@ -1829,19 +1851,20 @@ networkstatus_compute_consensus(smartlist_t *votes,
       log_warn(LD_BUG, "Couldn't sign consensus networkstatus.");
       goto done;
     }
-    smartlist_add(chunks, signature);
+    strbuf_add(sb, signature);
+    tor_free(signature);
 
     if (legacy_id_key_digest && legacy_signing_key) {
-      smartlist_add(chunks, tor_strdup("directory-signature "));
+      strbuf_add(sb, "directory-signature ");
       base16_encode(fingerprint, sizeof(fingerprint),
                     legacy_id_key_digest, DIGEST_LEN);
       crypto_pk_get_fingerprint(legacy_signing_key,
                                 signing_key_fingerprint, 0);
       if (flavor == FLAV_NS) {
-        smartlist_add_asprintf(chunks, "%s %s\n", fingerprint,
+        strbuf_add_printf(sb, "%s %s\n", fingerprint,
                      signing_key_fingerprint);
       } else {
-        smartlist_add_asprintf(chunks, "%s %s %s\n",
+        strbuf_add_printf(sb, "%s %s %s\n",
                      algname, fingerprint,
                      signing_key_fingerprint);
       }
@@ -1851,11 +1874,13 @@ networkstatus_compute_consensus(smartlist_t *votes,
         log_warn(LD_BUG, "Couldn't sign consensus networkstatus.");
         goto done;
       }
-      smartlist_add(chunks, signature);
+      strbuf_add(sb, signature);
+      tor_free(signature);
     }
   }
 
-  result = smartlist_join_strings(chunks, "", 0, NULL);
+  result = strbuf_steal(sb, NULL);
+  sb = NULL;
 
   {
     networkstatus_t *c;
@@ -1878,10 +1903,10 @@ networkstatus_compute_consensus(smartlist_t *votes,
   tor_free(client_versions);
   tor_free(server_versions);
   tor_free(packages);
+  tor_free(params);
   SMARTLIST_FOREACH(flags, char *, cp, tor_free(cp));
   smartlist_free(flags);
-  SMARTLIST_FOREACH(chunks, char *, cp, tor_free(cp));
-  smartlist_free(chunks);
+  strbuf_free(sb);
 
   return result;
 }
@@ -3250,6 +3275,7 @@ dirvote_free_all(void)
   previous_vote_list = NULL;
 
   dirvote_clear_pending_consensuses();
+  dirvote_free_generated_microdescs();
   tor_free(pending_consensus_signatures);
   if (pending_consensus_signature_list) {
     /* now empty as a result of dirvote_clear_votes(). */
@@ -3423,6 +3449,20 @@ dirvote_format_microdesc_vote_line(char *out_buf, size_t out_buf_len,
                                    const microdesc_t *md,
                                    int consensus_method_low,
                                    int consensus_method_high)
+{
+  return format_microdesc_vote_line_by_digest(out_buf, out_buf_len,
+                                              md->digest,
+                                              consensus_method_low,
+                                              consensus_method_high);
+}
+
+/** As dirvote_format_microdesc_vote_line(), but take the microdescriptor's
+ * sha256 digest rather than the microdescriptor itself. */
+static ssize_t
+format_microdesc_vote_line_by_digest(char *out_buf, size_t out_buf_len,
+                                     const char *digest256,
+                                     int consensus_method_low,
+                                     int consensus_method_high)
 {
   ssize_t ret = -1;
   char d64[BASE64_DIGEST256_LEN+1];
@@ -3432,7 +3472,7 @@ dirvote_format_microdesc_vote_line(char *out_buf, size_t out_buf_len,
                                ",");
   tor_assert(microdesc_consensus_methods);
 
-  if (digest256_to_base64(d64, md->digest)<0)
+  if (digest256_to_base64(d64, digest256)<0)
     goto out;
 
   if (tor_snprintf(out_buf, out_buf_len, "m %s sha256=%s\n",
@@ -3460,46 +3500,223 @@ static const struct consensus_method_range_t {
   {-1, -1}
 };
 
+/** How many entries does microdesc_consensus_methods have, not counting
+ * the terminator? */
+#define N_MICRODESC_METHOD_RANGES \
+  ((int)ARRAY_LENGTH(microdesc_consensus_methods) - 1)
+
 /** Helper type used when generating the microdescriptor lines in a directory
  * vote. */
 typedef struct microdesc_vote_line_t {
   int low;
   int high;
+  /** The sha256 digest of the microdescriptor. */
+  char digest[DIGEST256_LEN];
+  /** The microdescriptor itself, or NULL if it's already in our
+   * microdescriptor cache. */
   microdesc_t *md;
   struct microdesc_vote_line_t *next;
 } microdesc_vote_line_t;
 
+/** A microdescriptor that we generated for one of the ranges in
+ * microdesc_consensus_methods. */
+typedef struct generated_microdesc_t {
+  /** The body of the microdescriptor, or NULL if we couldn't make one. */
+  char *body;
+  /** The length of <b>body</b>. */
+  size_t bodylen;
+  /** The sha256 digest of <b>body</b>. */
+  char digest[DIGEST256_LEN];
+} generated_microdesc_t;
+
+/** The microdescriptors that we generated from a single router
+ * descriptor. */
+typedef struct generated_microdesc_ent_t {
+  /** One microdescriptor for each entry in microdesc_consensus_methods. */
+  generated_microdesc_t mds[N_MICRODESC_METHOD_RANGES];
+  /** The value of generated_microdesc_epoch when we last looked at this
+   * entry. */
+  unsigned int last_used;
+} generated_microdesc_ent_t;
+
+/** Map from the signed_descriptor_digest of a router descriptor to the
+ * generated_microdesc_ent_t for the microdescriptors we made from it.
+ * Since a microdescriptor depends only on the descriptor it came from and
+ * the consensus method, we only need to make each one once, no matter how
+ * many votes it goes into. */
+static digestmap_t *generated_microdesc_map = NULL;
+/** Incremented every time we finish making a vote: entries not used since
+ * the last increment belong to descriptors we've stopped voting on. */
+static unsigned int generated_microdesc_epoch = 0;
+/** How many descriptors have we made microdescriptors for, since the last
+ * time we finished a vote? */
+static int n_generated_microdesc_misses = 0;
+/** How many descriptors have we reused microdescriptors for, since the last
+ * time we finished a vote? */
+static int n_generated_microdesc_hits = 0;
+
+/** Release all storage held in <b>ent</b>. */
+static void
+generated_microdesc_ent_free(generated_microdesc_ent_t *ent)
+{
+  int i;
+  if (!ent)
+    return;
+  for (i = 0; i < N_MICRODESC_METHOD_RANGES; ++i)
+    tor_free(ent->mds[i].body);
+  tor_free(ent);
+}
+
+/** Helper for digestmap_free: free a generated_microdesc_ent_t. */
+static void
+generated_microdesc_ent_free_(void *ent)
+{
+  generated_microdesc_ent_free(ent);
+}
+
+/** We just finished making a vote: forget the microdescriptors we made from
+ * every router descriptor that didn't go into it, since either the router
+ * has published a new descriptor or it isn't listed any more. */
+void
+dirvote_expire_generated_microdescs(void)
+{
+  digestmap_iter_t *iter;
+  const char *key;
+  void *val;
+  int n_expired = 0;
+
+  if (!generated_microdesc_map)
+    return;
+
+  for (iter = digestmap_iter_init(generated_microdesc_map);
+       !digestmap_iter_done(iter); ) {
+    generated_microdesc_ent_t *ent;
+    digestmap_iter_get(iter, &key, &val);
+    ent = val;
+    if (ent->last_used != generated_microdesc_epoch) {
+      generated_microdesc_ent_free(ent);
+      iter = digestmap_iter_next_rmv(generated_microdesc_map, iter);
+      ++n_expired;
+    } else {
+      iter = digestmap_iter_next(generated_microdesc_map, iter);
+    }
+  }
+
+  log_info(LD_DIR, "Made microdescriptors for %d router descriptors, and "
+           "reused them for %d others. Forgot %d that we no longer need.",
+           n_generated_microdesc_misses, n_generated_microdesc_hits,
+           n_expired);
+  n_generated_microdesc_misses = n_generated_microdesc_hits = 0;
+  ++generated_microdesc_epoch;
+}
+
+/** Release all storage held by the generated microdescriptor cache. */
+static void
+dirvote_free_generated_microdescs(void)
+{
+  digestmap_free(generated_microdesc_map, generated_microdesc_ent_free_);
+  generated_microdesc_map = NULL;
+}
+
+/** Return the entry in the generated microdescriptor cache for <b>ri</b>,
+ * creating it if we don't have one yet.  If we create it, set
+ * *<b>fresh_out</b> to a new list of the microdescriptors we made, one per
+ * entry in microdesc_consensus_methods (with NULL for any we couldn't
+ * make). */
+static generated_microdesc_ent_t *
+generated_microdesc_ent_get(const routerinfo_t *ri, smartlist_t **fresh_out)
+{
+  const char *key = ri->cache_info.signed_descriptor_digest;
+  generated_microdesc_ent_t *ent;
+  int i;
+
+  if (!generated_microdesc_map)
+    generated_microdesc_map = digestmap_new();
+
+  ent = digestmap_get(generated_microdesc_map, key);
+  if (ent) {
+    ++n_generated_microdesc_hits;
+    ent->last_used = generated_microdesc_epoch;
+    return ent;
+  }
+
+  ++n_generated_microdesc_misses;
+  ent = tor_malloc_zero(sizeof(generated_microdesc_ent_t));
+  ent->last_used = generated_microdesc_epoch;
+  *fresh_out = smartlist_new();
+  for (i = 0; i < N_MICRODESC_METHOD_RANGES; ++i) {
+    microdesc_t *md = dirvote_create_microdescriptor(ri,
+                                           microdesc_consensus_methods[i].low);
+    if (md) {
+      ent->mds[i].body = tor_memdup_nulterm(md->body, md->bodylen);
+      ent->mds[i].bodylen = md->bodylen;
+      memcpy(ent->mds[i].digest, md->digest, DIGEST256_LEN);
+    }
+    smartlist_add(*fresh_out, md);
+  }
+  digestmap_set(generated_microdesc_map, key, ent);
+  return ent;
+}
+
 /** Generate and return a linked list of all the lines that should appear to
  * describe a router's microdescriptor versions in a directory vote.
- * Add the generated microdescriptors to <b>microdescriptors_out</b>. */
+ * Add any microdescriptors that aren't in our microdescriptor cache yet to
+ * <b>microdescriptors_out</b>. */
 vote_microdesc_hash_t *
 dirvote_format_all_microdesc_vote_lines(const routerinfo_t *ri, time_t now,
                                         smartlist_t *microdescriptors_out)
 {
-  const struct consensus_method_range_t *cmr;
   microdesc_vote_line_t *entries = NULL, *ep;
   vote_microdesc_hash_t *result = NULL;
+  smartlist_t *fresh = NULL;
+  generated_microdesc_ent_t *ent = generated_microdesc_ent_get(ri, &fresh);
+  int i;
 
-  /* Generate the microdescriptors. */
-  for (cmr = microdesc_consensus_methods;
-       cmr->low != -1 && cmr->high != -1;
-       cmr++) {
-    microdesc_t *md = dirvote_create_microdescriptor(ri, cmr->low);
-    if (md) {
-      microdesc_vote_line_t *e =
-        tor_malloc_zero(sizeof(microdesc_vote_line_t));
-      e->md = md;
-      e->low = cmr->low;
-      e->high = cmr->high;
-      e->next = entries;
-      entries = e;
+  /* Find or regenerate the microdescriptors. */
+  for (i = 0; i < N_MICRODESC_METHOD_RANGES; ++i) {
+    const generated_microdesc_t *gen = &ent->mds[i];
+    microdesc_vote_line_t *e;
+    microdesc_t *md = NULL;
+    if (!gen->body)
+      continue;
+
+    if (fresh) {
+      md = smartlist_get(fresh, i);
+    } else {
+      microdesc_t *cached =
+        microdesc_cache_lookup_by_digest256(get_microdesc_cache(),
+                                            gen->digest);
+      if (cached) {
+        cached->last_listed = now;
+      } else {
+        /* It fell out of the microdescriptor cache: parse our copy again
+         * rather than building it from scratch. */
+        smartlist_t *lst =
+          microdescs_parse_from_string(gen->body, gen->body + gen->bodylen,
+                                       0, SAVED_NOWHERE, NULL);
+        if (smartlist_len(lst) == 1)
+          md = smartlist_get(lst, 0);
+        else
+          SMARTLIST_FOREACH(lst, microdesc_t *, m, microdesc_free(m));
+        smartlist_free(lst);
+        if (!md)
+          continue;
+      }
     }
+
+    e = tor_malloc_zero(sizeof(microdesc_vote_line_t));
+    memcpy(e->digest, gen->digest, DIGEST256_LEN);
+    e->md = md;
+    e->low = microdesc_consensus_methods[i].low;
+    e->high = microdesc_consensus_methods[i].high;
+    e->next = entries;
+    entries = e;
   }
 
   /* Compress adjacent identical ones */
   for (ep = entries; ep; ep = ep->next) {
     while (ep->next &&
-           fast_memeq(ep->md->digest, ep->next->md->digest, DIGEST256_LEN) &&
+           fast_memeq(ep->digest, ep->next->digest, DIGEST256_LEN) &&
            ep->low == ep->next->high + 1) {
       microdesc_vote_line_t *next = ep->next;
       ep->low = next->low;
@@ -3513,18 +3730,21 @@ dirvote_format_all_microdesc_vote_lines(const routerinfo_t *ri, time_t now,
   while ((ep = entries)) {
     char buf[128];
     vote_microdesc_hash_t *h;
-    dirvote_format_microdesc_vote_line(buf, sizeof(buf), ep->md,
-                                       ep->low, ep->high);
+    format_microdesc_vote_line_by_digest(buf, sizeof(buf), ep->digest,
+                                         ep->low, ep->high);
     h = tor_malloc_zero(sizeof(vote_microdesc_hash_t));
     h->microdesc_hash_line = tor_strdup(buf);
     h->next = result;
     result = h;
-    ep->md->last_listed = now;
-    smartlist_add(microdescriptors_out, ep->md);
+    if (ep->md) {
+      ep->md->last_listed = now;
+      smartlist_add(microdescriptors_out, ep->md);
+    }
     entries = ep->next;
     tor_free(ep);
   }
 
+  smartlist_free(fresh);
   return result;
 }
 
@@ -145,6 +145,7 @@ ssize_t dirvote_format_microdesc_vote_line(char *out, size_t out_len,
                                            const microdesc_t *md,
                                            int consensus_method_low,
                                            int consensus_method_high);
+void dirvote_expire_generated_microdescs(void);
 vote_microdesc_hash_t *dirvote_format_all_microdesc_vote_lines(
                                         const routerinfo_t *ri,
                                         time_t now,
@@ -158,9 +159,10 @@ document_signature_t *voter_get_sig_by_algorithm(
                            const networkstatus_voter_info_t *voter,
                            digest_algorithm_t alg);
 
+char *format_networkstatus_vote(crypto_pk_t *private_key,
+                                networkstatus_t *v3_ns);
+
 #ifdef DIRVOTE_PRIVATE
-STATIC char *format_networkstatus_vote(crypto_pk_t *private_key,
-                                 networkstatus_t *v3_ns);
 STATIC char *dirvote_compute_params(smartlist_t *votes, int method,
                              int total_authorities);
 STATIC char *compute_consensus_package_lines(smartlist_t *votes);
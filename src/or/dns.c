@@ -2172,6 +2172,46 @@ dump_dns_mem_usage(int severity)
       (unsigned)hash_mem);
 }
 
+#ifndef HAVE_EVENT2_DNS_H
+/** Helper for dump_dns_nameserver_stats: log the counters in <b>stats</b>
+ * for one nameserver at the severity pointed to by <b>arg</b>. */
+static void
+dump_one_nameserver_stats(const struct evdns_nameserver_stats *stats,
+                          void *arg)
+{
+  const int severity = *(const int *)arg;
+  tor_addr_t addr;
+  uint16_t port;
+  if (tor_addr_from_sockaddr(&addr, stats->address, &port) < 0)
+    return;
+  tor_log(severity, LD_EXIT,
+          "Nameserver %s is %s: "U64_FORMAT" queries sent in "U64_FORMAT
+          " writes, "U64_FORMAT" replies received in "U64_FORMAT" reads, "
+          U64_FORMAT" timeouts.",
+          fmt_addrport(&addr, port), stats->is_up ? "up" : "down",
+          U64_PRINTF_ARG(stats->n_queries_sent),
+          U64_PRINTF_ARG(stats->n_send_calls),
+          U64_PRINTF_ARG(stats->n_replies_received),
+          U64_PRINTF_ARG(stats->n_recv_calls),
+          U64_PRINTF_ARG(stats->n_timeouts));
+}
+#endif
+
+/** Log how many queries, replies and timeouts we have seen for each of our
+ * nameservers, and how well we are batching our reads and writes to them.
+ * (Only available with our internal eventdns.c.) */
+void
+dump_dns_nameserver_stats(int severity)
+{
+#ifndef HAVE_EVENT2_DNS_H
+  if (!nameservers_configured)
+    return;
+  evdns_get_nameserver_stats(dump_one_nameserver_stats, &severity);
+#else
+  (void) severity;
+#endif
+}
+
 #ifdef DEBUG_DNS_CACHE
 /** Exit with an assertion if the DNS cache is corrupt. */
 static void
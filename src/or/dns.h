@@ -27,6 +27,7 @@ int dns_seems_to_be_broken(void);
 int dns_seems_to_be_broken_for_ipv6(void);
 void dns_reset_correctness_checks(void);
 void dump_dns_mem_usage(int severity);
+void dump_dns_nameserver_stats(int severity);
 
 #endif
 
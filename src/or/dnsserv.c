@@ -8,6 +8,7 @@
  * other hand, runs on Tor servers, and acts as a DNS client.
  **/
 
+#define DNSSERV_PRIVATE
 #include "or.h"
 #include "dnsserv.h"
 #include "config.h"
@@ -25,6 +26,274 @@
 #include "eventdns.h"
 #endif
 
+/** Identical DNSPort queries that are waiting for the answer to a single
+ * RESOLVE stream.  Maps query key (as built by dnsserv_query_key) to
+ * dnsserv_pending_t. */
+static strmap_t *pending_queries = NULL;
+
+/** Answers we have recently given on a DNSPort, for reuse until their TTL
+ * runs out.  Maps query key to dnsserv_cached_answer_t. */
+static strmap_t *answer_cache = NULL;
+/** Every dnsserv_cached_answer_t in answer_cache, as a priority queue
+ * ordered by expiry time. */
+static smartlist_t *answer_cache_pqueue = NULL;
+
+/** How many DNSPort queries have we launched a RESOLVE stream for? */
+static uint64_t n_queries_launched = 0;
+/** How many DNSPort queries have we answered from answer_cache? */
+static uint64_t n_queries_cached = 0;
+/** How many DNSPort queries have we attached to another identical query
+ * that was already in flight? */
+static uint64_t n_queries_coalesced = 0;
+
+/** Return a newly allocated string identifying the DNSPort question of type
+ * <b>qtype</b> for <b>name</b>, asked by <b>client_addr</b> on
+ * <b>listener</b>.  Two queries get the same key only if the listener's
+ * isolation settings would have let their RESOLVE streams share a circuit,
+ * so that we never coalesce or share answers across isolation boundaries or
+ * NEWNYM epochs. */
+STATIC char *
+dnsserv_query_key(const listener_connection_t *listener,
+                  const tor_addr_t *client_addr, int qtype, const char *name)
+{
+  const uint8_t flags = listener->entry_cfg.isolation_flags;
+  const int session_group = (flags & ISO_SESSIONGRP) ?
+    listener->entry_cfg.session_group : 0;
+  char *lc_name = tor_strdup(name);
+  char *key = NULL;
+
+  tor_strlower(lc_name);
+  tor_asprintf(&key, "%d %u %d %u %s %s",
+               qtype, (unsigned)flags, session_group, get_signewnym_epoch(),
+               (flags & ISO_CLIENTADDR) ? fmt_addr(client_addr) : "*",
+               lc_name);
+  tor_free(lc_name);
+  return key;
+}
+
+/** Return the address family of the answers to a DNSPort question of type
+ * <b>qtype</b> about <b>name</b>: AF_INET for A questions and PTR
+ * questions about IPv4 addresses, AF_INET6 for AAAA questions and PTR
+ * questions about IPv6 addresses, and AF_UNSPEC otherwise. */
+STATIC int
+dnsserv_question_family(int qtype, const char *name)
+{
+  tor_addr_t addr;
+  switch (qtype) {
+    case EVDNS_TYPE_A:
+      return AF_INET;
+    case EVDNS_TYPE_AAAA:
+      return AF_INET6;
+    case EVDNS_TYPE_PTR:
+      if (tor_addr_parse_PTR_name(&addr, name, AF_UNSPEC, 0) == 1)
+        return tor_addr_family(&addr);
+      return AF_UNSPEC;
+    default:
+      return AF_UNSPEC;
+  }
+}
+
+/** Return true iff the port configuration <b>cfg</b> allows us to answer
+ * questions about <b>family</b> addresses from the DNSPort answer cache,
+ * just as its UseIPv4Cache and UseIPv6Cache flags control the client-side
+ * DNS cache. */
+STATIC int
+dnsserv_may_use_cached_answer(const entry_port_cfg_t *cfg, int family)
+{
+  if (family == AF_INET)
+    return cfg->use_cached_ipv4_answers;
+  else if (family == AF_INET6)
+    return cfg->use_cached_ipv6_answers;
+  return 0;
+}
+
+/** Return true iff the port configuration <b>cfg</b> allows us to remember
+ * answers about <b>family</b> addresses in the DNSPort answer cache, just as
+ * its CacheIPv4DNS and CacheIPv6DNS flags control the client-side DNS
+ * cache. */
+STATIC int
+dnsserv_may_cache_answer(const entry_port_cfg_t *cfg, int family)
+{
+  if (family == AF_INET)
+    return cfg->cache_ipv4_answers;
+  else if (family == AF_INET6)
+    return cfg->cache_ipv6_answers;
+  return 0;
+}
+
+/** Helper: compare two cached answers by expiry time. */
+static int
+compare_cached_answers_by_expiry_(const void *_a, const void *_b)
+{
+  const dnsserv_cached_answer_t *a = _a, *b = _b;
+  if (a->expires < b->expires)
+    return -1;
+  else if (a->expires == b->expires)
+    return 0;
+  else
+    return 1;
+}
+
+/** Release all storage held by <b>ent</b>. */
+static void
+cached_answer_free(dnsserv_cached_answer_t *ent)
+{
+  if (!ent)
+    return;
+  tor_free(ent->key);
+  tor_free(ent->address);
+  tor_free(ent);
+}
+
+/** Helper: free a dnsserv_cached_answer_t as a void *. */
+static void
+cached_answer_free_(void *ent)
+{
+  cached_answer_free(ent);
+}
+
+/** Helper: free a dnsserv_pending_t as a void *, without answering the
+ * requests that are waiting on it. */
+static void
+pending_free_(void *p)
+{
+  dnsserv_pending_t *pending = p;
+  smartlist_free(pending->waiting);
+  tor_free(pending);
+}
+
+/** Remove <b>ent</b> from the answer cache and free it. */
+static void
+dnsserv_cache_remove(dnsserv_cached_answer_t *ent, const char *key)
+{
+  strmap_remove(answer_cache, key);
+  smartlist_pqueue_remove(answer_cache_pqueue,
+                          compare_cached_answers_by_expiry_,
+                          STRUCT_OFFSET(dnsserv_cached_answer_t, minheap_idx),
+                          ent);
+  cached_answer_free(ent);
+}
+
+/** Remove every answer from the cache whose TTL has run out by
+ * <b>now</b>. */
+static void
+dnsserv_cache_expire(time_t now)
+{
+  dnsserv_cached_answer_t *ent;
+  if (!answer_cache_pqueue)
+    return;
+  while (smartlist_len(answer_cache_pqueue)) {
+    ent = smartlist_get(answer_cache_pqueue, 0);
+    if (ent->expires > now)
+      break;
+    dnsserv_cache_remove(ent, ent->key);
+  }
+}
+
+/** Evict answers from the cache, closest to expiry first, until it holds
+ * no more than <b>max_entries</b> of them. */
+void
+dnsserv_cache_trim(int max_entries)
+{
+  dnsserv_cached_answer_t *ent;
+  if (!answer_cache_pqueue)
+    return;
+  if (max_entries < 0)
+    max_entries = 0;
+  while (smartlist_len(answer_cache_pqueue) > max_entries) {
+    ent = smartlist_get(answer_cache_pqueue, 0);
+    dnsserv_cache_remove(ent, ent->key);
+  }
+}
+
+/** Return the unexpired cached answer for the query <b>key</b>, or NULL if
+ * we have none. */
+STATIC const dnsserv_cached_answer_t *
+dnsserv_cache_lookup(const char *key, time_t now)
+{
+  dnsserv_cached_answer_t *ent;
+  if (!answer_cache)
+    return NULL;
+  ent = strmap_get(answer_cache, key);
+  if (ent && ent->expires <= now) {
+    dnsserv_cache_remove(ent, key);
+    ent = NULL;
+  }
+  return ent;
+}
+
+/** Remember the answer of <b>answer_type</b> (with <b>answer_len</b> bytes
+ * in <b>answer</b>) to the query <b>key</b>, which we got for
+ * <b>address</b> using <b>command</b>, for <b>ttl</b> seconds after
+ * <b>now</b>.  Only successful answers are cached.  If the cache holds
+ * DNSPortCacheSize answers already, evict the ones closest to expiry. */
+STATIC void
+dnsserv_cache_answer(const char *key, uint8_t command, const char *address,
+                     int answer_type, size_t answer_len, const char *answer,
+                     int ttl, time_t now)
+{
+  const int max_entries = get_options()->DNSPortCacheSize;
+  dnsserv_cached_answer_t *ent;
+
+  if (max_entries <= 0 || ttl <= 0)
+    return;
+  if (answer_type != RESOLVED_TYPE_IPV4 &&
+      answer_type != RESOLVED_TYPE_IPV6 &&
+      answer_type != RESOLVED_TYPE_HOSTNAME)
+    return;
+  if (answer_len > sizeof(ent->answer))
+    return;
+  if (ttl > MAX_DNS_ENTRY_AGE)
+    ttl = MAX_DNS_ENTRY_AGE;
+
+  if (!answer_cache) {
+    answer_cache = strmap_new();
+    answer_cache_pqueue = smartlist_new();
+  }
+
+  dnsserv_cache_expire(now);
+  if ((ent = strmap_get(answer_cache, key)))
+    dnsserv_cache_remove(ent, key);
+  dnsserv_cache_trim(max_entries - 1);
+
+  ent = tor_malloc_zero(sizeof(dnsserv_cached_answer_t));
+  ent->address = tor_strdup(address);
+  ent->command = command;
+  ent->answer_type = answer_type;
+  ent->answer_len = answer_len;
+  memcpy(ent->answer, answer, answer_len);
+  ent->expires = now + ttl;
+  ent->minheap_idx = -1;
+  ent->key = tor_strdup(key);
+  strmap_set(answer_cache, key, ent);
+  smartlist_pqueue_add(answer_cache_pqueue,
+                       compare_cached_answers_by_expiry_,
+                       STRUCT_OFFSET(dnsserv_cached_answer_t, minheap_idx),
+                       ent);
+}
+
+/** Note that the DNSPort request <b>req</b> needs the answer to the query
+ * <b>key</b>.  If an identical query is already in flight, add <b>req</b> to
+ * the requests waiting for its answer and return 1.  Otherwise, start
+ * tracking <b>key</b> as in flight and return 0: the caller must launch a
+ * RESOLVE stream for it. */
+STATIC int
+dnsserv_pending_add(const char *key, struct evdns_server_request *req)
+{
+  dnsserv_pending_t *pending;
+  if (!pending_queries)
+    pending_queries = strmap_new();
+  pending = strmap_get(pending_queries, key);
+  if (pending) {
+    smartlist_add(pending->waiting, req);
+    return 1;
+  }
+  pending = tor_malloc_zero(sizeof(dnsserv_pending_t));
+  pending->waiting = smartlist_new();
+  strmap_set(pending_queries, key, pending);
+  return 0;
+}
+
 /** Helper function: called by evdns whenever the client sends a request to our
  * DNSPort.  We need to eventually answer the request <b>req</b>.
  */
@@ -43,6 +312,9 @@ evdns_server_callback(struct evdns_server_request *req, void *data_)
   uint16_t port;
   int err = DNS_ERR_NONE;
   char *q_name;
+  char *key;
+  const dnsserv_cached_answer_t *cached = NULL;
+  int family;
 
   tor_assert(req);
 
@@ -122,6 +394,32 @@ evdns_server_callback(struct evdns_server_request *req, void *data_)
     return;
   }
 
+  /* Can we answer this from our cache, or from a resolve that's already in
+   * flight for somebody else who could share its circuit? */
+  key = dnsserv_query_key(listener, &tor_addr, q->type, q->name);
+  family = dnsserv_question_family(q->type, q->name);
+  if (dnsserv_may_use_cached_answer(&listener->entry_cfg, family))
+    cached = dnsserv_cache_lookup(key, approx_time());
+  if (cached) {
+    log_info(LD_APP, "Answering DNS request for %s from cache.",
+             escaped_safe_str_client(q->name));
+    ++n_queries_cached;
+    dnsserv_answer_request(req, cached->command, cached->address,
+                           cached->answer_type, cached->answer_len,
+                           cached->answer,
+                           (int)(cached->expires - approx_time()));
+    tor_free(key);
+    return;
+  }
+  if (dnsserv_pending_add(key, req)) {
+    log_info(LD_APP, "Attaching DNS request for %s to an identical request "
+             "that's already in progress.", escaped_safe_str_client(q->name));
+    ++n_queries_coalesced;
+    tor_free(key);
+    return;
+  }
+  ++n_queries_launched;
+
   /* Make a new dummy AP connection, and attach the request to it. */
   entry_conn = entry_connection_new(CONN_TYPE_AP, AF_INET);
   conn = ENTRY_TO_EDGE_CONN(entry_conn);
@@ -155,13 +453,16 @@ evdns_server_callback(struct evdns_server_request *req, void *data_)
 
   entry_conn->socks_request->listener_type = listener->base_.type;
   entry_conn->dns_server_request = req;
+  entry_conn->dns_server_key = key;
+  entry_conn->dns_server_may_cache =
+    dnsserv_may_cache_answer(&listener->entry_cfg, family);
   entry_conn->entry_cfg.isolation_flags = listener->entry_cfg.isolation_flags;
   entry_conn->entry_cfg.session_group = listener->entry_cfg.session_group;
   entry_conn->nym_epoch = get_signewnym_epoch();
 
   if (connection_add(ENTRY_TO_CONN(entry_conn)) < 0) {
     log_warn(LD_APP, "Couldn't register dummy connection for DNS request");
-    evdns_server_request_respond(req, DNS_ERR_SERVERFAILED);
+    dnsserv_reject_request(entry_conn);
     connection_free(ENTRY_TO_CONN(entry_conn));
     return;
   }
@@ -260,8 +561,27 @@ dnsserv_launch_request(const char *name, int reverse,
   return 0;
 }
 
+/** Stop tracking the in-flight query <b>key</b>, and return the list of
+ * requests that were waiting for its answer.  The caller must answer every
+ * request on the list, then free the list. */
+STATIC smartlist_t *
+dnsserv_pending_take(const char *key)
+{
+  dnsserv_pending_t *pending;
+  smartlist_t *waiting;
+  if (!pending_queries)
+    return smartlist_new();
+  pending = strmap_remove(pending_queries, key);
+  if (!pending)
+    return smartlist_new();
+  waiting = pending->waiting;
+  tor_free(pending);
+  return waiting;
+}
+
 /** If there is a pending request on <b>conn</b> that's waiting for an answer,
- * send back an error and free the request. */
+ * send back an error and free the request, along with any identical requests
+ * that were waiting for the same answer. */
 void
 dnsserv_reject_request(entry_connection_t *conn)
 {
@@ -270,6 +590,14 @@ dnsserv_reject_request(entry_connection_t *conn)
                                  DNS_ERR_SERVERFAILED);
     conn->dns_server_request = NULL;
   }
+  if (conn->dns_server_key) {
+    smartlist_t *waiting = dnsserv_pending_take(conn->dns_server_key);
+    SMARTLIST_FOREACH(waiting, struct evdns_server_request *, req,
+                      evdns_server_request_respond(req,
+                                                   DNS_ERR_SERVERFAILED));
+    smartlist_free(waiting);
+    tor_free(conn->dns_server_key);
+  }
 }
 
 /** Look up the original name that corresponds to 'addr' in req.  We use this
@@ -304,24 +632,18 @@ evdns_get_orig_address(const struct evdns_server_request *req,
   return addr;
 }
 
-/** Tell the dns request waiting for an answer on <b>conn</b> that we have an
- * answer of type <b>answer_type</b> (RESOLVE_TYPE_IPV4/IPV6/ERR), of length
- * <b>answer_len</b>, in <b>answer</b>, with TTL <b>ttl</b>.  Doesn't do
- * any caching; that's handled elsewhere. */
-void
-dnsserv_resolved(entry_connection_t *conn,
-                 int answer_type,
-                 size_t answer_len,
-                 const char *answer,
-                 int ttl)
+/** Answer the DNSPort request <b>req</b>: we looked up <b>address</b> with
+ * the SOCKS command <b>command</b>, and got an answer of type
+ * <b>answer_type</b> (RESOLVE_TYPE_IPV4/IPV6/ERR), of length
+ * <b>answer_len</b>, in <b>answer</b>, with TTL <b>ttl</b>. */
+MOCK_IMPL(STATIC void,
+dnsserv_answer_request,(struct evdns_server_request *req, uint8_t command,
+                        const char *address, int answer_type,
+                        size_t answer_len, const char *answer, int ttl))
 {
-  struct evdns_server_request *req = conn->dns_server_request;
   const char *name;
   int err = DNS_ERR_NONE;
-  if (!req)
-    return;
-  name = evdns_get_orig_address(req, answer_type,
-                                conn->socks_request->address);
+  name = evdns_get_orig_address(req, answer_type, address);
 
   /* XXXX Re-do; this is dumb. */
   if (ttl < 60)
@@ -335,13 +657,13 @@ dnsserv_resolved(entry_connection_t *conn,
                                         name,
                                         1, answer, ttl);
   } else if (answer_type == RESOLVED_TYPE_IPV4 && answer_len == 4 &&
-             conn->socks_request->command == SOCKS_COMMAND_RESOLVE) {
+             command == SOCKS_COMMAND_RESOLVE) {
     evdns_server_request_add_a_reply(req,
                                      name,
                                      1, answer, ttl);
   } else if (answer_type == RESOLVED_TYPE_HOSTNAME &&
              answer_len < 256 &&
-             conn->socks_request->command == SOCKS_COMMAND_RESOLVE_PTR) {
+             command == SOCKS_COMMAND_RESOLVE_PTR) {
     char *ans = tor_strndup(answer, answer_len);
     evdns_server_request_add_ptr_reply(req, NULL,
                                        name,
@@ -354,8 +676,75 @@ dnsserv_resolved(entry_connection_t *conn,
   }
 
   evdns_server_request_respond(req, err);
+}
+
+/** Tell the dns request waiting for an answer on <b>conn</b>, and any
+ * identical requests that were waiting along with it, that we have an
+ * answer of type <b>answer_type</b> (RESOLVE_TYPE_IPV4/IPV6/ERR), of length
+ * <b>answer_len</b>, in <b>answer</b>, with TTL <b>ttl</b>.  Successful
+ * answers are remembered in our DNSPort answer cache, if the DNSPort that
+ * asked lets us cache them. */
+void
+dnsserv_resolved(entry_connection_t *conn,
+                 int answer_type,
+                 size_t answer_len,
+                 const char *answer,
+                 int ttl)
+{
+  struct evdns_server_request *req = conn->dns_server_request;
+  const uint8_t command = conn->socks_request->command;
+  const char *address = conn->socks_request->address;
+  if (!req)
+    return;
 
+  dnsserv_answer_request(req, command, address,
+                         answer_type, answer_len, answer, ttl);
   conn->dns_server_request = NULL;
+
+  if (conn->dns_server_key) {
+    smartlist_t *waiting = dnsserv_pending_take(conn->dns_server_key);
+    SMARTLIST_FOREACH(waiting, struct evdns_server_request *, r,
+                      dnsserv_answer_request(r, command, address,
+                                             answer_type, answer_len,
+                                             answer, ttl));
+    smartlist_free(waiting);
+    if (conn->dns_server_may_cache)
+      dnsserv_cache_answer(conn->dns_server_key, command, address,
+                           answer_type, answer_len, answer, ttl,
+                           approx_time());
+    tor_free(conn->dns_server_key);
+  }
+}
+
+/** Log how many DNSPort queries we have answered from our answer cache, or
+ * by coalescing them with identical queries, rather than by launching a
+ * RESOLVE stream of their own. */
+void
+dnsserv_log_stats(int severity)
+{
+  if (!n_queries_launched && !n_queries_cached && !n_queries_coalesced)
+    return;
+  tor_log(severity, LD_APP,
+          "DNSPort: "U64_FORMAT" queries launched a resolve, "U64_FORMAT
+          " were answered from the cache (%d entries), and "U64_FORMAT
+          " waited on an identical resolve already in progress.",
+          U64_PRINTF_ARG(n_queries_launched),
+          U64_PRINTF_ARG(n_queries_cached),
+          answer_cache ? strmap_size(answer_cache) : 0,
+          U64_PRINTF_ARG(n_queries_coalesced));
+}
+
+/** Release all storage held by the DNSPort answer cache and the table of
+ * in-flight queries. */
+void
+dnsserv_free_all(void)
+{
+  strmap_free(answer_cache, cached_answer_free_);
+  answer_cache = NULL;
+  smartlist_free(answer_cache_pqueue);
+  answer_cache_pqueue = NULL;
+  strmap_free(pending_queries, pending_free_);
+  pending_queries = NULL;
 }
 
 /** Set up the evdns server port for the UDP socket on <b>conn</b>, which
@@ -22,6 +22,58 @@ void dnsserv_resolved(entry_connection_t *conn,
 void dnsserv_reject_request(entry_connection_t *conn);
 int dnsserv_launch_request(const char *name, int is_reverse,
                            control_connection_t *control_conn);
+void dnsserv_log_stats(int severity);
+void dnsserv_cache_trim(int max_entries);
+void dnsserv_free_all(void);
+
+#ifdef DNSSERV_PRIVATE
+/** A successful answer that we gave to a DNSPort query, kept until its TTL
+ * runs out so that we can give it again. */
+typedef struct dnsserv_cached_answer_t {
+  /** The query key (from dnsserv_query_key) that this answers. */
+  char *key;
+  /** The address we actually looked up (after any rewriting). */
+  char *address;
+  /** SOCKS_COMMAND_RESOLVE or SOCKS_COMMAND_RESOLVE_PTR. */
+  uint8_t command;
+  /** One of the RESOLVED_TYPE_* values. */
+  int answer_type;
+  size_t answer_len;
+  char answer[256];
+  /** When does this answer's TTL run out? */
+  time_t expires;
+  /** Position in the answer cache's expiry priority queue. */
+  int minheap_idx;
+} dnsserv_cached_answer_t;
+
+/** The DNSPort requests waiting for a single in-flight RESOLVE stream. */
+typedef struct dnsserv_pending_t {
+  /** Requests (struct evdns_server_request *) identical to the one on the
+   * RESOLVE stream, to be answered along with it. */
+  smartlist_t *waiting;
+} dnsserv_pending_t;
+
+STATIC int dnsserv_question_family(int qtype, const char *name);
+STATIC int dnsserv_may_use_cached_answer(const entry_port_cfg_t *cfg,
+                                         int family);
+STATIC int dnsserv_may_cache_answer(const entry_port_cfg_t *cfg, int family);
+STATIC char *dnsserv_query_key(const listener_connection_t *listener,
+                               const tor_addr_t *client_addr, int qtype,
+                               const char *name);
+STATIC const dnsserv_cached_answer_t *dnsserv_cache_lookup(const char *key,
+                                                           time_t now);
+STATIC void dnsserv_cache_answer(const char *key, uint8_t command,
+                                 const char *address, int answer_type,
+                                 size_t answer_len, const char *answer,
+                                 int ttl, time_t now);
+STATIC int dnsserv_pending_add(const char *key,
+                               struct evdns_server_request *req);
+STATIC smartlist_t *dnsserv_pending_take(const char *key);
+MOCK_DECL(STATIC void, dnsserv_answer_request,
+          (struct evdns_server_request *req, uint8_t command,
+           const char *address, int answer_type, size_t answer_len,
+           const char *answer, int ttl));
+#endif
 
 #endif
 
@@ -455,86 +455,295 @@ geoip_db_digest(sa_family_t family)
     return hex_str(geoip6_digest, DIGEST_LEN);
 }
 
-/** Entry in a map from IP address to the last time we've seen an incoming
- * connection from that IP address. Used by bridges only, to track which
- * countries have them blocked. */
-typedef struct clientmap_entry_t {
-  HT_ENTRY(clientmap_entry_t) node;
-  tor_addr_t addr;
- /* Name of pluggable transport used by this client. NULL if no
-    pluggable transport was used. */
-  char *transport_name;
-
-  /** Time when we last saw this IP address, in MINUTES since the epoch.
-   *
-   * (This will run out of space around 4011 CE.  If Tor is still in use around
-   * 4000 CE, please remember to add more bits to last_seen_in_minutes.) */
-  unsigned int last_seen_in_minutes:30;
-  unsigned int action:2;
-} clientmap_entry_t;
-
-/** Largest allowable value for last_seen_in_minutes.  (It's a 30-bit field,
- * so it can hold up to (1u<<30)-1, or 0x3fffffffu.
- */
+/** Number of bits of a client address hash that we use to pick a
+ * HyperLogLog register.  With 2^10 registers, the standard error of our
+ * estimates is about 3%, well within IP_GRANULARITY for small counts. */
+#define CLIENT_SKETCH_BITS 10
+/** Number of registers in each dense slice of a client_sketch_t. */
+#define CLIENT_SKETCH_REGISTERS (1<<CLIENT_SKETCH_BITS)
+/** Largest allowable value for last_seen_in_minutes. */
 #define MAX_LAST_SEEN_IN_MINUTES 0X3FFFFFFFu
 
-/** Map from client IP address to last time seen. */
-static HT_HEAD(clientmap, clientmap_entry_t) client_history =
-     HT_INITIALIZER();
+/** Return the hash under which we count the client at <b>addr</b> in our
+ * client_sketch_t counters.  Tests replace this to get the same hashes on
+ * every run, instead of ones keyed by our random siphash key. */
+MOCK_IMPL(STATIC uint64_t,
+geoip_client_addr_hash,(const tor_addr_t *addr))
+{
+  return tor_addr_hash(addr);
+}
+
+/** Return a newly allocated, empty client_sketch_t. */
+STATIC client_sketch_t *
+client_sketch_new(void)
+{
+  return tor_malloc_zero(sizeof(client_sketch_t));
+}
+
+/** Free all storage held by <b>sketch</b>. */
+STATIC void
+client_sketch_free(client_sketch_t *sketch)
+{
+  int i;
+  if (!sketch)
+    return;
+  tor_free(sketch->exact);
+  for (i = 0; i < CLIENT_SKETCH_N_SLICES; ++i)
+    tor_free(sketch->slices[i]);
+  tor_free(sketch);
+}
+
+/** Helper: free a client_sketch_t that we're storing in a map. */
+static void
+client_sketch_free_(void *sketch)
+{
+  client_sketch_free(sketch);
+}
 
-/** Hashtable helper: compute a hash of a clientmap_entry_t. */
-static INLINE unsigned
-clientmap_entry_hash(const clientmap_entry_t *a)
+/** Add the client whose address hashes to <b>addr_hash</b>, seen at
+ * <b>when</b>, to the HyperLogLog registers of the right slice of the dense
+ * <b>sketch</b>. */
+static void
+client_sketch_add_dense(client_sketch_t *sketch, uint64_t addr_hash,
+                        time_t when)
 {
-  unsigned h = (unsigned) tor_addr_hash(&a->addr);
+  const time_t slice_idx = (when > 0 ? when : 0) / CLIENT_SKETCH_SLICE_LEN;
+  const int pos = (int)(slice_idx % CLIENT_SKETCH_N_SLICES);
+  const unsigned reg = (unsigned)(addr_hash >> (64 - CLIENT_SKETCH_BITS));
+  const uint64_t rest = addr_hash << CLIENT_SKETCH_BITS;
+  uint8_t rank, *regs;
+
+  if (!sketch->slices[pos]) {
+    sketch->slices[pos] = tor_malloc_zero(CLIENT_SKETCH_REGISTERS);
+    sketch->slice_idx[pos] = slice_idx;
+  } else if (sketch->slice_idx[pos] < slice_idx) {
+    /* This slice is a full ring ago: recycle it. */
+    memset(sketch->slices[pos], 0, CLIENT_SKETCH_REGISTERS);
+    sketch->slice_idx[pos] = slice_idx;
+  } else if (sketch->slice_idx[pos] > slice_idx) {
+    /* Too old to fit in the ring at all. */
+    return;
+  }
+
+  /* The rank is the position of the first set bit after the register
+   * index. */
+  if (rest)
+    rank = (uint8_t)(64 - tor_log2(rest));
+  else
+    rank = 64 - CLIENT_SKETCH_BITS + 1;
+  regs = sketch->slices[pos];
+  if (regs[reg] < rank)
+    regs[reg] = rank;
+}
+
+/** Note that we have seen the client whose address hashes to
+ * <b>addr_hash</b> at time <b>now</b>. */
+STATIC void
+client_sketch_add(client_sketch_t *sketch, uint64_t addr_hash, time_t now)
+{
+  uint32_t minutes;
+  int i;
+
+  if (sketch->is_dense) {
+    client_sketch_add_dense(sketch, addr_hash, now);
+    return;
+  }
+
+  if (now / 60 <= (time_t)MAX_LAST_SEEN_IN_MINUTES && now >= 0)
+    minutes = (uint32_t)(now / 60);
+  else
+    minutes = 0;
 
-  if (a->transport_name)
-    h += (unsigned) siphash24g(a->transport_name, strlen(a->transport_name));
+  for (i = 0; i < sketch->n_exact; ++i) {
+    if (sketch->exact[i].addr_hash == addr_hash) {
+      sketch->exact[i].last_seen_in_minutes = minutes;
+      return;
+    }
+  }
+
+  if (sketch->n_exact == CLIENT_SKETCH_MAX_EXACT) {
+    /* Too many clients to remember individually: fold them into the
+     * registers, keeping their last-seen times. */
+    for (i = 0; i < sketch->n_exact; ++i) {
+      client_sketch_add_dense(sketch, sketch->exact[i].addr_hash,
+                    (time_t)sketch->exact[i].last_seen_in_minutes * 60);
+    }
+    tor_free(sketch->exact);
+    sketch->n_exact = sketch->n_exact_allocated = 0;
+    sketch->is_dense = 1;
+    client_sketch_add_dense(sketch, addr_hash, now);
+    return;
+  }
 
-  return h;
+  if (sketch->n_exact == sketch->n_exact_allocated) {
+    sketch->n_exact_allocated = sketch->n_exact_allocated ?
+      sketch->n_exact_allocated * 2 : 8;
+    sketch->exact = tor_reallocarray(sketch->exact,
+                                     sketch->n_exact_allocated,
+                                     sizeof(sketch_client_t));
+  }
+  sketch->exact[sketch->n_exact].addr_hash = addr_hash;
+  sketch->exact[sketch->n_exact].last_seen_in_minutes = minutes;
+  ++sketch->n_exact;
 }
-/** Hashtable helper: compare two clientmap_entry_t values for equality. */
-static INLINE int
-clientmap_entries_eq(const clientmap_entry_t *a, const clientmap_entry_t *b)
+
+/** Return the number of distinct clients that <b>sketch</b> has seen since
+ * <b>cutoff</b>.  The answer is exact if there are only a few of them, and
+ * a HyperLogLog estimate otherwise; in the latter case, clients seen up to
+ * CLIENT_SKETCH_SLICE_LEN seconds before <b>cutoff</b> may be counted. */
+STATIC unsigned
+client_sketch_count(const client_sketch_t *sketch, time_t cutoff)
 {
-  if (strcmp_opt(a->transport_name, b->transport_name))
+  uint8_t regs[CLIENT_SKETCH_REGISTERS];
+  const double m = CLIENT_SKETCH_REGISTERS;
+  double sum = 0.0, estimate;
+  int i, n_slices = 0, n_zero = 0;
+
+  if (!sketch)
+    return 0;
+
+  if (!sketch->is_dense) {
+    const uint32_t cutoff_minutes = cutoff > 0 ? (uint32_t)(cutoff / 60) : 0;
+    unsigned n = 0;
+    for (i = 0; i < sketch->n_exact; ++i) {
+      if (sketch->exact[i].last_seen_in_minutes >= cutoff_minutes)
+        ++n;
+    }
+    return n;
+  }
+
+  memset(regs, 0, sizeof(regs));
+  for (i = 0; i < CLIENT_SKETCH_N_SLICES; ++i) {
+    const uint8_t *slice = sketch->slices[i];
+    int j;
+    if (!slice ||
+        (sketch->slice_idx[i] + 1) * CLIENT_SKETCH_SLICE_LEN <= cutoff)
+      continue;
+    ++n_slices;
+    for (j = 0; j < CLIENT_SKETCH_REGISTERS; ++j) {
+      if (regs[j] < slice[j])
+        regs[j] = slice[j];
+    }
+  }
+  if (!n_slices)
     return 0;
 
-  return !tor_addr_compare(&a->addr, &b->addr, CMP_EXACT) &&
-         a->action == b->action;
+  for (i = 0; i < CLIENT_SKETCH_REGISTERS; ++i) {
+    sum += 1.0 / (double)(U64_LITERAL(1) << regs[i]);
+    if (!regs[i])
+      ++n_zero;
+  }
+  estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+  /* Use linear counting for small cardinalities, where the raw HyperLogLog
+   * estimate is biased. */
+  if (estimate <= 2.5 * m && n_zero)
+    estimate = m * tor_mathlog(m / n_zero);
+  return (unsigned) tor_lround(estimate);
 }
 
-HT_PROTOTYPE(clientmap, clientmap_entry_t, node, clientmap_entry_hash,
-             clientmap_entries_eq);
-HT_GENERATE2(clientmap, clientmap_entry_t, node, clientmap_entry_hash,
-             clientmap_entries_eq, 0.6, tor_reallocarray_, tor_free_)
+/** Forget the clients in <b>sketch</b> that haven't been seen since
+ * <b>cutoff</b>; in dense mode, forget whole slices that end before
+ * <b>cutoff</b>.  Return true iff the sketch is now empty. */
+STATIC int
+client_sketch_remove_old(client_sketch_t *sketch, time_t cutoff)
+{
+  int i, n_left = 0;
 
-/** Free all storage held by <b>ent</b>. */
-static void
-clientmap_entry_free(clientmap_entry_t *ent)
+  if (!sketch->is_dense) {
+    const uint32_t cutoff_minutes = cutoff > 0 ? (uint32_t)(cutoff / 60) : 0;
+    for (i = 0; i < sketch->n_exact; ++i) {
+      if (sketch->exact[i].last_seen_in_minutes >= cutoff_minutes)
+        sketch->exact[n_left++] = sketch->exact[i];
+    }
+    sketch->n_exact = n_left;
+    return n_left == 0;
+  }
+
+  for (i = 0; i < CLIENT_SKETCH_N_SLICES; ++i) {
+    if (!sketch->slices[i])
+      continue;
+    if ((sketch->slice_idx[i] + 1) * CLIENT_SKETCH_SLICE_LEN <= cutoff)
+      tor_free(sketch->slices[i]);
+    else
+      ++n_left;
+  }
+  if (!n_left)
+    sketch->is_dense = 0; /* Start over with exact counting. */
+  return n_left == 0;
+}
+
+/** Sketches of the clients we've seen for one geoip_client_action_t. */
+typedef struct client_history_t {
+  /** One client_sketch_t (or NULL) per entry in geoip_countries; clients
+   * whose country we can't resolve go at index 0. */
+  smartlist_t *by_country;
+  /** Sketches of the clients connecting over IPv4 and over IPv6. */
+  client_sketch_t *by_family[2];
+  /** Map from pluggable transport name to sketch of the clients that
+   * connected with that transport.  Only used for GEOIP_CLIENT_CONNECT. */
+  strmap_t *by_transport;
+} client_history_t;
+
+/** Client history, indexed by geoip_client_action_t. */
+static client_history_t client_history[2];
+
+/** Special transport name used for clients that didn't use a pluggable
+ * transport. Pluggable transport names can't have symbols in their names,
+ * so this string will never collide with a real transport. */
+static const char no_transport_str[] = "<OR>";
+
+/** Return the client_history_t for <b>action</b>. */
+static client_history_t *
+client_history_get(geoip_client_action_t action)
 {
-  if (!ent)
-    return;
+  tor_assert(action == GEOIP_CLIENT_CONNECT ||
+             action == GEOIP_CLIENT_NETWORKSTATUS);
+  return &client_history[action];
+}
 
-  tor_free(ent->transport_name);
-  tor_free(ent);
+/** Forget every client we've seen for <b>action</b>. */
+static void
+client_history_clear_action(geoip_client_action_t action)
+{
+  client_history_t *hist = client_history_get(action);
+  if (hist->by_country) {
+    SMARTLIST_FOREACH(hist->by_country, client_sketch_t *, sk,
+                      client_sketch_free(sk));
+    smartlist_free(hist->by_country);
+    hist->by_country = NULL;
+  }
+  client_sketch_free(hist->by_family[0]);
+  client_sketch_free(hist->by_family[1]);
+  hist->by_family[0] = hist->by_family[1] = NULL;
+  if (hist->by_transport) {
+    strmap_free(hist->by_transport, client_sketch_free_);
+    hist->by_transport = NULL;
+  }
 }
 
 /** Clear history of connecting clients used by entry and bridge stats. */
 static void
 client_history_clear(void)
 {
-  clientmap_entry_t **ent, **next, *this;
-  for (ent = HT_START(clientmap, &client_history); ent != NULL;
-       ent = next) {
-    if ((*ent)->action == GEOIP_CLIENT_CONNECT) {
-      this = *ent;
-      next = HT_NEXT_RMV(clientmap, &client_history, ent);
-      clientmap_entry_free(this);
-    } else {
-      next = HT_NEXT(clientmap, &client_history, ent);
-    }
+  client_history_clear_action(GEOIP_CLIENT_CONNECT);
+}
+
+/** Return the sketch for <b>country</b> in <b>hist</b>, creating it if
+ * necessary. */
+static client_sketch_t *
+client_history_country_sketch(client_history_t *hist, int country)
+{
+  client_sketch_t *sketch;
+  if (!hist->by_country)
+    hist->by_country = smartlist_new();
+  while (smartlist_len(hist->by_country) <= country)
+    smartlist_add(hist->by_country, NULL);
+  sketch = smartlist_get(hist->by_country, country);
+  if (!sketch) {
+    sketch = client_sketch_new();
+    smartlist_set(hist->by_country, country, sketch);
   }
+  return sketch;
 }
 
 /** Note that we've seen a client connect from the IP <b>addr</b>
@@ -547,8 +756,9 @@ geoip_note_client_seen(geoip_client_action_t action,
                        time_t now)
 {
   const or_options_t *options = get_options();
-  clientmap_entry_t lookup, *ent;
-  memset(&lookup, 0, sizeof(clientmap_entry_t));
+  client_history_t *hist;
+  uint64_t addr_hash;
+  int country_idx;
 
   if (action == GEOIP_CLIENT_CONNECT) {
     /* Only remember statistics as entry guard or as bridge. */
@@ -566,28 +776,43 @@ geoip_note_client_seen(geoip_client_action_t action,
             safe_str_client(fmt_addr((addr))),
             transport_name ? transport_name : "<no transport>");
 
-  tor_addr_copy(&lookup.addr, addr);
-  lookup.action = (int)action;
-  lookup.transport_name = (char*) transport_name;
-  ent = HT_FIND(clientmap, &client_history, &lookup);
-
-  if (! ent) {
-    ent = tor_malloc_zero(sizeof(clientmap_entry_t));
-    tor_addr_copy(&ent->addr, addr);
-    if (transport_name)
-      ent->transport_name = tor_strdup(transport_name);
-    ent->action = (int)action;
-    HT_INSERT(clientmap, &client_history, ent);
+  hist = client_history_get(action);
+  addr_hash = geoip_client_addr_hash(addr);
+
+  country_idx = geoip_get_country_by_addr(addr);
+  if (country_idx < 0)
+    country_idx = 0; /** unresolved requests are stored at index 0. */
+  client_sketch_add(client_history_country_sketch(hist, country_idx),
+                    addr_hash, now);
+
+  switch (tor_addr_family(addr)) {
+    case AF_INET:
+    case AF_INET6: {
+      const int fam_idx = tor_addr_family(addr) == AF_INET ? 0 : 1;
+      if (!hist->by_family[fam_idx])
+        hist->by_family[fam_idx] = client_sketch_new();
+      client_sketch_add(hist->by_family[fam_idx], addr_hash, now);
+      break;
+    }
+    default:
+      break;
+  }
+
+  if (action == GEOIP_CLIENT_CONNECT) {
+    client_sketch_t *sketch;
+    if (!transport_name)
+      transport_name = no_transport_str;
+    if (!hist->by_transport)
+      hist->by_transport = strmap_new();
+    sketch = strmap_get(hist->by_transport, transport_name);
+    if (!sketch) {
+      sketch = client_sketch_new();
+      strmap_set(hist->by_transport, transport_name, sketch);
+    }
+    client_sketch_add(sketch, addr_hash, now);
   }
-  if (now / 60 <= (int)MAX_LAST_SEEN_IN_MINUTES && now >= 0)
-    ent->last_seen_in_minutes = (unsigned)(now/60);
-  else
-    ent->last_seen_in_minutes = 0;
 
   if (action == GEOIP_CLIENT_NETWORKSTATUS) {
-    int country_idx = geoip_get_country_by_addr(addr);
-    if (country_idx < 0)
-      country_idx = 0; /** unresolved requests are stored at index 0. */
     if (country_idx >= 0 && country_idx < smartlist_len(geoip_countries)) {
       geoip_country_t *country = smartlist_get(geoip_countries, country_idx);
       ++country->n_v3_ns_requests;
@@ -595,27 +820,36 @@ geoip_note_client_seen(geoip_client_action_t action,
   }
 }
 
-/** HT_FOREACH helper: remove a clientmap_entry_t from the hashtable if it's
- * older than a certain time. */
-static int
-remove_old_client_helper_(struct clientmap_entry_t *ent, void *_cutoff)
-{
-  time_t cutoff = *(time_t*)_cutoff / 60;
-  if (ent->last_seen_in_minutes < cutoff) {
-    clientmap_entry_free(ent);
-    return 1;
-  } else {
-    return 0;
-  }
-}
-
-/** Forget about all clients that haven't connected since <b>cutoff</b>. */
+/** Forget about all clients that haven't connected since <b>cutoff</b>.
+ * (Once we've seen too many clients to track them individually, this is
+ * only accurate to within CLIENT_SKETCH_SLICE_LEN.) */
 void
 geoip_remove_old_clients(time_t cutoff)
 {
-  clientmap_HT_FOREACH_FN(&client_history,
-                          remove_old_client_helper_,
-                          &cutoff);
+  int action;
+  for (action = 0; action < 2; ++action) {
+    client_history_t *hist = &client_history[action];
+    if (hist->by_country) {
+      SMARTLIST_FOREACH_BEGIN(hist->by_country, client_sketch_t *, sk) {
+        if (sk && client_sketch_remove_old(sk, cutoff)) {
+          client_sketch_free(sk);
+          SMARTLIST_REPLACE_CURRENT(hist->by_country, sk, NULL);
+        }
+      } SMARTLIST_FOREACH_END(sk);
+    }
+    if (hist->by_family[0])
+      client_sketch_remove_old(hist->by_family[0], cutoff);
+    if (hist->by_family[1])
+      client_sketch_remove_old(hist->by_family[1], cutoff);
+    if (hist->by_transport) {
+      STRMAP_FOREACH_MODIFY(hist->by_transport, name, client_sketch_t *, sk) {
+        if (client_sketch_remove_old(sk, cutoff)) {
+          client_sketch_free(sk);
+          MAP_DEL_CURRENT(name);
+        }
+      } STRMAP_FOREACH_END;
+    }
+  }
 }
 
 /** How many responses are we giving to clients requesting v3 network
@@ -812,77 +1046,46 @@ char *
 geoip_get_transport_history(void)
 {
   unsigned granularity = IP_GRANULARITY;
-  /** String hash table (name of transport) -> (number of users). */
-  strmap_t *transport_counts = strmap_new();
+  const client_history_t *hist = client_history_get(GEOIP_CLIENT_CONNECT);
 
-  /** Smartlist that contains copies of the names of the transports
-      that have been used. */
+  /** Smartlist that contains the names of the transports that have been
+      used. */
   smartlist_t *transports_used = smartlist_new();
 
-  /* Special string to signify that no transport was used for this
-     connection. Pluggable transport names can't have symbols in their
-     names, so this string will never collide with a real transport. */
-  static const char* no_transport_str = "<OR>";
-
-  clientmap_entry_t **ent;
-  const char *transport_name = NULL;
   smartlist_t *string_chunks = smartlist_new();
   char *the_string = NULL;
 
   /* If we haven't seen any clients yet, return NULL. */
-  if (HT_EMPTY(&client_history))
+  if (!hist->by_transport || strmap_isempty(hist->by_transport))
     goto done;
 
   /** We do the following steps to form the transport history string:
-   *  a) Foreach client that uses a pluggable transport, we increase the
-   *  times that transport was used by one. If the client did not use
-   *  a transport, we increase the number of times someone connected
-   *  without obfuscation.
-   *  b) Foreach transport we observed, we write its transport history
-   *  string and push it to string_chunks. So, for example, if we've
-   *  seen 665 obfs2 clients, we write "obfs2=665".
+   *  a) Foreach transport we observed (including "<OR>" for clients that
+   *  didn't use one), we estimate how many distinct clients used it.
+   *  b) We write its transport history string and push it to
+   *  string_chunks. So, for example, if we've seen 665 obfs2 clients, we
+   *  write "obfs2=665".
    *  c) We concatenate string_chunks to form the final string.
    */
 
-  log_debug(LD_GENERAL,"Starting iteration for transport history. %d clients.",
-            HT_SIZE(&client_history));
-
-  /* Loop through all clients. */
-  HT_FOREACH(ent, clientmap, &client_history) {
-    uintptr_t val;
-    void *ptr;
-    transport_name = (*ent)->transport_name;
-    if (!transport_name)
-      transport_name = no_transport_str;
-
-    /* Increase the count for this transport name. */
-    ptr = strmap_get(transport_counts, transport_name);
-    val = (uintptr_t)ptr;
-    val++;
-    ptr = (void*)val;
-    strmap_set(transport_counts, transport_name, ptr);
-
-    /* If it's the first time we see this transport, note it. */
-    if (val == 1)
-      smartlist_add(transports_used, tor_strdup(transport_name));
-
-    log_debug(LD_GENERAL, "Client from '%s' with transport '%s'. "
-              "I've now seen %d clients.",
-              safe_str_client(fmt_addr(&(*ent)->addr)),
-              transport_name ? transport_name : "<no transport>",
-              (int)val);
-  }
+  STRMAP_FOREACH(hist->by_transport, transport_name, client_sketch_t *, sk) {
+    (void)sk;
+    smartlist_add(transports_used, (char *)transport_name);
+  } STRMAP_FOREACH_END;
 
   /* Sort the transport names (helps with unit testing). */
   smartlist_sort_strings(transports_used);
 
   /* Loop through all seen transports. */
   SMARTLIST_FOREACH_BEGIN(transports_used, const char *, transport_name) {
-    void *transport_count_ptr = strmap_get(transport_counts, transport_name);
-    uintptr_t transport_count = (uintptr_t) transport_count_ptr;
+    const client_sketch_t *sk = strmap_get(hist->by_transport,
+                                           transport_name);
+    unsigned transport_count = client_sketch_count(sk, 0);
 
-    log_debug(LD_GENERAL, "We got "U64_FORMAT" clients with transport '%s'.",
-              U64_PRINTF_ARG((uint64_t)transport_count), transport_name);
+    log_debug(LD_GENERAL, "We got %u clients with transport '%s'.",
+              transport_count, transport_name);
+    if (!transport_count)
+      continue;
 
     smartlist_add_asprintf(string_chunks, "%s="U64_FORMAT,
                            transport_name,
@@ -896,8 +1099,6 @@ geoip_get_transport_history(void)
   log_debug(LD_GENERAL, "Final bridge-ip-transports string: '%s'", the_string);
 
  done:
-  strmap_free(transport_counts, NULL);
-  SMARTLIST_FOREACH(transports_used, char *, s, tor_free(s));
   smartlist_free(transports_used);
   SMARTLIST_FOREACH(string_chunks, char *, s, tor_free(s));
   smartlist_free(string_chunks);
@@ -1025,34 +1226,25 @@ geoip_get_client_history(geoip_client_action_t action,
   smartlist_t *entries = NULL;
   int n_countries = geoip_get_n_countries();
   int i;
-  clientmap_entry_t **ent;
+  const client_history_t *hist = client_history_get(action);
   unsigned *counts = NULL;
   unsigned total = 0;
-  unsigned ipv4_count = 0, ipv6_count = 0;
+  unsigned ipv4_count, ipv6_count;
 
   if (!geoip_is_loaded(AF_INET) && !geoip_is_loaded(AF_INET6))
     return -1;
 
   counts = tor_calloc(n_countries, sizeof(unsigned));
-  HT_FOREACH(ent, clientmap, &client_history) {
-    int country;
-    if ((*ent)->action != (int)action)
-      continue;
-    country = geoip_get_country_by_addr(&(*ent)->addr);
-    if (country < 0)
-      country = 0; /** unresolved requests are stored at index 0. */
-    tor_assert(0 <= country && country < n_countries);
-    ++counts[country];
-    ++total;
-    switch (tor_addr_family(&(*ent)->addr)) {
-    case AF_INET:
-      ipv4_count++;
-      break;
-    case AF_INET6:
-      ipv6_count++;
-      break;
-    }
+  if (hist->by_country) {
+    SMARTLIST_FOREACH_BEGIN(hist->by_country, const client_sketch_t *, sk) {
+      if (sk_sl_idx >= n_countries)
+        break;
+      counts[sk_sl_idx] = client_sketch_count(sk, 0);
+      total += counts[sk_sl_idx];
+    } SMARTLIST_FOREACH_END(sk);
   }
+  ipv4_count = client_sketch_count(hist->by_family[0], 0);
+  ipv6_count = client_sketch_count(hist->by_family[1], 0);
   if (ipver_str) {
     smartlist_t *chunks = smartlist_new();
     smartlist_add_asprintf(chunks, "v4=%u",
@@ -1166,19 +1358,7 @@ geoip_reset_dirreq_stats(time_t now)
   SMARTLIST_FOREACH(geoip_countries, geoip_country_t *, c, {
       c->n_v3_ns_requests = 0;
   });
-  {
-    clientmap_entry_t **ent, **next, *this;
-    for (ent = HT_START(clientmap, &client_history); ent != NULL;
-         ent = next) {
-      if ((*ent)->action == GEOIP_CLIENT_NETWORKSTATUS) {
-        this = *ent;
-        next = HT_NEXT_RMV(clientmap, &client_history, ent);
-        clientmap_entry_free(this);
-      } else {
-        next = HT_NEXT(clientmap, &client_history, ent);
-      }
-    }
-  }
+  client_history_clear_action(GEOIP_CLIENT_NETWORKSTATUS);
   memset(ns_v3_responses, 0, sizeof(ns_v3_responses));
   {
     dirreq_map_entry_t **ent, **next, *this;
@@ -1445,20 +1625,16 @@ format_client_stats_heartbeat(time_t now)
   const int n_hours = 6;
   char *out = NULL;
   int n_clients = 0;
-  clientmap_entry_t **ent;
-  unsigned cutoff = (unsigned)( (now-n_hours*3600)/60 );
+  const client_history_t *hist = client_history_get(GEOIP_CLIENT_CONNECT);
+  time_t cutoff = now - n_hours*3600;
 
   if (!start_of_bridge_stats_interval)
     return NULL; /* Not initialized. */
 
-  /* count unique IPs */
-  HT_FOREACH(ent, clientmap, &client_history) {
-    /* only count directly connecting clients */
-    if ((*ent)->action != GEOIP_CLIENT_CONNECT)
-      continue;
-    if ((*ent)->last_seen_in_minutes < cutoff)
-      continue;
-    n_clients++;
+  /* count unique IPs: every client is in exactly one country. */
+  if (hist->by_country) {
+    SMARTLIST_FOREACH(hist->by_country, const client_sketch_t *, sk,
+                      n_clients += (int)client_sketch_count(sk, cutoff));
   }
 
   tor_asprintf(&out, "Heartbeat: "
@@ -1695,15 +1871,8 @@ clear_geoip_db(void)
 void
 geoip_free_all(void)
 {
-  {
-    clientmap_entry_t **ent, **next, *this;
-    for (ent = HT_START(clientmap, &client_history); ent != NULL; ent = next) {
-      this = *ent;
-      next = HT_NEXT_RMV(clientmap, &client_history, ent);
-      clientmap_entry_free(this);
-    }
-    HT_CLEAR(clientmap, &client_history);
-  }
+  client_history_clear_action(GEOIP_CLIENT_CONNECT);
+  client_history_clear_action(GEOIP_CLIENT_NETWORKSTATUS);
   {
     dirreq_map_entry_t **ent, **next, *this;
     for (ent = HT_START(dirreqmap, &dirreq_map); ent != NULL; ent = next) {
@@ -18,6 +18,52 @@
 STATIC int geoip_parse_entry(const char *line, sa_family_t family);
 STATIC int geoip_get_country_by_ipv4(uint32_t ipaddr);
 STATIC int geoip_get_country_by_ipv6(const struct in6_addr *addr);
+
+/** How many seconds of history does each dense slice of a client_sketch_t
+ * cover? */
+#define CLIENT_SKETCH_SLICE_LEN 3600
+/** How many slices does a dense client_sketch_t keep?  Enough to cover a
+ * whole 24-hour statistics interval, with a little slack. */
+#define CLIENT_SKETCH_N_SLICES 26
+/** Track clients in a client_sketch_t exactly until it has seen more than
+ * this many distinct addresses. */
+#define CLIENT_SKETCH_MAX_EXACT 256
+
+/** A client that an exact-mode client_sketch_t remembers. */
+typedef struct sketch_client_t {
+  /** geoip_client_addr_hash() of the client's address. */
+  uint64_t addr_hash;
+  /** Time when we last saw this client, in MINUTES since the epoch. */
+  uint32_t last_seen_in_minutes;
+} sketch_client_t;
+
+/** Counts the distinct clients we've seen in one country, address family,
+ * or pluggable transport.  A few clients are tracked exactly, by address
+ * hash and last-seen time.  Once there are too many of those, we switch to
+ * a ring of hourly HyperLogLog sketches, so that memory use stays bounded
+ * no matter how many clients we see. */
+typedef struct client_sketch_t {
+  /** Exact mode: the clients we've seen so far. */
+  sketch_client_t *exact;
+  /** Number of elements used and allocated in <b>exact</b>. */
+  int n_exact, n_exact_allocated;
+  /** Dense mode: HyperLogLog registers for each hour-long slice, or NULL
+   * if a slice is unused. */
+  uint8_t *slices[CLIENT_SKETCH_N_SLICES];
+  /** Dense mode: for each slice, which hour since the epoch it covers. */
+  time_t slice_idx[CLIENT_SKETCH_N_SLICES];
+  /** True iff this sketch has switched to HyperLogLog registers. */
+  unsigned int is_dense : 1;
+} client_sketch_t;
+
+STATIC client_sketch_t *client_sketch_new(void);
+STATIC void client_sketch_free(client_sketch_t *sketch);
+STATIC void client_sketch_add(client_sketch_t *sketch, uint64_t addr_hash,
+                              time_t now);
+STATIC unsigned client_sketch_count(const client_sketch_t *sketch,
+                                    time_t cutoff);
+STATIC int client_sketch_remove_old(client_sketch_t *sketch, time_t cutoff);
+MOCK_DECL(STATIC uint64_t, geoip_client_addr_hash, (const tor_addr_t *addr));
 #endif
 int should_record_bridge_info(const or_options_t *options);
 int geoip_load_file(sa_family_t family, const char *filename);
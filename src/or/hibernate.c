@@ -100,6 +100,10 @@ static time_t interval_wakeup_time = 0;
 /** How much bandwidth do we 'expect' to use per minute?  (0 if we have no
  * info from the last period.) */
 static uint64_t expected_bandwidth_usage = 0;
+/** If AccountingPacing is set, how many bytes per second may we read or
+ * write so that our remaining quota lasts until the end of the interval?
+ * (0 if we aren't pacing.) */
+static uint64_t pacing_rate = 0;
 /** What unit are we using for our accounting? */
 static time_unit_t cfg_unit = UNIT_MONTH;
 
@@ -116,6 +120,7 @@ static int read_bandwidth_usage(void);
 static time_t start_of_accounting_period_after(time_t now);
 static time_t start_of_accounting_period_containing(time_t now);
 static void accounting_set_wakeup_time(void);
+static void accounting_update_pacing_rate(time_t now);
 
 /* ************
  * Functions for bandwidth accounting.
@@ -408,6 +413,7 @@ configure_accounting(time_t now)
     }
   }
   accounting_set_wakeup_time();
+  accounting_update_pacing_rate(now);
 }
 
 /** Return the relevant number of bytes sent/received this interval
@@ -526,6 +532,71 @@ accounting_run_housekeeping(time_t now)
       log_warn(LD_FS, "Couldn't record bandwidth usage to disk.");
     }
   }
+  accounting_update_pacing_rate(now);
+}
+
+/** Never pace below this many bytes per second: the hard limit will stop us
+ * if we overrun, and a trickle is more useful than a dead relay. */
+#define MIN_PACING_RATE (20*1024)
+/** When pacing, let our buckets hold this many seconds' worth of bytes, so
+ * that we can absorb bursts.  Anything we use early just lowers the rate we
+ * compute for the rest of the interval. */
+#define PACING_BURST_SECONDS (10)
+
+/** Return the number of bytes per second we may read or write (each) so that
+ * <b>bytes_left</b> bytes last for <b>seconds_left</b> seconds.  If
+ * <b>sum_rule</b> is true, reading and writing share the same quota. */
+STATIC uint64_t
+accounting_compute_pacing_rate(uint64_t bytes_left, time_t seconds_left,
+                               int sum_rule)
+{
+  uint64_t rate;
+  if (seconds_left < 1)
+    seconds_left = 1;
+  rate = bytes_left / (uint64_t)seconds_left;
+  if (sum_rule)
+    rate /= 2;
+  if (rate < MIN_PACING_RATE)
+    rate = MIN_PACING_RATE;
+  return rate;
+}
+
+/** Recompute pacing_rate from the bytes we have left in this interval and
+ * the time remaining until it ends.  Called once per second. */
+static void
+accounting_update_pacing_rate(time_t now)
+{
+  const or_options_t *options = get_options();
+  uint64_t limit, used, left = 0;
+
+  if (!options->AccountingPacing || !options->AccountingMax ||
+      !interval_end_time) {
+    pacing_rate = 0;
+    return;
+  }
+
+  limit = options->AccountingMax;
+  used = get_accounting_bytes();
+  if (used < limit)
+    left = limit - used;
+  pacing_rate = accounting_compute_pacing_rate(left, interval_end_time - now,
+                                         options->AccountingRule == ACCT_SUM);
+}
+
+/** If we are pacing our bandwidth usage to fit our accounting quota, set
+ * *<b>rate_out</b> and *<b>burst_out</b> to the bucket rate and burst we
+ * should use for reading and for writing, and return 1.  Otherwise return
+ * 0. */
+int
+accounting_get_pacing_limits(int *rate_out, int *burst_out)
+{
+  uint64_t burst;
+  if (!pacing_rate || !get_options()->AccountingPacing)
+    return 0;
+  burst = pacing_rate * PACING_BURST_SECONDS;
+  *rate_out = (int) MIN(pacing_rate, INT32_MAX);
+  *burst_out = (int) MIN(burst, INT32_MAX);
+  return 1;
 }
 
 /** Based on our interval and our estimated bandwidth, choose a
@@ -560,6 +631,21 @@ accounting_set_wakeup_time(void)
     crypto_rand(digest, DIGEST_LEN);
   }
 
+  if (get_options()->AccountingPacing) {
+    char buf1[ISO_TIME_LEN+1];
+    char buf2[ISO_TIME_LEN+1];
+    format_local_iso_time(buf1, interval_start_time);
+    format_local_iso_time(buf2, interval_end_time);
+    interval_wakeup_time = interval_start_time;
+
+    log_notice(LD_ACCT,
+           "Configured accounting pacing. This interval begins at %s "
+           "and ends at %s. We will stay awake and limit our bandwidth so "
+           "that our quota lasts the whole interval.",
+           buf1, buf2);
+    return;
+  }
+
   if (!expected_bandwidth_usage) {
     char buf1[ISO_TIME_LEN+1];
     char buf2[ISO_TIME_LEN+1];
@@ -739,6 +825,11 @@ static int
 hibernate_soft_limit_reached(void)
 {
   const uint64_t acct_max = get_options()->AccountingMax;
+  /* When pacing, our usage is spread over the whole interval, so we'd only
+   * approach the soft limit in its last few hours: keep accepting
+   * connections until we actually run out. */
+  if (get_options()->AccountingPacing)
+    return hibernate_hard_limit_reached();
 #define SOFT_LIM_PCT (.95)
 #define SOFT_LIM_BYTES (500*1024*1024)
 #define SOFT_LIM_MINUTES (3*60)
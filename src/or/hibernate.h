@@ -29,6 +29,7 @@ int getinfo_helper_accounting(control_connection_t *conn,
                               const char *question, char **answer,
                               const char **errmsg);
 uint64_t get_accounting_max_total(void);
+int accounting_get_pacing_limits(int *rate_out, int *burst_out);
 
 #ifdef HIBERNATE_PRIVATE
 /** Possible values of hibernate_state */
@@ -49,6 +50,10 @@ typedef enum {
   HIBERNATE_STATE_INITIAL=5
 } hibernate_state_t;
 
+STATIC uint64_t accounting_compute_pacing_rate(uint64_t bytes_left,
+                                               time_t seconds_left,
+                                               int sum_rule);
+
 #ifdef TOR_UNIT_TESTS
 void hibernate_set_state_for_testing_(hibernate_state_t newstate);
 #endif
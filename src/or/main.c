@@ -28,6 +28,7 @@
 #include "connection_or.h"
 #include "control.h"
 #include "cpuworker.h"
+#include "crypto_calibrate.h"
 #include "crypto_s2k.h"
 #include "directory.h"
 #include "dirserv.h"
@@ -462,7 +463,7 @@ connection_unlink(connection_t *conn)
 
 /** Initialize the global connection list, closeable connection list,
  * and active connection list. */
-STATIC void
+void
 init_connection_lists(void)
 {
   if (!connection_array)
@@ -2337,13 +2338,31 @@ dumpstats(int severity)
     tor_log(severity,LD_NET,"Average packaged cell fullness: %2.3f%%",
         100*(U64_TO_DBL(stats_n_data_bytes_packaged) /
              U64_TO_DBL(stats_n_data_cells_packaged*RELAY_PAYLOAD_SIZE)) );
+  if (stats_n_data_cells_coalesce_waits)
+    tor_log(severity,LD_NET,"Held back "U64_FORMAT" partial cells to coalesce "
+        "stream data; "U64_FORMAT" were sent at their deadline.",
+        U64_PRINTF_ARG(stats_n_data_cells_coalesce_waits),
+        U64_PRINTF_ARG(stats_n_data_cells_coalesce_expired));
   if (stats_n_data_cells_received)
     tor_log(severity,LD_NET,"Average delivered cell fullness: %2.3f%%",
         100*(U64_TO_DBL(stats_n_data_bytes_received) /
              U64_TO_DBL(stats_n_data_cells_received*RELAY_PAYLOAD_SIZE)) );
+  if (stats_n_consensus_race_losers)
+    tor_log(severity,LD_NET,"Cancelled "U64_FORMAT" consensus fetches that "
+        "lost a race, wasting "U64_FORMAT" bytes.",
+        U64_PRINTF_ARG(stats_n_consensus_race_losers),
+        U64_PRINTF_ARG(stats_n_consensus_race_bytes_discarded));
+  if (stats_n_microdesc_stragglers)
+    tor_log(severity,LD_NET,"Cancelled "U64_FORMAT" microdescriptor fetches "
+        "that were too slow while bootstrapping, wasting "U64_FORMAT
+        " bytes.",
+        U64_PRINTF_ARG(stats_n_microdesc_stragglers),
+        U64_PRINTF_ARG(stats_n_microdesc_straggler_bytes_discarded));
 
   cpuworker_log_onionskin_overhead(severity, ONION_HANDSHAKE_TYPE_TAP, "TAP");
   cpuworker_log_onionskin_overhead(severity, ONION_HANDSHAKE_TYPE_NTOR,"ntor");
+  dump_dns_nameserver_stats(severity);
+  dnsserv_log_stats(severity);
 
   if (now - time_of_process_start >= 0)
     elapsed = now - time_of_process_start;
@@ -2367,6 +2386,7 @@ dumpstats(int severity)
   dumpmemusage(severity);
 
   rep_hist_dump_stats(now,severity);
+  rep_hist_dump_circ_prediction_stats(severity);
   rend_service_dump_stats(severity);
   dump_pk_ops(severity);
   dump_distinct_digest_count(severity);
@@ -2432,6 +2452,33 @@ handle_signals(int is_parent)
 #endif /* signal stuff */
 }
 
+/** Pick the fastest working implementation of each crypto primitive that
+ * we have a choice about.  If we timed them all last time we ran, on the
+ * same CPU with the same libraries, just use what we picked then. */
+static void
+choose_crypto_implementations(void)
+{
+  or_state_t *state = get_or_state();
+  char *platform = crypto_calibration_platform();
+
+  if (state->CryptoBackends && state->CryptoBackendsPlatform &&
+      !strcmp(state->CryptoBackendsPlatform, platform) &&
+      crypto_set_implementations(state->CryptoBackends) == 0) {
+    log_info(LD_CRYPTO, "Using the crypto implementations from our state "
+             "file: %s", state->CryptoBackends);
+    tor_free(platform);
+    return;
+  }
+
+  crypto_calibrate();
+  tor_free(state->CryptoBackends);
+  state->CryptoBackends = crypto_get_implementations();
+  tor_free(state->CryptoBackendsPlatform);
+  state->CryptoBackendsPlatform = platform;
+  or_state_mark_dirty(state, get_options()->AvoidDiskWrites ?
+                      time(NULL)+3600 : 0);
+}
+
 /** Main entry point for the Tor command-line client.
  */
 int
@@ -2549,6 +2596,8 @@ tor_init(int argc, char *argv[])
     log_err(LD_BUG, "Unable to initialize OpenSSL. Exiting.");
     return -1;
   }
+  if (get_options()->command == CMD_RUN_TOR && or_state_loaded())
+    choose_crypto_implementations();
   stream_choice_seed_weak_rng();
   if (tor_init_libevent_rng() < 0) {
     log_warn(LD_NET, "Problem initializing libevent RNG.");
@@ -2644,6 +2693,7 @@ tor_free_all(int postfork)
   rend_service_authorization_free_all();
   rep_hist_free_all();
   dns_free_all();
+  dnsserv_free_all();
   clear_pending_onions();
   circuit_free_all();
   entry_guards_free_all();
@@ -2652,6 +2702,7 @@ tor_free_all(int postfork)
   channel_free_all();
   connection_free_all();
   scheduler_free_all();
+  relay_coalesce_free_all();
   buf_shrink_freelists(1);
   memarea_clear_freelist();
   nodelist_free_all();
@@ -2664,6 +2715,7 @@ tor_free_all(int postfork)
     or_state_free_all();
     router_free_all();
     policies_free_all();
+    tor_intern_str_free_all();
   }
 #ifdef ENABLE_MEMPOOLS
   free_cell_pool();
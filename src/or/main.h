@@ -72,9 +72,9 @@ int tor_main(int argc, char *argv[]);
 
 int do_main_loop(void);
 int tor_init(int argc, char **argv);
+void init_connection_lists(void);
 
 #ifdef MAIN_PRIVATE
-STATIC void init_connection_lists(void);
 STATIC void close_closeable_connections(void);
 #endif
 
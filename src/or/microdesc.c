@@ -742,7 +742,8 @@ microdesc_free_(microdesc_t *md, const char *fname, int lineno)
     tor_free(md->body);
 
   if (md->family) {
-    SMARTLIST_FOREACH(md->family, char *, cp, tor_free(cp));
+    SMARTLIST_FOREACH(md->family, const char *, cp,
+                      tor_intern_str_release(cp));
     smartlist_free(md->family);
   }
   short_policy_free(md->exit_policy);
@@ -845,6 +846,10 @@ update_microdesc_downloads(time_t now)
   if (!we_fetch_microdescriptors(options))
     return;
 
+  /* While bootstrapping, give up on slow fetches so that we ask someone
+   * else for their microdescriptors below. */
+  connection_dir_cancel_microdesc_stragglers(now);
+
   pending = digest256map_new();
   list_pending_microdesc_downloads(pending);
 
@@ -239,6 +239,7 @@ networkstatus_vote_free(networkstatus_t *ns)
   if (!ns)
     return;
 
+  nodelist_forget_consensus(ns);
   tor_free(ns->client_versions);
   tor_free(ns->server_versions);
   if (ns->known_flags) {
@@ -734,6 +735,23 @@ we_want_to_fetch_flavor(const or_options_t *options, int flavor)
  * fetching certs before we check whether there is a better one? */
 #define DELAY_WHILE_FETCHING_CERTS (20*60)
 
+/** Return the number of concurrent fetches we want for a consensus whose
+ * latest copy is <b>c</b> (NULL if we have none).  We only race several
+ * directory sources against each other while bootstrapping as a client:
+ * once we have a live consensus, being slow costs us nothing. */
+STATIC int
+consensus_fetch_race_width(const or_options_t *options,
+                           const networkstatus_t *c, time_t now)
+{
+  if (c && c->valid_after <= now && now <= c->valid_until)
+    return 1;
+  if (directory_fetches_from_authorities(options))
+    return 1;
+  if (bootstrap_fetch_bytes_discarded() >= MAX_BOOTSTRAP_FETCH_OVERHEAD)
+    return 1;
+  return options->BootstrapConsensusFetches;
+}
+
 /** If we want to download a fresh consensus, launch a new download as
  * appropriate. */
 static void
@@ -747,6 +765,7 @@ update_consensus_networkstatus_downloads(time_t now)
     const char *resource;
     consensus_waiting_for_certs_t *waiting;
     networkstatus_t *c;
+    int n_fetching, width;
 
     if (! we_want_to_fetch_flavor(options, i))
       continue;
@@ -768,9 +787,11 @@ update_consensus_networkstatus_downloads(time_t now)
     if (!download_status_is_ready(&consensus_dl_status[i], now,
                              options->TestingConsensusMaxDownloadTries))
       continue; /* We failed downloading a consensus too recently. */
-    if (connection_dir_get_by_purpose_and_resource(
-                                DIR_PURPOSE_FETCH_CONSENSUS, resource))
-      continue; /* There's an in-progress download.*/
+    width = consensus_fetch_race_width(options, c, now);
+    n_fetching = connection_dir_count_by_purpose_and_resource(
+                                DIR_PURPOSE_FETCH_CONSENSUS, resource);
+    if (n_fetching >= width)
+      continue; /* There are enough in-progress downloads.*/
 
     waiting = &consensus_waiting_for_certs[i];
     if (waiting->consensus) {
@@ -785,12 +806,24 @@ update_consensus_networkstatus_downloads(time_t now)
       }
     }
 
-    log_info(LD_DIR, "Launching %s networkstatus consensus download.",
-             networkstatus_get_flavor_name(i));
-
-    directory_get_from_dirserver(DIR_PURPOSE_FETCH_CONSENSUS,
-                                 ROUTER_PURPOSE_GENERAL, resource,
-                                 PDS_RETRY_IF_NO_SERVERS);
+    if (n_fetching == 0) {
+      log_info(LD_DIR, "Launching %s networkstatus consensus download.",
+               networkstatus_get_flavor_name(i));
+      directory_get_from_dirserver(DIR_PURPOSE_FETCH_CONSENSUS,
+                                   ROUTER_PURPOSE_GENERAL, resource,
+                                   PDS_RETRY_IF_NO_SERVERS);
+      ++n_fetching;
+    }
+    /* While bootstrapping, race the first fetch against other sources, and
+     * keep whichever finishes first. */
+    for ( ; n_fetching < width; ++n_fetching) {
+      log_info(LD_DIR, "Launching extra %s networkstatus consensus download "
+               "to race the one in progress.",
+               networkstatus_get_flavor_name(i));
+      directory_get_from_dirserver(DIR_PURPOSE_FETCH_CONSENSUS,
+                                   ROUTER_PURPOSE_GENERAL, resource,
+                                   PDS_NO_EXISTING_CONSENSUS_FETCH);
+    }
   }
 }
 
@@ -1004,8 +1037,8 @@ consensus_is_waiting_for_certs(void)
 
 /** Return the most recent consensus that we have downloaded, or NULL if we
  * don't have one. */
-networkstatus_t *
-networkstatus_get_latest_consensus(void)
+MOCK_IMPL(networkstatus_t *,
+networkstatus_get_latest_consensus,(void))
 {
   return current_consensus;
 }
@@ -1184,6 +1217,8 @@ networkstatus_set_current_consensus(const char *consensus,
   consensus_waiting_for_certs_t *waiting = NULL;
   time_t current_valid_after = 0;
   int free_consensus = 1; /* Free 'c' at the end of the function */
+  /* The consensus of this flavor that 'c' replaces, if any. */
+  networkstatus_t *old_consensus = NULL;
   int old_ewma_enabled;
 
   if (flav < 0) {
@@ -1335,7 +1370,9 @@ networkstatus_set_current_consensus(const char *consensus,
   if (flav == FLAV_NS) {
     if (current_ns_consensus) {
       networkstatus_copy_old_consensus_info(c, current_ns_consensus);
-      networkstatus_vote_free(current_ns_consensus);
+      /* We free the old consensus once the nodelist has switched away from
+       * it, below. */
+      old_consensus = current_ns_consensus;
       /* Defensive programming : we should set current_consensus very soon,
        * but we're about to call some stuff in the meantime, and leaving this
        * dangling pointer around has proven to be trouble. */
@@ -1346,7 +1383,7 @@ networkstatus_set_current_consensus(const char *consensus,
   } else if (flav == FLAV_MICRODESC) {
     if (current_md_consensus) {
       networkstatus_copy_old_consensus_info(c, current_md_consensus);
-      networkstatus_vote_free(current_md_consensus);
+      old_consensus = current_md_consensus;
       /* more defensive programming */
       current_md_consensus = NULL;
     }
@@ -1384,7 +1421,7 @@ networkstatus_set_current_consensus(const char *consensus,
     /* XXXXNM Microdescs: needs a non-ns variant. ???? NM*/
     update_consensus_networkstatus_fetch_time(now);
 
-    nodelist_set_consensus(current_consensus);
+    nodelist_switch_consensus(old_consensus, current_consensus);
 
     dirvote_recalculate_timing(options, now);
     routerstatus_list_update_named_server_map();
@@ -1409,6 +1446,12 @@ networkstatus_set_current_consensus(const char *consensus,
         current_consensus);
   }
 
+  /* If this was the usable flavor, the nodelist has moved on to the new
+   * consensus; otherwise, freeing the old one makes the nodelist forget it
+   * in case it was built from it. */
+  networkstatus_vote_free(old_consensus);
+  old_consensus = NULL;
+
   if (directory_caches_dir_info(options)) {
     dirserv_set_cached_consensus_networkstatus(consensus,
                                                flavor,
@@ -24,6 +24,7 @@
 
 static void nodelist_drop_node(node_t *node, int remove_from_ht);
 static void node_free(node_t *node);
+static INLINE int node_is_usable(const node_t *node);
 
 /** count_usable_descriptors counts descriptors with these flag(s)
  */
@@ -55,6 +56,11 @@ typedef struct nodelist_t {
   /* Hash table to map from node ID digest to node. */
   HT_HEAD(nodelist_map, node_t) nodes_by_id;
 
+  /* The consensus that the nodes' routerstatus pointers point into, if
+   * any.  Only compared against, never dereferenced; reset by
+   * nodelist_forget_consensus() before that consensus is freed, so that a
+   * new consensus allocated at the same address can't be mistaken for it. */
+  const networkstatus_t *consensus;
 } nodelist_t;
 
 static INLINE unsigned int
@@ -214,6 +220,65 @@ nodelist_add_microdesc(microdesc_t *md)
   return node;
 }
 
+/** Point <b>node</b> at the routerstatus <b>rs</b> from a consensus of
+ * flavor <b>flavor</b>, and update the state that we derive from it.  If
+ * <b>update_country</b> is false, the node's address hasn't changed, so we
+ * keep its country. */
+static void
+node_set_routerstatus(node_t *node, routerstatus_t *rs,
+                      consensus_flavor_t flavor, int update_country,
+                      int authdir, int client, const or_options_t *options)
+{
+  node->rs = rs;
+  if (flavor == FLAV_MICRODESC) {
+    if (node->md == NULL ||
+        tor_memneq(node->md->digest,rs->descriptor_digest,DIGEST256_LEN)) {
+      if (node->md)
+        node->md->held_by_nodes--;
+      node->md = microdesc_cache_lookup_by_digest256(NULL,
+                                                     rs->descriptor_digest);
+      if (node->md)
+        node->md->held_by_nodes++;
+    }
+  }
+
+  if (update_country)
+    node_set_country(node);
+
+  /* If we're not an authdir, believe others. */
+  if (!authdir) {
+    node->is_valid = rs->is_valid;
+    node->is_running = rs->is_flagged_running;
+    node->is_fast = rs->is_fast;
+    node->is_stable = rs->is_stable;
+    node->is_possible_guard = rs->is_possible_guard;
+    node->is_exit = rs->is_exit;
+    node->is_bad_exit = rs->is_bad_exit;
+    node->is_hs_dir = rs->is_hs_dir;
+    node->ipv6_preferred = 0;
+    if (client && options->ClientPreferIPv6ORPort == 1 &&
+        (tor_addr_is_null(&rs->ipv6_addr) == 0 ||
+         (node->md && tor_addr_is_null(&node->md->ipv6_addr) == 0)))
+      node->ipv6_preferred = 1;
+  }
+}
+
+/** Helper: <b>node</b> has no routerstatus in the consensus.  Clear the
+ * flags that it got from the consensus so we can skip it, maybe. */
+static void
+node_clear_consensus_flags(node_t *node)
+{
+  tor_assert(node->ri); /* if it had only an md, or nothing, purge
+                         * would have removed it. */
+  if (node->ri->purpose == ROUTER_PURPOSE_GENERAL) {
+    /* Clear all flags. */
+    node->is_valid = node->is_running = node->is_hs_dir =
+      node->is_fast = node->is_stable =
+      node->is_possible_guard = node->is_exit =
+      node->is_bad_exit = node->ipv6_preferred = 0;
+  }
+}
+
 /** Tell the nodelist that the current usable consensus is <b>ns</b>.
  * This makes the nodelist change all of the routerstatus entries for
  * the nodes, drop nodes that no longer have enough info to get used,
@@ -235,61 +300,129 @@ nodelist_set_consensus(networkstatus_t *ns)
 
   SMARTLIST_FOREACH_BEGIN(ns->routerstatus_list, routerstatus_t *, rs) {
     node_t *node = node_get_or_create(rs->identity_digest);
-    node->rs = rs;
-    if (ns->flavor == FLAV_MICRODESC) {
-      if (node->md == NULL ||
-          tor_memneq(node->md->digest,rs->descriptor_digest,DIGEST256_LEN)) {
-        if (node->md)
-          node->md->held_by_nodes--;
-        node->md = microdesc_cache_lookup_by_digest256(NULL,
-                                                       rs->descriptor_digest);
-        if (node->md)
-          node->md->held_by_nodes++;
-      }
-    }
-
-    node_set_country(node);
-
-    /* If we're not an authdir, believe others. */
-    if (!authdir) {
-      node->is_valid = rs->is_valid;
-      node->is_running = rs->is_flagged_running;
-      node->is_fast = rs->is_fast;
-      node->is_stable = rs->is_stable;
-      node->is_possible_guard = rs->is_possible_guard;
-      node->is_exit = rs->is_exit;
-      node->is_bad_exit = rs->is_bad_exit;
-      node->is_hs_dir = rs->is_hs_dir;
-      node->ipv6_preferred = 0;
-      if (client && options->ClientPreferIPv6ORPort == 1 &&
-          (tor_addr_is_null(&rs->ipv6_addr) == 0 ||
-           (node->md && tor_addr_is_null(&node->md->ipv6_addr) == 0)))
-        node->ipv6_preferred = 1;
-    }
-
+    node_set_routerstatus(node, rs, ns->flavor, 1, authdir, client, options);
   } SMARTLIST_FOREACH_END(rs);
 
   nodelist_purge();
+  the_nodelist->consensus = ns;
 
   if (! authdir) {
     SMARTLIST_FOREACH_BEGIN(the_nodelist->nodes, node_t *, node) {
-      /* We have no routerstatus for this router. Clear flags so we can skip
-       * it, maybe.*/
-      if (!node->rs) {
-        tor_assert(node->ri); /* if it had only an md, or nothing, purge
-                               * would have removed it. */
-        if (node->ri->purpose == ROUTER_PURPOSE_GENERAL) {
-          /* Clear all flags. */
-          node->is_valid = node->is_running = node->is_hs_dir =
-            node->is_fast = node->is_stable =
-            node->is_possible_guard = node->is_exit =
-            node->is_bad_exit = node->ipv6_preferred = 0;
-        }
-      }
+      if (!node->rs)
+        node_clear_consensus_flags(node);
     } SMARTLIST_FOREACH_END(node);
   }
 }
 
+/** Tell the nodelist that the current usable consensus has changed from
+ * <b>old_ns</b> to <b>ns</b>.  This has the same effect as
+ * nodelist_set_consensus(<b>ns</b>), but instead of rebuilding every node,
+ * we walk the two sorted routerstatus lists side by side: nodes that left
+ * the consensus lose their routerstatus, new ones get one, and the rest
+ * get the new entry while keeping whatever we derived from an unchanged
+ * address.  Nodes that are in neither consensus aren't touched.
+ *
+ * <b>old_ns</b> must still be allocated.  If it isn't the consensus that
+ * the nodelist was built from, fall back to nodelist_set_consensus().
+ */
+void
+nodelist_switch_consensus(const networkstatus_t *old_ns,
+                          networkstatus_t *ns)
+{
+  const or_options_t *options = get_options();
+  int authdir = authdir_mode_v3(options);
+  int client = !server_mode(options);
+  const smartlist_t *old_list, *new_list;
+  int old_idx = 0, new_idx = 0, old_len, new_len;
+  int n_added = 0, n_removed = 0, n_moved = 0;
+
+  init_nodelist();
+  if (!old_ns || old_ns != the_nodelist->consensus ||
+      old_ns->flavor != ns->flavor) {
+    nodelist_set_consensus(ns);
+    return;
+  }
+  if (ns->flavor == FLAV_MICRODESC)
+    (void) get_microdesc_cache(); /* Make sure it exists first. */
+
+  old_list = old_ns->routerstatus_list;
+  new_list = ns->routerstatus_list;
+  old_len = smartlist_len(old_list);
+  new_len = smartlist_len(new_list);
+
+  while (old_idx < old_len || new_idx < new_len) {
+    const routerstatus_t *rs_old = NULL;
+    routerstatus_t *rs_new = NULL;
+    node_t *node;
+    int cmp;
+
+    if (old_idx < old_len)
+      rs_old = smartlist_get(old_list, old_idx);
+    if (new_idx < new_len)
+      rs_new = smartlist_get(new_list, new_idx);
+    if (!rs_new)
+      cmp = -1;
+    else if (!rs_old)
+      cmp = 1;
+    else
+      cmp = tor_memcmp(rs_old->identity_digest, rs_new->identity_digest,
+                       DIGEST_LEN);
+
+    if (cmp < 0) {
+      /* This router has left the consensus. */
+      ++old_idx;
+      node = node_get_mutable_by_id(rs_old->identity_digest);
+      if (!node || node->rs != rs_old)
+        continue;
+      ++n_removed;
+      node->rs = NULL;
+      if (node->md) {
+        /* An md is only useful if there is an rs. */
+        node->md->held_by_nodes--;
+        node->md = NULL;
+      }
+      if (! node_is_usable(node)) {
+        nodelist_drop_node(node, 1);
+        node_free(node);
+      } else if (! authdir) {
+        node_clear_consensus_flags(node);
+      }
+    } else if (cmp > 0) {
+      /* This router is new in the consensus. */
+      ++new_idx;
+      ++n_added;
+      node = node_get_or_create(rs_new->identity_digest);
+      node_set_routerstatus(node, rs_new, ns->flavor, 1,
+                            authdir, client, options);
+    } else {
+      /* This router is in both. */
+      int moved;
+      ++old_idx;
+      ++new_idx;
+      node = node_get_or_create(rs_new->identity_digest);
+      moved = node->rs != rs_old || rs_old->addr != rs_new->addr;
+      n_moved += moved;
+      node_set_routerstatus(node, rs_new, ns->flavor, moved,
+                            authdir, client, options);
+    }
+  }
+
+  the_nodelist->consensus = ns;
+  log_info(LD_DIR, "Switched the nodelist to a new consensus: %d routers "
+           "added, %d removed, %d with new addresses, out of %d.",
+           n_added, n_removed, n_moved, new_len);
+}
+
+/** Tell the nodelist that <b>ns</b> is about to be freed.  If the nodelist
+ * was built from it, forget that, so that the next
+ * nodelist_switch_consensus() does a full rebuild. */
+void
+nodelist_forget_consensus(const networkstatus_t *ns)
+{
+  if (the_nodelist && ns && the_nodelist->consensus == ns)
+    the_nodelist->consensus = NULL;
+}
+
 /** Helper: return true iff a node has a usable amount of information*/
 static INLINE int
 node_is_usable(const node_t *node)
@@ -416,6 +549,7 @@ nodelist_free_all(void)
     return;
 
   HT_CLEAR(nodelist_map, &the_nodelist->nodes_by_id);
+  the_nodelist->consensus = NULL;
   SMARTLIST_FOREACH_BEGIN(the_nodelist->nodes, node_t *, node) {
     node->nodelist_idx = -1;
     node_free(node);
@@ -22,6 +22,7 @@
 #include "relay.h"
 #include "rephist.h"
 #include "router.h"
+#include "extend_cell.h"
 
 /** Type for a linked list of circuits that are waiting for a free CPU worker
  * to process a waiting onion handshake. */
@@ -654,34 +655,61 @@ create_cell_init(create_cell_t *cell_out, uint8_t cell_type,
   memcpy(cell_out->onionskin, onionskin, handshake_len);
 }
 
-/** Helper: parse the CREATE2 payload at <b>p</b>, which could be up to
- * <b>p_len</b> bytes long, and use it to fill the fields of
+/** Helper: use the parsed CREATE2 body in <b>body</b> to fill the fields of
  * <b>cell_out</b>. Return 0 on success and -1 on failure.
  *
- * Note that part of the body of an EXTEND2 cell is a CREATE2 payload, so
- * this function is also used for parsing those.
+ * Note that part of the body of an EXTEND2 cell is a CREATE2 body, so this
+ * function is also used for parsing those.
  */
 static int
-parse_create2_payload(create_cell_t *cell_out, const uint8_t *p, size_t p_len)
+create_cell_from_create2_cell_body(create_cell_t *cell_out,
+                                   create2_cell_body_t *body)
 {
-  uint16_t handshake_type, handshake_len;
+  uint16_t handshake_type = create2_cell_body_get_handshake_type(body);
+  uint16_t handshake_len = create2_cell_body_get_handshake_len(body);
 
-  if (p_len < 4)
-    return -1;
-
-  handshake_type = ntohs(get_uint16(p));
-  handshake_len = ntohs(get_uint16(p+2));
-
-  if (handshake_len > CELL_PAYLOAD_SIZE - 4 || handshake_len > p_len - 4)
+  if (handshake_len > CELL_PAYLOAD_SIZE - 4)
     return -1;
   if (handshake_type == ONION_HANDSHAKE_TYPE_FAST)
     return -1;
 
   create_cell_init(cell_out, CELL_CREATE2, handshake_type, handshake_len,
-                   p+4);
+                   create2_cell_body_getarray_handshake_data(body));
   return 0;
 }
 
+/** Helper: parse the CREATE2 payload at <b>p</b>, which could be up to
+ * <b>p_len</b> bytes long, and use it to fill the fields of
+ * <b>cell_out</b>. Return 0 on success and -1 on failure.
+ */
+static int
+parse_create2_payload(create_cell_t *cell_out, const uint8_t *p, size_t p_len)
+{
+  create2_cell_body_t *body = NULL;
+  int r;
+
+  if (create2_cell_body_parse(&body, p, p_len) < 0)
+    return -1;
+  r = create_cell_from_create2_cell_body(cell_out, body);
+  create2_cell_body_free(body);
+  return r;
+}
+
+/** Helper: return a newly allocated CREATE2 body holding the handshake in
+ * <b>cell_in</b>. */
+static create2_cell_body_t *
+create2_cell_body_from_create_cell(const create_cell_t *cell_in)
+{
+  create2_cell_body_t *body = create2_cell_body_new();
+
+  create2_cell_body_set_handshake_type(body, cell_in->handshake_type);
+  create2_cell_body_set_handshake_len(body, cell_in->handshake_len);
+  create2_cell_body_setlen_handshake_data(body, cell_in->handshake_len);
+  memcpy(create2_cell_body_getarray_handshake_data(body),
+         cell_in->onionskin, cell_in->handshake_len);
+  return body;
+}
+
 /** Magic string which, in a CREATE or EXTEND cell, indicates that a seeming
  * TAP payload is really an ntor payload.  We'd do away with this if every
  * relay supported EXTEND2, but we want to be able to extend from A to B with
@@ -804,13 +832,55 @@ check_extend_cell(const extend_cell_t *cell)
   return check_create_cell(&cell->create_cell, 1);
 }
 
-/** Protocol constants for specifier types in EXTEND2
- * @{
- */
-#define SPECTYPE_IPV4 0
-#define SPECTYPE_IPV6 1
-#define SPECTYPE_LEGACY_ID 2
-/** @} */
+/** Helper: use the parsed EXTEND2 body in <b>body</b> to fill the fields
+ * of <b>cell_out</b>. Return 0 on success and -1 on failure. */
+static int
+extend_cell_from_extend2_cell_body(extend_cell_t *cell_out,
+                                   extend2_cell_body_t *body)
+{
+  size_t i;
+  int found_ipv4 = 0, found_ipv6 = 0, found_id = 0;
+
+  cell_out->cell_type = RELAY_COMMAND_EXTEND2;
+  tor_addr_make_unspec(&cell_out->orport_ipv4.addr);
+  tor_addr_make_unspec(&cell_out->orport_ipv6.addr);
+
+  /* Look at the specifiers. The parser has already checked their lengths;
+   * we'll only take the first IPv4 and first IPv6 address, and the node ID,
+   * and ignore everything else */
+  for (i = 0; i < extend2_cell_body_getlen_ls(body); ++i) {
+    link_specifier_t *ls = extend2_cell_body_get_ls(body, i);
+    switch (link_specifier_get_ls_type(ls)) {
+    case LS_IPV4:
+      if (!found_ipv4) {
+        tor_addr_from_ipv4h(&cell_out->orport_ipv4.addr,
+                            link_specifier_get_un_ipv4_addr(ls));
+        cell_out->orport_ipv4.port = link_specifier_get_un_ipv4_port(ls);
+        found_ipv4 = 1;
+      }
+      break;
+    case LS_IPV6:
+      if (!found_ipv6) {
+        tor_addr_from_ipv6_bytes(&cell_out->orport_ipv6.addr,
+                   (const char*)link_specifier_getarray_un_ipv6_addr(ls));
+        cell_out->orport_ipv6.port = link_specifier_get_un_ipv6_port(ls);
+        found_ipv6 = 1;
+      }
+      break;
+    case LS_LEGACY_ID:
+      if (found_id)
+        return -1;
+      memcpy(cell_out->node_id, link_specifier_getarray_un_legacy_id(ls),
+             DIGEST_LEN);
+      found_id = 1;
+      break;
+    }
+  }
+  if (!found_id || !found_ipv4)
+    return -1;
+  return create_cell_from_create2_cell_body(&cell_out->create_cell,
+                                     extend2_cell_body_get_create2(body));
+}
 
 /** Parse an EXTEND or EXTEND2 cell (according to <b>command</b>) from the
  * <b>payload_length</b> bytes of <b>payload</b> into <b>cell_out</b>. Return
@@ -819,12 +889,9 @@ int
 extend_cell_parse(extend_cell_t *cell_out, const uint8_t command,
                   const uint8_t *payload, size_t payload_length)
 {
-  const uint8_t *eop;
-
   memset(cell_out, 0, sizeof(*cell_out));
   if (payload_length > RELAY_PAYLOAD_SIZE)
     return -1;
-  eop = payload + payload_length;
 
   switch (command) {
   case RELAY_COMMAND_EXTEND:
@@ -855,62 +922,13 @@ extend_cell_parse(extend_cell_t *cell_out, const uint8_t command,
     }
   case RELAY_COMMAND_EXTEND2:
     {
-      uint8_t n_specs, spectype, speclen;
-      int i;
-      int found_ipv4 = 0, found_ipv6 = 0, found_id = 0;
-      tor_addr_make_unspec(&cell_out->orport_ipv4.addr);
-      tor_addr_make_unspec(&cell_out->orport_ipv6.addr);
-
-      if (payload_length == 0)
-        return -1;
-
-      cell_out->cell_type = RELAY_COMMAND_EXTEND2;
-      n_specs = *payload++;
-      /* Parse the specifiers. We'll only take the first IPv4 and first IPv6
-       * address, and the node ID, and ignore everything else */
-      for (i = 0; i < n_specs; ++i) {
-        if (eop - payload < 2)
-          return -1;
-        spectype = payload[0];
-        speclen = payload[1];
-        payload += 2;
-        if (eop - payload < speclen)
-          return -1;
-        switch (spectype) {
-        case SPECTYPE_IPV4:
-          if (speclen != 6)
-            return -1;
-          if (!found_ipv4) {
-            tor_addr_from_ipv4n(&cell_out->orport_ipv4.addr,
-                                get_uint32(payload));
-            cell_out->orport_ipv4.port = ntohs(get_uint16(payload+4));
-            found_ipv4 = 1;
-          }
-          break;
-        case SPECTYPE_IPV6:
-          if (speclen != 18)
-            return -1;
-          if (!found_ipv6) {
-            tor_addr_from_ipv6_bytes(&cell_out->orport_ipv6.addr,
-                                     (const char*)payload);
-            cell_out->orport_ipv6.port = ntohs(get_uint16(payload+16));
-            found_ipv6 = 1;
-          }
-          break;
-        case SPECTYPE_LEGACY_ID:
-          if (speclen != 20)
-            return -1;
-          if (found_id)
-            return -1;
-          memcpy(cell_out->node_id, payload, 20);
-          found_id = 1;
-          break;
-        }
-        payload += speclen;
-      }
-      if (!found_id || !found_ipv4)
+      extend2_cell_body_t *body = NULL;
+      int r;
+      if (extend2_cell_body_parse(&body, payload, payload_length) < 0)
         return -1;
-      if (parse_create2_payload(&cell_out->create_cell,payload,eop-payload)<0)
+      r = extend_cell_from_extend2_cell_body(cell_out, body);
+      extend2_cell_body_free(body);
+      if (r < 0)
         return -1;
       break;
     }
@@ -1009,10 +1027,13 @@ create_cell_format_impl(cell_t *cell_out, const create_cell_t *cell_in,
     memcpy(p, cell_in->onionskin, cell_in->handshake_len);
     break;
   case CELL_CREATE2:
-    tor_assert(cell_in->handshake_len <= sizeof(cell_out->payload)-4);
-    set_uint16(cell_out->payload, htons(cell_in->handshake_type));
-    set_uint16(cell_out->payload+2, htons(cell_in->handshake_len));
-    memcpy(cell_out->payload + 4, cell_in->onionskin, cell_in->handshake_len);
+    {
+      create2_cell_body_t *body = create2_cell_body_from_create_cell(cell_in);
+      ssize_t n = create2_cell_body_encode(p, space, body);
+      create2_cell_body_free(body);
+      if (n < 0)
+        return -1;
+    }
     break;
   default:
     return -1;
@@ -1070,12 +1091,11 @@ int
 extend_cell_format(uint8_t *command_out, uint16_t *len_out,
                    uint8_t *payload_out, const extend_cell_t *cell_in)
 {
-  uint8_t *p, *eop;
+  uint8_t *p;
   if (check_extend_cell(cell_in) < 0)
     return -1;
 
   p = payload_out;
-  eop = payload_out + RELAY_PAYLOAD_SIZE;
 
   memset(p, 0, RELAY_PAYLOAD_SIZE);
 
@@ -1098,33 +1118,35 @@ extend_cell_format(uint8_t *command_out, uint16_t *len_out,
     break;
   case RELAY_COMMAND_EXTEND2:
     {
-      uint8_t n = 2;
+      extend2_cell_body_t *body = extend2_cell_body_new();
+      link_specifier_t *ls;
+      ssize_t n;
       *command_out = RELAY_COMMAND_EXTEND2;
 
-      *p++ = n; /* 2 identifiers */
-      *p++ = SPECTYPE_IPV4; /* First is IPV4. */
-      *p++ = 6; /* It's 6 bytes long. */
-      set_uint32(p, tor_addr_to_ipv4n(&cell_in->orport_ipv4.addr));
-      set_uint16(p+4, htons(cell_in->orport_ipv4.port));
-      p += 6;
-      *p++ = SPECTYPE_LEGACY_ID; /* Next is an identity digest. */
-      *p++ = 20; /* It's 20 bytes long */
-      memcpy(p, cell_in->node_id, DIGEST_LEN);
-      p += 20;
+      /* First is IPv4. */
+      ls = link_specifier_new();
+      link_specifier_set_ls_type(ls, LS_IPV4);
+      link_specifier_set_un_ipv4_addr(ls,
+                          tor_addr_to_ipv4h(&cell_in->orport_ipv4.addr));
+      link_specifier_set_un_ipv4_port(ls, cell_in->orport_ipv4.port);
+      extend2_cell_body_add_ls(body, ls);
+      /* Next is an identity digest. */
+      ls = link_specifier_new();
+      link_specifier_set_ls_type(ls, LS_LEGACY_ID);
+      memcpy(link_specifier_getarray_un_legacy_id(ls), cell_in->node_id,
+             DIGEST_LEN);
+      extend2_cell_body_add_ls(body, ls);
+      extend2_cell_body_set_n_spec(body, 2);
 
       /* Now we can send the handshake */
-      set_uint16(p, htons(cell_in->create_cell.handshake_type));
-      set_uint16(p+2, htons(cell_in->create_cell.handshake_len));
-      p += 4;
+      extend2_cell_body_set_create2(body,
+                  create2_cell_body_from_create_cell(&cell_in->create_cell));
 
-      if (cell_in->create_cell.handshake_len > eop - p)
+      n = extend2_cell_body_encode(p, RELAY_PAYLOAD_SIZE, body);
+      extend2_cell_body_free(body);
+      if (n < 0)
         return -1;
-
-      memcpy(p, cell_in->create_cell.onionskin,
-             cell_in->create_cell.handshake_len);
-
-      p += cell_in->create_cell.handshake_len;
-      *len_out = p - payload_out;
+      *len_out = (uint16_t) n;
     }
     break;
   default:
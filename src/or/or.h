@@ -1580,6 +1580,20 @@ typedef struct edge_connection_t {
   /** True iff we've blocked reading until the circuit has fewer queued
    * cells. */
   unsigned int edge_blocked_on_circ:1;
+  /** True iff this stream is holding back a partial cell until
+   * coalesce_deadline; see StreamCoalesceDelay. */
+  unsigned int coalesce_pending:1;
+
+  /** Decayed count of how many cells we have recently packaged from this
+   * stream; used to let quiet streams go ahead of bulk ones when the circuit
+   * package window reopens.  Halved every STREAM_ACTIVITY_HALFLIFE seconds;
+   * see edge_stream_get_recent_cells(). */
+  uint32_t recent_cells;
+  /** When did we last decay <b>recent_cells</b>? */
+  time_t recent_cells_updated;
+  /** If coalesce_pending is set, the time after which we stop waiting for
+   * more data to fill a cell and package whatever is on the inbuf. */
+  struct timeval coalesce_deadline;
 
   /** Unique ID for directory requests; this used to be in connection_t, but
    * that's going away and being used on channels instead.  We still tag
@@ -1627,6 +1641,9 @@ typedef struct entry_connection_t {
   /** If this is a DNSPort connection, this field holds the pending DNS
    * request that we're going to try to answer.  */
   struct evdns_server_request *dns_server_request;
+  /** If this is a DNSPort connection, the key under which other DNSPort
+   * requests waiting for the same answer are recorded in dnsserv.c. */
+  char *dns_server_key;
 
 #define NUM_CIRCUITS_LAUNCHED_THRESHOLD 10
   /** Number of times we've launched a circuit to handle this stream. If
@@ -1663,6 +1680,14 @@ typedef struct entry_connection_t {
 
   /** Are we a socks SocksSocket listener? */
   unsigned int is_socks_socket:1;
+
+  /** True iff we've tried to attach this stream to a general-purpose
+   * circuit and had to wait for one to be built. */
+  unsigned int waited_for_circuit:1;
+
+  /** True iff this is a DNSPort connection whose listener lets us remember
+   * its answer in the DNSPort answer cache. */
+  unsigned int dns_server_may_cache:1;
 } entry_connection_t;
 
 typedef enum {
@@ -2021,7 +2046,9 @@ typedef struct {
   /** Public curve25519 key for onions */
   curve25519_public_key_t *onion_curve25519_pkey;
 
-  char *platform; /**< What software/operating system is this OR using? */
+  /** What software/operating system is this OR using?  Interned with
+   * tor_intern_str(). */
+  const char *platform;
 
   /* link info */
   uint32_t bandwidthrate; /**< How many bytes does this OR add to its token
@@ -2036,8 +2063,11 @@ typedef struct {
   struct short_policy_t *ipv6_exit_policy;
   long uptime; /**< How many seconds the router claims to have been up */
   smartlist_t *declared_family; /**< Nicknames of router which this router
-                                 * claims are its family. */
-  char *contact_info; /**< Declared contact info for this router. */
+                                 * claims are its family.  Interned with
+                                 * tor_intern_str(). */
+  /** Declared contact info for this router.  Interned with
+   * tor_intern_str(). */
+  const char *contact_info;
   unsigned int is_hibernating:1; /**< Whether the router claims to be
                                   * hibernating */
   unsigned int caches_extra_info:1; /**< Whether the router says it caches and
@@ -2169,6 +2199,12 @@ typedef struct short_policy_t {
   unsigned int is_accept : 1;
   /** The actual number of values in 'entries'. */
   unsigned int n_entries : 31;
+  /** How many microdescriptors and routerinfos share this policy?  See
+   * parse_short_policy(). */
+  unsigned int refcnt;
+  /** The summary we parsed this policy from; used as its key in the table
+   * of shared short policies. */
+  char *summary;
   /** An array of 0 or more short_policy_entry_t values, each describing a
    * range of ports that this policy accepts or rejects (depending on the
    * value of is_accept).
@@ -3271,6 +3307,12 @@ typedef enum invalid_router_usage_t {
 #define MIN_CONSTRAINED_TCP_BUFFER 2048
 #define MAX_CONSTRAINED_TCP_BUFFER 262144  /* 256k */
 
+/** Largest allowable value for StreamCoalesceDelay, in microseconds. */
+#define MAX_STREAM_COALESCE_DELAY 100000
+
+/** Largest allowable value for BootstrapConsensusFetches. */
+#define MAX_BOOTSTRAP_CONSENSUS_FETCHES 3
+
 /** @name Isolation flags
 
     Ways to isolate client streams
@@ -3471,6 +3513,9 @@ typedef struct {
   /** Ports to listen on for directory connections. */
   config_line_t *DirPort_lines;
   config_line_t *DNSPort_lines; /**< Ports to listen on for DNS requests. */
+  /** How many answers to DNSPort queries should we remember for reuse?
+   * 0 disables the cache. */
+  int DNSPortCacheSize;
 
   /* MaxMemInQueues value as input by the user. We clean this up to be
    * MaxMemInQueues. */
@@ -3622,6 +3667,9 @@ typedef struct {
                        * descriptor? Remember to publish them independently. */
   int KeepalivePeriod; /**< How often do we send padding cells to keep
                         * connections alive? */
+  /** How many microseconds may a stream hold back a partial relay cell's
+   * worth of data, waiting for enough to fill a cell?  0 for never. */
+  int StreamCoalesceDelay;
   int SocksTimeout; /**< How long do we let a socks connection wait
                      * unattached before we fail it? */
   int LearnCircuitBuildTimeout; /**< If non-zero, we attempt to learn a value
@@ -3658,6 +3706,18 @@ typedef struct {
   uint64_t PerConnBWRate; /**< Long-term bw on a single TLS conn, if set. */
   uint64_t PerConnBWBurst; /**< Allowed burst on a single TLS conn, if set. */
   int NumCPUs; /**< How many CPUs should we try to use? */
+  /** If set, a list of CPUs, like "0-3,8", to which we restrict the main
+   * thread. */
+  char *MainThreadCPUs;
+  /** If set, a list of CPUs over which we spread the worker threads, one
+   * CPU per thread. */
+  char *WorkerThreadCPUs;
+  /** Boolean: should worker threads stay off the main thread's CPUs and
+   * their hyperthread siblings? */
+  int WorkerThreadsAvoidMainSiblings;
+  /** Boolean: should the threads that we place on CPUs prefer memory from
+   * their own NUMA node? */
+  int ThreadLocalMemory;
 //int RunTesting; /**< If true, create testing circuits to measure how well the
 //                 * other ORs are running. */
   config_line_t *RendConfigLines; /**< List of configuration lines
@@ -3757,6 +3817,10 @@ typedef struct {
    * "sum for when in plus out reaches AccountingMax */
   char *AccountingRule_option;
   enum { ACCT_MAX, ACCT_SUM } AccountingRule;
+  /** If true, spread our AccountingMax evenly over the accounting interval
+   * by limiting our bandwidth rate, rather than running at full speed and
+   * then hibernating. */
+  int AccountingPacing;
 
   /** Base64-encoded hash of accepted passwords for the control system. */
   config_line_t *HashedControlPassword;
@@ -3824,6 +3888,10 @@ typedef struct {
   /** Should we fetch our dir info at the start of the consensus period? */
   int FetchDirInfoExtraEarly;
 
+  /** While we have no live consensus, how many directory sources should we
+   * race against each other for one? */
+  int BootstrapConsensusFetches;
+
   char *VirtualAddrNetworkIPv4; /**< Address and mask to hand out for virtual
                                  * MAPADDRESS requests for IPv4 addresses */
   char *VirtualAddrNetworkIPv6; /**< Address and mask to hand out for virtual
@@ -4285,6 +4353,11 @@ typedef struct {
   /** What version of Tor wrote this state file? */
   char *TorVersion;
 
+  /** Which crypto implementations did crypto_calibrate() pick last time,
+   * and on what platform, as given by crypto_calibration_platform()? */
+  char *CryptoBackends;
+  char *CryptoBackendsPlatform;
+
   /** Holds any unrecognized values we found in the state file, in the order
    * in which we found them. */
   config_line_t *ExtraLines;
@@ -4974,6 +5047,13 @@ typedef struct dir_server_t {
  * node that's currently a guard. */
 #define PDS_FOR_GUARD (1<<5)
 
+/** Flag to indicate that we should not use any directory server to which
+ * we have an existing directory connection for downloading a consensus.
+ *
+ * Passed to router_pick_directory_server (et al)
+ */
+#define PDS_NO_EXISTING_CONSENSUS_FETCH (1<<6)
+
 /** Possible ways to weight routers when choosing one randomly.  See
  * routerlist_sl_choose_by_bandwidth() for more information.*/
 typedef enum bandwidth_weight_rule_t {
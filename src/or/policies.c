@@ -1533,10 +1533,44 @@ policy_summarize(smartlist_t *policy, sa_family_t family)
   return result;
 }
 
+/** Map from policy summary strings to the short_policy_t parsed from them.
+ * Relays have only a few distinct exit policy summaries among them, so we
+ * share one short_policy_t among all the routerinfos and microdescriptors
+ * that use the same summary. */
+static strmap_t *short_policy_map = NULL;
+
+static short_policy_t *parse_short_policy_impl(const char *summary);
+
 /** Convert a summarized policy string into a short_policy_t.  Return NULL
- * if the string is not well-formed. */
+ * if the string is not well-formed.  The result may be shared with other
+ * callers, and must not be modified; release it with short_policy_free(). */
 short_policy_t *
 parse_short_policy(const char *summary)
+{
+  short_policy_t *result;
+
+  if (!short_policy_map)
+    short_policy_map = strmap_new();
+
+  result = strmap_get(short_policy_map, summary);
+  if (result) {
+    ++result->refcnt;
+    return result;
+  }
+
+  result = parse_short_policy_impl(summary);
+  if (!result)
+    return NULL;
+  result->refcnt = 1;
+  result->summary = tor_strdup(summary);
+  strmap_set(short_policy_map, summary, result);
+  return result;
+}
+
+/** Helper for parse_short_policy: parse <b>summary</b> into a newly
+ * allocated short_policy_t. */
+static short_policy_t *
+parse_short_policy_impl(const char *summary)
 {
   const char *orig_summary = summary;
   short_policy_t *result;
@@ -1658,10 +1692,18 @@ write_short_policy(const short_policy_t *policy)
   return answer;
 }
 
-/** Release all storage held in <b>policy</b>. */
+/** Release a reference to <b>policy</b>, and free it if nobody else is
+ * using it. */
 void
 short_policy_free(short_policy_t *policy)
 {
+  if (!policy)
+    return;
+  if (--policy->refcnt > 0)
+    return;
+  if (short_policy_map)
+    strmap_remove(short_policy_map, policy->summary);
+  tor_free(policy->summary);
   tor_free(policy);
 }
 
@@ -1853,6 +1895,10 @@ policies_free_all(void)
   addr_policy_list_free(authdir_badexit_policy);
   authdir_badexit_policy = NULL;
 
+  /* Anything still in here is still referenced by somebody else. */
+  strmap_free(short_policy_map, NULL);
+  short_policy_map = NULL;
+
   if (!HT_EMPTY(&policy_root)) {
     policy_map_ent_t **ent;
     int n = 0;
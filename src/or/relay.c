@@ -41,6 +41,13 @@
 #include "routerparse.h"
 #include "scheduler.h"
 
+#include "compat_libevent.h"
+#ifdef HAVE_EVENT2_EVENT_H
+#include <event2/event.h>
+#else
+#include <event.h>
+#endif
+
 static edge_connection_t *relay_lookup_conn(circuit_t *circ, cell_t *cell,
                                             cell_direction_t cell_direction,
                                             crypt_path_t *layer_hint);
@@ -1816,6 +1823,153 @@ uint64_t stats_n_data_cells_received = 0;
  * ever received were completely full of data. */
 uint64_t stats_n_data_bytes_received = 0;
 
+/** How many times has a stream held back a partial cell in the hope of
+ * filling it, ever? */
+uint64_t stats_n_data_cells_coalesce_waits = 0;
+/** How many of those times did we give up waiting and send a partial cell
+ * at the stream's coalescing deadline? */
+uint64_t stats_n_data_cells_coalesce_expired = 0;
+
+/** List of edge_connection_t that are holding back a partial cell until
+ * their coalesce_deadline. */
+static smartlist_t *coalescing_streams = NULL;
+/** Timer that fires when the earliest coalesce_deadline passes. */
+static struct event *coalesce_timer = NULL;
+/** True iff coalesce_timer is scheduled. */
+static int coalesce_timer_scheduled = 0;
+
+static void coalesce_timer_cb(evutil_socket_t fd, short what, void *arg);
+
+/** Make sure that coalesce_timer will fire when the earliest deadline among
+ * coalescing_streams has passed. */
+static void
+coalesce_schedule_timer(const struct timeval *now)
+{
+  struct timeval earliest, timeout;
+  int have_earliest = 0;
+
+  if (coalesce_timer_scheduled || !coalescing_streams ||
+      !tor_libevent_get_base())
+    return;
+
+  SMARTLIST_FOREACH(coalescing_streams, edge_connection_t *, conn, {
+    if (!have_earliest ||
+        timercmp(&conn->coalesce_deadline, &earliest, <)) {
+      earliest = conn->coalesce_deadline;
+      have_earliest = 1;
+    }
+  });
+  if (!have_earliest)
+    return;
+
+  if (timercmp(&earliest, now, >)) {
+    timersub(&earliest, now, &timeout);
+  } else {
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+  }
+
+  if (!coalesce_timer)
+    coalesce_timer = tor_evtimer_new(tor_libevent_get_base(),
+                                     coalesce_timer_cb, NULL);
+  if (evtimer_add(coalesce_timer, &timeout) < 0) {
+    log_warn(LD_BUG, "Couldn't add timer for coalescing stream data");
+    return;
+  }
+  coalesce_timer_scheduled = 1;
+}
+
+/** Callback: package the data on every stream whose coalescing deadline has
+ * passed, full cell or not. */
+static void
+coalesce_timer_cb(evutil_socket_t fd, short what, void *arg)
+{
+  smartlist_t *expired;
+  struct timeval now;
+  (void)fd;
+  (void)what;
+  (void)arg;
+
+  coalesce_timer_scheduled = 0;
+  if (!coalescing_streams)
+    return;
+
+  tor_gettimeofday(&now);
+  expired = smartlist_new();
+  SMARTLIST_FOREACH(coalescing_streams, edge_connection_t *, conn, {
+    if (timercmp(&conn->coalesce_deadline, &now, <=))
+      smartlist_add(expired, conn);
+  });
+
+  SMARTLIST_FOREACH_BEGIN(expired, edge_connection_t *, conn) {
+    ++stats_n_data_cells_coalesce_expired;
+    /* Leave coalesce_pending set so that the packaging code sees that the
+     * deadline has passed; it will cancel the deadline itself. */
+    if (!conn->base_.marked_for_close)
+      connection_edge_process_inbuf(conn, 1);
+    edge_stream_coalesce_cancel(conn);
+  } SMARTLIST_FOREACH_END(conn);
+  smartlist_free(expired);
+
+  coalesce_schedule_timer(&now);
+}
+
+/** Return true iff <b>conn</b>, which has only <b>len</b> bytes to package
+ * as of <b>now</b>, should hold them back for a little while in case more
+ * data arrives to fill the cell.  Starts the stream's coalescing deadline
+ * if it is not already waiting. */
+STATIC int
+edge_stream_should_coalesce(edge_connection_t *conn, size_t len,
+                            const struct timeval *now)
+{
+  const int delay = get_options()->StreamCoalesceDelay;
+
+  if (delay <= 0 || len >= RELAY_PAYLOAD_SIZE ||
+      conn->base_.inbuf_reached_eof)
+    return 0;
+
+  if (!conn->coalesce_pending) {
+    struct timeval delay_tv;
+    delay_tv.tv_sec = delay / 1000000;
+    delay_tv.tv_usec = delay % 1000000;
+    timeradd(now, &delay_tv, &conn->coalesce_deadline);
+    conn->coalesce_pending = 1;
+    if (!coalescing_streams)
+      coalescing_streams = smartlist_new();
+    smartlist_add(coalescing_streams, conn);
+    ++stats_n_data_cells_coalesce_waits;
+    coalesce_schedule_timer(now);
+    return 1;
+  }
+
+  return timercmp(now, &conn->coalesce_deadline, <);
+}
+
+/** Stop waiting for more data to fill a cell on <b>conn</b>, if we were. */
+void
+edge_stream_coalesce_cancel(edge_connection_t *conn)
+{
+  if (!conn->coalesce_pending)
+    return;
+  conn->coalesce_pending = 0;
+  if (coalescing_streams)
+    smartlist_remove(coalescing_streams, conn);
+}
+
+/** Release all storage held for stream data coalescing. */
+void
+relay_coalesce_free_all(void)
+{
+  if (coalescing_streams) {
+    SMARTLIST_FOREACH(coalescing_streams, edge_connection_t *, conn,
+                      conn->coalesce_pending = 0);
+    smartlist_free(coalescing_streams);
+  }
+  tor_event_free(coalesce_timer);
+  coalesce_timer = NULL;
+  coalesce_timer_scheduled = 0;
+}
+
 /** If <b>conn</b> has an entire relay payload of bytes on its inbuf (or
  * <b>package_partial</b> is true), and the appropriate package windows aren't
  * empty, grab a cell and send it down the circuit.
@@ -1894,6 +2048,15 @@ connection_edge_package_raw_inbuf(edge_connection_t *conn, int package_partial,
   if (!package_partial && bytes_to_process < RELAY_PAYLOAD_SIZE)
     return 0;
 
+  if (PREDICT_UNLIKELY(get_options()->StreamCoalesceDelay) &&
+      !sending_from_optimistic && bytes_to_process < RELAY_PAYLOAD_SIZE) {
+    struct timeval now;
+    tor_gettimeofday(&now);
+    if (edge_stream_should_coalesce(conn, bytes_to_process, &now))
+      return 0;
+  }
+  edge_stream_coalesce_cancel(conn);
+
   if (bytes_to_process > RELAY_PAYLOAD_SIZE) {
     length = RELAY_PAYLOAD_SIZE;
   } else {
@@ -1940,6 +2103,8 @@ connection_edge_package_raw_inbuf(edge_connection_t *conn, int package_partial,
     cpath_layer->package_window--;
   }
 
+  edge_stream_note_cell_packaged(conn, approx_time());
+
   if (--conn->package_window <= 0) { /* is it 0 after decrement? */
     connection_stop_reading(TO_CONN(conn));
     log_debug(domain,"conn->package_window reached 0.");
@@ -2022,6 +2187,79 @@ stream_choice_seed_weak_rng(void)
   crypto_seed_weak_rng(&stream_choice_rng);
 }
 
+/** How many seconds does it take for a stream's recent_cells count to
+ * decay by half? */
+#define STREAM_ACTIVITY_HALFLIFE 1
+
+/** Return the decayed number of cells that we have recently packaged from
+ * <b>conn</b>, as of <b>now</b>. */
+STATIC uint32_t
+edge_stream_get_recent_cells(edge_connection_t *conn, time_t now)
+{
+  if (now > conn->recent_cells_updated) {
+    time_t halvings = (now - conn->recent_cells_updated) /
+      STREAM_ACTIVITY_HALFLIFE;
+    if (halvings >= 32)
+      conn->recent_cells = 0;
+    else
+      conn->recent_cells >>= halvings;
+    if (conn->recent_cells == 0)
+      conn->recent_cells_updated = now;
+    else
+      conn->recent_cells_updated += halvings * STREAM_ACTIVITY_HALFLIFE;
+  }
+  return conn->recent_cells;
+}
+
+/** Remember that we just packaged a cell from <b>conn</b> at <b>now</b>. */
+STATIC void
+edge_stream_note_cell_packaged(edge_connection_t *conn, time_t now)
+{
+  edge_stream_get_recent_cells(conn, now);
+  if (conn->recent_cells < UINT32_MAX)
+    ++conn->recent_cells;
+}
+
+/** Add to <b>out</b> every stream on the linked list <b>first_conn</b> that
+ * could package cells onto the circuit at <b>layer_hint</b>, ordered so
+ * that the streams that have packaged the fewest cells recently come
+ * first.  Streams with equal recent activity keep their list order,
+ * starting at <b>start</b> and wrapping around. */
+STATIC void
+circuit_get_streams_by_activity(edge_connection_t *first_conn,
+                                edge_connection_t *start,
+                                crypt_path_t *layer_hint,
+                                time_t now, smartlist_t *out)
+{
+  edge_connection_t *conn;
+  int i, j;
+
+  if (!start)
+    start = first_conn;
+
+  conn = start;
+  do {
+    if (!conn->base_.marked_for_close && conn->package_window > 0 &&
+        (!layer_hint || conn->cpath_layer == layer_hint))
+      smartlist_add(out, conn);
+    conn = conn->next_stream ? conn->next_stream : first_conn;
+  } while (conn != start);
+
+  /* Insertion sort, since it is stable and there are rarely more than a
+   * handful of streams on a circuit. */
+  for (i = 1; i < smartlist_len(out); ++i) {
+    edge_connection_t *c = smartlist_get(out, i);
+    uint32_t activity = edge_stream_get_recent_cells(c, now);
+    for (j = i; j > 0; --j) {
+      edge_connection_t *prev = smartlist_get(out, j-1);
+      if (edge_stream_get_recent_cells(prev, now) <= activity)
+        break;
+      smartlist_set(out, j, prev);
+    }
+    smartlist_set(out, j, c);
+  }
+}
+
 /** A helper function for circuit_resume_edge_reading() above.
  * The arguments are the same, except that <b>conn</b> is the head
  * of a linked list of edge streams that should each be considered.
@@ -2038,6 +2276,8 @@ circuit_resume_edge_reading_helper(edge_connection_t *first_conn,
   int cells_per_conn;
   edge_connection_t *chosen_stream = NULL;
   int max_to_package;
+  smartlist_t *streams;
+  int result = 0;
 
   if (first_conn == NULL) {
     /* Don't bother to try to do the rest of this if there are no connections
@@ -2061,11 +2301,10 @@ circuit_resume_edge_reading_helper(edge_connection_t *first_conn,
   /* Once we used to start listening on the streams in the order they
    * appeared in the linked list.  That leads to starvation on the
    * streams that appeared later on the list, since the first streams
-   * would always get to read first.  Instead, we just pick a random
-   * stream on the list, and enable reading for streams starting at that
-   * point (and wrapping around as if the list were circular).  It would
-   * probably be better to actually remember which streams we've
-   * serviced in the past, but this is simple and effective. */
+   * would always get to read first.  Instead, we pick a random stream on
+   * the list as a starting point, and then let the streams that have
+   * packaged the fewest cells recently go first, so that interactive
+   * streams aren't stuck behind bulk transfers on the same circuit. */
 
   /* Select a stream uniformly at random from the linked list.  We
    * don't need cryptographic randomness here. */
@@ -2089,35 +2328,22 @@ circuit_resume_edge_reading_helper(edge_connection_t *first_conn,
     }
   }
 
-  /* Count how many non-marked streams there are that have anything on
-   * their inbuf, and enable reading on all of the connections. */
-  n_packaging_streams = 0;
-  /* Activate reading starting from the chosen stream */
-  for (conn=chosen_stream; conn; conn = conn->next_stream) {
-    /* Start reading for the streams starting from here */
-    if (conn->base_.marked_for_close || conn->package_window <= 0)
-      continue;
-    if (!layer_hint || conn->cpath_layer == layer_hint) {
-      connection_start_reading(TO_CONN(conn));
+  streams = smartlist_new();
+  circuit_get_streams_by_activity(first_conn, chosen_stream, layer_hint,
+                                  approx_time(), streams);
 
-      if (connection_get_inbuf_len(TO_CONN(conn)) > 0)
-        ++n_packaging_streams;
-    }
-  }
-  /* Go back and do the ones we skipped, circular-style */
-  for (conn = first_conn; conn != chosen_stream; conn = conn->next_stream) {
-    if (conn->base_.marked_for_close || conn->package_window <= 0)
-      continue;
-    if (!layer_hint || conn->cpath_layer == layer_hint) {
-      connection_start_reading(TO_CONN(conn));
+  /* Count how many streams there are that have anything on their inbuf,
+   * and enable reading on all of the connections. */
+  n_packaging_streams = 0;
+  SMARTLIST_FOREACH_BEGIN(streams, edge_connection_t *, c) {
+    connection_start_reading(TO_CONN(c));
 
-      if (connection_get_inbuf_len(TO_CONN(conn)) > 0)
-        ++n_packaging_streams;
-    }
-  }
+    if (connection_get_inbuf_len(TO_CONN(c)) > 0)
+      ++n_packaging_streams;
+  } SMARTLIST_FOREACH_END(c);
 
   if (n_packaging_streams == 0) /* avoid divide-by-zero */
-    return 0;
+    goto done;
 
  again:
 
@@ -2126,42 +2352,42 @@ circuit_resume_edge_reading_helper(edge_connection_t *first_conn,
   packaged_this_round = 0;
   n_streams_left = 0;
 
-  /* Iterate over all connections.  Package up to cells_per_conn cells on
-   * each.  Update packaged_this_round with the total number of cells
-   * packaged, and n_streams_left with the number that still have data to
-   * package.
+  /* Iterate over all connections, quietest first.  Package up to
+   * cells_per_conn cells on each.  Update packaged_this_round with the
+   * total number of cells packaged, and n_streams_left with the number
+   * that still have data to package.
    */
-  for (conn=first_conn; conn; conn=conn->next_stream) {
-    if (conn->base_.marked_for_close || conn->package_window <= 0)
+  SMARTLIST_FOREACH_BEGIN(streams, edge_connection_t *, c) {
+    int n = cells_per_conn, r;
+    if (c->base_.marked_for_close || c->package_window <= 0)
       continue;
-    if (!layer_hint || conn->cpath_layer == layer_hint) {
-      int n = cells_per_conn, r;
-      /* handle whatever might still be on the inbuf */
-      r = connection_edge_package_raw_inbuf(conn, 1, &n);
+    /* handle whatever might still be on the inbuf */
+    r = connection_edge_package_raw_inbuf(c, 1, &n);
 
-      /* Note how many we packaged */
-      packaged_this_round += (cells_per_conn-n);
+    /* Note how many we packaged */
+    packaged_this_round += (cells_per_conn-n);
 
-      if (r<0) {
-        /* Problem while packaging. (We already sent an end cell if
-         * possible) */
-        connection_mark_for_close(TO_CONN(conn));
-        continue;
-      }
+    if (r<0) {
+      /* Problem while packaging. (We already sent an end cell if
+       * possible) */
+      connection_mark_for_close(TO_CONN(c));
+      continue;
+    }
 
-      /* If there's still data to read, we'll be coming back to this stream. */
-      if (connection_get_inbuf_len(TO_CONN(conn)))
-          ++n_streams_left;
+    /* If there's still data to read, we'll be coming back to this stream. */
+    if (connection_get_inbuf_len(TO_CONN(c)))
+        ++n_streams_left;
 
-      /* If the circuit won't accept any more data, return without looking
-       * at any more of the streams. Any connections that should be stopped
-       * have already been stopped by connection_edge_package_raw_inbuf. */
-      if (circuit_consider_stop_edge_reading(circ, layer_hint))
-        return -1;
-      /* XXXX should we also stop immediately if we fill up the cell queue?
-       * Probably. */
+    /* If the circuit won't accept any more data, return without looking
+     * at any more of the streams. Any connections that should be stopped
+     * have already been stopped by connection_edge_package_raw_inbuf. */
+    if (circuit_consider_stop_edge_reading(circ, layer_hint)) {
+      result = -1;
+      goto done;
     }
-  }
+    /* XXXX should we also stop immediately if we fill up the cell queue?
+     * Probably. */
+  } SMARTLIST_FOREACH_END(c);
 
   /* If we made progress, and we are willing to package more, and there are
    * any streams left that want to package stuff... try again!
@@ -2173,7 +2399,9 @@ circuit_resume_edge_reading_helper(edge_connection_t *first_conn,
     goto again;
   }
 
-  return 0;
+ done:
+  smartlist_free(streams);
+  return result;
 }
 
 /** Check if the package window for <b>circ</b> is empty (at
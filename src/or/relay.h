@@ -41,6 +41,11 @@ extern uint64_t stats_n_data_cells_packaged;
 extern uint64_t stats_n_data_bytes_packaged;
 extern uint64_t stats_n_data_cells_received;
 extern uint64_t stats_n_data_bytes_received;
+extern uint64_t stats_n_data_cells_coalesce_waits;
+extern uint64_t stats_n_data_cells_coalesce_expired;
+
+void edge_stream_coalesce_cancel(edge_connection_t *conn);
+void relay_coalesce_free_all(void);
 
 #ifdef ENABLE_MEMPOOLS
 void init_cell_pool(void);
@@ -106,6 +111,16 @@ STATIC packed_cell_t *packed_cell_new(void);
 STATIC packed_cell_t *cell_queue_pop(cell_queue_t *queue);
 STATIC size_t cell_queues_get_total_allocation(void);
 STATIC int cell_queues_check_size(void);
+STATIC uint32_t edge_stream_get_recent_cells(edge_connection_t *conn,
+                                             time_t now);
+STATIC int edge_stream_should_coalesce(edge_connection_t *conn, size_t len,
+                                       const struct timeval *now);
+STATIC void edge_stream_note_cell_packaged(edge_connection_t *conn,
+                                           time_t now);
+STATIC void circuit_get_streams_by_activity(edge_connection_t *first_conn,
+                                            edge_connection_t *start,
+                                            crypt_path_t *layer_hint,
+                                            time_t now, smartlist_t *out);
 #endif
 
 #endif
@@ -20,6 +20,7 @@
 #include "router.h"
 #include "routerlist.h"
 #include "ht.h"
+#include <math.h>
 
 static void bw_arrays_init(void);
 static void predicted_ports_init(void);
@@ -1837,6 +1838,86 @@ rep_hist_get_predicted_internal(time_t now, int *need_uptime,
   return 1;
 }
 
+/** Half-life, in seconds, of our estimate of how often streams need a
+ * fresh exit circuit. */
+#define CIRC_DEMAND_HALFLIFE (10*60)
+
+/** For ordinary ports [0] and for LongLivedPorts [1]: an exponentially
+ * decayed estimate of how many streams per second have needed a clean
+ * circuit of their own, as of circ_demand_updated[]. */
+static double circ_demand_rate[2];
+/** When did we last update each element of circ_demand_rate? */
+static time_t circ_demand_updated[2];
+/** How many general-purpose streams have attached to a circuit at once,
+ * and how many had to wait for one to be built? */
+static uint64_t n_streams_attached_at_once = 0, n_streams_waited_for_circ = 0;
+
+/** Return the value of circ_demand_rate[<b>idx</b>], decayed to time
+ * <b>now</b>. */
+static double
+circ_demand_rate_at(int idx, time_t now)
+{
+  double rate = circ_demand_rate[idx];
+  if (rate > 0 && now > circ_demand_updated[idx])
+    rate *= pow(0.5, (double)(now - circ_demand_updated[idx]) /
+                CIRC_DEMAND_HALFLIFE);
+  return rate;
+}
+
+/** Remember that at time <b>now</b>, a stream needed an exit circuit that
+ * no other stream was using: either because it attached to a clean
+ * circuit, or because it had to wait for a new one.  (Streams that can
+ * share a dirty circuit under their isolation rules don't count.)  Set
+ * <b>need_uptime</b> if the stream was for one of our LongLivedPorts. */
+void
+rep_hist_note_clean_circ_demand(time_t now, int need_uptime)
+{
+  const int idx = need_uptime ? 1 : 0;
+  /* Each arrival adds 1/tau, where tau is the mean lifetime of the decay;
+   * so a steady stream of arrivals converges to its rate per second. */
+  const double tau = CIRC_DEMAND_HALFLIFE / log(2.0);
+  circ_demand_rate[idx] = circ_demand_rate_at(idx, now) + 1.0 / tau;
+  circ_demand_updated[idx] = now;
+}
+
+/** Return our estimate of how many streams per second will need a clean
+ * exit circuit of their own, for LongLivedPorts if <b>need_uptime</b> is
+ * set and for other ports otherwise. */
+double
+rep_hist_get_clean_circ_demand(time_t now, int need_uptime)
+{
+  return circ_demand_rate_at(need_uptime ? 1 : 0, now);
+}
+
+/** Remember that a general-purpose stream has been attached to a circuit;
+ * <b>waited</b> is true iff it had to wait for a circuit to be built. */
+void
+rep_hist_note_stream_attached(int waited)
+{
+  if (waited)
+    ++n_streams_waited_for_circ;
+  else
+    ++n_streams_attached_at_once;
+}
+
+/** Log how well our preemptive circuits have been serving our streams. */
+void
+rep_hist_dump_circ_prediction_stats(int severity)
+{
+  const uint64_t total = n_streams_attached_at_once +
+    n_streams_waited_for_circ;
+  const time_t now = time(NULL);
+  tor_log(severity, LD_HIST,
+          "Preemptive circuits: "U64_FORMAT" of "U64_FORMAT" streams "
+          "attached without waiting for a circuit (%.1f%%). Expecting "
+          "%.3f streams/sec to need a fresh circuit (%.3f for long-lived "
+          "ports).",
+          U64_PRINTF_ARG(n_streams_attached_at_once), U64_PRINTF_ARG(total),
+          total ? 100.0 * n_streams_attached_at_once / total : 0.0,
+          rep_hist_get_clean_circ_demand(now, 0),
+          rep_hist_get_clean_circ_demand(now, 1));
+}
+
 /** Any ports used lately? These are pre-seeded if we just started
  * up or if we're running a hidden service. */
 int
@@ -57,6 +57,11 @@ void rep_hist_note_used_internal(time_t now, int need_uptime,
 int rep_hist_get_predicted_internal(time_t now, int *need_uptime,
                                     int *need_capacity);
 
+void rep_hist_note_clean_circ_demand(time_t now, int need_uptime);
+double rep_hist_get_clean_circ_demand(time_t now, int need_uptime);
+void rep_hist_note_stream_attached(int waited);
+void rep_hist_dump_circ_prediction_stats(int severity);
+
 int any_predicted_circuits(time_t now);
 int rep_hist_circbuilding_dormant(time_t now);
 
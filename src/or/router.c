@@ -29,6 +29,7 @@
 #include "routerlist.h"
 #include "routerparse.h"
 #include "statefile.h"
+#include "strbuf.h"
 #include "transports.h"
 #include "routerset.h"
 
@@ -2291,6 +2292,9 @@ get_platform_str(char *platform, size_t len)
  */
 #define DEBUG_ROUTER_DUMP_ROUTER_TO_STRING
 
+/** A server descriptor is usually somewhat shorter than this. */
+#define ROUTER_DESC_SIZE_HINT 4096
+
 /** OR only: Given a routerinfo for this router, and an identity key to sign
  * with, encode the routerinfo as a signed server descriptor and return a new
  * string encoding the result, or NULL on failure.
@@ -2311,7 +2315,7 @@ router_dump_router_to_string(routerinfo_t *router,
   char *family_line = NULL;
   char *extra_or_address = NULL;
   const or_options_t *options = get_options();
-  smartlist_t *chunks = NULL;
+  strbuf_t *sb = NULL;
   char *output = NULL;
 
   /* Make sure the identity key matches the one in the routerinfo. */
@@ -2374,10 +2378,10 @@ router_dump_router_to_string(routerinfo_t *router,
   }
 
   address = tor_dup_ip(router->addr);
-  chunks = smartlist_new();
+  sb = strbuf_new(ROUTER_DESC_SIZE_HINT);
 
   /* Generate the easy portion of the router descriptor. */
-  smartlist_add_asprintf(chunks,
+  strbuf_add_printf(sb,
                     "router %s %s %d 0 %d\n"
                     "%s"
                     "platform %s\n"
@@ -2417,7 +2421,7 @@ router_dump_router_to_string(routerinfo_t *router,
     const char *ci = options->ContactInfo;
     if (strchr(ci, '\n') || strchr(ci, '\r'))
       ci = escaped(ci);
-    smartlist_add_asprintf(chunks, "contact %s\n", ci);
+    strbuf_add_printf(sb, "contact %s\n", ci);
   }
 
   if (router->onion_curve25519_pkey) {
@@ -2425,35 +2429,35 @@ router_dump_router_to_string(routerinfo_t *router,
     base64_encode(kbuf, sizeof(kbuf),
                   (const char *)router->onion_curve25519_pkey->public_key,
                   CURVE25519_PUBKEY_LEN);
-    smartlist_add_asprintf(chunks, "ntor-onion-key %s", kbuf);
+    strbuf_add_printf(sb, "ntor-onion-key %s", kbuf);
   }
 
   /* Write the exit policy to the end of 's'. */
   if (!router->exit_policy || !smartlist_len(router->exit_policy)) {
-    smartlist_add(chunks, tor_strdup("reject *:*\n"));
+    strbuf_add(sb, "reject *:*\n");
   } else if (router->exit_policy) {
     char *exit_policy = router_dump_exit_policy_to_string(router,1,0);
 
     if (!exit_policy)
       goto err;
 
-    smartlist_add_asprintf(chunks, "%s\n", exit_policy);
+    strbuf_add(sb, exit_policy);
+    strbuf_add(sb, "\n");
     tor_free(exit_policy);
   }
 
   if (router->ipv6_exit_policy) {
     char *p6 = write_short_policy(router->ipv6_exit_policy);
     if (p6 && strcmp(p6, "reject 1-65535")) {
-      smartlist_add_asprintf(chunks,
-                            "ipv6-policy %s\n", p6);
+      strbuf_add_printf(sb, "ipv6-policy %s\n", p6);
     }
     tor_free(p6);
   }
 
   /* Sign the descriptor */
-  smartlist_add(chunks, tor_strdup("router-signature\n"));
+  strbuf_add(sb, "router-signature\n");
 
-  crypto_digest_smartlist(digest, DIGEST_LEN, chunks, "", DIGEST_SHA1);
+  crypto_digest(digest, strbuf_get(sb), strbuf_len(sb));
 
   note_crypto_pk_op(SIGN_RTR);
   {
@@ -2462,13 +2466,15 @@ router_dump_router_to_string(routerinfo_t *router,
       log_warn(LD_BUG, "Couldn't sign router descriptor");
       goto err;
     }
-    smartlist_add(chunks, sig);
+    strbuf_add(sb, sig);
+    tor_free(sig);
   }
 
   /* include a last '\n' */
-  smartlist_add(chunks, tor_strdup("\n"));
+  strbuf_add(sb, "\n");
 
-  output = smartlist_join_strings(chunks, "", 0, NULL);
+  output = strbuf_steal(sb, NULL);
+  sb = NULL;
 
 #ifdef DEBUG_ROUTER_DUMP_ROUTER_TO_STRING
   {
@@ -2493,10 +2499,7 @@ router_dump_router_to_string(routerinfo_t *router,
  err:
   tor_free(output); /* sets output to NULL */
  done:
-  if (chunks) {
-    SMARTLIST_FOREACH(chunks, char *, cp, tor_free(cp));
-    smartlist_free(chunks);
-  }
+  strbuf_free(sb);
   tor_free(address);
   tor_free(family_line);
   tor_free(onion_pkey);
@@ -1303,7 +1303,8 @@ router_pick_directory_server(dirinfo_type_t type, int flags)
      * we must be excluding good servers because we already have serverdesc
      * fetches with them.  Do not mark down servers up because of this. */
     tor_assert((flags & (PDS_NO_EXISTING_SERVERDESC_FETCH|
-                         PDS_NO_EXISTING_MICRODESC_FETCH)));
+                         PDS_NO_EXISTING_MICRODESC_FETCH|
+                         PDS_NO_EXISTING_CONSENSUS_FETCH)));
     return NULL;
   }
 
@@ -1409,7 +1410,8 @@ router_pick_dirserver_generic(smartlist_t *sourcelist,
      * we must be excluding good servers because we already have serverdesc
      * fetches with them.  Do not mark down servers up because of this. */
     tor_assert((flags & (PDS_NO_EXISTING_SERVERDESC_FETCH|
-                         PDS_NO_EXISTING_MICRODESC_FETCH)));
+                         PDS_NO_EXISTING_MICRODESC_FETCH|
+                         PDS_NO_EXISTING_CONSENSUS_FETCH)));
     return NULL;
   }
 
@@ -1427,7 +1429,8 @@ router_pick_dirserver_generic(smartlist_t *sourcelist,
  *
  * If <b>n_busy_out</b> is provided, set *<b>n_busy_out</b> to the number of
  * directories that we excluded for no other reason than
- * PDS_NO_EXISTING_SERVERDESC_FETCH or PDS_NO_EXISTING_MICRODESC_FETCH.
+ * PDS_NO_EXISTING_SERVERDESC_FETCH, PDS_NO_EXISTING_MICRODESC_FETCH, or
+ * PDS_NO_EXISTING_CONSENSUS_FETCH.
  */
 static const routerstatus_t *
 router_pick_directory_server_impl(dirinfo_type_t type, int flags,
@@ -1444,6 +1447,7 @@ router_pick_directory_server_impl(dirinfo_type_t type, int flags,
   const int fascistfirewall = ! (flags & PDS_IGNORE_FASCISTFIREWALL);
   const int no_serverdesc_fetching =(flags & PDS_NO_EXISTING_SERVERDESC_FETCH);
   const int no_microdesc_fetching = (flags & PDS_NO_EXISTING_MICRODESC_FETCH);
+  const int no_consensus_fetching = (flags & PDS_NO_EXISTING_CONSENSUS_FETCH);
   const int for_guard = (flags & PDS_FOR_GUARD);
   int try_excluding = 1, n_excluded = 0, n_busy = 0;
 
@@ -1511,6 +1515,13 @@ router_pick_directory_server_impl(dirinfo_type_t type, int flags,
       continue;
     }
 
+    if (no_consensus_fetching && connection_get_by_type_addr_port_purpose(
+      CONN_TYPE_DIR, &addr, status->dir_port, DIR_PURPOSE_FETCH_CONSENSUS)
+    ) {
+      ++n_busy;
+      continue;
+    }
+
     is_overloaded = status->last_dir_503_at + DIR_503_TIMEOUT > now;
 
     if ((!fascistfirewall ||
@@ -1607,6 +1618,7 @@ router_pick_trusteddirserver_impl(const smartlist_t *sourcelist,
   const int fascistfirewall = ! (flags & PDS_IGNORE_FASCISTFIREWALL);
   const int no_serverdesc_fetching =(flags & PDS_NO_EXISTING_SERVERDESC_FETCH);
   const int no_microdesc_fetching =(flags & PDS_NO_EXISTING_MICRODESC_FETCH);
+  const int no_consensus_fetching =(flags & PDS_NO_EXISTING_CONSENSUS_FETCH);
   const double auth_weight = (sourcelist == fallback_dir_servers) ?
     options->DirAuthorityFallbackRate : 1.0;
   smartlist_t *pick_from;
@@ -1664,6 +1676,13 @@ router_pick_trusteddirserver_impl(const smartlist_t *sourcelist,
           continue;
         }
       }
+      if (no_consensus_fetching) {
+        if (connection_get_by_type_addr_port_purpose(
+             CONN_TYPE_DIR, &addr, d->dir_port, DIR_PURPOSE_FETCH_CONSENSUS)) {
+          ++n_busy;
+          continue;
+        }
+      }
 
       if (d->or_port &&
           (!fascistfirewall ||
@@ -2597,15 +2616,16 @@ routerinfo_free(routerinfo_t *router)
 
   tor_free(router->cache_info.signed_descriptor_body);
   tor_free(router->nickname);
-  tor_free(router->platform);
-  tor_free(router->contact_info);
+  tor_intern_str_release(router->platform);
+  tor_intern_str_release(router->contact_info);
   if (router->onion_pkey)
     crypto_pk_free(router->onion_pkey);
   tor_free(router->onion_curve25519_pkey);
   if (router->identity_pkey)
     crypto_pk_free(router->identity_pkey);
   if (router->declared_family) {
-    SMARTLIST_FOREACH(router->declared_family, char *, s, tor_free(s));
+    SMARTLIST_FOREACH(router->declared_family, const char *, s,
+                      tor_intern_str_release(s));
     smartlist_free(router->declared_family);
   }
   addr_policy_list_free(router->exit_policy);
@@ -1325,11 +1325,11 @@ router_parse_entry_from_string(const char *s, const char *end,
   }
 
   if ((tok = find_opt_by_keyword(tokens, K_PLATFORM))) {
-    router->platform = tor_strdup(tok->args[0]);
+    router->platform = tor_intern_str(tok->args[0]);
   }
 
   if ((tok = find_opt_by_keyword(tokens, K_CONTACT))) {
-    router->contact_info = tor_strdup(tok->args[0]);
+    router->contact_info = tor_intern_str(tok->args[0]);
   }
 
   if (find_opt_by_keyword(tokens, K_REJECT6) ||
@@ -1380,7 +1380,8 @@ router_parse_entry_from_string(const char *s, const char *end,
                  escaped(tok->args[i]));
         goto err;
       }
-      smartlist_add(router->declared_family, tor_strdup(tok->args[i]));
+      smartlist_add(router->declared_family,
+                    (char *) tor_intern_str(tok->args[i]));
     }
   }
 
@@ -1424,7 +1425,7 @@ router_parse_entry_from_string(const char *s, const char *end,
     goto err;
 
   if (!router->platform) {
-    router->platform = tor_strdup("<unknown>");
+    router->platform = tor_intern_str("<unknown>");
   }
   goto done;
 
@@ -4162,7 +4163,7 @@ microdescs_parse_from_string(const char *s, const char *eos,
                    escaped(tok->args[i]));
           goto next;
         }
-        smartlist_add(md->family, tor_strdup(tok->args[i]));
+        smartlist_add(md->family, (char *) tor_intern_str(tok->args[i]));
       }
     }
 
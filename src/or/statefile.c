@@ -79,6 +79,9 @@ static config_var_t state_vars_[] = {
 
   V(TorVersion,                       STRING,   NULL),
 
+  V(CryptoBackends,                   STRING,   NULL),
+  V(CryptoBackendsPlatform,           STRING,   NULL),
+
   V(LastRotatedOnionKey,              ISOTIME,  NULL),
   V(LastWritten,                      ISOTIME,  NULL),
 
@@ -11,6 +11,8 @@
 #include "or.h"
 #include "circuituse.h"
 #include "config.h"
+#include "cpuworker.h"
+#include "dnsserv.h"
 #include "status.h"
 #include "nodelist.h"
 #include "relay.h"
@@ -130,8 +132,18 @@ log_heartbeat(time_t now)
   if (public_server_mode(options))
     rep_hist_log_circuit_handshake_stats(now);
 
+  if (options && options->DNSPort_set)
+    dnsserv_log_stats(LOG_NOTICE);
+
   circuit_log_ancient_one_hop_circuits(1800);
 
+  {
+    char *placement = cpu_placement_describe();
+    if (placement)
+      log_notice(LD_HEARTBEAT, "%s", placement);
+    tor_free(placement);
+  }
+
   if (options && options->BridgeRelay) {
     char *msg = NULL;
     msg = format_client_stats_heartbeat(now);
@@ -158,6 +170,7 @@ log_accounting(const time_t now, const or_options_t *options)
   time_t interval_end = accounting_get_end_time();
   char end_buf[ISO_TIME_LEN + 1];
   char *remaining = NULL;
+  int pacing_rate, pacing_burst;
   if (options->AccountingRule == ACCT_SUM)
     acc_bytes *= 2;
   acc_max = bytes_to_usage(acc_bytes);
@@ -168,6 +181,10 @@ log_accounting(const time_t now, const or_options_t *options)
       "Sent: %s / %s, Received: %s / %s. The "
       "current accounting interval ends on %s, in %s.",
       acc_sent, acc_max, acc_rcvd, acc_max, end_buf, remaining);
+  if (accounting_get_pacing_limits(&pacing_rate, &pacing_burst))
+    log_notice(LD_HEARTBEAT, "Heartbeat: Accounting pacing limits our "
+               "bandwidth to %d bytes/sec (burst %d bytes) in each direction.",
+               pacing_rate, pacing_burst);
 
   tor_free(acc_rcvd);
   tor_free(acc_sent);
@@ -14,6 +14,7 @@ const char tor_git_revision[] = "";
 
 #include "orconfig.h"
 
+#define TOR_CHANNEL_INTERNAL_
 #include "or.h"
 #include "onion_tap.h"
 #include "relay.h"
@@ -25,10 +26,29 @@ const char tor_git_revision[] = "";
 #include <openssl/obj_mac.h>
 #endif
 
+#include "buffers.h"
+#include "channel.h"
+#include "channeltls.h"
+#include "circuitbuild.h"
+#include "circuitlist.h"
 #include "config.h"
+#include "connection.h"
+#include "main.h"
 #include "crypto_curve25519.h"
 #include "onion_ntor.h"
 #include "crypto_ed25519.h"
+#include "dirvote.h"
+#include "microdesc.h"
+#include "networkstatus.h"
+#include "router.h"
+#include "routerlist.h"
+#include "routerparse.h"
+#include "scheduler.h"
+#include "strbuf.h"
+#include "torgzip.h"
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_PROCESS_CPUTIME_ID)
 static uint64_t nanostart;
@@ -81,6 +101,450 @@ perftime(void)
 #define MICROCOUNT(start,end,iters) \
   ( NANOCOUNT((start), (end), (iters)) / 1000.0 )
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_CYCLECOUNT
+/** Return the CPU's timestamp counter.  Unlike perftime(), this counts
+ * cycles (at the nominal clock rate), and is cheap enough to read around a
+ * few cells. */
+static inline uint64_t
+cyclecount(void)
+{
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return (((uint64_t)hi) << 32) | lo;
+}
+#endif
+
+/** A number that benchmarks can look up with get_bench_param(), and which
+ * the command line can override with <b>name</b>=<b>value</b>. */
+typedef struct bench_param_t {
+  const char *name;
+  int value;
+  const char *description;
+} bench_param_t;
+
+static bench_param_t bench_params[] = {
+  { "or_circuits", 10000, "relayed circuits for mem_footprint" },
+  { "origin_circuits", 1000, "origin circuits for mem_footprint" },
+  { "streams", 5000, "exit streams for mem_footprint" },
+  { "or_conns", 500, "OR connections for mem_footprint" },
+  { "queue_depth", 4, "cells queued on each circuit and connection "
+    "for mem_footprint" },
+  { "forward_circuits", 16384, "most relayed circuits for cell_forward" },
+  { "forward_conns", 64, "OR connections for cell_forward" },
+  { "close_circuits", 16384, "most circuits on the channel that "
+    "channel_close closes" },
+  { "close_conns", 64, "OR connections that carry the other ends of "
+    "channel_close's circuits" },
+  { NULL, 0, NULL }
+};
+
+/** Return the bench_param_t whose name is the first <b>namelen</b> bytes
+ * of <b>name</b>, or NULL if there isn't one. */
+static bench_param_t *
+find_bench_param(const char *name, size_t namelen)
+{
+  bench_param_t *p;
+  for (p = bench_params; p->name; ++p) {
+    if (strlen(p->name) == namelen && !strncmp(p->name, name, namelen))
+      return p;
+  }
+  return NULL;
+}
+
+/** Return the value of the benchmark parameter called <b>name</b>. */
+static int
+get_bench_param(const char *name)
+{
+  bench_param_t *p = find_bench_param(name, strlen(name));
+  tor_assert(p);
+  return p->value;
+}
+
+/** Everything we've measured of one quantity that a benchmark reports,
+ * with one sample for every repetition. */
+typedef struct bench_metric_t {
+  char *benchmark; /**< Name of the benchmark that reports it. */
+  char *name; /**< What it measures. */
+  char *unit; /**< What it's measured in, e.g. "nsec/byte" or "ops/sec". */
+  double *samples; /**< The values we've seen so far. */
+  int n_samples; /**< Number of values in samples. */
+  int samples_allocated; /**< Number of values that samples has room for. */
+} bench_metric_t;
+
+/** Every metric recorded so far, in the order we first saw them. */
+static smartlist_t *bench_metrics = NULL;
+/** The benchmark whose results bench_record() should keep, or NULL if we
+ * are only warming up. */
+static const char *bench_recording = NULL;
+
+static void bench_record(const char *unit, double value,
+                         const char *fmt, ...)
+  CHECK_PRINTF(3, 4);
+
+/** Remember that the benchmark now running measured <b>value</b> (in
+ * <b>unit</b>) for the metric named by <b>fmt</b> and the following
+ * arguments.  Benchmarks call this alongside their printf() for every number
+ * that a later run should be compared against. */
+static void
+bench_record(const char *unit, double value, const char *fmt, ...)
+{
+  bench_metric_t *m = NULL;
+  char *name = NULL;
+  va_list ap;
+
+  if (!bench_recording)
+    return;
+  va_start(ap, fmt);
+  tor_vasprintf(&name, fmt, ap);
+  va_end(ap);
+
+  if (!bench_metrics)
+    bench_metrics = smartlist_new();
+  SMARTLIST_FOREACH(bench_metrics, bench_metric_t *, metric, {
+    if (!strcmp(metric->benchmark, bench_recording) &&
+        !strcmp(metric->name, name)) {
+      m = metric;
+      break;
+    }
+  });
+  if (!m) {
+    m = tor_malloc_zero(sizeof(bench_metric_t));
+    m->benchmark = tor_strdup(bench_recording);
+    m->name = name;
+    m->unit = tor_strdup(unit);
+    smartlist_add(bench_metrics, m);
+  } else {
+    tor_free(name);
+  }
+  if (m->n_samples == m->samples_allocated) {
+    m->samples_allocated = m->samples_allocated ? m->samples_allocated*2 : 8;
+    m->samples = tor_reallocarray(m->samples, m->samples_allocated,
+                                  sizeof(double));
+  }
+  m->samples[m->n_samples++] = value;
+}
+
+/** Helper: compare two doubles for qsort. */
+static int
+compare_doubles(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  if (da < db)
+    return -1;
+  else if (da > db)
+    return 1;
+  return 0;
+}
+
+/** Return the <b>pct</b>th percentile of the <b>n</b> values in
+ * <b>sorted</b>, which must be in ascending order, interpolating linearly
+ * between the samples on either side. */
+static double
+percentile(const double *sorted, int n, double pct)
+{
+  double pos, frac;
+  int lo;
+  tor_assert(n > 0);
+  pos = (n - 1) * pct / 100.0;
+  lo = (int)pos;
+  if (lo >= n - 1)
+    return sorted[n - 1];
+  frac = pos - lo;
+  return sorted[lo] + (sorted[lo + 1] - sorted[lo]) * frac;
+}
+
+/** Set *<b>median_out</b>, *<b>p10_out</b> and *<b>p90_out</b> to the
+ * median, 10th and 90th percentile of the samples in <b>m</b>. */
+static void
+bench_metric_summarize(const bench_metric_t *m, double *median_out,
+                       double *p10_out, double *p90_out)
+{
+  double *sorted = tor_memdup(m->samples, m->n_samples * sizeof(double));
+  qsort(sorted, m->n_samples, sizeof(double), compare_doubles);
+  *median_out = percentile(sorted, m->n_samples, 50);
+  *p10_out = percentile(sorted, m->n_samples, 10);
+  *p90_out = percentile(sorted, m->n_samples, 90);
+  tor_free(sorted);
+}
+
+/** Return true iff bigger numbers are better for <b>unit</b>: rates are,
+ * while times, sizes and everything else are not. */
+static int
+unit_is_rate(const char *unit)
+{
+  return strstr(unit, "/sec") != NULL;
+}
+
+/** Print the median and spread of every metric that <b>benchmark</b>
+ * recorded. */
+static void
+print_bench_summary(const char *benchmark)
+{
+  if (!bench_metrics)
+    return;
+  SMARTLIST_FOREACH_BEGIN(bench_metrics, const bench_metric_t *, m) {
+    double median, p10, p90;
+    if (strcmp(m->benchmark, benchmark))
+      continue;
+    bench_metric_summarize(m, &median, &p10, &p90);
+    printf("  %s: median %.4g %s (p10 %.4g, p90 %.4g, n=%d)\n",
+           m->name, median, m->unit, p10, p90, m->n_samples);
+  } SMARTLIST_FOREACH_END(m);
+}
+
+/** Append <b>s</b> to <b>sb</b> as a quoted JSON string. */
+static void
+strbuf_add_json_string(strbuf_t *sb, const char *s)
+{
+  strbuf_add(sb, "\"");
+  for ( ; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      strbuf_add_printf(sb, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      strbuf_add_printf(sb, "\\u%04x", (unsigned char)*s);
+    else
+      strbuf_add_len(sb, s, 1);
+  }
+  strbuf_add(sb, "\"");
+}
+
+/** Look for a line starting with <b>field</b> in <b>fname</b>, a file of
+ * "field : value" lines like /proc/cpuinfo, and return a newly allocated
+ * copy of its value.  If <b>field</b> is NULL, return the whole first line.
+ * Return NULL if there's no such file or line. */
+static char *
+read_info_field(const char *fname, const char *field)
+{
+  FILE *f = fopen(fname, "r");
+  char line[256];
+  char *result = NULL;
+  if (!f)
+    return NULL;
+  while (fgets(line, sizeof(line), f)) {
+    char *val = line;
+    if (field) {
+      if (strcmpstart(line, field))
+        continue;
+      val = strchr(line, ':');
+      if (!val)
+        continue;
+      ++val;
+    }
+    result = tor_strdup(eat_whitespace(val));
+    tor_strstrip(result, "\r\n");
+    break;
+  }
+  fclose(f);
+  return result;
+}
+
+/** Append a JSON member called <b>key</b> to <b>sb</b>, whose value is the
+ * string <b>val</b>, or null if <b>val</b> is NULL. */
+static void
+strbuf_add_json_member(strbuf_t *sb, const char *key, const char *val)
+{
+  strbuf_add(sb, "    ");
+  strbuf_add_json_string(sb, key);
+  strbuf_add(sb, ": ");
+  if (val)
+    strbuf_add_json_string(sb, val);
+  else
+    strbuf_add(sb, "null");
+  strbuf_add(sb, ",\n");
+}
+
+/** Describe the machine we're running on, and how we ran, as the members
+ * of a JSON object, so that runs from different machines or builds can be
+ * told apart. */
+static void
+add_bench_environment(strbuf_t *sb, int reps, int warmup)
+{
+  const char *cpufreq = "/sys/devices/system/cpu/cpu0/cpufreq/";
+  char *cpu_model = read_info_field("/proc/cpuinfo", "model name");
+  char *cpu_mhz = read_info_field("/proc/cpuinfo", "cpu MHz");
+  char *fname = NULL, *governor, *cur_khz;
+  char timebuf[ISO_TIME_LEN+1];
+  bench_param_t *p;
+
+  tor_asprintf(&fname, "%sscaling_governor", cpufreq);
+  governor = read_info_field(fname, NULL);
+  tor_free(fname);
+  tor_asprintf(&fname, "%sscaling_cur_freq", cpufreq);
+  cur_khz = read_info_field(fname, NULL);
+  tor_free(fname);
+  format_iso_time(timebuf, time(NULL));
+
+  strbuf_add_json_member(sb, "tor_version", VERSION);
+  strbuf_add_json_member(sb, "openssl_version",
+                         crypto_openssl_get_version_str());
+#ifdef __VERSION__
+  strbuf_add_json_member(sb, "compiler", __VERSION__);
+#else
+  strbuf_add_json_member(sb, "compiler", NULL);
+#endif
+  strbuf_add_json_member(sb, "uname", get_uname());
+  strbuf_add_json_member(sb, "cpu_model", cpu_model);
+  strbuf_add_json_member(sb, "cpu_mhz", cpu_mhz);
+  strbuf_add_json_member(sb, "cpu_cur_freq_khz", cur_khz);
+  strbuf_add_json_member(sb, "cpu_governor", governor);
+  strbuf_add_printf(sb, "    \"num_cpus\": %d,\n", compute_num_cpus());
+  strbuf_add_json_member(sb, "time", timebuf);
+  strbuf_add_printf(sb, "    \"reps\": %d,\n    \"warmup\": %d,\n",
+                    reps, warmup);
+  strbuf_add(sb, "    \"params\": {");
+  for (p = bench_params; p->name; ++p) {
+    strbuf_add(sb, p == bench_params ? " " : ", ");
+    strbuf_add_json_string(sb, p->name);
+    strbuf_add_printf(sb, ": %d", p->value);
+  }
+  strbuf_add(sb, " }\n");
+
+  tor_free(cpu_model);
+  tor_free(cpu_mhz);
+  tor_free(governor);
+  tor_free(cur_khz);
+}
+
+/** Write every metric we've recorded, along with a description of where
+ * and how we recorded them, as JSON to <b>fname</b>.  Return 0 on success,
+ * -1 on failure. */
+static int
+write_bench_json(const char *fname, int reps, int warmup)
+{
+  strbuf_t *sb = strbuf_new(4096);
+  char *s;
+  int r;
+
+  strbuf_add(sb, "{\n  \"environment\": {\n");
+  add_bench_environment(sb, reps, warmup);
+  strbuf_add(sb, "  },\n  \"metrics\": [");
+  if (bench_metrics) {
+    SMARTLIST_FOREACH_BEGIN(bench_metrics, const bench_metric_t *, m) {
+      double median, p10, p90;
+      int i;
+      bench_metric_summarize(m, &median, &p10, &p90);
+      strbuf_add(sb, m_sl_idx ? ",\n    {" : "\n    {");
+      strbuf_add(sb, " \"benchmark\": ");
+      strbuf_add_json_string(sb, m->benchmark);
+      strbuf_add(sb, ", \"metric\": ");
+      strbuf_add_json_string(sb, m->name);
+      strbuf_add(sb, ", \"unit\": ");
+      strbuf_add_json_string(sb, m->unit);
+      strbuf_add_printf(sb, ",\n      \"higher_is_better\": %s, "
+                        "\"median\": %.17g, \"p10\": %.17g, \"p90\": %.17g,"
+                        "\n      \"samples\": [",
+                        unit_is_rate(m->unit) ? "true" : "false",
+                        median, p10, p90);
+      for (i = 0; i < m->n_samples; ++i)
+        strbuf_add_printf(sb, "%s%.17g", i ? ", " : "", m->samples[i]);
+      strbuf_add(sb, "] }");
+    } SMARTLIST_FOREACH_END(m);
+  }
+  strbuf_add(sb, "\n  ]\n}\n");
+
+  s = strbuf_steal(sb, NULL);
+  r = write_str_to_file(fname, s, 0);
+  tor_free(s);
+  return r;
+}
+
+/** Release all storage held by the metrics we've recorded. */
+static void
+bench_metrics_free_all(void)
+{
+  if (!bench_metrics)
+    return;
+  SMARTLIST_FOREACH_BEGIN(bench_metrics, bench_metric_t *, m) {
+    tor_free(m->benchmark);
+    tor_free(m->name);
+    tor_free(m->unit);
+    tor_free(m->samples);
+    tor_free(m);
+  } SMARTLIST_FOREACH_END(m);
+  smartlist_free(bench_metrics);
+  bench_metrics = NULL;
+}
+
+#ifdef __linux__
+/** Return the value of the <b>field</b> line in /proc/self/status, which
+ * should be in kilobytes, or 0 if we can't find it. */
+static unsigned long
+proc_status_kb(const char *field)
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[128];
+  unsigned long kb = 0;
+  if (!f)
+    return 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (!strcmpstart(line, field) && line[strlen(field)] == ':') {
+      kb = strtoul(line + strlen(field) + 1, NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+#endif
+
+/** Return how much memory this process has resident right now, in
+ * kilobytes, or 0 if we can't tell. */
+static unsigned long
+current_rss_kb(void)
+{
+#ifdef __linux__
+  return proc_status_kb("VmRSS");
+#else
+  return 0;
+#endif
+}
+
+/** Return the largest amount of memory this process has had resident since
+ * the last reset_peak_rss(), in kilobytes, or 0 if we can't tell. */
+static unsigned long
+peak_rss_kb(void)
+{
+#ifdef __linux__
+  unsigned long kb = proc_status_kb("VmHWM");
+  if (kb)
+    return kb;
+#endif
+#if defined(HAVE_SYS_RESOURCE_H) && !defined(_WIN32)
+  {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+      return 0;
+#ifdef __APPLE__
+    /* Darwin reports bytes, not kilobytes. */
+    return (unsigned long)ru.ru_maxrss / 1024;
+#else
+    return (unsigned long)ru.ru_maxrss;
+#endif
+  }
+#else
+  return 0;
+#endif
+}
+
+/** Forget the largest amount of memory we've had resident so far, if the
+ * OS lets us, so that peak_rss_kb() only tells us about what happens next.
+ * Return the resulting peak_rss_kb().  (Elsewhere, the peak only ever goes
+ * up, so benchmarks that use less memory than their predecessors will all
+ * report the same figure.) */
+static unsigned long
+reset_peak_rss(void)
+{
+#ifdef __linux__
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (f) {
+    fputs("5", f);
+    fclose(f);
+  }
+#endif
+  return peak_rss_kb();
+}
+
 /** Run AES performance benchmarks. */
 static void
 bench_aes(void)
@@ -106,6 +570,8 @@ bench_aes(void)
     tor_free(b2);
     printf("%d bytes: %.2f nsec per byte\n", len,
            NANOCOUNT(start, end, iters*len));
+    bench_record("nsec/byte", NANOCOUNT(start, end, iters*len),
+                 "%d bytes", len);
   }
   crypto_cipher_free(c);
 }
@@ -136,6 +602,7 @@ bench_onion_TAP(void)
   }
   end = perftime();
   printf("Client-side, part 1: %f usec.\n", NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters), "Client-side, part 1");
 
   onion_skin_TAP_create(key, &dh_out, os);
   start = perftime();
@@ -147,6 +614,8 @@ bench_onion_TAP(void)
   end = perftime();
   printf("Server-side, key guessed right: %f usec\n",
          NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters),
+               "Server-side, key guessed right");
 
   start = perftime();
   for (i = 0; i < iters; ++i) {
@@ -157,6 +626,8 @@ bench_onion_TAP(void)
   end = perftime();
   printf("Server-side, key guessed wrong: %f usec.\n",
          NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters),
+               "Server-side, key guessed wrong");
 
   start = perftime();
   for (i = 0; i < iters; ++i) {
@@ -172,6 +643,7 @@ bench_onion_TAP(void)
   end = perftime();
   printf("Client-side, part 2: %f usec.\n",
          NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters), "Client-side, part 2");
 
  done:
   crypto_pk_free(key);
@@ -207,6 +679,7 @@ bench_onion_ntor(void)
   }
   end = perftime();
   printf("Client-side, part 1: %f usec.\n", NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters), "Client-side, part 1");
 
   state = NULL;
   onion_skin_ntor_create(nodeid, &keypair1.pubkey, &state, os);
@@ -219,6 +692,7 @@ bench_onion_ntor(void)
   end = perftime();
   printf("Server-side: %f usec\n",
          NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters), "Server-side");
 
   start = perftime();
   for (i = 0; i < iters; ++i) {
@@ -231,6 +705,7 @@ bench_onion_ntor(void)
   end = perftime();
   printf("Client-side, part 2: %f usec.\n",
          NANOCOUNT(start, end, iters)/1e3);
+  bench_record("usec", MICROCOUNT(start, end, iters), "Client-side, part 2");
 
   ntor_handshake_state_free(state);
   dimap_free(keymap, NULL);
@@ -256,6 +731,7 @@ bench_ed25519(void)
   end = perftime();
   printf("Generate public key: %.2f usec\n",
          MICROCOUNT(start, end, iters));
+  bench_record("usec", MICROCOUNT(start, end, iters), "Generate public key");
 
   start = perftime();
   for (i = 0; i < iters; ++i) {
@@ -264,6 +740,7 @@ bench_ed25519(void)
   end = perftime();
   printf("Sign a short message: %.2f usec\n",
          MICROCOUNT(start, end, iters));
+  bench_record("usec", MICROCOUNT(start, end, iters), "Sign a short message");
 
   start = perftime();
   for (i = 0; i < iters; ++i) {
@@ -272,6 +749,7 @@ bench_ed25519(void)
   end = perftime();
   printf("Verify signature: %.2f usec\n",
          MICROCOUNT(start, end, iters));
+  bench_record("usec", MICROCOUNT(start, end, iters), "Verify signature");
 
   curve25519_keypair_generate(&curve_kp, 0);
   start = perftime();
@@ -282,6 +760,8 @@ bench_ed25519(void)
   end = perftime();
   printf("Convert public point from curve25519: %.2f usec\n",
          MICROCOUNT(start, end, iters));
+  bench_record("usec", MICROCOUNT(start, end, iters),
+               "Convert public point from curve25519");
 
   curve25519_keypair_generate(&curve_kp, 0);
   start = perftime();
@@ -291,6 +771,7 @@ bench_ed25519(void)
   end = perftime();
   printf("Blind a public key: %.2f usec\n",
          MICROCOUNT(start, end, iters));
+  bench_record("usec", MICROCOUNT(start, end, iters), "Blind a public key");
 }
 
 static void
@@ -315,6 +796,8 @@ bench_cell_aes(void)
     end = perftime();
     printf("%d bytes, misaligned by %d: %.2f nsec per byte\n", len, misalign,
            NANOCOUNT(start, end, iters*len));
+    bench_record("nsec/byte", NANOCOUNT(start, end, iters*len),
+                 "%d bytes, misaligned by %d", len, misalign);
   }
 
   crypto_cipher_free(c);
@@ -355,6 +838,8 @@ bench_dmap(void)
   pt2 = perftime();
   printf("digestmap_set: %.2f ns per element\n",
          NANOCOUNT(start, pt2, iters*elts));
+  bench_record("nsec/element", NANOCOUNT(start, pt2, iters*elts),
+               "digestmap_set");
 
   for (i = 0; i < iters; ++i) {
     SMARTLIST_FOREACH(sl, const char *, cp, digestmap_get(dm, cp));
@@ -363,6 +848,8 @@ bench_dmap(void)
   pt3 = perftime();
   printf("digestmap_get: %.2f ns per element\n",
          NANOCOUNT(pt2, pt3, iters*elts*2));
+  bench_record("nsec/element", NANOCOUNT(pt2, pt3, iters*elts*2),
+               "digestmap_get");
 
   for (i = 0; i < iters; ++i) {
     SMARTLIST_FOREACH(sl, const char *, cp, digestset_add(ds, cp));
@@ -370,6 +857,8 @@ bench_dmap(void)
   pt4 = perftime();
   printf("digestset_add: %.2f ns per element\n",
          NANOCOUNT(pt3, pt4, iters*elts));
+  bench_record("nsec/element", NANOCOUNT(pt3, pt4, iters*elts),
+               "digestset_add");
 
   for (i = 0; i < iters; ++i) {
     SMARTLIST_FOREACH(sl, const char *, cp, n += digestset_contains(ds, cp));
@@ -378,6 +867,8 @@ bench_dmap(void)
   end = perftime();
   printf("digestset_contains: %.2f ns per element.\n",
          NANOCOUNT(pt4, end, iters*elts*2));
+  bench_record("nsec/element", NANOCOUNT(pt4, end, iters*elts*2),
+               "digestset_contains");
   /* We need to use this, or else the whole loop gets optimized out. */
   printf("Hits == %d\n", n);
 
@@ -396,6 +887,992 @@ bench_dmap(void)
   smartlist_free(sl2);
 }
 
+/** Helper: compare two DIGEST_LEN digests the way we used to sort them. */
+static int
+compare_digests_qsort(const void **a, const void **b)
+{
+  return tor_memcmp(*a, *b, DIGEST_LEN);
+}
+
+/** Compare sorting and de-duplicating lists of digests with
+ * smartlist_sort_digests() against a plain comparison sort. */
+static void
+bench_digest_sort(void)
+{
+  int n, i, iter;
+  uint64_t start, end;
+  smartlist_t *digests = smartlist_new(), *sl = smartlist_new();
+
+  for (n = 100; n <= 100000; n *= 10) {
+    const int iters = 1000000 / n;
+    uint64_t qsort_time = 0, radix_time = 0, uniq_time = 0;
+    for (i = 0; i < n; ++i) {
+      char *d = tor_malloc(DIGEST_LEN);
+      crypto_rand(d, DIGEST_LEN);
+      smartlist_add(digests, d);
+    }
+    for (iter = 0; iter < iters; ++iter) {
+      smartlist_clear(sl);
+      smartlist_add_all(sl, digests);
+      start = perftime();
+      smartlist_sort(sl, compare_digests_qsort);
+      end = perftime();
+      qsort_time += end - start;
+
+      smartlist_clear(sl);
+      smartlist_add_all(sl, digests);
+      start = perftime();
+      smartlist_sort_digests(sl);
+      end = perftime();
+      radix_time += end - start;
+    }
+    /* Every digest twice, so that half of them are duplicates. */
+    for (iter = 0; iter < iters; ++iter) {
+      smartlist_clear(sl);
+      SMARTLIST_FOREACH(digests, const char *, d, {
+        smartlist_add(sl, tor_memdup(d, DIGEST_LEN));
+        smartlist_add(sl, tor_memdup(d, DIGEST_LEN));
+      });
+      smartlist_sort_digests(sl);
+      start = perftime();
+      smartlist_uniq_digests(sl);
+      end = perftime();
+      uniq_time += end - start;
+      SMARTLIST_FOREACH(sl, char *, d, tor_free(d));
+    }
+    printf("%d digests: qsort %.2f nsec/digest, radix %.2f nsec/digest, "
+           "uniq %.2f nsec/digest\n", n,
+           NANOCOUNT(0, qsort_time, iters * n),
+           NANOCOUNT(0, radix_time, iters * n),
+           NANOCOUNT(0, uniq_time, iters * n * 2));
+    bench_record("nsec/digest", NANOCOUNT(0, qsort_time, iters * n),
+                 "%d digests, qsort", n);
+    bench_record("nsec/digest", NANOCOUNT(0, radix_time, iters * n),
+                 "%d digests, radix", n);
+    bench_record("nsec/digest", NANOCOUNT(0, uniq_time, iters * n * 2),
+                 "%d digests, uniq", n);
+    SMARTLIST_FOREACH(digests, char *, d, tor_free(d));
+    smartlist_clear(digests);
+  }
+  smartlist_clear(sl);
+  smartlist_free(sl);
+  smartlist_free(digests);
+}
+
+/** How many relays do the synthetic directory documents describe? */
+#define DIRDOC_N_ROUTERS 1000
+/** How many RSA keys do the synthetic relays share?  Generating a fresh key
+ * for every relay would take far longer than the benchmarks themselves. */
+#define DIRDOC_N_KEYS 16
+/** How many authorities vote on the synthetic consensus? */
+#define DIRDOC_N_VOTERS 3
+/** How many times do we repeat each directory document benchmark? */
+#define DIRDOC_ITERS 10
+
+extern const char AUTHORITY_CERT_1[];
+extern const char AUTHORITY_CERT_2[];
+extern const char AUTHORITY_CERT_3[];
+extern const char AUTHORITY_SIGNKEY_1[];
+extern const char AUTHORITY_SIGNKEY_2[];
+extern const char AUTHORITY_SIGNKEY_3[];
+
+/** A synthetic network's worth of directory documents, shared by all the
+ * directory benchmarks. */
+typedef struct dirdoc_fixture_t {
+  /** Certificates and signing keys for each voting authority. */
+  authority_cert_t *certs[DIRDOC_N_VOTERS];
+  crypto_pk_t *signing_keys[DIRDOC_N_VOTERS];
+  /** Each authority's vote, before formatting. */
+  networkstatus_t *vote_objs[DIRDOC_N_VOTERS];
+  /** Each authority's vote, formatted and signed. */
+  char *vote_bodies[DIRDOC_N_VOTERS];
+  /** Each authority's vote, parsed back from vote_bodies. */
+  smartlist_t *votes;
+  /** The consensus computed from <b>votes</b>, in each flavor. */
+  char *consensus_ns;
+  char *consensus_md;
+  /** Every relay's microdescriptor, concatenated. */
+  char *microdescs;
+  /** Every relay's router descriptor, concatenated. */
+  char *descriptors;
+} dirdoc_fixture_t;
+
+/** Return a new synthetic routerinfo_t for the <b>idx</b>th relay of a
+ * network, signed with <b>key</b>, which it uses as its identity key and as
+ * its onion key. Every relay gets its own identity digest, so that votes can
+ * list them all. */
+static routerinfo_t *
+make_dirdoc_router(int idx, crypto_pk_t *key, time_t now)
+{
+  routerinfo_t *ri = tor_malloc_zero(sizeof(routerinfo_t));
+
+  tor_asprintf(&ri->nickname, "bench%d", idx);
+  ri->addr = 0x0a000000u + idx;
+  ri->or_port = 9001;
+  ri->dir_port = (idx % 3) ? 0 : 9030;
+  ri->platform = tor_strdup("Tor "VERSION" on Linux");
+  ri->cache_info.published_on = now - (idx % 3600);
+  crypto_rand(ri->cache_info.identity_digest, DIGEST_LEN);
+  ri->identity_pkey = crypto_pk_dup_key(key);
+  ri->onion_pkey = crypto_pk_dup_key(key);
+  ri->onion_curve25519_pkey =
+    tor_malloc_zero(sizeof(curve25519_public_key_t));
+  crypto_rand((char *)ri->onion_curve25519_pkey->public_key,
+              CURVE25519_PUBKEY_LEN);
+  ri->bandwidthrate = 100000 + 1000 * (idx % 500);
+  ri->bandwidthburst = 2 * ri->bandwidthrate;
+  ri->bandwidthcapacity = ri->bandwidthrate;
+  {
+    static const char *exit_lines[] = {
+      "accept 0.0.0.0/0:80", "accept 0.0.0.0/0:443",
+      "accept 0.0.0.0/0:6660-6667", "reject 0.0.0.0/0:*", NULL
+    };
+    /* One relay in four is an exit. */
+    int i = (idx % 4 == 0) ? 0 : 3;
+    ri->exit_policy = smartlist_new();
+    for ( ; exit_lines[i]; ++i)
+      smartlist_add(ri->exit_policy,
+                    router_parse_addr_policy_item_from_string(exit_lines[i],
+                                                              -1));
+  }
+  if (idx % 10 == 0) {
+    ri->declared_family = smartlist_new();
+    smartlist_add_asprintf(ri->declared_family, "bench%d", idx + 1);
+    smartlist_add_asprintf(ri->declared_family, "bench%d", idx + 2);
+  }
+  return ri;
+}
+
+/** Helper: compare two vote_routerstatus_t by identity digest. */
+static int
+compare_vote_rs_by_id(const void **a, const void **b)
+{
+  const vote_routerstatus_t *vrs_a = *a, *vrs_b = *b;
+  return fast_memcmp(vrs_a->status.identity_digest,
+                     vrs_b->status.identity_digest, DIGEST_LEN);
+}
+
+/** Return a new vote from the <b>voter</b>th authority about
+ * <b>routers</b>, whose microdescriptors are in <b>mds</b>. */
+static networkstatus_t *
+make_dirdoc_vote(dirdoc_fixture_t *fix, int voter,
+                 routerinfo_t **routers, microdesc_t **mds, time_t now)
+{
+  networkstatus_t *vote = tor_malloc_zero(sizeof(networkstatus_t));
+  networkstatus_voter_info_t *vi;
+  authority_cert_t *cert = fix->certs[voter];
+  int i;
+
+  vote->type = NS_TYPE_VOTE;
+  vote->published = now;
+  vote->valid_after = now + 1000;
+  vote->fresh_until = now + 2000;
+  vote->valid_until = now + 3000;
+  vote->vote_seconds = 100;
+  vote->dist_seconds = 200;
+  vote->supported_methods = smartlist_new();
+  vote->client_versions = tor_strdup("0.2.4.26,0.2.5.10,0.2.6.2-alpha");
+  vote->server_versions = tor_strdup("0.2.4.26,0.2.5.10,0.2.6.2-alpha");
+  vote->known_flags = smartlist_new();
+  smartlist_split_string(vote->known_flags,
+                         "Exit Fast Guard HSDir Running Stable V2Dir Valid",
+                         0, SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+  vote->voters = smartlist_new();
+  vi = tor_malloc_zero(sizeof(networkstatus_voter_info_t));
+  tor_asprintf(&vi->nickname, "voter%d", voter);
+  tor_asprintf(&vi->address, "10.255.0.%d", voter + 1);
+  vi->addr = 0x0aff0001u + voter;
+  vi->dir_port = 80;
+  vi->or_port = 443;
+  vi->contact = tor_strdup("voter@example.com");
+  crypto_pk_get_digest(cert->identity_key, vi->identity_digest);
+  smartlist_add(vote->voters, vi);
+  vote->cert = authority_cert_dup(cert);
+  vote->net_params = smartlist_new();
+  smartlist_split_string(vote->net_params,
+                         "circwindow=1000 refuseunknownexits=1", NULL,
+                         SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+  vote->routerstatus_list = smartlist_new();
+
+  for (i = 0; i < DIRDOC_N_ROUTERS; ++i) {
+    const routerinfo_t *ri = routers[i];
+    vote_routerstatus_t *vrs = tor_malloc_zero(sizeof(vote_routerstatus_t));
+    routerstatus_t *rs = &vrs->status;
+    char mline[256];
+
+    vrs->version = tor_strdup(ri->platform);
+    strlcpy(rs->nickname, ri->nickname, sizeof(rs->nickname));
+    memcpy(rs->identity_digest, ri->cache_info.identity_digest, DIGEST_LEN);
+    memcpy(rs->descriptor_digest, ri->cache_info.signed_descriptor_digest,
+           DIGEST_LEN);
+    rs->published_on = ri->cache_info.published_on;
+    rs->addr = ri->addr;
+    rs->or_port = ri->or_port;
+    rs->dir_port = ri->dir_port;
+    rs->is_flagged_running = rs->is_valid = 1;
+    rs->is_fast = (i % 5) != 0;
+    rs->is_stable = (i % 3) != 0;
+    rs->is_possible_guard = (i % 7) == 0;
+    rs->is_exit = (i % 4) == 0;
+    rs->is_hs_dir = ri->dir_port != 0;
+    rs->has_bandwidth = 1;
+    rs->bandwidth_kb = (uint32_t)(ri->bandwidthrate / 1000);
+    /* The authorities disagree a little about how fast everyone is. */
+    vrs->has_measured_bw = 1;
+    vrs->measured_bw_kb = rs->bandwidth_kb + voter * 10;
+    if (rs->is_exit)
+      vrs->status.exitsummary = tor_strdup("accept 80,443,6660-6667");
+
+    tor_assert(dirvote_format_microdesc_vote_line(mline, sizeof(mline),
+                                 mds[i], MIN_SUPPORTED_CONSENSUS_METHOD,
+                                 MAX_SUPPORTED_CONSENSUS_METHOD) > 0);
+    vrs->microdesc = tor_malloc_zero(sizeof(vote_microdesc_hash_t));
+    vrs->microdesc->microdesc_hash_line = tor_strdup(mline);
+    smartlist_add(vote->routerstatus_list, vrs);
+  }
+  smartlist_sort(vote->routerstatus_list, compare_vote_rs_by_id);
+  return vote;
+}
+
+/** Return the synthetic directory documents for the directory benchmarks,
+ * generating them the first time we're called.  They stay around until we
+ * exit. */
+static dirdoc_fixture_t *
+get_dirdoc_fixture(void)
+{
+  static dirdoc_fixture_t *fix = NULL;
+  const char *cert_strs[DIRDOC_N_VOTERS] = {
+    AUTHORITY_CERT_1, AUTHORITY_CERT_2, AUTHORITY_CERT_3
+  };
+  const char *signkey_strs[DIRDOC_N_VOTERS] = {
+    AUTHORITY_SIGNKEY_1, AUTHORITY_SIGNKEY_2, AUTHORITY_SIGNKEY_3
+  };
+  crypto_pk_t *keys[DIRDOC_N_KEYS];
+  routerinfo_t **routers;
+  microdesc_t **mds;
+  smartlist_t *descs, *md_bodies;
+  time_t now = time(NULL);
+  int i;
+
+  if (fix)
+    return fix;
+  fix = tor_malloc_zero(sizeof(dirdoc_fixture_t));
+
+  for (i = 0; i < DIRDOC_N_VOTERS; ++i) {
+    fix->certs[i] = authority_cert_parse_from_string(cert_strs[i], NULL);
+    tor_assert(fix->certs[i]);
+    fix->signing_keys[i] = crypto_pk_new();
+    tor_assert(!crypto_pk_read_private_key_from_string(fix->signing_keys[i],
+                                                       signkey_strs[i], -1));
+  }
+  for (i = 0; i < DIRDOC_N_KEYS; ++i) {
+    keys[i] = crypto_pk_new();
+    tor_assert(!crypto_pk_generate_key(keys[i]));
+  }
+
+  routers = tor_calloc(DIRDOC_N_ROUTERS, sizeof(routerinfo_t *));
+  mds = tor_calloc(DIRDOC_N_ROUTERS, sizeof(microdesc_t *));
+  descs = smartlist_new();
+  md_bodies = smartlist_new();
+  for (i = 0; i < DIRDOC_N_ROUTERS; ++i) {
+    char *desc;
+    routers[i] = make_dirdoc_router(i, keys[i % DIRDOC_N_KEYS], now);
+    desc = router_dump_router_to_string(routers[i], keys[i % DIRDOC_N_KEYS]);
+    tor_assert(desc);
+    smartlist_add(descs, desc);
+    mds[i] = dirvote_create_microdescriptor(routers[i],
+                                            MAX_SUPPORTED_CONSENSUS_METHOD);
+    tor_assert(mds[i]);
+    smartlist_add(md_bodies, tor_strndup(mds[i]->body, mds[i]->bodylen));
+  }
+  /* Voting looks each relay up in the routerlist, so put them there. */
+  for (i = 0; i < DIRDOC_N_ROUTERS; ++i) {
+    signed_descriptor_t *sd = &routers[i]->cache_info;
+    const char *desc = smartlist_get(descs, i);
+    const char *msg = NULL;
+    crypto_digest(sd->signed_descriptor_digest, desc, strlen(desc));
+    sd->signed_descriptor_body = tor_strdup(desc);
+    sd->signed_descriptor_len = strlen(desc);
+    sd->do_not_cache = 1;
+    sd->routerlist_index = -1;
+    tor_assert(router_add_to_routerlist(routers[i], &msg, 0, 0) >= 0);
+  }
+  fix->descriptors = smartlist_join_strings(descs, "", 0, NULL);
+  fix->microdescs = smartlist_join_strings(md_bodies, "", 0, NULL);
+
+  fix->votes = smartlist_new();
+  for (i = 0; i < DIRDOC_N_VOTERS; ++i) {
+    networkstatus_t *v;
+    fix->vote_objs[i] = make_dirdoc_vote(fix, i, routers, mds, now);
+    fix->vote_bodies[i] = format_networkstatus_vote(fix->signing_keys[i],
+                                                    fix->vote_objs[i]);
+    tor_assert(fix->vote_bodies[i]);
+    v = networkstatus_parse_vote_from_string(fix->vote_bodies[i], NULL,
+                                             NS_TYPE_VOTE);
+    tor_assert(v);
+    smartlist_add(fix->votes, v);
+  }
+  fix->consensus_ns = networkstatus_compute_consensus(fix->votes,
+                           DIRDOC_N_VOTERS, fix->certs[0]->identity_key,
+                           fix->signing_keys[0], NULL, NULL, FLAV_NS);
+  fix->consensus_md = networkstatus_compute_consensus(fix->votes,
+                           DIRDOC_N_VOTERS, fix->certs[0]->identity_key,
+                           fix->signing_keys[0], NULL, NULL, FLAV_MICRODESC);
+  tor_assert(fix->consensus_ns && fix->consensus_md);
+
+  for (i = 0; i < DIRDOC_N_ROUTERS; ++i)
+    microdesc_free(mds[i]);
+  for (i = 0; i < DIRDOC_N_KEYS; ++i)
+    crypto_pk_free(keys[i]);
+  SMARTLIST_FOREACH(descs, char *, cp, tor_free(cp));
+  SMARTLIST_FOREACH(md_bodies, char *, cp, tor_free(cp));
+  smartlist_free(descs);
+  smartlist_free(md_bodies);
+  tor_free(routers);
+  tor_free(mds);
+
+  printf("Synthetic network: %d relays, %d authorities. Vote: %lu bytes; "
+         "consensus: %lu bytes; microdesc consensus: %lu bytes.\n",
+         DIRDOC_N_ROUTERS, DIRDOC_N_VOTERS,
+         (unsigned long)strlen(fix->vote_bodies[0]),
+         (unsigned long)strlen(fix->consensus_ns),
+         (unsigned long)strlen(fix->consensus_md));
+  return fix;
+}
+
+/** Report how fast a directory benchmark handled <b>n_docs</b> documents
+ * totalling <b>n_bytes</b> bytes between <b>start</b> and <b>end</b>, and
+ * how far it pushed up our peak memory use from <b>rss_before</b>. */
+static void
+print_dirdoc_result(const char *what, uint64_t n_docs, uint64_t n_bytes,
+                    uint64_t start, uint64_t end, unsigned long rss_before)
+{
+  const double secs = NANOCOUNT(start, end, 1) / 1e9;
+  const unsigned long rss = peak_rss_kb();
+  printf("%s: %.2f documents/sec, %.2f MB/sec, peak RSS %lu KB (+%lu KB)\n",
+         what, n_docs / secs, n_bytes / secs / (1<<20), rss,
+         rss - rss_before);
+  bench_record("documents/sec", n_docs / secs, "%s", what);
+  bench_record("MB/sec", n_bytes / secs / (1<<20), "%s", what);
+  bench_record("KB", (double)(rss - rss_before), "%s, peak RSS growth", what);
+}
+
+/** Benchmark formatting and signing a vote. */
+static void
+bench_dir_format_vote(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  unsigned long rss = reset_peak_rss();
+  uint64_t start, end, n_bytes = 0;
+  int i;
+
+  reset_perftime();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    char *body = format_networkstatus_vote(fix->signing_keys[0],
+                                           fix->vote_objs[0]);
+    tor_assert(body);
+    n_bytes += strlen(body);
+    tor_free(body);
+  }
+  end = perftime();
+  print_dirdoc_result("format_networkstatus_vote", DIRDOC_ITERS, n_bytes,
+                      start, end, rss);
+}
+
+/** Helper: benchmark parsing <b>body</b> as a networkstatus of type
+ * <b>type</b>. */
+static void
+bench_parse_ns_helper(const char *what, const char *body,
+                      networkstatus_type_t type)
+{
+  unsigned long rss = reset_peak_rss();
+  const size_t len = strlen(body);
+  uint64_t start, end;
+  int i;
+
+  reset_perftime();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    networkstatus_t *ns = networkstatus_parse_vote_from_string(body, NULL,
+                                                               type);
+    tor_assert(ns);
+    networkstatus_vote_free(ns);
+  }
+  end = perftime();
+  print_dirdoc_result(what, DIRDOC_ITERS, (uint64_t)len * DIRDOC_ITERS,
+                      start, end, rss);
+}
+
+/** Benchmark parsing votes and both flavors of consensus. */
+static void
+bench_dir_parse_networkstatus(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  bench_parse_ns_helper("Parse vote", fix->vote_bodies[0], NS_TYPE_VOTE);
+  bench_parse_ns_helper("Parse ns consensus", fix->consensus_ns,
+                        NS_TYPE_CONSENSUS);
+  bench_parse_ns_helper("Parse microdesc consensus", fix->consensus_md,
+                        NS_TYPE_CONSENSUS);
+}
+
+/** Benchmark computing both flavors of consensus from our votes. */
+static void
+bench_dir_compute_consensus(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  const consensus_flavor_t flavors[] = { FLAV_NS, FLAV_MICRODESC };
+  unsigned f;
+
+  for (f = 0; f < ARRAY_LENGTH(flavors); ++f) {
+    unsigned long rss = reset_peak_rss();
+    uint64_t start, end, n_bytes = 0;
+    int i;
+    reset_perftime();
+    start = perftime();
+    for (i = 0; i < DIRDOC_ITERS; ++i) {
+      char *body = networkstatus_compute_consensus(fix->votes,
+                              DIRDOC_N_VOTERS, fix->certs[0]->identity_key,
+                              fix->signing_keys[0], NULL, NULL, flavors[f]);
+      tor_assert(body);
+      n_bytes += strlen(body);
+      tor_free(body);
+    }
+    end = perftime();
+    print_dirdoc_result(flavors[f] == FLAV_NS ?
+                        "Compute ns consensus" :
+                        "Compute microdesc consensus",
+                        DIRDOC_ITERS, n_bytes, start, end, rss);
+  }
+}
+
+/** Benchmark parsing a batch of microdescriptors. */
+static void
+bench_dir_parse_microdescs(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  unsigned long rss = reset_peak_rss();
+  const size_t len = strlen(fix->microdescs);
+  uint64_t start, end, n_docs = 0;
+  int i;
+
+  reset_perftime();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    smartlist_t *mds = microdescs_parse_from_string(fix->microdescs,
+                                                    fix->microdescs + len,
+                                                    0, SAVED_NOWHERE, NULL);
+    n_docs += smartlist_len(mds);
+    SMARTLIST_FOREACH(mds, microdesc_t *, md, microdesc_free(md));
+    smartlist_free(mds);
+  }
+  end = perftime();
+  tor_assert(n_docs == (uint64_t)DIRDOC_ITERS * DIRDOC_N_ROUTERS);
+  print_dirdoc_result("microdescs_parse_from_string", n_docs,
+                      (uint64_t)len * DIRDOC_ITERS, start, end, rss);
+}
+
+/** Benchmark parsing (and checking the signatures on) a batch of router
+ * descriptors. */
+static void
+bench_dir_parse_routers(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  unsigned long rss = reset_peak_rss();
+  const size_t len = strlen(fix->descriptors);
+  uint64_t start, end, n_docs = 0;
+  int i;
+
+  reset_perftime();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    smartlist_t *routers = smartlist_new();
+    const char *cp = fix->descriptors;
+    tor_assert(!router_parse_list_from_string(&cp, cp + len, routers,
+                                              SAVED_NOWHERE, 0, 0, NULL,
+                                              NULL));
+    n_docs += smartlist_len(routers);
+    SMARTLIST_FOREACH(routers, routerinfo_t *, ri, routerinfo_free(ri));
+    smartlist_free(routers);
+  }
+  end = perftime();
+  tor_assert(n_docs == (uint64_t)DIRDOC_ITERS * DIRDOC_N_ROUTERS);
+  print_dirdoc_result("router_parse_list_from_string", n_docs,
+                      (uint64_t)len * DIRDOC_ITERS, start, end, rss);
+}
+
+/** Benchmark compressing and decompressing a consensus the way we serve
+ * it.  Rates are in terms of the uncompressed size. */
+static void
+bench_dir_compress_consensus(void)
+{
+  dirdoc_fixture_t *fix = get_dirdoc_fixture();
+  const char *body = fix->consensus_ns;
+  const size_t len = strlen(body);
+  unsigned long rss = reset_peak_rss();
+  char *compressed = NULL, *out = NULL;
+  size_t compressed_len = 0, out_len = 0;
+  uint64_t start, end;
+  int i;
+
+  reset_perftime();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    tor_free(compressed);
+    tor_assert(!tor_gzip_compress(&compressed, &compressed_len, body, len,
+                                  ZLIB_METHOD));
+  }
+  end = perftime();
+  print_dirdoc_result("Compress consensus", DIRDOC_ITERS,
+                      (uint64_t)len * DIRDOC_ITERS, start, end, rss);
+  printf("(%lu bytes compressed to %lu)\n", (unsigned long)len,
+         (unsigned long)compressed_len);
+
+  rss = reset_peak_rss();
+  start = perftime();
+  for (i = 0; i < DIRDOC_ITERS; ++i) {
+    tor_free(out);
+    tor_assert(!tor_gzip_uncompress(&out, &out_len, compressed,
+                                    compressed_len, ZLIB_METHOD, 1,
+                                    LOG_WARN));
+  }
+  end = perftime();
+  tor_assert(out_len == len && fast_memeq(out, body, len));
+  print_dirdoc_result("Decompress consensus", DIRDOC_ITERS,
+                      (uint64_t)len * DIRDOC_ITERS, start, end, rss);
+  tor_free(compressed);
+  tor_free(out);
+}
+
+/** Print one line of the mem_footprint table: <b>n</b> objects of
+ * <b>size</b> bytes each made our resident memory grow from
+ * <b>rss_before</b> to <b>rss_after</b> kilobytes. */
+static void
+print_footprint_row(const char *what, uint64_t n, size_t size,
+                    unsigned long rss_before, unsigned long rss_after)
+{
+  const double per_obj = n ?
+    ((double)rss_after - (double)rss_before) * 1024 / n : 0;
+  printf("%-34s %9lu %7lu %12.1f %10.1f\n", what, (unsigned long)n,
+         (unsigned long)size, per_obj, per_obj - size);
+  bench_record("bytes/object", per_obj, "%s", what);
+}
+
+/** Set up the connection lists and the libevent base that connections,
+ * channels and the scheduler expect, unless an earlier benchmark did. */
+static void
+bench_init_mainloop(void)
+{
+  tor_libevent_cfg cfg;
+  init_connection_lists();
+  if (tor_libevent_get_base())
+    return;
+  memset(&cfg, 0, sizeof(cfg));
+  tor_libevent_initialize(&cfg);
+}
+
+/** Return a new OR connection with a channel_tls_t but no socket or TLS,
+ * as if from 10.x.x.x address number <b>idx</b>. */
+static or_connection_t *
+bench_or_connection_new(int idx)
+{
+  or_connection_t *orconn = or_connection_new(CONN_TYPE_OR, AF_INET);
+  tor_addr_from_ipv4h(&TO_CONN(orconn)->addr, 0x0a000000u + idx);
+  TO_CONN(orconn)->port = 9001;
+  TO_CONN(orconn)->address = tor_dup_ip(0x0a000000u + idx);
+  channel_tls_handle_incoming(orconn);
+  TLS_CHAN_TO_BASE(orconn->chan)->wide_circ_ids = 1;
+  return orconn;
+}
+
+/** Return a new open relayed circuit with ID <b>p_circ_id</b> on
+ * <b>p_chan</b> and <b>n_circ_id</b> on <b>n_chan</b>, with relay crypto
+ * set up. */
+static or_circuit_t *
+bench_or_circuit_new(circid_t p_circ_id, channel_t *p_chan,
+                     circid_t n_circ_id, channel_t *n_chan)
+{
+  or_circuit_t *circ = or_circuit_new(p_circ_id, p_chan);
+  circ->base_.purpose = CIRCUIT_PURPOSE_OR;
+  circuit_set_n_circid_chan(TO_CIRCUIT(circ), n_circ_id, n_chan);
+  circuit_set_state(TO_CIRCUIT(circ), CIRCUIT_STATE_OPEN);
+  circ->p_crypto = crypto_cipher_new(NULL);
+  circ->n_crypto = crypto_cipher_new(NULL);
+  circ->p_digest = crypto_digest_new();
+  circ->n_digest = crypto_digest_new();
+  return circ;
+}
+
+/** Close every channel on <b>conns</b>, with the circuits on them, and free
+ * the connections. */
+static void
+bench_or_connections_free(or_connection_t **conns, int n_conns)
+{
+  int i;
+  for (i = 0; i < n_conns; ++i) {
+    channel_t *chan = TLS_CHAN_TO_BASE(conns[i]->chan);
+    channel_close_from_lower_layer(chan);
+    channel_closed(chan);
+    connection_free(TO_CONN(conns[i]));
+  }
+  while (circuit_count_pending_close())
+    circuit_close_all_marked();
+  channel_run_cleanup();
+}
+
+/** Build a relay's worth of OR connections, circuits, streams and queued
+ * cells, as sized by the or_conns, or_circuits, origin_circuits, streams
+ * and queue_depth parameters, and report how much memory each kind of
+ * object costs us; then tear everything down again and report what we
+ * didn't give back.
+ *
+ * The connections have no sockets and no TLS, but each one gets a real
+ * channel_tls_t; every relayed circuit joins two of those channels, and
+ * carries its share of the exit streams.
+ *
+ * Since we measure how much the process grows, and the allocator keeps what
+ * we free for next time, this only means anything the first time it runs. */
+static void
+bench_mem_footprint(void)
+{
+  const int n_conns = MAX(get_bench_param("or_conns"), 1);
+  const int n_or_circs = get_bench_param("or_circuits");
+  const int n_origin_circs = get_bench_param("origin_circuits");
+  const int n_streams = get_bench_param("streams");
+  const int depth = get_bench_param("queue_depth");
+  or_connection_t **conns = tor_calloc(n_conns, sizeof(or_connection_t *));
+  or_circuit_t **or_circs =
+    tor_calloc(MAX(n_or_circs, 1), sizeof(or_circuit_t *));
+  origin_circuit_t **origin_circs =
+    tor_calloc(MAX(n_origin_circs, 1), sizeof(origin_circuit_t *));
+  cell_t cell;
+  char *payload;
+  unsigned long rss_start, rss_prev, rss_now;
+  size_t buf_start, buf_prev;
+  uint64_t n_cells = 0, n_buffered = 0;
+  int i, j;
+
+  bench_init_mainloop();
+  scheduler_init();
+  memset(&cell, 0, sizeof(cell));
+  cell.command = CELL_RELAY;
+  crypto_rand((char *)cell.payload, sizeof(cell.payload));
+  payload = tor_malloc(CELL_MAX_NETWORK_SIZE * MAX(depth, 1));
+  crypto_rand(payload, CELL_MAX_NETWORK_SIZE * MAX(depth, 1));
+
+  printf("%-34s %9s %7s %12s %10s\n", "", "count", "sizeof",
+         "bytes/object", "overhead");
+  rss_start = rss_prev = current_rss_kb();
+  buf_start = buf_get_total_allocation();
+
+  for (i = 0; i < n_conns; ++i)
+    conns[i] = bench_or_connection_new(i);
+  rss_now = current_rss_kb();
+  print_footprint_row("or_connection_t + channel_tls_t", n_conns,
+                      sizeof(or_connection_t) + sizeof(channel_tls_t),
+                      rss_prev, rss_now);
+  rss_prev = rss_now;
+
+  for (i = 0; i < n_or_circs; ++i) {
+    channel_t *p_chan = TLS_CHAN_TO_BASE(conns[i % n_conns]->chan);
+    channel_t *n_chan = TLS_CHAN_TO_BASE(conns[(i+1) % n_conns]->chan);
+    or_circs[i] = bench_or_circuit_new(i + 1, p_chan, 0x40000000 + i, n_chan);
+  }
+  rss_now = current_rss_kb();
+  print_footprint_row("or_circuit_t", n_or_circs, sizeof(or_circuit_t),
+                      rss_prev, rss_now);
+  rss_prev = rss_now;
+
+  for (i = 0; i < n_origin_circs; ++i) {
+    channel_t *chan = TLS_CHAN_TO_BASE(conns[i % n_conns]->chan);
+    origin_circuit_t *circ = origin_circuit_new();
+    char keys[CPATH_KEY_MATERIAL_LEN];
+    circ->base_.purpose = CIRCUIT_PURPOSE_C_GENERAL;
+    circ->build_state = tor_malloc_zero(sizeof(cpath_build_state_t));
+    circ->build_state->desired_path_len = DEFAULT_ROUTE_LEN;
+    for (j = 0; j < DEFAULT_ROUTE_LEN; ++j) {
+      crypt_path_t *hop = tor_malloc_zero(sizeof(crypt_path_t));
+      hop->magic = CRYPT_PATH_MAGIC;
+      hop->state = CPATH_STATE_OPEN;
+      crypto_rand(keys, sizeof(keys));
+      tor_assert(!circuit_init_cpath_crypto(hop, keys, 0));
+      onion_append_to_cpath(&circ->cpath, hop);
+    }
+    circuit_set_n_circid_chan(TO_CIRCUIT(circ), 0x20000000 + i, chan);
+    circuit_set_state(TO_CIRCUIT(circ), CIRCUIT_STATE_OPEN);
+    origin_circs[i] = circ;
+  }
+  rss_now = current_rss_kb();
+  print_footprint_row("origin_circuit_t + 3-hop cpath", n_origin_circs,
+                      sizeof(origin_circuit_t) + sizeof(cpath_build_state_t) +
+                      DEFAULT_ROUTE_LEN * sizeof(crypt_path_t),
+                      rss_prev, rss_now);
+  rss_prev = rss_now;
+
+  for (i = 0; i < n_streams && n_or_circs; ++i) {
+    or_circuit_t *circ = or_circs[i % n_or_circs];
+    edge_connection_t *stream = edge_connection_new(CONN_TYPE_EXIT, AF_INET);
+    TO_CONN(stream)->state = EXIT_CONN_STATE_OPEN;
+    stream->stream_id = i / n_or_circs + 1;
+    stream->on_circuit = TO_CIRCUIT(circ);
+    stream->next_stream = circ->n_streams;
+    circ->n_streams = stream;
+  }
+  rss_now = current_rss_kb();
+  print_footprint_row("edge_connection_t", n_or_circs ? n_streams : 0,
+                      sizeof(edge_connection_t), rss_prev, rss_now);
+  rss_prev = rss_now;
+
+  for (i = 0; i < n_or_circs; ++i) {
+    circuit_t *circ = TO_CIRCUIT(or_circs[i]);
+    for (j = 0; j < depth; ++j) {
+      cell_queue_append_packed_copy(circ, &circ->n_chan_cells, 1, &cell,
+                                    1, 0);
+      cell_queue_append_packed_copy(circ, &or_circs[i]->p_chan_cells, 0,
+                                    &cell, 1, 0);
+      n_cells += 2;
+    }
+  }
+  for (i = 0; i < n_origin_circs; ++i) {
+    circuit_t *circ = TO_CIRCUIT(origin_circs[i]);
+    for (j = 0; j < depth; ++j) {
+      cell_queue_append_packed_copy(circ, &circ->n_chan_cells, 1, &cell,
+                                    1, 0);
+      ++n_cells;
+    }
+  }
+  rss_now = current_rss_kb();
+  print_footprint_row("Queued cells", n_cells, packed_cell_mem_cost(),
+                      rss_prev, rss_now);
+  rss_prev = rss_now;
+
+  buf_prev = buf_get_total_allocation();
+  for (i = 0; i < n_conns; ++i) {
+    write_to_buf(payload, CELL_MAX_NETWORK_SIZE * depth,
+                 TO_CONN(conns[i])->outbuf);
+    n_buffered += CELL_MAX_NETWORK_SIZE * depth;
+  }
+  for (i = 0; i < n_or_circs; ++i) {
+    edge_connection_t *stream;
+    for (stream = or_circs[i]->n_streams; stream;
+         stream = stream->next_stream) {
+      write_to_buf(payload, RELAY_PAYLOAD_SIZE * depth,
+                   TO_CONN(stream)->outbuf);
+      n_buffered += RELAY_PAYLOAD_SIZE * depth;
+    }
+  }
+  rss_now = current_rss_kb();
+  print_footprint_row("Buffered bytes", n_buffered, 1, rss_prev, rss_now);
+  printf("(Buffers allocated %lu bytes to hold them.)\n",
+         (unsigned long)(buf_get_total_allocation() - buf_prev));
+
+  printf("(Overhead is everything past the struct itself: allocator "
+         "headers and rounding,\n plus whatever else each object "
+         "allocates.)\n");
+  printf("Resident memory: %lu KB at start, %lu KB with everything "
+         "allocated.\n", rss_start, rss_now);
+
+  /* Tear it all down the way a relay would when its connections go away:
+   * the streams close, then each channel closes and takes its circuits
+   * with it. */
+  for (i = 0; i < n_or_circs; ++i) {
+    edge_connection_t *stream = or_circs[i]->n_streams, *next;
+    or_circs[i]->n_streams = NULL;
+    for ( ; stream; stream = next) {
+      next = stream->next_stream;
+      connection_free(TO_CONN(stream));
+    }
+  }
+  bench_or_connections_free(conns, n_conns);
+  scheduler_free_all();
+
+  rss_now = current_rss_kb();
+  printf("After teardown: %lu KB resident (%ld KB not returned to the OS); "
+         "%d circuits and %ld bytes of buffers left over.\n",
+         rss_now, (long)rss_now - (long)rss_start,
+         smartlist_len(circuit_get_global_list()),
+         (long)buf_get_total_allocation() - (long)buf_start);
+
+  tor_free(payload);
+  tor_free(conns);
+  tor_free(or_circs);
+  tor_free(origin_circs);
+}
+
+/** Write out every cell queued for <b>conns</b> through their channels,
+ * then throw the bytes away as if the kernel had taken them. */
+static void
+bench_flush_or_connections(or_connection_t **conns, int n_conns)
+{
+  int i;
+  for (i = 0; i < n_conns; ++i) {
+    channel_t *chan = TLS_CHAN_TO_BASE(conns[i]->chan);
+    while (channel_flush_from_first_active_circuit(chan, 1000) > 0)
+      ;
+    buf_clear(TO_CONN(conns[i])->outbuf);
+  }
+}
+
+/** Time the relay forwarding path, less the relay crypto that cell_ops
+ * already times: look up the circuit for each incoming relay cell, queue
+ * the cell on the circuit's next channel, and flush the queues through the
+ * circuitmux to the outgoing connections.  Cells arrive scattered over 1 to
+ * forward_circuits circuits, which share forward_conns connections, so that
+ * the growth in the per-cell cost shows what touching more circuits costs
+ * us in cache misses. */
+static void
+bench_cell_forward(void)
+{
+  const int max_circs = MAX(get_bench_param("forward_circuits"), 1);
+  const int n_conns = MAX(get_bench_param("forward_conns"), 1);
+  const int n_cells = 1<<17;
+  const int flush_every = 256;
+  or_connection_t **conns = tor_calloc(n_conns, sizeof(or_connection_t *));
+  or_circuit_t **circs = tor_calloc(max_circs, sizeof(or_circuit_t *));
+  const uint64_t old_max_mem = get_options()->MaxMemInQueues;
+  cell_t cell;
+  int n_circs, i, k;
+
+  bench_init_mainloop();
+  scheduler_init();
+  /* We never validated our options, so nothing has set MaxMemInQueues. */
+  get_options_mutable()->MaxMemInQueues = U64_LITERAL(1) << 30;
+  memset(&cell, 0, sizeof(cell));
+  cell.command = CELL_RELAY;
+  crypto_rand((char *)cell.payload, sizeof(cell.payload));
+
+  for (i = 0; i < n_conns; ++i) {
+    conns[i] = bench_or_connection_new(i);
+    /* Skip the handshake and everything channel_change_state() would do on
+     * opening: we only need the channel to accept cells. */
+    TLS_CHAN_TO_BASE(conns[i]->chan)->state = CHANNEL_STATE_OPEN;
+  }
+  for (i = 0; i < max_circs; ++i) {
+    channel_t *p_chan = TLS_CHAN_TO_BASE(conns[i % n_conns]->chan);
+    channel_t *n_chan = TLS_CHAN_TO_BASE(conns[(i+1) % n_conns]->chan);
+    circs[i] = bench_or_circuit_new(i + 1, p_chan, 0x40000000 + i, n_chan);
+  }
+
+  for (n_circs = 1; ; n_circs *= 16) {
+    uint64_t start, end;
+#ifdef HAVE_CYCLECOUNT
+    uint64_t cycles;
+#endif
+    if (n_circs > max_circs)
+      n_circs = max_circs;
+
+    reset_perftime();
+    start = perftime();
+#ifdef HAVE_CYCLECOUNT
+    cycles = cyclecount();
+#endif
+    for (k = 0; k < n_cells; ++k) {
+      /* Visit the circuits in a scattered order, the way cells from many
+       * clients would arrive. */
+      const or_circuit_t *want =
+        circs[(int)(((uint64_t)k * 2654435761u) % (unsigned)n_circs)];
+      circuit_t *circ = circuit_get_by_circid_channel(want->p_circ_id,
+                                                      want->p_chan);
+      cell.circ_id = circ->n_circ_id;
+      append_cell_to_circuit_queue(circ, circ->n_chan, &cell,
+                                   CELL_DIRECTION_OUT, 0);
+      if ((k + 1) % flush_every == 0)
+        bench_flush_or_connections(conns, n_conns);
+    }
+    bench_flush_or_connections(conns, n_conns);
+#ifdef HAVE_CYCLECOUNT
+    cycles = cyclecount() - cycles;
+#endif
+    end = perftime();
+
+    printf("Forwarding over %6d circuits: %.2f ns per cell", n_circs,
+           NANOCOUNT(start, end, n_cells));
+    bench_record("nsec/cell", NANOCOUNT(start, end, n_cells),
+                 "forward over %d circuits", n_circs);
+#ifdef HAVE_CYCLECOUNT
+    printf(" (%.0f cycles)", (double)cycles / n_cells);
+    bench_record("cycles/cell", (double)cycles / n_cells,
+                 "forward over %d circuits (cycles)", n_circs);
+#endif
+    puts("");
+    if (n_circs == max_circs)
+      break;
+  }
+
+  bench_or_connections_free(conns, n_conns);
+  scheduler_free_all();
+  get_options_mutable()->MaxMemInQueues = old_max_mem;
+  tor_free(conns);
+  tor_free(circs);
+}
+
+/** Time what happens when a channel carrying many relayed circuits dies:
+ * channel_closed() unlinks and marks every circuit on it, which queues a
+ * DESTROY on each circuit's other channel; then circuit_close_all_marked()
+ * frees them, and the other channels write out their DESTROYs.  The other
+ * ends of the circuits are spread over close_conns open channels.  We try
+ * 256 circuits, then four times as many each round, up to close_circuits. */
+static void
+bench_channel_close(void)
+{
+  const int max_circs = MAX(get_bench_param("close_circuits"), 1);
+  const int n_peers = MAX(get_bench_param("close_conns"), 1);
+  or_connection_t **conns = tor_calloc(n_peers + 1,
+                                       sizeof(or_connection_t *));
+  int n_circs, i;
+
+  bench_init_mainloop();
+  scheduler_init();
+
+  for (n_circs = MIN(256, max_circs); ; n_circs *= 4) {
+    channel_t *chan;
+    uint64_t start, marked, freed, flushed;
+    if (n_circs > max_circs)
+      n_circs = max_circs;
+
+    for (i = 0; i <= n_peers; ++i) {
+      conns[i] = bench_or_connection_new(i);
+      TLS_CHAN_TO_BASE(conns[i]->chan)->state = CHANNEL_STATE_OPEN;
+      TLS_CHAN_TO_BASE(conns[i]->chan)->has_been_open = 1;
+    }
+    chan = TLS_CHAN_TO_BASE(conns[0]->chan);
+    for (i = 0; i < n_circs; ++i) {
+      channel_t *n_chan = TLS_CHAN_TO_BASE(conns[1 + i % n_peers]->chan);
+      bench_or_circuit_new(i + 1, chan, 0x40000000 + i, n_chan);
+    }
+
+    reset_perftime();
+    start = perftime();
+    channel_close_from_lower_layer(chan);
+    channel_closed(chan);
+    marked = perftime();
+    while (circuit_count_pending_close())
+      circuit_close_all_marked();
+    freed = perftime();
+    bench_flush_or_connections(conns + 1, n_peers);
+    flushed = perftime();
+
+    printf("Closing a channel with %5d circuits: %.2f usec per circuit "
+           "to mark, %.2f to free, %.2f to send the DESTROYs\n", n_circs,
+           MICROCOUNT(start, marked, n_circs),
+           MICROCOUNT(marked, freed, n_circs),
+           MICROCOUNT(freed, flushed, n_circs));
+    bench_record("usec/circuit", MICROCOUNT(start, marked, n_circs),
+                 "mark %d circuits", n_circs);
+    bench_record("usec/circuit", MICROCOUNT(marked, freed, n_circs),
+                 "free %d circuits", n_circs);
+    bench_record("usec/circuit", MICROCOUNT(freed, flushed, n_circs),
+                 "send %d DESTROYs", n_circs);
+
+    bench_or_connections_free(conns, n_peers + 1);
+    if (n_circs == max_circs)
+      break;
+  }
+
+  scheduler_free_all();
+  tor_free(conns);
+}
+
 static void
 bench_siphash(void)
 {
@@ -415,6 +1892,8 @@ bench_siphash(void)
     end = perftime();
     printf("siphash24g(%d): %.2f ns per call\n",
            lens[i], NANOCOUNT(start,end,N));
+    bench_record("nsec/call", NANOCOUNT(start,end,N),
+                 "siphash24g(%d)", lens[i]);
   }
 }
 
@@ -457,6 +1936,8 @@ bench_cell_ops(void)
            outbound?"Out":" In",
            NANOCOUNT(start,end,iters),
            NANOCOUNT(start,end,iters*CELL_PAYLOAD_SIZE));
+    bench_record("nsec/cell", NANOCOUNT(start,end,iters),
+                 "%s cells", outbound?"Outbound":"Inbound");
   }
 
   crypto_digest_free(or_circ->p_digest);
@@ -500,6 +1981,8 @@ bench_dh(void)
   end = perftime();
   printf("Complete DH handshakes (1024 bit, public and private ops):\n"
          "      %f millisec each.\n", NANOCOUNT(start, end, iters)/1e6);
+  bench_record("msec", NANOCOUNT(start, end, iters)/1e6,
+               "DH handshake (1024 bit)");
 }
 
 #if (!defined(OPENSSL_NO_EC)                    \
@@ -541,6 +2024,8 @@ bench_ecdh_impl(int nid, const char *name)
   end = perftime();
   printf("Complete ECDH %s handshakes (2 public and 2 private ops):\n"
          "      %f millisec each.\n", name, NANOCOUNT(start, end, iters)/1e6);
+  bench_record("msec", NANOCOUNT(start, end, iters)/1e6,
+               "ECDH %s handshake", name);
 }
 
 static void
@@ -562,12 +2047,24 @@ typedef struct benchmark_t {
   const char *name;
   bench_fn fn;
   int enabled;
+  /** True iff this benchmark only makes sense the first time it runs in a
+   * process, and so ignores --warmup and --reps. */
+  int run_once;
 } benchmark_t;
 
-#define ENT(s) { #s , bench_##s, 0 }
+#define ENT(s) { #s , bench_##s, 0, 0 }
+#define ENT_ONCE(s) { #s , bench_##s, 0, 1 }
 
 static struct benchmark_t benchmarks[] = {
   ENT(dmap),
+  ENT(digest_sort),
+  ENT(dir_format_vote),
+  ENT(dir_parse_networkstatus),
+  ENT(dir_compute_consensus),
+  ENT(dir_parse_microdescs),
+  ENT(dir_parse_routers),
+  ENT(dir_compress_consensus),
+  ENT_ONCE(mem_footprint),
   ENT(siphash),
   ENT(aes),
   ENT(onion_TAP),
@@ -576,12 +2073,14 @@ static struct benchmark_t benchmarks[] = {
 
   ENT(cell_aes),
   ENT(cell_ops),
+  ENT(cell_forward),
+  ENT(channel_close),
   ENT(dh),
 #ifdef HAVE_EC_BENCHMARKS
   ENT(ecdh_p256),
   ENT(ecdh_p224),
 #endif
-  {NULL,NULL,0}
+  {NULL,NULL,0,0}
 };
 
 static benchmark_t *
@@ -597,12 +2096,17 @@ find_benchmark(const char *name)
 }
 
 /** Main entry point for benchmark code: parse the command line, and run
- * some benchmarks. */
+ * some benchmarks.
+ *
+ * With --warmup N, run each benchmark N times before measuring it; with
+ * --reps N, measure it N times and summarize the results; with --json FILE,
+ * write everything we measured to FILE for scripts/test/bench-compare.py. */
 int
 main(int argc, const char **argv)
 {
   int i;
-  int list=0, n_enabled=0;
+  int list=0, n_enabled=0, reps=1, warmup=0;
+  const char *json_fname = NULL;
   benchmark_t *b;
   char *errmsg;
   or_options_t *options;
@@ -610,8 +2114,41 @@ main(int argc, const char **argv)
   tor_threads_init();
 
   for (i = 1; i < argc; ++i) {
+    const char *eq = strchr(argv[i], '=');
     if (!strcmp(argv[i], "--list")) {
       list = 1;
+    } else if (!strcmp(argv[i], "--reps") || !strcmp(argv[i], "--warmup")) {
+      int ok;
+      int *countp = !strcmp(argv[i], "--reps") ? &reps : &warmup;
+      if (i+1 == argc) {
+        printf("%s needs an argument\n", argv[i]);
+        return 1;
+      }
+      *countp = (int)tor_parse_long(argv[i+1], 10, countp == &reps ? 1 : 0,
+                                    INT_MAX, &ok, NULL);
+      if (!ok) {
+        printf("Bad value for %s\n", argv[i]);
+        return 1;
+      }
+      ++i;
+    } else if (!strcmp(argv[i], "--json")) {
+      if (i+1 == argc) {
+        printf("%s needs an argument\n", argv[i]);
+        return 1;
+      }
+      json_fname = argv[++i];
+    } else if (eq) {
+      bench_param_t *p = find_bench_param(argv[i], eq - argv[i]);
+      int ok;
+      if (!p) {
+        printf("No such parameter as %s\n", argv[i]);
+        return 1;
+      }
+      p->value = (int)tor_parse_long(eq + 1, 10, 0, INT_MAX, &ok, NULL);
+      if (!ok) {
+        printf("Bad value for %s\n", p->name);
+        return 1;
+      }
     } else {
       benchmark_t *b = find_benchmark(argv[i]);
       ++n_enabled;
@@ -640,11 +2177,47 @@ main(int argc, const char **argv)
 
   for (b = benchmarks; b->name; ++b) {
     if (b->enabled || n_enabled == 0) {
+      const int n_warmup = b->run_once ? 0 : warmup;
+      const int n_reps = b->run_once ? 1 : reps;
+      int rep;
       printf("===== %s =====\n", b->name);
-      if (!list)
+      if (list)
+        continue;
+      /* Warmup runs fill caches and settle the CPU clock; we don't keep
+       * what they measure. */
+      for (rep = 0; rep < n_warmup; ++rep) {
+        printf("----- warmup %d/%d -----\n", rep+1, n_warmup);
+        b->fn();
+      }
+      bench_recording = b->name;
+      for (rep = 0; rep < n_reps; ++rep) {
+        if (n_reps > 1 || n_warmup)
+          printf("----- run %d/%d -----\n", rep+1, n_reps);
         b->fn();
+      }
+      bench_recording = NULL;
+      if (n_reps > 1) {
+        printf("----- summary of %d runs -----\n", n_reps);
+        print_bench_summary(b->name);
+      }
+    }
+  }
+  if (list) {
+    bench_param_t *p;
+    puts("===== parameters (set with name=value) =====");
+    for (p = bench_params; p->name; ++p)
+      printf("%s=%d: %s\n", p->name, p->value, p->description);
+  }
+
+  if (json_fname && !list) {
+    if (write_bench_json(json_fname, reps, warmup) < 0) {
+      printf("Couldn't write results to %s\n", json_fname);
+      bench_metrics_free_all();
+      return 1;
     }
+    printf("Wrote results to %s\n", json_fname);
   }
+  bench_metrics_free_all();
 
   return 0;
 }
@@ -0,0 +1,948 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file simnet.c
+ * \brief A deterministic in-process network simulator for the test suite.
+ *
+ * A simnet_t holds a handful of simulated nodes: clients and relays.  Nodes
+ * talk over simulated channels.  Each direction of a link has a latency and
+ * a bandwidth, and each end has an output buffer of the same size as a real
+ * OR connection's.
+ *
+ * Cells take the same path through relays that they would in a real Tor
+ * process:
+ * <ul>
+ *   <li>append_cell_to_circuit_queue() puts them on circuit queues;
+ *   <li>circuitmux policies pick which circuit to flush next;
+ *   <li>the real scheduler decides when each channel gets to write.
+ * </ul>
+ * There is no cryptography, no TLS and no real onion handshake.  A relay
+ * answers a CREATE2 cell after the node's configured handshake delay, and
+ * the relay cell payloads carry a private mini-protocol instead of
+ * encrypted relay cells.  Circuits extend one hop at a time, and exits
+ * answer BEGIN with a stream of DATA cells.  Circuit-level SENDME windows
+ * are enforced.
+ *
+ * The simulation runs on a virtual clock:
+ * <ul>
+ *   <li>Events wait in a priority queue ordered by virtual time, with ties
+ *       broken by insertion order.
+ *   <li>approx_time() and the cached time of day follow the clock.
+ *   <li>A private libevent base, installed by mocking
+ *       tor_libevent_get_base(), dispatches the scheduler's event.
+ * </ul>
+ * No real time or network access is involved, so the same scenario always
+ * gives the same timings.
+ *
+ * Every node shares the process-wide channel, circuit and scheduler state.
+ * So only one simnet_t may exist at a time, and simnet_free() tears all of
+ * that state down.
+ */
+
+#include "orconfig.h"
+
+/* Libevent stuff */
+#ifdef HAVE_EVENT2_EVENT_H
+#include <event2/event.h>
+#else
+#include <event.h>
+#endif
+
+#define TOR_CHANNEL_INTERNAL_
+#include "or.h"
+#include "channel.h"
+#include "circuitlist.h"
+#include "circuitmux.h"
+#include "command.h"
+#include "compat_libevent.h"
+#include "config.h"
+#include "relay.h"
+#include "scheduler.h"
+#include "simnet.h"
+
+/** Virtual time at which every simulation starts, in seconds since the
+ * epoch. */
+#define SIMNET_EPOCH 1400000000
+
+/** Circuit IDs picked by the second node passed to simnet_connect() start
+ * here, so that they can't collide with the ones the first node picks. */
+#define SIMNET_CIRC_ID_B_BASE 0x40000000u
+
+/** Relay commands in our mini-protocol.  They go in the second byte of a
+ * relay cell's payload.  The first byte holds the number of hops the cell
+ * still has to travel outward before it reaches its recipient, and the next
+ * four hold a command-specific argument. */
+#define SIMNET_RELAY_EXTEND 1
+#define SIMNET_RELAY_EXTENDED 2
+#define SIMNET_RELAY_BEGIN 3
+#define SIMNET_RELAY_DATA 4
+#define SIMNET_RELAY_SENDME 5
+
+/** A simulated client or relay. */
+typedef struct simnet_node_t {
+  int idx; /**< Position of this node in simnet_t.nodes. */
+  simnet_role_t role;
+  /** How long does this node take to answer a CREATE2 cell? */
+  uint32_t create_usec;
+  /** Every simnet_chan_t that this node has open. */
+  smartlist_t *chans;
+} simnet_node_t;
+
+/** One end of a simulated link.  Everything this end writes reaches
+ * <b>peer</b> after the link's latency.  Writes are serialized at the
+ * link's bandwidth. */
+typedef struct simnet_chan_t {
+  channel_t base_; /**< Must be first. */
+  simnet_t *sim;
+  simnet_node_t *node; /**< Node that owns this end of the link. */
+  struct simnet_chan_t *peer; /**< The other end of the link. */
+  uint32_t latency_usec;
+  uint64_t bytes_per_sec;
+  /** Virtual time at which the last cell we've been given finishes
+   * transmitting. */
+  uint64_t busy_until;
+  /** Bytes handed to us by the channel layer that haven't finished
+   * transmitting yet: the equivalent of a connection's outbuf. */
+  size_t bytes_on_link;
+  /** Next circuit ID this end will use when a relay extends over it. */
+  circid_t next_circ_id;
+  /** Description for get_remote_descr(). */
+  char descr[32];
+} simnet_chan_t;
+
+/** Kinds of things that can happen at a moment in virtual time. */
+typedef enum {
+  /** A circuit from simnet_launch_circuit() is due to start. */
+  SIMNET_EV_LAUNCH,
+  /** A cell has finished transmitting on a link. */
+  SIMNET_EV_XMIT_DONE,
+  /** A cell has reached the far end of a link. */
+  SIMNET_EV_DELIVER,
+  /** A relay has finished its handshake for a CREATE2 cell. */
+  SIMNET_EV_CREATE,
+  /** A callback from simnet_schedule() is due. */
+  SIMNET_EV_CALLBACK,
+} simnet_event_type_t;
+
+/** An entry in a simnet_t's event queue. */
+typedef struct simnet_event_t {
+  uint64_t when; /**< Virtual time at which this event happens. */
+  uint64_t seq; /**< Tie-breaker: events at the same time run in order. */
+  int heap_idx; /**< Position in simnet_t.events. */
+  simnet_event_type_t type;
+  simnet_chan_t *chan; /**< For XMIT_DONE, DELIVER and CREATE events. */
+  cell_t *cell; /**< Owned cell, for XMIT_DONE and DELIVER events. */
+  circid_t circ_id; /**< For CREATE events. */
+  int circ_idx; /**< For LAUNCH events. */
+  simnet_callback_fn fn; /**< For CALLBACK events. */
+  void *arg; /**< For CALLBACK events. */
+} simnet_event_t;
+
+/** Client-side state for a circuit launched with simnet_launch_circuit(). */
+typedef struct simnet_circ_t {
+  simnet_circ_stats_t stats;
+  int client; /**< Index of the client node. */
+  int *path; /**< Indices of the relays, from first hop to exit. */
+  int path_len;
+  int n_built; /**< How many hops have finished extending? */
+  /** The client's end of the circuit: an or_circuit_t with no p_chan. */
+  or_circuit_t *circ;
+  int cells_since_sendme; /**< DATA cells since we last sent a SENDME. */
+} simnet_circ_t;
+
+/** Exit-side state for a data transfer requested with BEGIN. */
+typedef struct simnet_stream_t {
+  circuit_t *circ; /**< The exit's end of the circuit. */
+  uint32_t bytes_left; /**< How much more data do we have to send? */
+  int package_window; /**< How many more cells may we send? */
+} simnet_stream_t;
+
+/** A simulated network. */
+struct simnet_t {
+  uint64_t now; /**< Virtual time, in microseconds since SIMNET_EPOCH. */
+  uint64_t next_seq; /**< Sequence number for the next event we add. */
+  smartlist_t *events; /**< Priority queue of simnet_event_t. */
+  smartlist_t *nodes; /**< simnet_node_t, by index. */
+  smartlist_t *chans; /**< Every simnet_chan_t we've made. */
+  smartlist_t *circs; /**< simnet_circ_t, by index. */
+  smartlist_t *streams; /**< Active simnet_stream_t at exits. */
+  /** Policy for every channel's circuitmux, or NULL for the default. */
+  const circuitmux_policy_t *cmux_policy;
+  struct event_base *base; /**< Event base that runs the scheduler. */
+  /** Saved MaxMemInQueues values, to restore in simnet_free(). */
+  uint64_t old_max_mem, old_max_mem_low;
+};
+
+/** The event base of the live simnet_t, if any. */
+static struct event_base *simnet_event_base = NULL;
+
+/** Mock for tor_libevent_get_base(): hand out the simulator's base. */
+static struct event_base *
+simnet_get_event_base(void)
+{
+  return simnet_event_base;
+}
+
+/** Helper for the event pqueue: order events by time, then by when they
+ * were added. */
+static int
+compare_simnet_events_(const void *a_, const void *b_)
+{
+  const simnet_event_t *a = a_, *b = b_;
+  if (a->when != b->when)
+    return a->when < b->when ? -1 : 1;
+  if (a->seq != b->seq)
+    return a->seq < b->seq ? -1 : 1;
+  return 0;
+}
+
+/** Add and return a new event of type <b>type</b> at virtual time
+ * <b>when</b>; the caller fills in its arguments. */
+static simnet_event_t *
+simnet_event_add(simnet_t *sim, uint64_t when, simnet_event_type_t type)
+{
+  simnet_event_t *ev = tor_malloc_zero(sizeof(simnet_event_t));
+  tor_assert(when >= sim->now);
+  ev->when = when;
+  ev->seq = sim->next_seq++;
+  ev->type = type;
+  smartlist_pqueue_add(sim->events, compare_simnet_events_,
+                       STRUCT_OFFSET(simnet_event_t, heap_idx), ev);
+  return ev;
+}
+
+/** Release all storage held by <b>ev</b>. */
+static void
+simnet_event_free(simnet_event_t *ev)
+{
+  if (!ev)
+    return;
+  tor_free(ev->cell);
+  tor_free(ev);
+}
+
+/** Move the virtual clock to <b>now</b>, and make approx_time() and
+ * tor_gettimeofday_cached() agree with it. */
+static void
+simnet_set_clock(simnet_t *sim, uint64_t now)
+{
+  struct timeval tv;
+  tor_assert(now >= sim->now);
+  sim->now = now;
+  tv.tv_sec = SIMNET_EPOCH + (time_t)(now / 1000000);
+  tv.tv_usec = (int)(now % 1000000);
+  update_approx_time(tv.tv_sec);
+  tor_gettimeofday_cache_set(&tv);
+}
+
+/** Run the scheduler, and anything else libevent has made active, until
+ * nothing is left to do at the current virtual time. */
+static void
+simnet_run_scheduler(simnet_t *sim)
+{
+  while (event_base_loop(sim->base, EVLOOP_NONBLOCK) == 0)
+    ;
+}
+
+/** Return the simnet_chan_t that <b>chan</b> is part of. */
+static INLINE simnet_chan_t *
+simnet_chan_from_base(channel_t *chan)
+{
+  return (simnet_chan_t *)chan;
+}
+
+/** Return <b>node</b>'s end of its link to the node with index
+ * <b>peer_idx</b>, or NULL if they aren't connected. */
+static simnet_chan_t *
+simnet_node_get_chan_to(simnet_node_t *node, int peer_idx)
+{
+  SMARTLIST_FOREACH(node->chans, simnet_chan_t *, sc,
+                    if (sc->peer->node->idx == peer_idx)
+                      return sc);
+  return NULL;
+}
+
+/** Start transmitting <b>cell</b>, which we take ownership of, on the link
+ * at <b>sc</b>. */
+static void
+simnet_chan_transmit(simnet_chan_t *sc, cell_t *cell)
+{
+  simnet_t *sim = sc->sim;
+  const size_t cell_size = get_cell_network_size(sc->base_.wide_circ_ids);
+  const uint64_t tx_usec =
+    (cell_size * (uint64_t)1000000 + sc->bytes_per_sec - 1) /
+    sc->bytes_per_sec;
+  simnet_event_t *ev;
+
+  sc->busy_until = MAX(sim->now, sc->busy_until) + tx_usec;
+  sc->bytes_on_link += cell_size;
+  ev = simnet_event_add(sim, sc->busy_until, SIMNET_EV_XMIT_DONE);
+  ev->chan = sc;
+  ev->cell = cell;
+}
+
+/** Close method for simulated channels: there's nothing to flush, so we
+ * are closed right away. */
+static void
+simnet_chan_close(channel_t *chan)
+{
+  channel_closed(chan);
+}
+
+/** Describe_transport method for simulated channels. */
+static const char *
+simnet_chan_describe_transport(channel_t *chan)
+{
+  (void)chan;
+  return "simulated link";
+}
+
+/** Get_remote_descr method for simulated channels. */
+static const char *
+simnet_chan_get_remote_descr(channel_t *chan, int flags)
+{
+  (void)flags;
+  return simnet_chan_from_base(chan)->descr;
+}
+
+/** Is_canonical method for simulated channels: they all are. */
+static int
+simnet_chan_is_canonical(channel_t *chan, int req)
+{
+  (void)chan;
+  (void)req;
+  return 1;
+}
+
+/** Num_bytes_queued method for simulated channels. */
+static size_t
+simnet_chan_num_bytes_queued(channel_t *chan)
+{
+  return simnet_chan_from_base(chan)->bytes_on_link;
+}
+
+/** Num_cells_writeable method for simulated channels.  As for a real OR
+ * connection, we accept cells until the output buffer holds
+ * OR_CONN_HIGHWATER bytes. */
+static int
+simnet_chan_num_cells_writeable(channel_t *chan)
+{
+  simnet_chan_t *sc = simnet_chan_from_base(chan);
+  const size_t cell_size = get_cell_network_size(chan->wide_circ_ids);
+  if (sc->bytes_on_link >= OR_CONN_HIGHWATER)
+    return 0;
+  return (int)CEIL_DIV(OR_CONN_HIGHWATER - sc->bytes_on_link, cell_size);
+}
+
+/** Write_cell method for simulated channels. */
+static int
+simnet_chan_write_cell(channel_t *chan, cell_t *cell)
+{
+  simnet_chan_transmit(simnet_chan_from_base(chan),
+                       tor_memdup(cell, sizeof(cell_t)));
+  return 1;
+}
+
+/** Write_packed_cell method for simulated channels. */
+static int
+simnet_chan_write_packed_cell(channel_t *chan, packed_cell_t *packed_cell)
+{
+  cell_t *cell = tor_malloc_zero(sizeof(cell_t));
+  const char *body = packed_cell->body;
+
+  tor_assert(chan->wide_circ_ids);
+  cell->circ_id = ntohl(get_uint32(body));
+  cell->command = get_uint8(body + 4);
+  memcpy(cell->payload, body + 5, CELL_PAYLOAD_SIZE);
+  packed_cell_free(packed_cell);
+
+  simnet_chan_transmit(simnet_chan_from_base(chan), cell);
+  return 1;
+}
+
+/** Write_var_cell method for simulated channels.  Simulated nodes never
+ * handshake, so these are only accepted and dropped. */
+static int
+simnet_chan_write_var_cell(channel_t *chan, var_cell_t *var_cell)
+{
+  (void)chan;
+  log_debug(LD_CHANNEL, "Dropping var_cell with command %d on a simulated "
+            "link.", (int)var_cell->command);
+  return 1;
+}
+
+static void simnet_handle_cell(channel_t *chan, cell_t *cell);
+
+/** Create and return <b>node</b>'s end of a new link. */
+static simnet_chan_t *
+simnet_chan_new(simnet_t *sim, simnet_node_t *node, circid_t first_circ_id,
+                uint32_t latency_usec, uint64_t bytes_per_sec)
+{
+  simnet_chan_t *sc = tor_malloc_zero(sizeof(simnet_chan_t));
+  channel_t *chan = &sc->base_;
+
+  sc->sim = sim;
+  sc->node = node;
+  sc->latency_usec = latency_usec;
+  sc->bytes_per_sec = bytes_per_sec;
+  sc->next_circ_id = first_circ_id;
+
+  channel_init(chan);
+  chan->close = simnet_chan_close;
+  chan->describe_transport = simnet_chan_describe_transport;
+  chan->get_remote_descr = simnet_chan_get_remote_descr;
+  chan->is_canonical = simnet_chan_is_canonical;
+  chan->num_bytes_queued = simnet_chan_num_bytes_queued;
+  chan->num_cells_writeable = simnet_chan_num_cells_writeable;
+  chan->write_cell = simnet_chan_write_cell;
+  chan->write_packed_cell = simnet_chan_write_packed_cell;
+  chan->write_var_cell = simnet_chan_write_var_cell;
+  chan->wide_circ_ids = 1;
+  chan->has_been_open = 1;
+  chan->cmux = circuitmux_alloc();
+  if (sim->cmux_policy)
+    circuitmux_set_policy(chan->cmux, sim->cmux_policy);
+  chan->state = CHANNEL_STATE_OPEN;
+  channel_register(chan);
+  channel_set_cell_handlers(chan, simnet_handle_cell, NULL);
+  /* Like a freshly opened OR connection, we have an empty outbuf. */
+  scheduler_channel_wants_writes(chan);
+
+  smartlist_add(node->chans, sc);
+  smartlist_add(sim->chans, sc);
+  return sc;
+}
+
+/** Put a relay cell from our mini-protocol on <b>circ</b>'s queue in
+ * direction <b>direction</b>. */
+static void
+simnet_send_relay(circuit_t *circ, cell_direction_t direction, uint8_t hops,
+                  uint8_t command, uint32_t arg)
+{
+  cell_t cell;
+  channel_t *chan;
+
+  memset(&cell, 0, sizeof(cell));
+  cell.command = CELL_RELAY;
+  if (direction == CELL_DIRECTION_OUT) {
+    chan = circ->n_chan;
+    cell.circ_id = circ->n_circ_id;
+  } else {
+    chan = TO_OR_CIRCUIT(circ)->p_chan;
+    cell.circ_id = TO_OR_CIRCUIT(circ)->p_circ_id;
+  }
+  tor_assert(chan);
+  cell.payload[0] = hops;
+  cell.payload[1] = command;
+  set_uint32(cell.payload + 2, htonl(arg));
+  append_cell_to_circuit_queue(circ, chan, &cell, direction, 0);
+}
+
+/** Return the client-side record for the client end <b>circ</b>. */
+static simnet_circ_t *
+simnet_circ_from_circuit(simnet_t *sim, circuit_t *circ)
+{
+  int idx = (int)circ->n_circ_id - 1;
+  simnet_circ_t *c;
+  tor_assert(idx >= 0 && idx < smartlist_len(sim->circs));
+  c = smartlist_get(sim->circs, idx);
+  tor_assert(TO_CIRCUIT(c->circ) == circ);
+  return c;
+}
+
+/** Return the exit-side stream for <b>circ</b>, or NULL if it has none. */
+static simnet_stream_t *
+simnet_stream_from_circuit(simnet_t *sim, circuit_t *circ)
+{
+  SMARTLIST_FOREACH(sim->streams, simnet_stream_t *, st,
+                    if (st->circ == circ)
+                      return st);
+  return NULL;
+}
+
+/** Send as much of <b>st</b>'s data as its package window allows. */
+static void
+simnet_stream_package(simnet_t *sim, simnet_stream_t *st)
+{
+  while (st->package_window > 0 && st->bytes_left > 0) {
+    uint32_t n = MIN(st->bytes_left, RELAY_PAYLOAD_SIZE);
+    simnet_send_relay(st->circ, CELL_DIRECTION_IN, 0, SIMNET_RELAY_DATA, n);
+    st->bytes_left -= n;
+    --st->package_window;
+  }
+  if (st->bytes_left == 0) {
+    smartlist_remove(sim->streams, st);
+    tor_free(st);
+  }
+}
+
+/** One more hop of the client-side circuit <b>c</b> is done: extend it
+ * further, or start fetching data. */
+static void
+simnet_client_hop_built(simnet_t *sim, simnet_circ_t *c)
+{
+  circuit_t *circ = TO_CIRCUIT(c->circ);
+
+  if (++c->n_built < c->path_len) {
+    simnet_send_relay(circ, CELL_DIRECTION_OUT, c->n_built - 1,
+                      SIMNET_RELAY_EXTEND, c->path[c->n_built]);
+    return;
+  }
+
+  c->stats.built = 1;
+  c->stats.built_at = sim->now;
+  if (c->stats.bytes_requested) {
+    simnet_send_relay(circ, CELL_DIRECTION_OUT, c->path_len - 1,
+                      SIMNET_RELAY_BEGIN, c->stats.bytes_requested);
+  } else {
+    c->stats.transfer_done = 1;
+    c->stats.transfer_done_at = sim->now;
+  }
+}
+
+/** Handle a relay cell that has reached the client end <b>circ</b>. */
+static void
+simnet_client_handle_relay(simnet_t *sim, circuit_t *circ,
+                           uint8_t command, uint32_t arg)
+{
+  simnet_circ_t *c = simnet_circ_from_circuit(sim, circ);
+
+  switch (command) {
+    case SIMNET_RELAY_EXTENDED:
+      simnet_client_hop_built(sim, c);
+      break;
+    case SIMNET_RELAY_DATA:
+      c->stats.bytes_received += arg;
+      if (++c->cells_since_sendme == CIRCWINDOW_INCREMENT) {
+        c->cells_since_sendme = 0;
+        simnet_send_relay(circ, CELL_DIRECTION_OUT, c->path_len - 1,
+                          SIMNET_RELAY_SENDME, 0);
+      }
+      if (!c->stats.transfer_done &&
+          c->stats.bytes_received >= c->stats.bytes_requested) {
+        c->stats.transfer_done = 1;
+        c->stats.transfer_done_at = sim->now;
+      }
+      break;
+    default:
+      log_warn(LD_BUG, "Unexpected relay command %d at a simulated client.",
+               (int)command);
+      break;
+  }
+}
+
+/** Handle a relay cell that has reached the relay end <b>circ</b>, arriving
+ * on <b>sc</b>. */
+static void
+simnet_relay_handle_relay(simnet_t *sim, simnet_chan_t *sc, circuit_t *circ,
+                          uint8_t command, uint32_t arg)
+{
+  simnet_stream_t *st;
+  simnet_chan_t *next;
+  cell_t cell;
+
+  switch (command) {
+    case SIMNET_RELAY_EXTEND:
+      next = simnet_node_get_chan_to(sc->node, (int)arg);
+      if (!next || circ->n_chan) {
+        log_warn(LD_BUG, "Simulated relay %d can't extend to node %d.",
+                 sc->node->idx, (int)arg);
+        break;
+      }
+      tor_assert(next->peer->node->role == SIMNET_RELAY);
+      circuit_set_n_circid_chan(circ, next->next_circ_id++, &next->base_);
+      memset(&cell, 0, sizeof(cell));
+      cell.circ_id = circ->n_circ_id;
+      cell.command = CELL_CREATE2;
+      append_cell_to_circuit_queue(circ, &next->base_, &cell,
+                                   CELL_DIRECTION_OUT, 0);
+      break;
+    case SIMNET_RELAY_BEGIN:
+      st = tor_malloc_zero(sizeof(simnet_stream_t));
+      st->circ = circ;
+      st->bytes_left = arg;
+      st->package_window = CIRCWINDOW_START;
+      smartlist_add(sim->streams, st);
+      simnet_stream_package(sim, st);
+      break;
+    case SIMNET_RELAY_SENDME:
+      st = simnet_stream_from_circuit(sim, circ);
+      if (st) {
+        st->package_window += CIRCWINDOW_INCREMENT;
+        simnet_stream_package(sim, st);
+      }
+      break;
+    default:
+      log_warn(LD_BUG, "Unexpected relay command %d at a simulated relay.",
+               (int)command);
+      break;
+  }
+}
+
+/** Cell handler for every simulated channel. */
+static void
+simnet_handle_cell(channel_t *chan, cell_t *cell)
+{
+  simnet_chan_t *sc = simnet_chan_from_base(chan);
+  simnet_t *sim = sc->sim;
+  circuit_t *circ;
+  simnet_event_t *ev;
+  uint8_t hops, command;
+  uint32_t arg;
+
+  if (cell->command == CELL_CREATE2) {
+    if (sc->node->role != SIMNET_RELAY) {
+      log_warn(LD_BUG, "Simulated client got a CREATE2 cell.");
+      return;
+    }
+    ev = simnet_event_add(sim, sim->now + sc->node->create_usec,
+                          SIMNET_EV_CREATE);
+    ev->chan = sc;
+    ev->circ_id = cell->circ_id;
+    return;
+  }
+
+  circ = circuit_get_by_circid_channel(cell->circ_id, chan);
+  if (!circ) {
+    log_debug(LD_CHANNEL, "Simulated node %d dropped a cell for unknown "
+              "circuit %u.", sc->node->idx, (unsigned)cell->circ_id);
+    return;
+  }
+  tor_assert(CIRCUIT_IS_ORCIRC(circ));
+
+  if (cell->command == CELL_CREATED2) {
+    if (TO_OR_CIRCUIT(circ)->p_chan)
+      simnet_send_relay(circ, CELL_DIRECTION_IN, 0, SIMNET_RELAY_EXTENDED, 0);
+    else
+      simnet_client_hop_built(sim, simnet_circ_from_circuit(sim, circ));
+    return;
+  }
+  if (cell->command != CELL_RELAY) {
+    log_debug(LD_CHANNEL, "Simulated node %d ignored a %s cell.",
+              sc->node->idx, cell_command_to_string(cell->command));
+    return;
+  }
+
+  hops = cell->payload[0];
+  command = cell->payload[1];
+  arg = ntohl(get_uint32(cell->payload + 2));
+
+  if (circ->n_chan == chan) {
+    /* Inbound: pass it back toward the client, or take it if we are the
+     * client. */
+    or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
+    if (or_circ->p_chan) {
+      cell->circ_id = or_circ->p_circ_id;
+      append_cell_to_circuit_queue(circ, or_circ->p_chan, cell,
+                                   CELL_DIRECTION_IN, 0);
+    } else {
+      simnet_client_handle_relay(sim, circ, command, arg);
+    }
+  } else if (hops) {
+    /* Outbound and not for us: pass it on. */
+    if (!circ->n_chan) {
+      log_warn(LD_BUG, "Simulated relay %d has nowhere to send a relay "
+               "cell.", sc->node->idx);
+      return;
+    }
+    cell->payload[0] = hops - 1;
+    cell->circ_id = circ->n_circ_id;
+    append_cell_to_circuit_queue(circ, circ->n_chan, cell,
+                                 CELL_DIRECTION_OUT, 0);
+  } else {
+    simnet_relay_handle_relay(sim, sc, circ, command, arg);
+  }
+}
+
+/** Launch the client-side circuit with index <b>circ_idx</b>. */
+static void
+simnet_launch_now(simnet_t *sim, int circ_idx)
+{
+  simnet_circ_t *c = smartlist_get(sim->circs, circ_idx);
+  simnet_node_t *client = smartlist_get(sim->nodes, c->client);
+  simnet_chan_t *sc = simnet_node_get_chan_to(client, c->path[0]);
+  cell_t cell;
+
+  tor_assert(sc);
+  c->circ = or_circuit_new(0, NULL);
+  /* Client circuit IDs are unique across the simulation, so that we can
+   * find our records from them. */
+  circuit_set_n_circid_chan(TO_CIRCUIT(c->circ), circ_idx + 1, &sc->base_);
+  c->stats.launched_at = sim->now;
+
+  memset(&cell, 0, sizeof(cell));
+  cell.circ_id = circ_idx + 1;
+  cell.command = CELL_CREATE2;
+  append_cell_to_circuit_queue(TO_CIRCUIT(c->circ), &sc->base_, &cell,
+                               CELL_DIRECTION_OUT, 0);
+}
+
+/** Make <b>ev</b> happen. */
+static void
+simnet_event_run(simnet_t *sim, simnet_event_t *ev)
+{
+  simnet_chan_t *sc = ev->chan;
+  simnet_event_t *deliver;
+  or_circuit_t *or_circ;
+  cell_t cell;
+
+  switch (ev->type) {
+    case SIMNET_EV_LAUNCH:
+      simnet_launch_now(sim, ev->circ_idx);
+      break;
+    case SIMNET_EV_XMIT_DONE:
+      sc->bytes_on_link -= get_cell_network_size(sc->base_.wide_circ_ids);
+      deliver = simnet_event_add(sim, sim->now + sc->latency_usec,
+                                 SIMNET_EV_DELIVER);
+      deliver->chan = sc->peer;
+      deliver->cell = ev->cell;
+      ev->cell = NULL;
+      if (CHANNEL_IS_OPEN(&sc->base_)) {
+        channel_update_xmit_queue_size(&sc->base_);
+        /* Same rule as connection_or_flushed_some(). */
+        if (sc->bytes_on_link < OR_CONN_LOWWATER)
+          scheduler_channel_wants_writes(&sc->base_);
+      }
+      break;
+    case SIMNET_EV_DELIVER:
+      if (CHANNEL_IS_OPEN(&sc->base_))
+        channel_queue_cell(&sc->base_, ev->cell);
+      break;
+    case SIMNET_EV_CREATE:
+      if (circuit_id_in_use_on_channel(ev->circ_id, &sc->base_)) {
+        log_warn(LD_BUG, "Simulated relay %d got a CREATE2 cell for a "
+                 "circuit ID already in use.", sc->node->idx);
+        break;
+      }
+      or_circ = or_circuit_new(ev->circ_id, &sc->base_);
+      TO_CIRCUIT(or_circ)->purpose = CIRCUIT_PURPOSE_OR;
+      memset(&cell, 0, sizeof(cell));
+      cell.circ_id = ev->circ_id;
+      cell.command = CELL_CREATED2;
+      append_cell_to_circuit_queue(TO_CIRCUIT(or_circ), &sc->base_, &cell,
+                                   CELL_DIRECTION_IN, 0);
+      break;
+    case SIMNET_EV_CALLBACK:
+      ev->fn(sim, ev->arg);
+      break;
+  }
+}
+
+/** Allocate and return a new, empty simulated network.  Only one may exist
+ * at a time. */
+simnet_t *
+simnet_new(void)
+{
+  simnet_t *sim = tor_malloc_zero(sizeof(simnet_t));
+  or_options_t *options = get_options_mutable();
+
+  tor_assert(!simnet_event_base);
+  sim->events = smartlist_new();
+  sim->nodes = smartlist_new();
+  sim->chans = smartlist_new();
+  sim->circs = smartlist_new();
+  sim->streams = smartlist_new();
+
+#ifdef HAVE_EVENT2_EVENT_H
+  sim->base = event_base_new();
+#else
+  sim->base = event_init();
+#endif
+  tor_assert(sim->base);
+  simnet_event_base = sim->base;
+  MOCK(tor_libevent_get_base, simnet_get_event_base);
+
+  /* Keep the OOM handler away from our cell queues. */
+  sim->old_max_mem = options->MaxMemInQueues;
+  sim->old_max_mem_low = options->MaxMemInQueues_low_threshold;
+  options->MaxMemInQueues = U64_LITERAL(1) << 40;
+  options->MaxMemInQueues_low_threshold = (options->MaxMemInQueues / 4) * 3;
+
+  simnet_set_clock(sim, 0);
+  scheduler_init();
+  /* Use the configured thresholds, as options_act() would. */
+  scheduler_set_watermarks((uint32_t)options->SchedulerLowWaterMark__,
+                           (uint32_t)options->SchedulerHighWaterMark__,
+                           (options->SchedulerMaxFlushCells__ > 0) ?
+                           options->SchedulerMaxFlushCells__ : 1000);
+  return sim;
+}
+
+/** Tear down <b>sim</b>, along with every channel and circuit in the
+ * process. */
+void
+simnet_free(simnet_t *sim)
+{
+  or_options_t *options;
+  if (!sim)
+    return;
+  options = get_options_mutable();
+
+  SMARTLIST_FOREACH(sim->events, simnet_event_t *, ev,
+                    simnet_event_free(ev));
+  smartlist_free(sim->events);
+
+  circuit_free_all();
+  SMARTLIST_FOREACH(sim->chans, simnet_chan_t *, sc,
+                    channel_mark_for_close(&sc->base_));
+  channel_free_all();
+  smartlist_free(sim->chans);
+
+  scheduler_free_all();
+  UNMOCK(tor_libevent_get_base);
+  event_base_free(sim->base);
+  simnet_event_base = NULL;
+
+  options->MaxMemInQueues = sim->old_max_mem;
+  options->MaxMemInQueues_low_threshold = sim->old_max_mem_low;
+
+  SMARTLIST_FOREACH(sim->nodes, simnet_node_t *, node, {
+    smartlist_free(node->chans);
+    tor_free(node);
+  });
+  smartlist_free(sim->nodes);
+  SMARTLIST_FOREACH(sim->circs, simnet_circ_t *, c, {
+    tor_free(c->path);
+    tor_free(c);
+  });
+  smartlist_free(sim->circs);
+  SMARTLIST_FOREACH(sim->streams, simnet_stream_t *, st, tor_free(st));
+  smartlist_free(sim->streams);
+  tor_free(sim);
+}
+
+/** Add a node with role <b>role</b> to <b>sim</b>, and return its index.
+ * If it is a relay, it takes <b>create_usec</b> of virtual time to answer
+ * each CREATE2 cell. */
+int
+simnet_add_node(simnet_t *sim, simnet_role_t role, uint32_t create_usec)
+{
+  simnet_node_t *node = tor_malloc_zero(sizeof(simnet_node_t));
+  node->idx = smartlist_len(sim->nodes);
+  node->role = role;
+  node->create_usec = create_usec;
+  node->chans = smartlist_new();
+  smartlist_add(sim->nodes, node);
+  return node->idx;
+}
+
+/** Connect the nodes with indices <b>node_a</b> and <b>node_b</b> with a
+ * link.  In each direction, the link has a latency of <b>latency_usec</b>
+ * and carries <b>bytes_per_sec</b>. */
+void
+simnet_connect(simnet_t *sim, int node_a, int node_b,
+               uint32_t latency_usec, uint64_t bytes_per_sec)
+{
+  simnet_node_t *a = smartlist_get(sim->nodes, node_a);
+  simnet_node_t *b = smartlist_get(sim->nodes, node_b);
+  simnet_chan_t *sc_a, *sc_b;
+
+  tor_assert(a != b);
+  tor_assert(bytes_per_sec > 0);
+  tor_assert(!simnet_node_get_chan_to(a, node_b));
+
+  sc_a = simnet_chan_new(sim, a, 1, latency_usec, bytes_per_sec);
+  sc_b = simnet_chan_new(sim, b, SIMNET_CIRC_ID_B_BASE, latency_usec,
+                         bytes_per_sec);
+  sc_a->peer = sc_b;
+  sc_b->peer = sc_a;
+  tor_snprintf(sc_a->descr, sizeof(sc_a->descr), "simnet node %d", node_b);
+  tor_snprintf(sc_b->descr, sizeof(sc_b->descr), "simnet node %d", node_a);
+}
+
+/** Use <b>policy</b> for the circuitmux of every channel in <b>sim</b>,
+ * including channels created later.  NULL means the default policy. */
+void
+simnet_set_cmux_policy(simnet_t *sim, const circuitmux_policy_t *policy)
+{
+  sim->cmux_policy = policy;
+  SMARTLIST_FOREACH(sim->chans, simnet_chan_t *, sc,
+                    circuitmux_set_policy(sc->base_.cmux, policy));
+}
+
+/** Arrange for the client with index <b>client</b> to build a circuit
+ * through the <b>path_len</b> relays in <b>path</b>, starting
+ * <b>delay_usec</b> from now.  Once the circuit is built, the client asks
+ * the exit for <b>fetch_bytes</b> of data.  Return the circuit's index for
+ * simnet_get_circuit_stats(). */
+int
+simnet_launch_circuit(simnet_t *sim, uint64_t delay_usec, int client,
+                      const int *path, int path_len, uint32_t fetch_bytes)
+{
+  simnet_circ_t *c = tor_malloc_zero(sizeof(simnet_circ_t));
+  simnet_event_t *ev;
+
+  tor_assert(path_len >= 1 && path_len < 256);
+  tor_assert(((simnet_node_t *)smartlist_get(sim->nodes, client))->role ==
+             SIMNET_CLIENT);
+  c->client = client;
+  c->path = tor_memdup(path, sizeof(int) * path_len);
+  c->path_len = path_len;
+  c->stats.bytes_requested = fetch_bytes;
+  smartlist_add(sim->circs, c);
+
+  ev = simnet_event_add(sim, sim->now + delay_usec, SIMNET_EV_LAUNCH);
+  ev->circ_idx = smartlist_len(sim->circs) - 1;
+  return ev->circ_idx;
+}
+
+/** Arrange for <b>fn</b>(<b>sim</b>, <b>arg</b>) to be called once
+ * <b>delay_usec</b> of virtual time has passed. */
+void
+simnet_schedule(simnet_t *sim, uint64_t delay_usec,
+                simnet_callback_fn fn, void *arg)
+{
+  simnet_event_t *ev = simnet_event_add(sim, sim->now + delay_usec,
+                                        SIMNET_EV_CALLBACK);
+  ev->fn = fn;
+  ev->arg = arg;
+}
+
+/** Run <b>sim</b> until nothing is left to happen, or until the virtual
+ * clock would pass <b>until_usec</b>.  Return the virtual time at which we
+ * stopped. */
+uint64_t
+simnet_run(simnet_t *sim, uint64_t until_usec)
+{
+  simnet_run_scheduler(sim);
+  while (smartlist_len(sim->events)) {
+    simnet_event_t *ev = smartlist_get(sim->events, 0);
+    if (ev->when > until_usec) {
+      simnet_set_clock(sim, until_usec);
+      break;
+    }
+    smartlist_pqueue_pop(sim->events, compare_simnet_events_,
+                         STRUCT_OFFSET(simnet_event_t, heap_idx));
+    simnet_set_clock(sim, ev->when);
+    simnet_event_run(sim, ev);
+    simnet_event_free(ev);
+    simnet_run_scheduler(sim);
+  }
+  return sim->now;
+}
+
+/** Return the current virtual time of <b>sim</b>, in microseconds since
+ * the simulation started. */
+uint64_t
+simnet_now(const simnet_t *sim)
+{
+  return sim->now;
+}
+
+/** Return the number of circuits launched in <b>sim</b>. */
+int
+simnet_n_circuits(const simnet_t *sim)
+{
+  return smartlist_len(sim->circs);
+}
+
+/** Return what has happened so far to the circuit with index
+ * <b>circ_idx</b>. */
+const simnet_circ_stats_t *
+simnet_get_circuit_stats(const simnet_t *sim, int circ_idx)
+{
+  const simnet_circ_t *c = smartlist_get(sim->circs, circ_idx);
+  return &c->stats;
+}
+
@@ -0,0 +1,58 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#ifndef TOR_SIMNET_H
+#define TOR_SIMNET_H
+
+/**
+ * \file simnet.h
+ * \brief Declarations for the in-process network simulator used by the
+ * test suite.
+ */
+
+typedef struct simnet_t simnet_t;
+
+/** What part does a simulated node play? */
+typedef enum {
+  /** Launches circuits and fetches data over them. */
+  SIMNET_CLIENT,
+  /** Accepts and extends circuits, and serves data at the end of them. */
+  SIMNET_RELAY,
+} simnet_role_t;
+
+/** What happened to a circuit launched with simnet_launch_circuit(). All
+ * times are in microseconds of virtual time since the simulation started. */
+typedef struct simnet_circ_stats_t {
+  uint64_t launched_at; /**< When did we send the first CREATE cell? */
+  uint64_t built_at; /**< When did the last hop finish extending? */
+  uint64_t transfer_done_at; /**< When did the last byte of data arrive? */
+  uint32_t bytes_requested; /**< How much data did we ask the exit for? */
+  uint32_t bytes_received; /**< How much data has arrived so far? */
+  unsigned int built : 1; /**< True iff built_at is set. */
+  unsigned int transfer_done : 1; /**< True iff transfer_done_at is set. */
+} simnet_circ_stats_t;
+
+/** Callback type for simnet_schedule(). */
+typedef void (*simnet_callback_fn)(simnet_t *sim, void *arg);
+
+simnet_t *simnet_new(void);
+void simnet_free(simnet_t *sim);
+int simnet_add_node(simnet_t *sim, simnet_role_t role,
+                    uint32_t create_usec);
+void simnet_connect(simnet_t *sim, int node_a, int node_b,
+                    uint32_t latency_usec, uint64_t bytes_per_sec);
+void simnet_set_cmux_policy(simnet_t *sim,
+                            const circuitmux_policy_t *policy);
+int simnet_launch_circuit(simnet_t *sim, uint64_t delay_usec, int client,
+                          const int *path, int path_len,
+                          uint32_t fetch_bytes);
+void simnet_schedule(simnet_t *sim, uint64_t delay_usec,
+                     simnet_callback_fn fn, void *arg);
+uint64_t simnet_run(simnet_t *sim, uint64_t until_usec);
+uint64_t simnet_now(const simnet_t *sim);
+int simnet_n_circuits(const simnet_t *sim);
+const simnet_circ_stats_t *simnet_get_circuit_stats(const simnet_t *sim,
+                                                    int circ_idx);
+
+#endif /* !defined(TOR_SIMNET_H) */
+
@@ -28,6 +28,7 @@
 #define ROUTER_PRIVATE
 #define CIRCUITSTATS_PRIVATE
 #define CIRCUITLIST_PRIVATE
+#define CIRCUITUSE_PRIVATE
 #define STATEFILE_PRIVATE
 
 /*
@@ -43,6 +44,7 @@ double fabs(double x);
 #include "buffers.h"
 #include "circuitlist.h"
 #include "circuitstats.h"
+#include "circuituse.h"
 #include "config.h"
 #include "connection_edge.h"
 #include "geoip.h"
@@ -605,6 +607,39 @@ test_rend_fns(void *arg)
                geoip_get_country_name(geoip_get_country_by_ipv6(&in6))); \
   } while (0)
 
+/** Helper: return a well-mixed hash of <b>len</b> bytes at <b>data</b>
+ * that is the same on every run, unlike tor_addr_hash(). */
+static uint64_t
+fixed_hash(const void *data, size_t len)
+{
+  char d[DIGEST_LEN];
+  uint64_t h;
+  crypto_digest(d, data, len);
+  memcpy(&h, d, sizeof(h));
+  return h;
+}
+
+/** Helper: return the <b>n</b>th client address hash for sketch tests. */
+static uint64_t
+test_addr_hash(uint64_t n)
+{
+  return fixed_hash(&n, sizeof(n));
+}
+
+/** Replacement for geoip_client_addr_hash() that does not depend on our
+ * random siphash key, so that client counts are the same on every run. */
+static uint64_t
+mock_geoip_client_addr_hash(const tor_addr_t *addr)
+{
+  if (tor_addr_family(addr) == AF_INET) {
+    uint32_t a = tor_addr_to_ipv4n(addr);
+    return fixed_hash(&a, sizeof(a));
+  } else if (tor_addr_family(addr) == AF_INET6) {
+    return fixed_hash(tor_addr_to_in6_addr8(addr), 16);
+  }
+  return 0;
+}
+
 /** Run unit tests for GeoIP code. */
 static void
 test_geoip(void *arg)
@@ -693,6 +728,7 @@ test_geoip(void *arg)
   SET_TEST_IPV6(3);
   tt_int_op(0,OP_EQ, geoip_get_country_by_ipv6(&in6));
 
+  MOCK(geoip_client_addr_hash, mock_geoip_client_addr_hash);
   get_options_mutable()->BridgeRelay = 1;
   get_options_mutable()->BridgeRecordUsageByCountry = 1;
   /* Put 9 observations in AB... */
@@ -849,6 +885,7 @@ test_geoip(void *arg)
   get_options_mutable()->EntryStatistics = 0;
 
  done:
+  UNMOCK(geoip_client_addr_hash);
   tor_free(s);
   tor_free(v);
 }
@@ -863,6 +900,7 @@ test_geoip_with_pt(void *arg)
   struct in6_addr in6;
 
   (void)arg;
+  MOCK(geoip_client_addr_hash, mock_geoip_client_addr_hash);
   get_options_mutable()->BridgeRelay = 1;
   get_options_mutable()->BridgeRecordUsageByCountry = 1;
 
@@ -922,6 +960,7 @@ test_geoip_with_pt(void *arg)
   get_options_mutable()->EntryStatistics = 0;
 
  done:
+  UNMOCK(geoip_client_addr_hash);
   tor_free(s);
 }
 
@@ -929,6 +968,105 @@ test_geoip_with_pt(void *arg)
 #undef SET_TEST_IPV6
 #undef CHECK_COUNTRY
 
+/** Run unit tests for the sketches we use to count unique clients. */
+static void
+test_geoip_sketch(void *arg)
+{
+  time_t now = 1281533250; /* 2010-08-11 13:27:30 UTC */
+  client_sketch_t *sk = NULL;
+  unsigned n;
+  uint64_t i;
+
+  (void)arg;
+  sk = client_sketch_new();
+  tt_int_op(0, OP_EQ, client_sketch_count(sk, 0));
+
+  /* Small populations are counted exactly, however often we see them. */
+  for (i = 0; i < 100; ++i) {
+    client_sketch_add(sk, test_addr_hash(1000 + i), now - 7200);
+  }
+  for (i = 0; i < 20; ++i) {
+    client_sketch_add(sk, test_addr_hash(i), now - 7200);
+    client_sketch_add(sk, test_addr_hash(i), now);
+  }
+  tt_int_op(120, OP_EQ, client_sketch_count(sk, 0));
+  tt_int_op(20, OP_EQ, client_sketch_count(sk, now - 6000));
+  tt_int_op(0, OP_EQ, client_sketch_remove_old(sk, now - 6000));
+  tt_int_op(20, OP_EQ, client_sketch_count(sk, 0));
+  tt_int_op(1, OP_EQ, client_sketch_remove_old(sk, now + 60));
+
+  /* Large populations are estimated to within a few percent, without
+   * remembering each client. */
+  for (i = 0; i < 50000; ++i) {
+    client_sketch_add(sk, test_addr_hash(100000 + i), now - 3*3600);
+  }
+  tt_assert(sk->is_dense);
+  tt_ptr_op(NULL, OP_EQ, sk->exact);
+  n = client_sketch_count(sk, 0);
+  tt_int_op(n, OP_GT, 47500);
+  tt_int_op(n, OP_LT, 52500);
+
+  /* Old slices can be forgotten. */
+  for (i = 0; i < 1000; ++i) {
+    client_sketch_add(sk, test_addr_hash(200000 + i), now);
+  }
+  n = client_sketch_count(sk, now - 3600);
+  tt_int_op(n, OP_GT, 950);
+  tt_int_op(n, OP_LT, 1050);
+  tt_int_op(0, OP_EQ, client_sketch_remove_old(sk, now - 3600));
+  n = client_sketch_count(sk, 0);
+  tt_int_op(n, OP_GT, 950);
+  tt_int_op(n, OP_LT, 1050);
+
+ done:
+  client_sketch_free(sk);
+}
+
+/** Check that a client_sketch_t stays exact up to CLIENT_SKETCH_MAX_EXACT
+ * clients, and that it keeps what it knew when it switches to registers. */
+static void
+test_geoip_sketch_boundary(void *arg)
+{
+  time_t now = 1281533250; /* 2010-08-11 13:27:30 UTC */
+  client_sketch_t *sk = NULL;
+  unsigned n;
+  uint64_t i;
+
+  (void)arg;
+  sk = client_sketch_new();
+
+  /* Exactly CLIENT_SKETCH_MAX_EXACT clients, some of them seen twice. */
+  for (i = 0; i < CLIENT_SKETCH_MAX_EXACT; ++i) {
+    client_sketch_add(sk, test_addr_hash(i), now - 7200);
+  }
+  for (i = 0; i < 10; ++i) {
+    client_sketch_add(sk, test_addr_hash(i), now);
+  }
+  tt_assert(!sk->is_dense);
+  tt_int_op(CLIENT_SKETCH_MAX_EXACT, OP_EQ, client_sketch_count(sk, 0));
+  tt_int_op(10, OP_EQ, client_sketch_count(sk, now - 3600));
+
+  /* One more distinct client switches it to registers. */
+  client_sketch_add(sk, test_addr_hash(CLIENT_SKETCH_MAX_EXACT), now);
+  tt_assert(sk->is_dense);
+  tt_ptr_op(NULL, OP_EQ, sk->exact);
+  tt_int_op(0, OP_EQ, sk->n_exact);
+  n = client_sketch_count(sk, 0);
+  tt_int_op(n, OP_GT, (CLIENT_SKETCH_MAX_EXACT + 1) * 95 / 100);
+  tt_int_op(n, OP_LT, (CLIENT_SKETCH_MAX_EXACT + 1) * 105 / 100);
+
+  /* The folded-in clients kept their last-seen hour, and seeing them again
+   * doesn't count them twice. */
+  tt_int_op(client_sketch_count(sk, now - 3600), OP_LT, 20);
+  for (i = 0; i <= CLIENT_SKETCH_MAX_EXACT; ++i) {
+    client_sketch_add(sk, test_addr_hash(i), now - 7200);
+  }
+  tt_int_op(n, OP_EQ, client_sketch_count(sk, 0));
+
+ done:
+  client_sketch_free(sk);
+}
+
 /** Run unit tests for stats code. */
 static void
 test_stats(void *arg)
@@ -1089,6 +1227,41 @@ test_stats(void *arg)
   tor_free(s);
 }
 
+/** Run unit tests for sizing our pool of preemptive circuits. */
+static void
+test_circuit_prediction(void *arg)
+{
+  time_t now = 1281533250; /* 2010-08-11 13:27:30 UTC */
+  double rate;
+  int i;
+
+  (void)arg;
+  /* With no demand, we keep one circuit around per predicted port. */
+  tt_double_op(rep_hist_get_clean_circ_demand(now, 0), OP_EQ, 0.0);
+  tt_int_op(1, OP_EQ, circuit_predicted_pool_size(0.0, 10.0));
+
+  /* A stream needing a fresh circuit every 2 seconds converges on a rate
+   * of 0.5 per second. */
+  for (i = 0; i < 3600; i += 2)
+    rep_hist_note_clean_circ_demand(now + i, 0);
+  rate = rep_hist_get_clean_circ_demand(now + 3600, 0);
+  tt_double_op(fabs(rate - 0.5), OP_LT, 0.05);
+  /* Other port classes are tracked separately. */
+  tt_double_op(rep_hist_get_clean_circ_demand(now + 3600, 1), OP_EQ, 0.0);
+
+  /* Demand decays once the streams stop. */
+  tt_double_op(rep_hist_get_clean_circ_demand(now + 3600 + 600, 0), OP_LT,
+               rate * 0.51);
+
+  /* Five arrivals expected per build time: 5 + sqrt(5), rounded up. */
+  tt_int_op(8, OP_EQ, circuit_predicted_pool_size(0.5, 10.0));
+  /* Never more than we're willing to keep unused. */
+  tt_int_op(12, OP_EQ, circuit_predicted_pool_size(100.0, 60.0));
+
+ done:
+  ;
+}
+
 #define ENT(name)                                                       \
   { #name, test_ ## name , 0, NULL, NULL }
 #define FORK(name)                                                      \
@@ -1103,7 +1276,10 @@ static struct testcase_t test_array[] = {
   ENT(rend_fns),
   ENT(geoip),
   FORK(geoip_with_pt),
+  ENT(geoip_sketch),
+  ENT(geoip_sketch_boundary),
   FORK(stats),
+  FORK(circuit_prediction),
 
   END_OF_TESTCASES
 };
@@ -1124,6 +1300,7 @@ extern struct testcase_t container_tests[];
 extern struct testcase_t controller_event_tests[];
 extern struct testcase_t crypto_tests[];
 extern struct testcase_t dir_tests[];
+extern struct testcase_t dnsserv_tests[];
 extern struct testcase_t entryconn_tests[];
 extern struct testcase_t entrynodes_tests[];
 extern struct testcase_t extorport_tests[];
@@ -1144,9 +1321,11 @@ extern struct testcase_t routerkeys_tests[];
 extern struct testcase_t routerlist_tests[];
 extern struct testcase_t routerset_tests[];
 extern struct testcase_t scheduler_tests[];
+extern struct testcase_t simnet_tests[];
 extern struct testcase_t socks_tests[];
 extern struct testcase_t status_tests[];
 extern struct testcase_t thread_tests[];
+extern struct testcase_t tortls_tests[];
 extern struct testcase_t util_tests[];
 
 struct testgroup_t testgroups[] = {
@@ -1168,6 +1347,7 @@ struct testgroup_t testgroups[] = {
   { "crypto/", crypto_tests },
   { "dir/", dir_tests },
   { "dir/md/", microdesc_tests },
+  { "dnsserv/", dnsserv_tests },
   { "entryconn/", entryconn_tests },
   { "entrynodes/", entrynodes_tests },
   { "extorport/", extorport_tests },
@@ -1185,8 +1365,10 @@ struct testgroup_t testgroups[] = {
   { "routerlist/", routerlist_tests },
   { "routerset/" , routerset_tests },
   { "scheduler/", scheduler_tests },
+  { "simnet/", simnet_tests },
   { "socks/", socks_tests },
   { "status/" , status_tests },
+  { "tortls/", tortls_tests },
   { "util/", util_tests },
   { "util/logging/", logging_tests },
   { "util/thread/", thread_tests },
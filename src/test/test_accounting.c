@@ -67,10 +67,91 @@ test_accounting_limits(void *arg)
   or_state_free(or_state);
 }
 
+#undef NS_SUBMODULE
+#define NS_SUBMODULE pacing
+
+/*
+ * Test that pacing spreads our remaining quota over the rest of the
+ * interval, and that it replaces the soft limit but not the hard one.
+ */
+
+NS_DECL(or_state_t *, get_or_state, (void));
+static or_state_t *
+NS(get_or_state)(void)
+{
+  return or_state;
+}
+
+static void
+test_accounting_pacing(void *arg)
+{
+  or_options_t *options = get_options_mutable();
+  time_t fake_time = time(NULL);
+  time_t end_time;
+  int rate = 0, burst = 0;
+  (void) arg;
+
+  NS_MOCK(get_or_state);
+  or_state = or_state_new();
+
+  /* The rate is what's left over the time that's left; with the sum rule,
+   * reading and writing share it. */
+  tt_u64_op(accounting_compute_pacing_rate(U64_LITERAL(1) << 30, 1024, 0),
+            OP_EQ, 1024*1024);
+  tt_u64_op(accounting_compute_pacing_rate(U64_LITERAL(1) << 30, 1024, 1),
+            OP_EQ, 512*1024);
+  /* Never pace below the minimum, even when we're out of bytes or time. */
+  tt_u64_op(accounting_compute_pacing_rate(0, 1024, 0), OP_EQ, 20*1024);
+  tt_u64_op(accounting_compute_pacing_rate(U64_LITERAL(1) << 30, 0, 0),
+            OP_EQ, U64_LITERAL(1) << 30);
+
+  options->AccountingMax = U64_LITERAL(1) << 40;
+  options->AccountingRule = ACCT_MAX;
+  options->AccountingPacing = 0;
+  tt_int_op(0, OP_EQ, accounting_parse_options(options, 0));
+  configure_accounting(fake_time);
+  tt_int_op(0, OP_EQ, accounting_get_pacing_limits(&rate, &burst));
+
+  options->AccountingPacing = 1;
+  configure_accounting(fake_time);
+  end_time = accounting_get_end_time();
+  tt_int_op(1, OP_EQ, accounting_get_pacing_limits(&rate, &burst));
+  tt_int_op(rate, OP_EQ,
+            (int)MIN(options->AccountingMax / (end_time - fake_time),
+                     INT32_MAX));
+  tt_int_op(burst, OP_GE, rate);
+
+  /* Using bytes early lowers the rate for the rest of the interval. */
+  accounting_add_bytes((size_t)1 << 30, 0, 1);
+  fake_time += 1;
+  accounting_run_housekeeping(fake_time);
+  {
+    int new_rate = 0;
+    tt_int_op(1, OP_EQ, accounting_get_pacing_limits(&new_rate, &burst));
+    tt_int_op(new_rate, OP_LE, rate);
+  }
+
+  /* Pacing never puts us into soft hibernation... */
+  options->AccountingMax = (U64_LITERAL(1) << 30) + 1024;
+  consider_hibernation(fake_time);
+  tt_int_op(we_are_hibernating(), OP_EQ, 0);
+
+  /* ... but the hard limit still applies. */
+  options->AccountingMax = U64_LITERAL(1) << 29;
+  consider_hibernation(fake_time);
+  tt_int_op(we_are_hibernating(), OP_EQ, 1);
+
+ done:
+  options->AccountingPacing = 0;
+  NS_UNMOCK(get_or_state);
+  or_state_free(or_state);
+}
+
 #undef NS_SUBMODULE
 
 struct testcase_t accounting_tests[] = {
   { "bwlimits", test_accounting_limits, TT_FORK, NULL, NULL },
+  { "pacing", test_accounting_pacing, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
 
@@ -17,6 +17,7 @@
 #include "onion_ntor.h"
 #include "relay.h"
 #include "test.h"
+#include "link_handshake.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -1248,6 +1249,75 @@ test_cfmt_is_destroy(void *arg)
   tor_free(chan);
 }
 
+static void
+test_cfmt_link_handshake_cells(void *arg)
+{
+  certs_cell_t *cc = NULL;
+  netinfo_cell_t *nc = NULL;
+  netinfo_addr_t *na;
+  uint8_t b[CELL_PAYLOAD_SIZE], b2[CELL_PAYLOAD_SIZE];
+  size_t i;
+  (void)arg;
+
+  /* A CERTS body with two certificates, and some junk after. */
+  memcpy(b, "\x02" "\x01\x00\x03" "abc" "\x07\x00\x00" "xyz", 13);
+  tt_int_op(10, OP_EQ, certs_cell_parse(&cc, b, 13));
+  tt_int_op(2, OP_EQ, certs_cell_getlen_certs(cc));
+  tt_int_op(1, OP_EQ,
+            certs_cell_cert_get_cert_type(certs_cell_get_certs(cc, 0)));
+  tt_int_op(3, OP_EQ, certs_cell_cert_getlen_body(certs_cell_get_certs(cc,0)));
+  tt_mem_op("abc", OP_EQ,
+            certs_cell_cert_getarray_body(certs_cell_get_certs(cc, 0)), 3);
+  tt_int_op(0, OP_EQ, certs_cell_cert_getlen_body(certs_cell_get_certs(cc,1)));
+  tt_int_op(10, OP_EQ, certs_cell_encode(b2, sizeof(b2), cc));
+  tt_mem_op(b, OP_EQ, b2, 10);
+  certs_cell_free(cc);
+  cc = NULL;
+
+  /* Any truncation of it is an error. */
+  for (i = 0; i < 10; ++i) {
+    tt_int_op(-2, OP_EQ, certs_cell_parse(&cc, b, i));
+    tt_ptr_op(cc, OP_EQ, NULL);
+  }
+
+  /* A NETINFO body: we're 18.244.0.1; they're 10.0.0.1 and an IPv6
+   * address, and there's an address type we don't know. */
+  memset(b, 0, sizeof(b));
+  memcpy(b, "\x54\xa1\x1a\xce" "\x04\x04\x12\xf4\x00\x01" "\x03", 11);
+  memcpy(b+11, "\x04\x04\x0a\x00\x00\x01", 6);
+  memcpy(b+17, "\x06\x10" "\x20\x02\x00\x00\x00\x00\x00\x00"
+         "\x00\x00\x00\x00\x00\xf0\xc5\x1e", 18);
+  memcpy(b+35, "\xf0\x02zz", 4);
+  tt_int_op(39, OP_EQ, netinfo_cell_parse(&nc, b, sizeof(b)));
+  tt_int_op(0x54a11ace, OP_EQ, netinfo_cell_get_timestamp(nc));
+  na = netinfo_cell_get_other_addr(nc);
+  tt_int_op(NETINFO_ADDR_TYPE_IPV4, OP_EQ, netinfo_addr_get_addr_type(na));
+  tt_int_op(0x12f40001, OP_EQ, netinfo_addr_get_addr_ipv4(na));
+  tt_int_op(3, OP_EQ, netinfo_cell_getlen_my_addrs(nc));
+  na = netinfo_cell_get_my_addrs(nc, 1);
+  tt_int_op(NETINFO_ADDR_TYPE_IPV6, OP_EQ, netinfo_addr_get_addr_type(na));
+  tt_mem_op(b+19, OP_EQ, netinfo_addr_getarray_addr_ipv6(na), 16);
+  na = netinfo_cell_get_my_addrs(nc, 2);
+  tt_int_op(0xf0, OP_EQ, netinfo_addr_get_addr_type(na));
+  netinfo_cell_free(nc);
+  nc = NULL;
+
+  /* An IPv4 address with the wrong length is rejected... */
+  b[12] = 5;
+  tt_int_op(-1, OP_EQ, netinfo_cell_parse(&nc, b, sizeof(b)));
+  tt_ptr_op(nc, OP_EQ, NULL);
+  b[12] = 4;
+  b[30+5] = 0xff;
+  b[30+6] = 0xff;
+  /* ...and so is an address that runs off the end of the cell. */
+  tt_int_op(-2, OP_EQ, netinfo_cell_parse(&nc, b, 40));
+  tt_ptr_op(nc, OP_EQ, NULL);
+
+ done:
+  certs_cell_free(cc);
+  netinfo_cell_free(nc);
+}
+
 #define TEST(name, flags)                                               \
   { #name, test_cfmt_ ## name, flags, 0, NULL }
 
@@ -1261,6 +1331,7 @@ struct testcase_t cell_format_tests[] = {
   TEST(extended_cells, 0),
   TEST(resolved_cells, 0),
   TEST(is_destroy, 0),
+  TEST(link_handshake_cells, 0),
   END_OF_TESTCASES
 };
 
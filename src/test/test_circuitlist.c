@@ -343,10 +343,56 @@ test_pick_circid(void *arg)
   circuit_free_all();
 }
 
+static void
+test_close_marked(void *arg)
+{
+  smartlist_t *circs = smartlist_new();
+  or_circuit_t *keep = NULL, *freed_early = NULL;
+  int i;
+
+  (void)arg;
+  keep = or_circuit_new(0, NULL);
+  for (i = 0; i < 1100; ++i) {
+    or_circuit_t *c = or_circuit_new(0, NULL);
+    c->base_.purpose = CIRCUIT_PURPOSE_OR;
+    smartlist_add(circs, c);
+  }
+  tt_int_op(smartlist_len(circuit_get_global_list()), OP_EQ, 1101);
+  tt_int_op(circuit_count_pending_close(), OP_EQ, 0);
+
+  SMARTLIST_FOREACH(circs, or_circuit_t *, c,
+      circuit_mark_for_close(TO_CIRCUIT(c), END_CIRC_REASON_FINISHED));
+  tt_int_op(circuit_count_pending_close(), OP_EQ, 1100);
+
+  /* Freeing a marked circuit directly takes it off the pending list. */
+  freed_early = smartlist_pop_last(circs);
+  circuit_free(TO_CIRCUIT(freed_early));
+  tt_int_op(circuit_count_pending_close(), OP_EQ, 1099);
+
+  /* Marked circuits are freed in batches; the unmarked one stays. */
+  circuit_close_all_marked();
+  tt_int_op(circuit_count_pending_close(), OP_EQ, 1099 - 1024);
+  tt_int_op(smartlist_len(circuit_get_global_list()), OP_EQ, 1 + 1099 - 1024);
+  circuit_close_all_marked();
+  tt_int_op(circuit_count_pending_close(), OP_EQ, 0);
+  tt_int_op(smartlist_len(circuit_get_global_list()), OP_EQ, 1);
+  tt_ptr_op(smartlist_get(circuit_get_global_list(), 0), OP_EQ, keep);
+  tt_int_op(TO_CIRCUIT(keep)->global_circuitlist_idx, OP_EQ, 0);
+
+  /* Nothing to do is fine. */
+  circuit_close_all_marked();
+  tt_int_op(smartlist_len(circuit_get_global_list()), OP_EQ, 1);
+
+ done:
+  smartlist_free(circs);
+  circuit_free_all();
+}
+
 struct testcase_t circuitlist_tests[] = {
   { "maps", test_clist_maps, TT_FORK, NULL, NULL },
   { "rend_token_maps", test_rend_token_maps, TT_FORK, NULL, NULL },
   { "pick_circid", test_pick_circid, TT_FORK, NULL, NULL },
+  { "close_marked", test_close_marked, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
 
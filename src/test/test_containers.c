@@ -441,6 +441,56 @@ test_container_smartlist_digests(void *arg)
   smartlist_free(sl);
 }
 
+/** Helper: compare two DIGEST256_LEN digests with memcmp. */
+static int
+compare_digests256_for_test(const void **a, const void **b)
+{
+  return memcmp(*a, *b, DIGEST256_LEN);
+}
+
+/** Check that the radix sort used for digest lists agrees with a plain
+ * memcmp sort on lists big enough to need several passes, and that removing
+ * duplicates from them works. */
+static void
+test_container_smartlist_digests_large(void *arg)
+{
+  smartlist_t *sl = smartlist_new(), *expected = smartlist_new();
+  int i;
+  (void)arg;
+
+  for (i = 0; i < 5000; ++i) {
+    char d[DIGEST256_LEN];
+    crypto_rand(d, sizeof(d));
+    /* Make lots of shared prefixes, and some exact duplicates. */
+    if (i % 3 == 0)
+      memset(d, 0x80, 4);
+    if (i % 7 == 0)
+      memset(d, 0, sizeof(d) - 1);
+    smartlist_add(sl, tor_memdup(d, sizeof(d)));
+    if (i % 5 == 0)
+      smartlist_add(sl, tor_memdup(d, sizeof(d)));
+  }
+  smartlist_add_all(expected, sl);
+  smartlist_sort(expected, compare_digests256_for_test);
+
+  smartlist_sort_digests256(sl);
+  tt_int_op(smartlist_len(sl), OP_EQ, smartlist_len(expected));
+  for (i = 0; i < smartlist_len(sl); ++i)
+    tt_mem_op(smartlist_get(sl, i), OP_EQ, smartlist_get(expected, i),
+              DIGEST256_LEN);
+
+  smartlist_uniq_digests256(sl);
+  tt_int_op(smartlist_len(sl), OP_LT, smartlist_len(expected));
+  for (i = 1; i < smartlist_len(sl); ++i)
+    tt_int_op(memcmp(smartlist_get(sl, i-1), smartlist_get(sl, i),
+                     DIGEST256_LEN), OP_LT, 0);
+
+ done:
+  SMARTLIST_FOREACH(sl, char *, cp, tor_free(cp));
+  smartlist_free(sl);
+  smartlist_free(expected);
+}
+
 /** Run unit tests for concatenate-a-smartlist-of-strings functions. */
 static void
 test_container_smartlist_join(void *arg)
@@ -1041,6 +1091,44 @@ test_container_fp_pair_map(void *arg)
   tor_free(v105);
 }
 
+/** Run unit tests for string interning. */
+static void
+test_container_intern_str(void *arg)
+{
+  char *dup = tor_strdup("Tor 0.2.6.2-alpha on Linux");
+  const char *a, *b, *c;
+  const int n_before = tor_intern_str_count();
+
+  (void)arg;
+  a = tor_intern_str(dup);
+  b = tor_intern_str("Tor 0.2.6.2-alpha on Linux");
+  c = tor_intern_str("Tor 0.2.5.10 on Linux");
+  tt_str_op(a, OP_EQ, dup);
+  tt_ptr_op(a, OP_NE, dup);
+  tt_ptr_op(a, OP_EQ, b);
+  tt_ptr_op(a, OP_NE, c);
+  tt_int_op(tor_intern_str_count(), OP_EQ, n_before + 2);
+
+  /* Strings stay around until their last reference is gone. */
+  tor_intern_str_release(a);
+  tt_str_op(b, OP_EQ, "Tor 0.2.6.2-alpha on Linux");
+  tt_int_op(tor_intern_str_count(), OP_EQ, n_before + 2);
+  tor_intern_str_release(b);
+  tor_intern_str_release(c);
+  tt_int_op(tor_intern_str_count(), OP_EQ, n_before);
+
+  /* Releasing a string that was never interned just frees it. */
+  c = tor_intern_str("Tor 0.2.6.2-alpha on Linux");
+  tor_intern_str_release(dup);
+  dup = NULL;
+  tt_int_op(tor_intern_str_count(), OP_EQ, n_before + 1);
+  tor_intern_str_release(c);
+  tor_intern_str_release(NULL);
+
+ done:
+  tor_free(dup);
+}
+
 #define CONTAINER_LEGACY(name)                                          \
   { #name, test_container_ ## name , 0, NULL, NULL }
 
@@ -1052,6 +1140,7 @@ struct testcase_t container_tests[] = {
   CONTAINER_LEGACY(smartlist_strings),
   CONTAINER_LEGACY(smartlist_overlap),
   CONTAINER_LEGACY(smartlist_digests),
+  CONTAINER(smartlist_digests_large, 0),
   CONTAINER_LEGACY(smartlist_join),
   CONTAINER(smartlist_ints_eq, 0),
   CONTAINER_LEGACY(bitarray),
@@ -1061,6 +1150,7 @@ struct testcase_t container_tests[] = {
   CONTAINER_LEGACY(order_functions),
   CONTAINER(di_map, 0),
   CONTAINER_LEGACY(fp_pair_map),
+  CONTAINER(intern_str, 0),
   END_OF_TESTCASES
 };
 
@@ -10,6 +10,7 @@
 #include "aes.h"
 #include "util.h"
 #include "siphash.h"
+#include "crypto_calibrate.h"
 #include "crypto_curve25519.h"
 #include "crypto_ed25519.h"
 #include "ed25519_vectors.inc"
@@ -1599,6 +1600,170 @@ test_crypto_siphash(void *arg)
   ;
 }
 
+/** Make sure that every counter-mode implementation we can use produces
+ * the same keystream, however we chop up the input. */
+static void
+test_crypto_aes_ctr_impls(void *arg)
+{
+  const size_t len = 4099;
+  char key[16], iv[16];
+  char *plain = tor_malloc(len);
+  char *expected = tor_malloc(len);
+  char *encrypted = tor_malloc(len);
+  aes_cnt_cipher_t *c = NULL;
+  aes_ctr_impl_t impl, orig_impl;
+  size_t pos, n;
+
+  (void)arg;
+  evaluate_evp_for_aes(-1);
+  evaluate_ctr_for_aes();
+  orig_impl = aes_get_ctr_impl();
+  tt_assert(aes_ctr_impl_is_available(AES_CTR_IMPL_BUILTIN));
+
+  crypto_rand(key, sizeof(key));
+  crypto_rand(iv, sizeof(iv));
+  /* Start near a carry into the high bytes of the counter. */
+  memset(iv+8, 0xff, 7);
+  crypto_rand(plain, len);
+
+  aes_set_ctr_impl(AES_CTR_IMPL_BUILTIN);
+  c = aes_new_cipher(key, iv);
+  aes_crypt(c, plain, len, expected);
+  aes_cipher_free(c);
+  c = NULL;
+
+  for (impl = 0; impl < N_AES_CTR_IMPLS; ++impl) {
+    if (!aes_ctr_impl_is_available(impl))
+      continue;
+    aes_set_ctr_impl(impl);
+    tt_int_op(aes_get_ctr_impl(), OP_EQ, impl);
+
+    c = aes_new_cipher(key, iv);
+    for (pos = 0; pos < len; pos += n) {
+      n = 1 + crypto_rand_int(600);
+      n = MIN(n, len - pos);
+      aes_crypt(c, plain+pos, n, encrypted+pos);
+    }
+    aes_cipher_free(c);
+    tt_mem_op(encrypted, OP_EQ, expected, len);
+
+    c = aes_new_cipher(key, iv);
+    memcpy(encrypted, plain, len);
+    for (pos = 0; pos < len; pos += n) {
+      n = 1 + crypto_rand_int(600);
+      n = MIN(n, len - pos);
+      aes_crypt_inplace(c, encrypted+pos, n);
+    }
+    aes_cipher_free(c);
+    c = NULL;
+    tt_mem_op(encrypted, OP_EQ, expected, len);
+  }
+
+  aes_set_ctr_impl(orig_impl);
+
+ done:
+  aes_cipher_free(c);
+  tor_free(plain);
+  tor_free(expected);
+  tor_free(encrypted);
+}
+
+/** Make sure both ways of multiplying the curve25519 basepoint agree with
+ * the Montgomery ladder. */
+static void
+test_crypto_curve25519_basepoint(void *arg)
+{
+  /* From RFC 7748, section 6.1. */
+  const char secret_hex[] =
+    "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a";
+  const char public_hex[] =
+    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a";
+  const uint8_t basepoint[32] = {9};
+  uint8_t secret[32], out_ladder[32], out_ed[32];
+  curve25519_basepoint_impl_t orig_impl = curve25519_get_basepoint_impl();
+  int i;
+  char *mem_op_hex_tmp = NULL;
+
+  (void)arg;
+  base16_decode((char*)secret, sizeof(secret),
+                secret_hex, strlen(secret_hex));
+
+  curve25519_set_basepoint_impl(CURVE25519_BASEPOINT_IMPL_LADDER);
+  tt_int_op(0, OP_EQ, curve25519_basepoint_impl(out_ladder, secret));
+  curve25519_set_basepoint_impl(CURVE25519_BASEPOINT_IMPL_ED25519);
+  tt_int_op(0, OP_EQ, curve25519_basepoint_impl(out_ed, secret));
+  test_memeq_hex(out_ladder, public_hex);
+  test_memeq_hex(out_ed, public_hex);
+
+  for (i = 0; i < 64; ++i) {
+    crypto_rand((char*)secret, sizeof(secret));
+    curve25519_impl(out_ladder, secret, basepoint);
+    tt_int_op(0, OP_EQ, curve25519_basepoint_impl(out_ed, secret));
+    tt_mem_op(out_ed, OP_EQ, out_ladder, 32);
+  }
+
+ done:
+  curve25519_set_basepoint_impl(orig_impl);
+  tor_free(mem_op_hex_tmp);
+}
+
+static void
+test_crypto_calibrate(void *arg)
+{
+  char *impls = NULL, *impls2 = NULL, *platform = NULL, *platform2 = NULL;
+  char d[DIGEST_LEN], d_evp[DIGEST_LEN];
+  char d256[DIGEST256_LEN], d256_evp[DIGEST256_LEN];
+  const char data[] = "Calibrated digests had better not change the answer";
+
+  (void)arg;
+  crypto_calibrate();
+  impls = crypto_get_implementations();
+  tt_assert(!strcmpstart(impls, "aes-ctr="));
+  tt_assert(strstr(impls, " sha1="));
+  tt_assert(strstr(impls, " sha256="));
+  tt_assert(strstr(impls, " curve25519-base="));
+
+  /* What we get, we can set again. */
+  tt_int_op(0, OP_EQ, crypto_set_implementations(impls));
+  impls2 = crypto_get_implementations();
+  tt_str_op(impls, OP_EQ, impls2);
+  tor_free(impls2);
+
+  /* Nonsense is rejected, and changes nothing. */
+  tt_int_op(-1, OP_EQ, crypto_set_implementations("aes-ctr=nope"));
+  tt_int_op(-1, OP_EQ, crypto_set_implementations("sha1=evp bogus=x"));
+  tt_int_op(-1, OP_EQ, crypto_set_implementations("sha1"));
+  impls2 = crypto_get_implementations();
+  tt_str_op(impls, OP_EQ, impls2);
+  tor_free(impls2);
+
+  /* Both digest implementations give the same answer. */
+  tt_int_op(0, OP_EQ,
+            crypto_set_implementations("sha1=direct sha256=direct"));
+  crypto_digest(d, data, strlen(data));
+  crypto_digest256(d256, data, strlen(data), DIGEST_SHA256);
+  tt_int_op(0, OP_EQ, crypto_set_implementations("sha1=evp sha256=evp"));
+  impls2 = crypto_get_implementations();
+  tt_assert(strstr(impls2, " sha1=evp sha256=evp "));
+  crypto_digest(d_evp, data, strlen(data));
+  crypto_digest256(d256_evp, data, strlen(data), DIGEST_SHA256);
+  tt_mem_op(d, OP_EQ, d_evp, DIGEST_LEN);
+  tt_mem_op(d256, OP_EQ, d256_evp, DIGEST256_LEN);
+  tt_int_op(0, OP_EQ, crypto_set_implementations(impls));
+
+  /* The platform key is stable, and looks like what we store. */
+  platform = crypto_calibration_platform();
+  platform2 = crypto_calibration_platform();
+  tt_int_op(strlen(platform), OP_EQ, 40);
+  tt_str_op(platform, OP_EQ, platform2);
+
+ done:
+  tor_free(impls);
+  tor_free(impls2);
+  tor_free(platform);
+  tor_free(platform2);
+}
+
 #define CRYPTO_LEGACY(name)                                            \
   { #name, test_crypto_ ## name , 0, NULL, NULL }
 
@@ -1616,6 +1781,7 @@ struct testcase_t crypto_tests[] = {
     (void*)"aes" },
   { "aes_iv_EVP", test_crypto_aes_iv, TT_FORK, &passthrough_setup,
     (void*)"evp" },
+  { "aes_ctr_impls", test_crypto_aes_ctr_impls, TT_FORK, NULL, NULL },
   CRYPTO_LEGACY(base32_decode),
   { "kdf_TAP", test_crypto_kdf_TAP, 0, NULL, NULL },
   { "hkdf_sha256", test_crypto_hkdf_sha256, 0, NULL, NULL },
@@ -1624,6 +1790,9 @@ struct testcase_t crypto_tests[] = {
   { "curve25519_wrappers", test_crypto_curve25519_wrappers, 0, NULL, NULL },
   { "curve25519_encode", test_crypto_curve25519_encode, 0, NULL, NULL },
   { "curve25519_persist", test_crypto_curve25519_persist, 0, NULL, NULL },
+  { "curve25519_basepoint", test_crypto_curve25519_basepoint, 0, NULL,
+    NULL },
+  { "calibrate", test_crypto_calibrate, TT_FORK, NULL, NULL },
   { "ed25519_simple", test_crypto_ed25519_simple, 0, NULL, NULL },
   { "ed25519_test_vectors", test_crypto_ed25519_test_vectors, 0, NULL, NULL },
   { "ed25519_encode", test_crypto_ed25519_encode, 0, NULL, NULL },
@@ -11,13 +11,17 @@
 #define ROUTER_PRIVATE
 #define ROUTERLIST_PRIVATE
 #define HIBERNATE_PRIVATE
+#define MAIN_PRIVATE
 #define NETWORKSTATUS_PRIVATE
 #include "or.h"
+#include "buffers.h"
 #include "config.h"
+#include "connection.h"
 #include "directory.h"
 #include "dirserv.h"
 #include "dirvote.h"
 #include "hibernate.h"
+#include "main.h"
 #include "networkstatus.h"
 #include "router.h"
 #include "routerlist.h"
@@ -3100,6 +3104,183 @@ test_dir_packages(void *arg)
   tor_free(res);
 }
 
+static void
+test_dir_consensus_race_width(void *arg)
+{
+  or_options_t *options = tor_malloc_zero(sizeof(or_options_t));
+  networkstatus_t *c = tor_malloc_zero(sizeof(networkstatus_t));
+  const time_t now = 1400000000;
+
+  (void)arg;
+  options->BootstrapConsensusFetches = 3;
+
+  /* With no consensus, or an expired one, we race. */
+  tt_int_op(3, OP_EQ, consensus_fetch_race_width(options, NULL, now));
+  c->valid_after = now - 7200;
+  c->valid_until = now - 1;
+  tt_int_op(3, OP_EQ, consensus_fetch_race_width(options, c, now));
+
+  /* With a live consensus, we don't. */
+  c->valid_until = now + 3600;
+  tt_int_op(1, OP_EQ, consensus_fetch_race_width(options, c, now));
+
+  /* Nor do we when we fetch from the authorities anyway. */
+  options->FetchDirInfoEarly = 1;
+  tt_int_op(1, OP_EQ, consensus_fetch_race_width(options, NULL, now));
+  options->FetchDirInfoEarly = 0;
+
+  /* Once losing fetches have wasted too much, we stop. */
+  stats_n_consensus_race_bytes_discarded = 4*1024*1024;
+  tt_int_op(1, OP_EQ, consensus_fetch_race_width(options, NULL, now));
+
+ done:
+  stats_n_consensus_race_bytes_discarded = 0;
+  tor_free(options);
+  tor_free(c);
+}
+
+/** Helper: return a new client directory connection, added to the
+ * connection array, that is fetching <b>resource</b> for <b>purpose</b>.
+ * It was opened at <b>created</b> and has read <b>n_read</b> bytes. */
+static dir_connection_t *
+new_test_fetch_connection(int purpose, const char *resource, time_t created,
+                          size_t n_read)
+{
+  dir_connection_t *conn = dir_connection_new(AF_INET);
+  char *body = tor_malloc_zero(n_read + 1);
+
+  TO_CONN(conn)->s = tor_open_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  tor_assert(SOCKET_OK(TO_CONN(conn)->s));
+  TO_CONN(conn)->purpose = purpose;
+  TO_CONN(conn)->state = DIR_CONN_STATE_CLIENT_READING;
+  TO_CONN(conn)->address = tor_strdup("127.0.0.1");
+  TO_CONN(conn)->port = 9030;
+  TO_CONN(conn)->timestamp_created = created;
+  conn->requested_resource = tor_strdup(resource);
+  write_to_buf(body, n_read, TO_CONN(conn)->inbuf);
+  tor_free(body);
+  tor_assert(connection_add(TO_CONN(conn)) == 0);
+  return conn;
+}
+
+/** Helper: close and free every connection, without treating any of them
+ * as a failed fetch. */
+static void
+close_test_fetch_connections(void)
+{
+  SMARTLIST_FOREACH_BEGIN(get_connection_array(), connection_t *, conn) {
+    conn->state = DIR_CONN_STATE_CLIENT_FINISHED;
+    if (!conn->marked_for_close)
+      connection_mark_for_close(conn);
+  } SMARTLIST_FOREACH_END(conn);
+  close_closeable_connections();
+}
+
+static void
+test_dir_consensus_race_losers(void *arg)
+{
+  tor_libevent_cfg cfg;
+  dir_connection_t *winner, *loser, *other_flavor, *md_fetch;
+  const time_t now = time(NULL);
+  (void)arg;
+
+  memset(&cfg, 0, sizeof(cfg));
+  tor_libevent_initialize(&cfg);
+  init_connection_lists();
+
+  winner = new_test_fetch_connection(DIR_PURPOSE_FETCH_CONSENSUS,
+                                     "microdesc", now, 100);
+  loser = new_test_fetch_connection(DIR_PURPOSE_FETCH_CONSENSUS,
+                                    "microdesc", now, 1000);
+  other_flavor = new_test_fetch_connection(DIR_PURPOSE_FETCH_CONSENSUS,
+                                           "ns", now, 2000);
+  md_fetch = new_test_fetch_connection(DIR_PURPOSE_FETCH_MICRODESC,
+                                       "d/microdesc", now, 4000);
+
+  connection_dir_close_consensus_race_losers(winner);
+
+  /* Only the other fetch of the same flavor is cancelled, and it is moved
+   * to CLIENT_FINISHED so that closing it doesn't count as a failure. */
+  tt_assert(TO_CONN(loser)->marked_for_close);
+  tt_int_op(DIR_CONN_STATE_CLIENT_FINISHED, OP_EQ, TO_CONN(loser)->state);
+  tt_assert(! TO_CONN(winner)->marked_for_close);
+  tt_assert(! TO_CONN(other_flavor)->marked_for_close);
+  tt_int_op(DIR_CONN_STATE_CLIENT_READING, OP_EQ,
+            TO_CONN(other_flavor)->state);
+  tt_assert(! TO_CONN(md_fetch)->marked_for_close);
+
+  /* Its bytes are counted as discarded. */
+  tt_u64_op(1, OP_EQ, stats_n_consensus_race_losers);
+  tt_u64_op(1000, OP_EQ, stats_n_consensus_race_bytes_discarded);
+  tt_u64_op(1000, OP_EQ, bootstrap_fetch_bytes_discarded());
+
+  /* Doing it again finds nothing more to cancel. */
+  connection_dir_close_consensus_race_losers(winner);
+  tt_u64_op(1, OP_EQ, stats_n_consensus_race_losers);
+
+ done:
+  close_test_fetch_connections();
+  stats_n_consensus_race_losers = 0;
+  stats_n_consensus_race_bytes_discarded = 0;
+}
+
+static void
+test_dir_microdesc_stragglers(void *arg)
+{
+  tor_libevent_cfg cfg;
+  dir_connection_t *slow, *fresh, *consensus;
+  const time_t now = time(NULL);
+  (void)arg;
+
+  memset(&cfg, 0, sizeof(cfg));
+  tor_libevent_initialize(&cfg);
+  init_connection_lists();
+
+  slow = new_test_fetch_connection(DIR_PURPOSE_FETCH_MICRODESC,
+                                   "d/slow", now - 20, 500);
+  fresh = new_test_fetch_connection(DIR_PURPOSE_FETCH_MICRODESC,
+                                    "d/fresh", now - 5, 700);
+  consensus = new_test_fetch_connection(DIR_PURPOSE_FETCH_CONSENSUS,
+                                        "microdesc", now - 60, 900);
+
+  /* We only do this when we're racing fetches while bootstrapping. */
+  get_options_mutable()->BootstrapConsensusFetches = 1;
+  tt_int_op(0, OP_EQ, connection_dir_cancel_microdesc_stragglers(now));
+  get_options_mutable()->BootstrapConsensusFetches = 2;
+
+  /* Nor once the bootstrap fetches have wasted too much. */
+  stats_n_consensus_race_bytes_discarded = MAX_BOOTSTRAP_FETCH_OVERHEAD;
+  tt_int_op(0, OP_EQ, connection_dir_cancel_microdesc_stragglers(now));
+  stats_n_consensus_race_bytes_discarded = 0;
+  tt_assert(! TO_CONN(slow)->marked_for_close);
+
+  /* Otherwise, a microdesc fetch that has run too long is cancelled
+   * without counting as a failure, and its bytes count as wasted. */
+  tt_int_op(1, OP_EQ, connection_dir_cancel_microdesc_stragglers(now));
+  tt_assert(TO_CONN(slow)->marked_for_close);
+  tt_int_op(DIR_CONN_STATE_CLIENT_FINISHED, OP_EQ, TO_CONN(slow)->state);
+  tt_assert(! TO_CONN(fresh)->marked_for_close);
+  tt_assert(! TO_CONN(consensus)->marked_for_close);
+  tt_u64_op(1, OP_EQ, stats_n_microdesc_stragglers);
+  tt_u64_op(500, OP_EQ, stats_n_microdesc_straggler_bytes_discarded);
+  tt_u64_op(500, OP_EQ, bootstrap_fetch_bytes_discarded());
+
+  /* Those bytes count against the same cap as consensus races. */
+  stats_n_consensus_race_bytes_discarded = MAX_BOOTSTRAP_FETCH_OVERHEAD - 500;
+  tt_int_op(0, OP_EQ, connection_dir_cancel_microdesc_stragglers(now + 60));
+  tt_assert(! TO_CONN(fresh)->marked_for_close);
+  stats_n_consensus_race_bytes_discarded = 0;
+  tt_int_op(1, OP_EQ, connection_dir_cancel_microdesc_stragglers(now + 60));
+  tt_assert(TO_CONN(fresh)->marked_for_close);
+
+ done:
+  close_test_fetch_connections();
+  get_options_mutable()->BootstrapConsensusFetches = 1;
+  stats_n_consensus_race_bytes_discarded = 0;
+  stats_n_microdesc_stragglers = 0;
+  stats_n_microdesc_straggler_bytes_discarded = 0;
+}
+
 #define DIR_LEGACY(name)                                                   \
   { #name, test_dir_ ## name , TT_FORK, NULL, NULL }
 
@@ -3130,6 +3311,9 @@ struct testcase_t dir_tests[] = {
   DIR(purpose_needs_anonymity, 0),
   DIR(fetch_type, 0),
   DIR(packages, 0),
+  DIR(consensus_race_width, TT_FORK),
+  DIR(consensus_race_losers, TT_FORK),
+  DIR(microdesc_stragglers, TT_FORK),
   END_OF_TESTCASES
 };
 
@@ -0,0 +1,249 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#define CONNECTION_PRIVATE
+#define DNSSERV_PRIVATE
+
+#include "orconfig.h"
+#include "or.h"
+#include "config.h"
+#include "connection.h"
+#include "connection_edge.h"
+#include "dnsserv.h"
+#include "test.h"
+#ifdef HAVE_EVENT2_DNS_H
+#include <event2/dns.h>
+#else
+#include "eventdns.h"
+#endif
+
+static void
+test_dnsserv_query_key(void *arg)
+{
+  listener_connection_t *listener = NULL;
+  tor_addr_t a1, a2;
+  char *k1 = NULL, *k2 = NULL;
+
+  (void)arg;
+  listener = tor_malloc_zero(sizeof(listener_connection_t));
+  listener->entry_cfg.isolation_flags = ISO_DEFAULT;
+  listener->entry_cfg.session_group = -4;
+  tor_addr_parse(&a1, "10.0.0.1");
+  tor_addr_parse(&a2, "10.0.0.2");
+
+  /* Names are case-insensitive. */
+  k1 = dnsserv_query_key(listener, &a1, 1, "www.Example.COM");
+  k2 = dnsserv_query_key(listener, &a1, 1, "www.example.com");
+  tt_str_op(k1, OP_EQ, k2);
+  tor_free(k2);
+
+  /* Different question types never match. */
+  k2 = dnsserv_query_key(listener, &a1, 28, "www.example.com");
+  tt_str_op(k1, OP_NE, k2);
+  tor_free(k2);
+
+  /* With IsolateClientAddr, different clients never match... */
+  k2 = dnsserv_query_key(listener, &a2, 1, "www.example.com");
+  tt_str_op(k1, OP_NE, k2);
+  tor_free(k1);
+  tor_free(k2);
+
+  /* ... but without it, they do. */
+  listener->entry_cfg.isolation_flags &= ~ISO_CLIENTADDR;
+  k1 = dnsserv_query_key(listener, &a1, 1, "www.example.com");
+  k2 = dnsserv_query_key(listener, &a2, 1, "www.example.com");
+  tt_str_op(k1, OP_EQ, k2);
+
+ done:
+  tor_free(k1);
+  tor_free(k2);
+  tor_free(listener);
+}
+
+static void
+test_dnsserv_cache(void *arg)
+{
+  const dnsserv_cached_answer_t *ent;
+  const time_t now = 1400000000;
+  const char ipv4[4] = { 10, 0, 0, 1 };
+  const int old_size = get_options()->DNSPortCacheSize;
+
+  (void)arg;
+  get_options_mutable()->DNSPortCacheSize = 2;
+
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", now));
+
+  /* Errors and answers without a TTL don't get cached. */
+  dnsserv_cache_answer("k1", SOCKS_COMMAND_RESOLVE, "example.com",
+                       RESOLVED_TYPE_ERROR, 0, NULL, 300, now);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", now));
+  dnsserv_cache_answer("k1", SOCKS_COMMAND_RESOLVE, "example.com",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, -1, now);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", now));
+
+  dnsserv_cache_answer("k1", SOCKS_COMMAND_RESOLVE, "example.com",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, 300, now);
+  ent = dnsserv_cache_lookup("k1", now + 10);
+  tt_assert(ent);
+  tt_str_op(ent->address, OP_EQ, "example.com");
+  tt_int_op(ent->answer_type, OP_EQ, RESOLVED_TYPE_IPV4);
+  tt_int_op(ent->answer_len, OP_EQ, 4);
+  tt_mem_op(ent->answer, OP_EQ, ipv4, 4);
+  tt_int_op(ent->expires, OP_EQ, now + 300);
+
+  /* The TTL is respected. */
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", now + 300));
+
+  /* When the cache is full, the answer closest to expiry goes first. */
+  dnsserv_cache_answer("k1", SOCKS_COMMAND_RESOLVE, "example.com",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, 100, now);
+  dnsserv_cache_answer("k2", SOCKS_COMMAND_RESOLVE, "example.net",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, 200, now);
+  dnsserv_cache_answer("k3", SOCKS_COMMAND_RESOLVE, "example.org",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, 300, now);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", now));
+  tt_assert(dnsserv_cache_lookup("k2", now));
+  tt_assert(dnsserv_cache_lookup("k3", now));
+
+  /* Lowering the cache size evicts the answers closest to expiry. */
+  dnsserv_cache_trim(1);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k2", now));
+  tt_assert(dnsserv_cache_lookup("k3", now));
+  dnsserv_cache_trim(0);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k3", now));
+
+  /* A cache size of 0 disables caching. */
+  get_options_mutable()->DNSPortCacheSize = 0;
+  dnsserv_cache_answer("k4", SOCKS_COMMAND_RESOLVE, "example.edu",
+                       RESOLVED_TYPE_IPV4, 4, ipv4, 300, now);
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k4", now));
+
+ done:
+  get_options_mutable()->DNSPortCacheSize = old_size;
+  dnsserv_free_all();
+}
+
+static void
+test_dnsserv_cache_flags(void *arg)
+{
+  entry_port_cfg_t cfg;
+
+  (void)arg;
+  tt_int_op(AF_INET, OP_EQ,
+            dnsserv_question_family(EVDNS_TYPE_A, "example.com"));
+  tt_int_op(AF_INET6, OP_EQ,
+            dnsserv_question_family(EVDNS_TYPE_AAAA, "example.com"));
+  tt_int_op(AF_INET, OP_EQ,
+            dnsserv_question_family(EVDNS_TYPE_PTR,
+                                    "1.0.0.10.in-addr.arpa"));
+  tt_int_op(AF_INET6, OP_EQ,
+            dnsserv_question_family(EVDNS_TYPE_PTR,
+                              "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0."
+                              "0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.ip6.arpa"));
+  tt_int_op(AF_UNSPEC, OP_EQ,
+            dnsserv_question_family(EVDNS_TYPE_PTR, "example.com"));
+
+  /* The port's cache flags decide, one address family at a time. */
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.cache_ipv4_answers = 1;
+  cfg.use_cached_ipv6_answers = 1;
+  tt_assert(dnsserv_may_cache_answer(&cfg, AF_INET));
+  tt_assert(!dnsserv_may_cache_answer(&cfg, AF_INET6));
+  tt_assert(!dnsserv_may_use_cached_answer(&cfg, AF_INET));
+  tt_assert(dnsserv_may_use_cached_answer(&cfg, AF_INET6));
+  tt_assert(!dnsserv_may_cache_answer(&cfg, AF_UNSPEC));
+  tt_assert(!dnsserv_may_use_cached_answer(&cfg, AF_UNSPEC));
+
+ done:
+  ;
+}
+
+/** Requests that mock_dnsserv_answer_request has answered, in order. */
+static smartlist_t *answered_requests = NULL;
+
+static void
+mock_dnsserv_answer_request(struct evdns_server_request *req,
+                            uint8_t command, const char *address,
+                            int answer_type, size_t answer_len,
+                            const char *answer, int ttl)
+{
+  (void)command;
+  (void)address;
+  (void)answer_type;
+  (void)answer_len;
+  (void)answer;
+  (void)ttl;
+  smartlist_add(answered_requests, req);
+}
+
+static void
+test_dnsserv_coalesce(void *arg)
+{
+  /* We never look inside the requests, so any distinct pointers will do. */
+  struct evdns_server_request *r1 = (void*)"r1", *r2 = (void*)"r2",
+    *r3 = (void*)"r3", *r4 = (void*)"r4";
+  entry_connection_t *conn = NULL;
+  const char ipv4[4] = { 10, 0, 0, 1 };
+  const int old_size = get_options()->DNSPortCacheSize;
+
+  (void)arg;
+  MOCK(dnsserv_answer_request, mock_dnsserv_answer_request);
+  answered_requests = smartlist_new();
+  get_options_mutable()->DNSPortCacheSize = 16;
+
+  /* The first request for a key launches a resolve; identical ones wait for
+   * it, and other keys are independent. */
+  tt_int_op(0, OP_EQ, dnsserv_pending_add("k1", r1));
+  tt_int_op(1, OP_EQ, dnsserv_pending_add("k1", r2));
+  tt_int_op(1, OP_EQ, dnsserv_pending_add("k1", r3));
+  tt_int_op(0, OP_EQ, dnsserv_pending_add("k2", r4));
+
+  /* When the answer arrives, every request waiting on it gets it. */
+  conn = entry_connection_new(CONN_TYPE_AP, AF_INET);
+  conn->socks_request->command = SOCKS_COMMAND_RESOLVE;
+  strlcpy(conn->socks_request->address, "example.com",
+          sizeof(conn->socks_request->address));
+  conn->dns_server_request = r1;
+  conn->dns_server_key = tor_strdup("k1");
+  dnsserv_resolved(conn, RESOLVED_TYPE_IPV4, 4, ipv4, 300);
+  tt_int_op(3, OP_EQ, smartlist_len(answered_requests));
+  tt_ptr_op(r1, OP_EQ, smartlist_get(answered_requests, 0));
+  tt_ptr_op(r2, OP_EQ, smartlist_get(answered_requests, 1));
+  tt_ptr_op(r3, OP_EQ, smartlist_get(answered_requests, 2));
+  tt_ptr_op(NULL, OP_EQ, conn->dns_server_request);
+  tt_ptr_op(NULL, OP_EQ, conn->dns_server_key);
+
+  /* The port didn't let us cache the answer, and the key is no longer in
+   * flight. */
+  tt_ptr_op(NULL, OP_EQ, dnsserv_cache_lookup("k1", approx_time()));
+  tt_int_op(0, OP_EQ, dnsserv_pending_add("k1", r1));
+
+  /* If the port lets us, the answer goes in the cache too. */
+  smartlist_clear(answered_requests);
+  tt_int_op(1, OP_EQ, dnsserv_pending_add("k2", r1));
+  conn->dns_server_request = r4;
+  conn->dns_server_key = tor_strdup("k2");
+  conn->dns_server_may_cache = 1;
+  dnsserv_resolved(conn, RESOLVED_TYPE_IPV4, 4, ipv4, 300);
+  tt_int_op(2, OP_EQ, smartlist_len(answered_requests));
+  tt_assert(dnsserv_cache_lookup("k2", approx_time()));
+  tt_int_op(0, OP_EQ, dnsserv_pending_add("k2", r1));
+
+ done:
+  UNMOCK(dnsserv_answer_request);
+  get_options_mutable()->DNSPortCacheSize = old_size;
+  smartlist_free(answered_requests);
+  answered_requests = NULL;
+  if (conn)
+    connection_free_(ENTRY_TO_CONN(conn));
+  dnsserv_free_all();
+}
+
+struct testcase_t dnsserv_tests[] = {
+  { "query_key", test_dnsserv_query_key, TT_FORK, NULL, NULL },
+  { "cache", test_dnsserv_cache, TT_FORK, NULL, NULL },
+  { "cache_flags", test_dnsserv_cache_flags, 0, NULL, NULL },
+  { "coalesce", test_dnsserv_coalesce, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
+
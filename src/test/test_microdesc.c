@@ -396,6 +396,66 @@ test_md_generate(void *arg)
   routerinfo_free(ri);
 }
 
+static void
+free_vote_microdesc_hashes(vote_microdesc_hash_t *h)
+{
+  while (h) {
+    vote_microdesc_hash_t *next = h->next;
+    tor_free(h->microdesc_hash_line);
+    tor_free(h);
+    h = next;
+  }
+}
+
+static void
+test_md_generate_cached(void *arg)
+{
+  routerinfo_t *ri;
+  smartlist_t *mds = smartlist_new(), *added;
+  vote_microdesc_hash_t *h1 = NULL, *h2 = NULL, *a, *b;
+  int n;
+  (void)arg;
+
+  ri = router_parse_entry_from_string(test_ri, NULL, 0, 0, NULL, NULL);
+  tt_assert(ri);
+
+  h1 = dirvote_format_all_microdesc_vote_lines(ri, 1000, mds);
+  tt_assert(h1);
+  n = smartlist_len(mds);
+  tt_int_op(n, OP_GT, 0);
+  /* Put them in the microdescriptor cache, as a vote would. */
+  added = microdescs_add_list_to_cache(get_microdesc_cache(), mds,
+                                       SAVED_NOWHERE, 0);
+  smartlist_free(added);
+  smartlist_clear(mds);
+
+  /* The second time, we reuse what we made: nothing new to cache, and the
+   * same lines. */
+  h2 = dirvote_format_all_microdesc_vote_lines(ri, 2000, mds);
+  tt_int_op(smartlist_len(mds), OP_EQ, 0);
+  for (a = h1, b = h2; a && b; a = a->next, b = b->next)
+    tt_str_op(a->microdesc_hash_line, OP_EQ, b->microdesc_hash_line);
+  tt_ptr_op(a, OP_EQ, NULL);
+  tt_ptr_op(b, OP_EQ, NULL);
+  free_vote_microdesc_hashes(h2);
+  h2 = NULL;
+
+  /* After a vote that didn't include this descriptor, we forget it, and
+   * make its microdescriptors again next time. */
+  dirvote_expire_generated_microdescs();
+  dirvote_expire_generated_microdescs();
+  h2 = dirvote_format_all_microdesc_vote_lines(ri, 3000, mds);
+  tt_int_op(smartlist_len(mds), OP_EQ, n);
+
+ done:
+  free_vote_microdesc_hashes(h1);
+  free_vote_microdesc_hashes(h2);
+  SMARTLIST_FOREACH(mds, microdesc_t *, md, microdesc_free(md));
+  smartlist_free(mds);
+  routerinfo_free(ri);
+  dirvote_free_all();
+}
+
 /* Taken at random from my ~/.tor/cached-microdescs file and then
  * hand-munged */
 static const char MD_PARSE_TEST_DATA[] =
@@ -717,6 +777,7 @@ struct testcase_t microdesc_tests[] = {
   { "cache", test_md_cache, TT_FORK, NULL, NULL },
   { "broken_cache", test_md_cache_broken, TT_FORK, NULL, NULL },
   { "generate", test_md_generate, 0, NULL, NULL },
+  { "generate_cached", test_md_generate_cached, TT_FORK, NULL, NULL },
   { "parse", test_md_parse, 0, NULL, NULL },
   { "reject_cache", test_md_reject_cache, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
@@ -7,6 +7,7 @@
  **/
 
 #include "or.h"
+#include "networkstatus.h"
 #include "nodelist.h"
 #include "test.h"
 
@@ -60,12 +61,198 @@ test_nodelist_node_get_verbose_nickname_not_named(void *arg)
   return;
 }
 
+/** Helper: add a routerstatus for a router whose identity digest is all
+ * <b>id_byte</b> to the consensus <b>ns</b>, and return it. */
+static routerstatus_t *
+add_test_routerstatus(networkstatus_t *ns, char id_byte, uint32_t addr,
+                      int is_fast)
+{
+  routerstatus_t *rs = tor_malloc_zero(sizeof(routerstatus_t));
+  memset(rs->identity_digest, id_byte, DIGEST_LEN);
+  memset(rs->descriptor_digest, id_byte, DIGEST256_LEN);
+  strlcpy(rs->nickname, "TestOR", sizeof(rs->nickname));
+  rs->addr = addr;
+  rs->or_port = 9001;
+  rs->is_valid = rs->is_flagged_running = 1;
+  rs->is_fast = is_fast;
+  smartlist_add(ns->routerstatus_list, rs);
+  return rs;
+}
+
+/** Helper: return a new, empty ns-flavored consensus. */
+static networkstatus_t *
+new_test_consensus(void)
+{
+  networkstatus_t *ns = tor_malloc_zero(sizeof(networkstatus_t));
+  ns->type = NS_TYPE_CONSENSUS;
+  ns->flavor = FLAV_NS;
+  ns->routerstatus_list = smartlist_new();
+  return ns;
+}
+
+/** The consensus that mock_networkstatus_get_latest_consensus() returns. */
+static networkstatus_t *mock_latest_consensus = NULL;
+
+static networkstatus_t *
+mock_networkstatus_get_latest_consensus(void)
+{
+  return mock_latest_consensus;
+}
+
+/** Switching the nodelist from one consensus to the next should give the
+ * same nodes as building it from scratch, and should leave nodes for
+ * routers that stayed listed in place. */
+static void
+test_nodelist_switch_consensus(void *arg)
+{
+  networkstatus_t *ns1 = new_test_consensus(), *ns2 = new_test_consensus();
+  routerstatus_t *rs_b, *rs_c, *rs_d;
+  const node_t *node_b, *node_c;
+  char id[DIGEST_LEN];
+  (void) arg;
+
+  /* Routers 0x10 and 0x20 leave; 0x30 changes; 0x40 stays; 0x50 joins. */
+  add_test_routerstatus(ns1, 0x10, 0x01020304, 1);
+  add_test_routerstatus(ns1, 0x20, 0x01020305, 1);
+  add_test_routerstatus(ns1, 0x30, 0x01020306, 0);
+  add_test_routerstatus(ns1, 0x40, 0x01020307, 1);
+  rs_b = add_test_routerstatus(ns2, 0x30, 0x0a000001, 1);
+  rs_c = add_test_routerstatus(ns2, 0x40, 0x01020307, 1);
+  rs_d = add_test_routerstatus(ns2, 0x50, 0x01020308, 0);
+
+  MOCK(networkstatus_get_latest_consensus,
+       mock_networkstatus_get_latest_consensus);
+  mock_latest_consensus = ns1;
+  nodelist_set_consensus(ns1);
+  memset(id, 0x30, DIGEST_LEN);
+  node_b = node_get_by_id(id);
+  tt_assert(node_b);
+  tt_assert(! node_b->is_fast);
+  memset(id, 0x40, DIGEST_LEN);
+  node_c = node_get_by_id(id);
+  tt_assert(node_c);
+
+  mock_latest_consensus = ns2;
+  nodelist_switch_consensus(ns1, ns2);
+  networkstatus_vote_free(ns1);
+  ns1 = NULL;
+  nodelist_assert_ok();
+
+  memset(id, 0x10, DIGEST_LEN);
+  tt_assert(! node_get_by_id(id));
+  memset(id, 0x20, DIGEST_LEN);
+  tt_assert(! node_get_by_id(id));
+  memset(id, 0x30, DIGEST_LEN);
+  tt_ptr_op(node_get_by_id(id), ==, node_b);
+  tt_ptr_op(node_b->rs, ==, rs_b);
+  tt_assert(node_b->is_fast);
+  memset(id, 0x40, DIGEST_LEN);
+  tt_ptr_op(node_get_by_id(id), ==, node_c);
+  tt_ptr_op(node_c->rs, ==, rs_c);
+  memset(id, 0x50, DIGEST_LEN);
+  tt_assert(node_get_by_id(id));
+  tt_ptr_op(node_get_by_id(id)->rs, ==, rs_d);
+  tt_int_op(smartlist_len(nodelist_get_list()), ==, 3);
+
+  /* If we don't say which consensus we're switching from, we rebuild. */
+  nodelist_switch_consensus(NULL, ns2);
+  nodelist_assert_ok();
+  tt_int_op(smartlist_len(nodelist_get_list()), ==, 3);
+  memset(id, 0x30, DIGEST_LEN);
+  tt_ptr_op(node_get_by_id(id)->rs, ==, rs_b);
+
+ done:
+  UNMOCK(networkstatus_get_latest_consensus);
+  nodelist_free_all();
+  networkstatus_vote_free(ns1);
+  networkstatus_vote_free(ns2);
+}
+
+/** If the consensus we're told we're switching from isn't the one the
+ * nodelist was built from, or the nodelist has been told to forget it, we
+ * must rebuild from scratch rather than trust the old routerstatus list. */
+static void
+test_nodelist_switch_consensus_mismatch(void *arg)
+{
+  networkstatus_t *ns1 = new_test_consensus(), *ns2 = new_test_consensus();
+  networkstatus_t *other = new_test_consensus(), *ns3 = NULL;
+  routerstatus_t *rs_a, *rs_b;
+  node_t *node;
+  char id[DIGEST_LEN];
+  (void) arg;
+
+  add_test_routerstatus(ns1, 0x10, 0x01020304, 1);
+  add_test_routerstatus(ns1, 0x20, 0x01020305, 1);
+  /* "other" is a consensus that the nodelist never saw.  Walking from it
+   * would miss 0x20, which would keep pointing into ns1. */
+  add_test_routerstatus(other, 0x10, 0x01020304, 1);
+  rs_a = add_test_routerstatus(ns2, 0x10, 0x01020304, 1);
+  rs_b = add_test_routerstatus(ns2, 0x30, 0x01020306, 1);
+
+  MOCK(networkstatus_get_latest_consensus,
+       mock_networkstatus_get_latest_consensus);
+  mock_latest_consensus = ns1;
+  nodelist_set_consensus(ns1);
+  tt_int_op(smartlist_len(nodelist_get_list()), ==, 2);
+
+  mock_latest_consensus = ns2;
+  nodelist_switch_consensus(other, ns2);
+  networkstatus_vote_free(ns1);
+  ns1 = NULL;
+  nodelist_assert_ok();
+
+  memset(id, 0x20, DIGEST_LEN);
+  tt_assert(! node_get_by_id(id));
+  memset(id, 0x10, DIGEST_LEN);
+  tt_ptr_op(node_get_by_id(id)->rs, ==, rs_a);
+  memset(id, 0x30, DIGEST_LEN);
+  tt_ptr_op(node_get_by_id(id)->rs, ==, rs_b);
+  tt_int_op(smartlist_len(nodelist_get_list()), ==, 2);
+
+  /* An unchanged router keeps what we derived from its address when we
+   * switch incrementally... */
+  ns3 = new_test_consensus();
+  add_test_routerstatus(ns3, 0x10, 0x01020304, 1);
+  rs_b = add_test_routerstatus(ns3, 0x30, 0x01020306, 1);
+  memset(id, 0x30, DIGEST_LEN);
+  node = node_get_mutable_by_id(id);
+  node->country = 42;
+  mock_latest_consensus = ns3;
+  nodelist_switch_consensus(ns2, ns3);
+  tt_ptr_op(node_get_by_id(id), ==, node);
+  tt_ptr_op(node->rs, ==, rs_b);
+  tt_int_op(node->country, ==, 42);
+
+  /* ...but once the nodelist has forgotten the old consensus, as it does
+   * when that consensus is freed, everything gets rebuilt. */
+  networkstatus_vote_free(ns2);
+  ns2 = new_test_consensus();
+  add_test_routerstatus(ns2, 0x10, 0x01020304, 1);
+  rs_b = add_test_routerstatus(ns2, 0x30, 0x01020306, 1);
+  nodelist_forget_consensus(ns3);
+  mock_latest_consensus = ns2;
+  nodelist_switch_consensus(ns3, ns2);
+  nodelist_assert_ok();
+  tt_ptr_op(node_get_by_id(id)->rs, ==, rs_b);
+  tt_int_op(node_get_by_id(id)->country, !=, 42);
+
+ done:
+  UNMOCK(networkstatus_get_latest_consensus);
+  nodelist_free_all();
+  networkstatus_vote_free(ns1);
+  networkstatus_vote_free(ns2);
+  networkstatus_vote_free(ns3);
+  networkstatus_vote_free(other);
+}
+
 #define NODE(name, flags) \
   { #name, test_nodelist_##name, (flags), NULL, NULL }
 
 struct testcase_t nodelist_tests[] = {
   NODE(node_get_verbose_nickname_by_id_null_node, TT_FORK),
   NODE(node_get_verbose_nickname_not_named, TT_FORK),
+  NODE(switch_consensus, TT_FORK),
+  NODE(switch_consensus_mismatch, TT_FORK),
   END_OF_TESTCASES
 };
 
@@ -438,10 +438,47 @@ test_dump_exit_policy_to_string(void *arg)
  tor_free(ep);
 }
 
+/** Run unit tests for sharing parsed short policies. */
+static void
+test_policies_short_shared(void *arg)
+{
+  short_policy_t *p1 = NULL, *p2 = NULL, *p3 = NULL;
+  char *out = NULL;
+
+  (void)arg;
+  p1 = parse_short_policy("accept 22,80,443");
+  p2 = parse_short_policy("accept 22,80,443");
+  p3 = parse_short_policy("reject 25");
+  tt_assert(p1);
+  tt_ptr_op(p1, OP_EQ, p2);
+  tt_ptr_op(p1, OP_NE, p3);
+  tt_int_op(p1->refcnt, OP_EQ, 2);
+
+  /* Freeing one reference leaves the other intact. */
+  short_policy_free(p2);
+  p2 = NULL;
+  out = write_short_policy(p1);
+  tt_str_op(out, OP_EQ, "accept 22,80,443");
+
+  /* Once all references are gone, parsing makes a new one. */
+  short_policy_free(p1);
+  p1 = parse_short_policy("accept 22,80,443");
+  tt_int_op(p1->refcnt, OP_EQ, 1);
+
+  tt_ptr_op(NULL, OP_EQ, parse_short_policy("accept fred"));
+
+ done:
+  tor_free(out);
+  short_policy_free(p1);
+  short_policy_free(p2);
+  short_policy_free(p3);
+}
+
 struct testcase_t policy_tests[] = {
   { "router_dump_exit_policy_to_string", test_dump_exit_policy_to_string, 0,
     NULL, NULL },
   { "general", test_policies_general, 0, NULL, NULL },
+  { "short_shared", test_policies_short_shared, 0, NULL, NULL },
   END_OF_TESTCASES
 };
 
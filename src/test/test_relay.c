@@ -4,6 +4,7 @@
 #include "or.h"
 #define CIRCUITBUILD_PRIVATE
 #include "circuitbuild.h"
+#include "config.h"
 #define RELAY_PRIVATE
 #include "relay.h"
 /* For init/free stuff */
@@ -126,9 +127,117 @@ test_relay_append_cell_to_circuit_queue(void *arg)
   return;
 }
 
+static void
+test_relay_stream_activity_order(void *arg)
+{
+  edge_connection_t *s1 = NULL, *s2 = NULL, *s3 = NULL;
+  smartlist_t *streams = smartlist_new();
+  const time_t now = 1400000000;
+  int i;
+
+  (void)arg;
+  s1 = tor_malloc_zero(sizeof(edge_connection_t));
+  s2 = tor_malloc_zero(sizeof(edge_connection_t));
+  s3 = tor_malloc_zero(sizeof(edge_connection_t));
+  s1->next_stream = s2;
+  s2->next_stream = s3;
+  s1->package_window = s2->package_window = s3->package_window = 500;
+
+  /* Activity decays by half every second, and goes away entirely. */
+  for (i = 0; i < 100; ++i)
+    edge_stream_note_cell_packaged(s1, now);
+  tt_int_op(edge_stream_get_recent_cells(s1, now), OP_EQ, 100);
+  tt_int_op(edge_stream_get_recent_cells(s1, now+1), OP_EQ, 50);
+  tt_int_op(edge_stream_get_recent_cells(s1, now+3), OP_EQ, 12);
+  tt_int_op(edge_stream_get_recent_cells(s1, now+100), OP_EQ, 0);
+
+  /* With no activity, the list order is kept, starting at 'start'. */
+  circuit_get_streams_by_activity(s1, s2, NULL, now, streams);
+  tt_int_op(smartlist_len(streams), OP_EQ, 3);
+  tt_ptr_op(smartlist_get(streams, 0), OP_EQ, s2);
+  tt_ptr_op(smartlist_get(streams, 1), OP_EQ, s3);
+  tt_ptr_op(smartlist_get(streams, 2), OP_EQ, s1);
+  smartlist_clear(streams);
+
+  /* A bulk stream goes to the back; a quiet one goes to the front. */
+  for (i = 0; i < 400; ++i)
+    edge_stream_note_cell_packaged(s2, now);
+  for (i = 0; i < 20; ++i)
+    edge_stream_note_cell_packaged(s1, now);
+  edge_stream_note_cell_packaged(s3, now);
+  circuit_get_streams_by_activity(s1, s2, NULL, now, streams);
+  tt_int_op(smartlist_len(streams), OP_EQ, 3);
+  tt_ptr_op(smartlist_get(streams, 0), OP_EQ, s3);
+  tt_ptr_op(smartlist_get(streams, 1), OP_EQ, s1);
+  tt_ptr_op(smartlist_get(streams, 2), OP_EQ, s2);
+  smartlist_clear(streams);
+
+  /* Streams that can't package are left out. */
+  s3->package_window = 0;
+  s1->base_.marked_for_close = 1;
+  circuit_get_streams_by_activity(s1, NULL, NULL, now, streams);
+  tt_int_op(smartlist_len(streams), OP_EQ, 1);
+  tt_ptr_op(smartlist_get(streams, 0), OP_EQ, s2);
+
+ done:
+  smartlist_free(streams);
+  tor_free(s1);
+  tor_free(s2);
+  tor_free(s3);
+}
+
+static void
+test_relay_stream_coalesce(void *arg)
+{
+  edge_connection_t *conn = NULL;
+  struct timeval now, later;
+  const int old_delay = get_options()->StreamCoalesceDelay;
+
+  (void)arg;
+  conn = tor_malloc_zero(sizeof(edge_connection_t));
+  now.tv_sec = 1400000000;
+  now.tv_usec = 999000;
+
+  /* Disabled by default. */
+  get_options_mutable()->StreamCoalesceDelay = 0;
+  tt_int_op(0, OP_EQ, edge_stream_should_coalesce(conn, 10, &now));
+  tt_int_op(0, OP_EQ, conn->coalesce_pending);
+
+  /* A partial cell waits until its deadline... */
+  get_options_mutable()->StreamCoalesceDelay = 5000;
+  tt_int_op(1, OP_EQ, edge_stream_should_coalesce(conn, 10, &now));
+  tt_int_op(1, OP_EQ, conn->coalesce_pending);
+  tt_int_op(conn->coalesce_deadline.tv_sec, OP_EQ, 1400000001);
+  tt_int_op(conn->coalesce_deadline.tv_usec, OP_EQ, 4000);
+  later.tv_sec = 1400000001;
+  later.tv_usec = 3999;
+  tt_int_op(1, OP_EQ, edge_stream_should_coalesce(conn, 100, &later));
+  later.tv_usec = 4000;
+  tt_int_op(0, OP_EQ, edge_stream_should_coalesce(conn, 100, &later));
+  edge_stream_coalesce_cancel(conn);
+  tt_int_op(0, OP_EQ, conn->coalesce_pending);
+
+  /* ... but full cells and data at EOF go at once. */
+  tt_int_op(0, OP_EQ,
+            edge_stream_should_coalesce(conn, RELAY_PAYLOAD_SIZE, &now));
+  conn->base_.inbuf_reached_eof = 1;
+  tt_int_op(0, OP_EQ, edge_stream_should_coalesce(conn, 10, &now));
+  tt_int_op(0, OP_EQ, conn->coalesce_pending);
+
+ done:
+  get_options_mutable()->StreamCoalesceDelay = old_delay;
+  if (conn)
+    edge_stream_coalesce_cancel(conn);
+  relay_coalesce_free_all();
+  tor_free(conn);
+}
+
 struct testcase_t relay_tests[] = {
   { "append_cell_to_circuit_queue", test_relay_append_cell_to_circuit_queue,
     TT_FORK, NULL, NULL },
+  { "stream_activity_order", test_relay_stream_activity_order, 0,
+    NULL, NULL },
+  { "stream_coalesce", test_relay_stream_coalesce, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
 
@@ -0,0 +1,190 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#include "orconfig.h"
+#include "or.h"
+#include "circuitmux_ewma.h"
+#include "test.h"
+#include "simnet.h"
+
+/** A link fast enough that each cell spends a microsecond on the wire. */
+#define FAST_LINK_BW 514000000
+/** One-way latency of every link in these tests, in microseconds. */
+#define LINK_LATENCY 10000
+
+static smartlist_t *callback_log = NULL;
+
+static void
+record_callback(simnet_t *sim, void *arg)
+{
+  smartlist_add_asprintf(callback_log, "%s@"U64_FORMAT":%ld",
+                         (const char *)arg, U64_PRINTF_ARG(simnet_now(sim)),
+                         (long)approx_time());
+}
+
+static void
+test_simnet_clock(void *arg)
+{
+  simnet_t *sim = NULL;
+  char *s = NULL;
+
+  (void)arg;
+  callback_log = smartlist_new();
+  sim = simnet_new();
+
+  simnet_schedule(sim, 3000000, record_callback, (void*)"c");
+  simnet_schedule(sim, 10, record_callback, (void*)"a");
+  simnet_schedule(sim, 10, record_callback, (void*)"b");
+
+  /* Events run in time order; ties run in the order they were added. */
+  tt_u64_op(simnet_run(sim, 2000000), OP_EQ, 2000000);
+  s = smartlist_join_strings(callback_log, " ", 0, NULL);
+  tt_str_op(s, OP_EQ, "a@10:1400000000 b@10:1400000000");
+  tor_free(s);
+
+  /* The clock follows the events, and so does approx_time(). */
+  tt_u64_op(simnet_run(sim, UINT64_MAX), OP_EQ, 3000000);
+  s = smartlist_join_strings(callback_log, " ", 0, NULL);
+  tt_str_op(s, OP_EQ,
+            "a@10:1400000000 b@10:1400000000 c@3000000:1400000003");
+
+ done:
+  tor_free(s);
+  simnet_free(sim);
+  SMARTLIST_FOREACH(callback_log, char *, cp, tor_free(cp));
+  smartlist_free(callback_log);
+}
+
+static void
+test_simnet_circuit_build(void *arg)
+{
+  simnet_t *sim = NULL;
+  const simnet_circ_stats_t *st;
+  int client, path[3], i;
+
+  (void)arg;
+  sim = simnet_new();
+  client = simnet_add_node(sim, SIMNET_CLIENT, 0);
+  for (i = 0; i < 3; ++i)
+    path[i] = simnet_add_node(sim, SIMNET_RELAY, 500);
+  simnet_connect(sim, client, path[0], LINK_LATENCY, FAST_LINK_BW);
+  simnet_connect(sim, path[0], path[1], LINK_LATENCY, FAST_LINK_BW);
+  simnet_connect(sim, path[1], path[2], LINK_LATENCY, FAST_LINK_BW);
+
+  tt_int_op(0, OP_EQ, simnet_launch_circuit(sim, 1000, client, path, 3, 0));
+  simnet_run(sim, UINT64_MAX);
+
+  st = simnet_get_circuit_stats(sim, 0);
+  tt_assert(st->built);
+  tt_u64_op(st->launched_at, OP_EQ, 1000);
+  /* Extending telescopes: the first hop takes one round trip, the second
+   * two, and the third three.  Each one-way crossing of a link costs its
+   * latency plus a microsecond on the wire, and each hop costs 500
+   * microseconds of handshake. */
+  tt_u64_op(st->built_at - st->launched_at, OP_EQ,
+            12 * (LINK_LATENCY + 1) + 3 * 500);
+  tt_assert(st->transfer_done);
+
+ done:
+  simnet_free(sim);
+}
+
+/** Fetch <b>n_bytes</b> over a three-hop circuit whose middle link carries
+ * a megabyte per second, and store what happened in *<b>out</b>. */
+static void
+run_bottleneck_fetch(uint32_t n_bytes, simnet_circ_stats_t *out)
+{
+  simnet_t *sim = simnet_new();
+  int client, path[3], i;
+
+  client = simnet_add_node(sim, SIMNET_CLIENT, 0);
+  for (i = 0; i < 3; ++i)
+    path[i] = simnet_add_node(sim, SIMNET_RELAY, 0);
+  simnet_connect(sim, client, path[0], LINK_LATENCY, 10000000);
+  simnet_connect(sim, path[0], path[1], LINK_LATENCY, 1000000);
+  simnet_connect(sim, path[1], path[2], LINK_LATENCY, 10000000);
+
+  simnet_launch_circuit(sim, 0, client, path, 3, n_bytes);
+  simnet_run(sim, UINT64_MAX);
+  memcpy(out, simnet_get_circuit_stats(sim, 0), sizeof(*out));
+  simnet_free(sim);
+}
+
+static void
+test_simnet_throughput(void *arg)
+{
+  simnet_circ_stats_t st1, st2;
+  const uint32_t n_bytes = 512000;
+  const uint64_t n_cells = CEIL_DIV(n_bytes, RELAY_PAYLOAD_SIZE);
+  uint64_t elapsed, wire_time;
+
+  (void)arg;
+  run_bottleneck_fetch(n_bytes, &st1);
+  tt_assert(st1.transfer_done);
+  tt_int_op(st1.bytes_received, OP_EQ, n_bytes);
+
+  /* The transfer can't beat the bottleneck, and with a window far bigger
+   * than the path's bandwidth-delay product, it shouldn't lose much to
+   * it either. */
+  elapsed = st1.transfer_done_at - st1.built_at;
+  wire_time = n_cells * get_cell_network_size(1);
+  tt_u64_op(elapsed, OP_GE, wire_time);
+  tt_u64_op(elapsed, OP_LE, wire_time + 10 * LINK_LATENCY);
+
+  /* Same scenario, same timings. */
+  run_bottleneck_fetch(n_bytes, &st2);
+  tt_mem_op(&st1, OP_EQ, &st2, sizeof(st1));
+
+ done:
+  ;
+}
+
+static void
+test_simnet_many_circuits(void *arg)
+{
+  simnet_t *sim = NULL;
+  const int n_clients = 4, n_circs = 10;
+  const uint32_t n_bytes = 50000;
+  int relays[3], i, j;
+  uint64_t last_done = 0;
+
+  (void)arg;
+  sim = simnet_new();
+  simnet_set_cmux_policy(sim, &ewma_policy);
+  for (i = 0; i < 3; ++i)
+    relays[i] = simnet_add_node(sim, SIMNET_RELAY, 1000);
+  simnet_connect(sim, relays[0], relays[1], LINK_LATENCY, 1000000);
+  simnet_connect(sim, relays[1], relays[2], LINK_LATENCY, 10000000);
+  for (i = 0; i < n_clients; ++i) {
+    int client = simnet_add_node(sim, SIMNET_CLIENT, 0);
+    simnet_connect(sim, client, relays[0], LINK_LATENCY, 10000000);
+    for (j = 0; j < n_circs; ++j)
+      simnet_launch_circuit(sim, j * 1000, client, relays, 3, n_bytes);
+  }
+
+  simnet_run(sim, UINT64_MAX);
+
+  tt_int_op(simnet_n_circuits(sim), OP_EQ, n_clients * n_circs);
+  for (i = 0; i < simnet_n_circuits(sim); ++i) {
+    const simnet_circ_stats_t *st = simnet_get_circuit_stats(sim, i);
+    tt_assert(st->transfer_done);
+    tt_int_op(st->bytes_received, OP_EQ, n_bytes);
+    last_done = MAX(last_done, st->transfer_done_at);
+  }
+  /* Everything had to squeeze through the slow link. */
+  tt_u64_op(last_done, OP_GE,
+            n_clients * n_circs *
+            CEIL_DIV(n_bytes, RELAY_PAYLOAD_SIZE) * get_cell_network_size(1));
+
+ done:
+  simnet_free(sim);
+}
+
+struct testcase_t simnet_tests[] = {
+  { "clock", test_simnet_clock, TT_FORK, NULL, NULL },
+  { "circuit_build", test_simnet_circuit_build, TT_FORK, NULL, NULL },
+  { "throughput", test_simnet_throughput, TT_FORK, NULL, NULL },
+  { "many_circuits", test_simnet_many_circuits, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
+
@@ -4,8 +4,11 @@
 /* See LICENSE for licensing information */
 
 #include "orconfig.h"
+#define CPUWORKER_PRIVATE
 #include "or.h"
 #include "compat_threads.h"
+#include "cpuworker.h"
+#include "workqueue.h"
 #include "test.h"
 
 /** mutex for thread test to stop the threads hitting data at the same time. */
@@ -302,11 +305,224 @@ test_threads_conditionvar(void *arg)
   cv_testinfo_free(ti);
 }
 
+static void
+test_threads_cpuset(void *arg)
+{
+  tor_cpuset_t set;
+  char *s = NULL;
+  (void)arg;
+
+  tt_int_op(0, ==, tor_cpuset_parse(&set, ""));
+  tt_int_op(0, ==, tor_cpuset_count(&set));
+  tt_int_op(-1, ==, tor_cpuset_nth(&set, 0));
+  s = tor_cpuset_format(&set);
+  tt_str_op(s, ==, "");
+  tor_free(s);
+
+  tt_int_op(0, ==, tor_cpuset_parse(&set, "8, 0-3,2 ,10-11"));
+  tt_int_op(7, ==, tor_cpuset_count(&set));
+  tt_assert(tor_cpuset_contains(&set, 3));
+  tt_assert(!tor_cpuset_contains(&set, 4));
+  tt_int_op(8, ==, tor_cpuset_nth(&set, 4));
+  tt_int_op(11, ==, tor_cpuset_nth(&set, 6));
+  tt_int_op(-1, ==, tor_cpuset_nth(&set, 7));
+  s = tor_cpuset_format(&set);
+  tt_str_op(s, ==, "0-3,8,10-11");
+  tor_free(s);
+
+  tor_cpuset_remove(&set, 2);
+  tor_cpuset_add(&set, TOR_CPUSET_MAX_CPUS-1);
+  tor_cpuset_add(&set, TOR_CPUSET_MAX_CPUS); /* ignored */
+  s = tor_cpuset_format(&set);
+  tt_str_op(s, ==, "0-1,3,8,10-11,1023");
+  tor_free(s);
+
+  /* Malformed lists leave the set empty. */
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "1,x"));
+  tt_int_op(0, ==, tor_cpuset_count(&set));
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "3-1"));
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "1-"));
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "-1"));
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "1024"));
+  tt_int_op(-1, ==, tor_cpuset_parse(&set, "1 2"));
+
+ done:
+  tor_free(s);
+}
+
+static void
+test_threads_affinity(void *arg)
+{
+  tor_cpuset_t orig, one, now;
+  (void)arg;
+
+  if (tor_thread_get_cpus(&orig) < 0 || tor_cpuset_count(&orig) == 0)
+    tt_skip();
+
+  tor_cpuset_clear(&one);
+  tor_cpuset_add(&one, tor_cpuset_nth(&orig, tor_cpuset_count(&orig) - 1));
+  tt_int_op(0, ==, tor_thread_set_cpus(&one));
+  tt_int_op(0, ==, tor_thread_get_cpus(&now));
+  tt_mem_op(&now, ==, &one, sizeof(now));
+
+  tt_int_op(0, ==, tor_thread_set_cpus(&orig));
+  tt_int_op(0, ==, tor_thread_get_cpus(&now));
+  tt_mem_op(&now, ==, &orig, sizeof(now));
+
+ done:
+  ;
+}
+
+/** How many threads the fake affinity calls below can keep track of. */
+#define MOCK_CPUS_MAX_THREADS 16
+/** Lock for the fake affinity of each thread. */
+static tor_mutex_t *mock_cpus_lock = NULL;
+/** Thread IDs that have called mock_tor_thread_set_cpus(), and the CPUs
+ * each one asked for. */
+static unsigned long mock_cpus_thread[MOCK_CPUS_MAX_THREADS];
+static tor_cpuset_t mock_cpus_set[MOCK_CPUS_MAX_THREADS];
+static int mock_cpus_n = 0;
+/** The CPUs of a thread that hasn't set its own.  Like a real new thread,
+ * it gets whatever its creator had when it was started. */
+static tor_cpuset_t mock_cpus_inherited;
+
+/** Return the index of the calling thread in mock_cpus_thread, or -1.
+ * Must hold mock_cpus_lock. */
+static int
+mock_cpus_find_thread(void)
+{
+  unsigned long id = tor_get_thread_id();
+  int i;
+  for (i = 0; i < mock_cpus_n; ++i) {
+    if (mock_cpus_thread[i] == id)
+      return i;
+  }
+  return -1;
+}
+
+static int
+mock_tor_thread_set_cpus(const tor_cpuset_t *set)
+{
+  int idx;
+  tor_mutex_acquire(mock_cpus_lock);
+  idx = mock_cpus_find_thread();
+  if (idx < 0 && mock_cpus_n < MOCK_CPUS_MAX_THREADS) {
+    idx = mock_cpus_n++;
+    mock_cpus_thread[idx] = tor_get_thread_id();
+  }
+  if (idx >= 0)
+    memcpy(&mock_cpus_set[idx], set, sizeof(*set));
+  tor_mutex_release(mock_cpus_lock);
+  return idx >= 0 ? 0 : -1;
+}
+
+static int
+mock_tor_thread_get_cpus(tor_cpuset_t *set_out)
+{
+  int idx;
+  tor_mutex_acquire(mock_cpus_lock);
+  idx = mock_cpus_find_thread();
+  memcpy(set_out, idx >= 0 ? &mock_cpus_set[idx] : &mock_cpus_inherited,
+         sizeof(*set_out));
+  tor_mutex_release(mock_cpus_lock);
+  return 0;
+}
+
+static void *
+placement_thread_state_new(void *arg)
+{
+  (void)arg;
+  return tor_malloc_zero(1);
+}
+
+static void
+placement_thread_state_free(void *state)
+{
+  tor_free(state);
+}
+
+/** Setting MainThreadCPUs alone must not leave the workers, which are
+ * started by the already-pinned main thread, on the main thread's CPUs. */
+static void
+test_threads_placement_main_only(void *arg)
+{
+  or_options_t *options = tor_malloc_zero(sizeof(or_options_t));
+  replyqueue_t *rq = NULL;
+  threadpool_t *pool = NULL;
+  tor_cpuset_t started, cpus;
+  char *s = NULL;
+  const int n_threads = 2;
+  int i, n_placed, n_set = 0, n_set_ok = 0, tries;
+  (void)arg;
+
+  mock_cpus_lock = tor_mutex_new();
+  tor_cpuset_parse(&started, "0-7");
+  memcpy(&mock_cpus_inherited, &started, sizeof(started));
+  MOCK(tor_thread_set_cpus, mock_tor_thread_set_cpus);
+  MOCK(tor_thread_get_cpus, mock_tor_thread_get_cpus);
+
+  /* options_act() pins the main thread before cpu_init() has started any
+   * workers. */
+  options->MainThreadCPUs = tor_strdup("0");
+  cpu_placement_apply(options, NULL);
+  tt_int_op(0, ==, tor_thread_get_cpus(&cpus));
+  s = tor_cpuset_format(&cpus);
+  tt_str_op(s, ==, "0");
+
+  /* So the workers start out on the main thread's CPU... */
+  memcpy(&mock_cpus_inherited, &cpus, sizeof(cpus));
+  rq = replyqueue_new(0);
+  tt_assert(rq);
+  pool = threadpool_new(n_threads, rq, placement_thread_state_new,
+                        placement_thread_state_free, NULL);
+  tt_assert(pool);
+
+  /* ...until cpu_init() moves them back onto the CPUs we started with. */
+  cpu_placement_apply(options, pool);
+  for (tries = 0; tries < 500; ++tries) {
+    n_placed = 0;
+    for (i = 0; i < n_threads; ++i) {
+      if (threadpool_get_thread_cpus(pool, i, &cpus) != 0)
+        ++n_placed;
+    }
+    if (n_placed == n_threads)
+      break;
+    tor_sleep_msec(10);
+  }
+  for (i = 0; i < n_threads; ++i) {
+    tt_int_op(1, ==, threadpool_get_thread_cpus(pool, i, &cpus));
+    tt_mem_op(&cpus, ==, &started, sizeof(cpus));
+  }
+
+  /* Each worker really asked for those CPUs itself. */
+  tor_mutex_acquire(mock_cpus_lock);
+  for (i = 0; i < mock_cpus_n; ++i) {
+    if (mock_cpus_thread[i] == tor_get_thread_id())
+      continue;
+    ++n_set;
+    if (tor_memeq(&mock_cpus_set[i], &started, sizeof(started)))
+      ++n_set_ok;
+  }
+  tor_mutex_release(mock_cpus_lock);
+  tt_int_op(n_set, ==, n_threads);
+  tt_int_op(n_set_ok, ==, n_threads);
+
+ done:
+  /* The workers may still be running, so leave the mocks and the pool
+   * alone; this test runs in its own process. */
+  tor_free(s);
+  tor_free(options->MainThreadCPUs);
+  tor_free(options);
+}
+
 #define THREAD_TEST(name)                                               \
   { #name, test_threads_##name, TT_FORK, NULL, NULL }
 
 struct testcase_t thread_tests[] = {
   THREAD_TEST(basic),
+  THREAD_TEST(cpuset),
+  THREAD_TEST(affinity),
+  THREAD_TEST(placement_main_only),
   { "conditionvar", test_threads_conditionvar, TT_FORK,
     &passthrough_setup, (void*)"no-tv" },
   { "conditionvar_timeout", test_threads_conditionvar, TT_FORK,
@@ -0,0 +1,82 @@
+/* Copyright (c) 2015, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#include "orconfig.h"
+#include "or.h"
+#include "tortls.h"
+#include "test.h"
+
+/** Make sure that the certificate cache answers repeated decodes and
+ * signature checks, and only for the same signer. */
+static void
+test_tortls_cert_cache(void *arg)
+{
+  crypto_pk_t *key = pk_generate(0);
+  const tor_cert_t *my_link = NULL, *my_id = NULL;
+  tor_cert_t *link = NULL, *id1 = NULL, *id2 = NULL;
+  const uint8_t *der;
+  size_t der_len;
+  int n_entries;
+  uint64_t n_checks, n_skipped;
+  (void)arg;
+
+  tt_int_op(0, ==, tor_tls_context_init(TOR_TLS_CTX_IS_PUBLIC_SERVER,
+                                        key, key, 86400));
+  tt_int_op(0, ==, tor_tls_get_my_certs(1, &my_link, &my_id));
+  tor_cert_cache_clear();
+
+  /* Decoding the same certificate twice only adds one entry. */
+  tor_cert_get_der(my_id, &der, &der_len);
+  id1 = tor_cert_decode(der, der_len);
+  id2 = tor_cert_decode(der, der_len);
+  tt_assert(id1);
+  tt_assert(id2);
+  tt_assert(id1 != id2);
+  tt_mem_op(tor_cert_get_cert_digests(id1), ==,
+            tor_cert_get_cert_digests(id2), sizeof(digests_t));
+  tor_cert_get_der(my_link, &der, &der_len);
+  link = tor_cert_decode(der, der_len);
+  tt_assert(link);
+  tor_cert_cache_get_stats(&n_entries, &n_checks, &n_skipped);
+  tt_int_op(n_entries, ==, 2);
+  tt_u64_op(n_checks, ==, 0);
+
+  /* The second check of the same signature comes from the cache. */
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, id1, id1, 1));
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, id2, id2, 1));
+  tor_cert_cache_get_stats(&n_entries, &n_checks, &n_skipped);
+  tt_u64_op(n_checks, ==, 2);
+  tt_u64_op(n_skipped, ==, 1);
+
+  /* A different signer gets checked for real, and doesn't spoil the
+   * cached result. */
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, link, id1, 0));
+  tt_assert(! tor_tls_cert_is_valid(LOG_INFO, link, link, 0));
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, link, id2, 0));
+  tor_cert_cache_get_stats(&n_entries, &n_checks, &n_skipped);
+  tt_u64_op(n_checks, ==, 5);
+  tt_u64_op(n_skipped, ==, 2);
+
+  /* Certificates from the cache outlive each other and the cache. */
+  tor_cert_free(id1);
+  id1 = NULL;
+  tor_cert_cache_clear();
+  tor_cert_cache_get_stats(&n_entries, &n_checks, &n_skipped);
+  tt_int_op(n_entries, ==, 0);
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, id2, id2, 1));
+  tt_assert(tor_tls_cert_is_valid(LOG_WARN, link, id2, 0));
+  tor_cert_cache_get_stats(&n_entries, &n_checks, &n_skipped);
+  tt_u64_op(n_skipped, ==, 2);
+
+ done:
+  tor_cert_free(id1);
+  tor_cert_free(id2);
+  tor_cert_free(link);
+  crypto_pk_free(key);
+}
+
+struct testcase_t tortls_tests[] = {
+  { "cert_cache", test_tortls_cert_cache, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
+
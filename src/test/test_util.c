@@ -16,6 +16,7 @@
 #include "mempool.h"
 #endif /* ENABLE_MEMPOOLS */
 #include "memarea.h"
+#include "strbuf.h"
 #include "util_process.h"
 
 #ifdef _WIN32
@@ -4389,6 +4390,56 @@ test_util_ipv4_validation(void *arg)
   return;
 }
 
+static void
+test_util_strbuf(void *arg)
+{
+  strbuf_t *sb = strbuf_new(0);
+  smartlist_t *sl = smartlist_new();
+  char *s = NULL, *big = NULL;
+  size_t len = 0;
+  int i;
+
+  (void)arg;
+  tt_int_op(strbuf_len(sb), OP_EQ, 0);
+  tt_str_op(strbuf_get(sb), OP_EQ, "");
+
+  strbuf_add(sb, "hello");
+  strbuf_add_len(sb, " worldXXX", 6);
+  strbuf_add_printf(sb, " %d%s", 42, "!");
+  tt_str_op(strbuf_get(sb), OP_EQ, "hello world 42!");
+  tt_int_op(strbuf_len(sb), OP_EQ, 15);
+
+  smartlist_add(sl, (char*)"a");
+  smartlist_add(sl, (char*)"b");
+  smartlist_add(sl, (char*)"c");
+  strbuf_add_joined(sb, sl, ", ");
+  tt_str_op(strbuf_get(sb), OP_EQ, "hello world 42!a, b, c");
+
+  /* Make it grow, both by adding and by formatting. */
+  big = tor_malloc(2048);
+  memset(big, 'z', 2047);
+  big[2047] = '\0';
+  strbuf_add(sb, big);
+  strbuf_add_printf(sb, "%s%s", big, big);
+  tt_int_op(strbuf_len(sb), OP_EQ, 22 + 3*2047);
+  for (i = 0; i < 1000; ++i)
+    strbuf_add_printf(sb, "%03d", i);
+  tt_int_op(strbuf_len(sb), OP_EQ, 22 + 3*2047 + 3000);
+  tt_mem_op(strbuf_get(sb) + 22 + 3*2047, OP_EQ, "000001002", 9);
+
+  s = strbuf_steal(sb, &len);
+  sb = NULL;
+  tt_int_op(len, OP_EQ, 22 + 3*2047 + 3000);
+  tt_int_op(strlen(s), OP_EQ, len);
+  tt_str_op(s + len - 6, OP_EQ, "998999");
+
+ done:
+  strbuf_free(sb);
+  smartlist_free(sl);
+  tor_free(s);
+  tor_free(big);
+}
+
 struct testcase_t util_tests[] = {
   UTIL_LEGACY(time),
   UTIL_TEST(parse_http_time, 0),
@@ -4459,6 +4510,7 @@ struct testcase_t util_tests[] = {
   UTIL_TEST(max_mem, 0),
   UTIL_TEST(hostname_validation, 0),
   UTIL_TEST(ipv4_validation, 0),
+  UTIL_TEST(strbuf, 0),
   END_OF_TESTCASES
 };
 